@@ -0,0 +1,78 @@
+#
+# time loading rows into an indexed field in order, nearly in order and
+# at random, the way a feed of position reports arrives
+#
+# $Id$
+#
+
+package require ctable
+
+source cputime.tcl
+
+CExtension feedtest 1.0 {
+
+CTable feedTable {
+    varstring ident
+    int clock indexed 1
+    double latitude
+    double longitude
+}
+
+}
+
+package require Feedtest
+
+set nRows 1000000
+set start 1700000000
+
+proc clock_for {order i} {
+    global nRows start
+
+    switch $order {
+	ordered {
+	    return [expr {$start + $i / 4}]
+	}
+	jittered {
+	    return [expr {$start + ($i + int(rand() * 200)) / 4}]
+	}
+	random {
+	    return [expr {$start + int(rand() * $nRows / 4)}]
+	}
+    }
+}
+
+proc load {file withIndex} {
+    global nRows
+
+    f reset
+    if {$withIndex} {
+	f index create clock
+    }
+
+    set fp [open $file r]
+    f read_tabsep $fp
+    close $fp
+
+    if {$withIndex && [f index count clock] != $nRows} {
+	error "$file: index count [f index count clock], expected $nRows"
+    }
+}
+
+# the difference between loading with and without the index is the time
+# spent placing rows in the index
+feedTable create f
+foreach order {ordered jittered random} {
+    set fp [open feed-$order.txt w]
+    for {set i 0} {$i < $nRows} {incr i} {
+	puts $fp "$i\tUAL$i\t[clock_for $order $i]\t29.76\t-95.56"
+    }
+    close $fp
+
+    puts "loading $nRows rows, $order clock, without an index"
+    puts [cputime [list load feed-$order.txt 0]]
+    puts "loading $nRows rows, $order clock, indexed"
+    puts [cputime [list load feed-$order.txt 1]]
+
+    file delete feed-$order.txt
+}
+f destroy
@@ -0,0 +1,992 @@
+// $Id$
+
+/*
+  Bitmap index, see ctable_bitmapindex.h for the layout.
+
+  Everything here is in the master's own memory and only the master
+  uses it, so unlike the other indexes nothing has to be kept readable
+  while it changes.
+*/
+#include "jsw_slib.h"
+#include "ctable_bitmapindex.h"
+
+#ifdef __GNUC__
+# define BitmapPopCount(w)	__builtin_popcountll (w)
+# define BitmapLowestBit(w)	__builtin_ctzll (w)
+#else
+static int
+BitmapPopCount (uint64_t w)
+{
+    int n = 0;
+
+    for (; w != 0; w &= w - 1) {
+	n++;
+    }
+    return n;
+}
+
+static int
+BitmapLowestBit (uint64_t w)
+{
+    int b = 0;
+
+    while ((w & 1) == 0) {
+	w >>= 1;
+	b++;
+    }
+    return b;
+}
+#endif
+
+#define BitmapWordTest(words, low)	(((words)[(low) >> 6] >> ((low) & 63)) & 1)
+
+//
+// BitmapContainerFree - free what the container points to
+//
+static void
+BitmapContainerFree (ctable_BitmapContainer *c)
+{
+    if (c->array) {
+	ckfree ((char *)c->array);
+	c->array = NULL;
+    }
+    if (c->words) {
+	ckfree ((char *)c->words);
+	c->words = NULL;
+    }
+}
+
+//
+// BitmapContainerToWords - turn an array container into a bitmap container
+//
+static void
+BitmapContainerToWords (ctable_BitmapContainer *c)
+{
+    uint64_t *words = (uint64_t *)ckalloc (CTABLE_BITMAP_WORDS * sizeof (uint64_t));
+    int       i;
+
+    memset (words, 0, CTABLE_BITMAP_WORDS * sizeof (uint64_t));
+    for (i = 0; i < c->n; i++) {
+	words[c->array[i] >> 6] |= (uint64_t)1 << (c->array[i] & 63);
+    }
+
+    ckfree ((char *)c->array);
+    c->array = NULL;
+    c->size = 0;
+    c->words = words;
+}
+
+//
+// BitmapContainerToArray - turn a bitmap container back into an array
+//
+static void
+BitmapContainerToArray (ctable_BitmapContainer *c)
+{
+    int       size = c->n > 4 ? c->n : 4;
+    uint16_t *array = (uint16_t *)ckalloc (size * sizeof (uint16_t));
+    int       n = 0;
+    int       i;
+
+    for (i = 0; i < CTABLE_BITMAP_WORDS; i++) {
+	uint64_t w;
+
+	for (w = c->words[i]; w != 0; w &= w - 1) {
+	    array[n++] = (uint16_t)((i << 6) + BitmapLowestBit (w));
+	}
+    }
+
+    ckfree ((char *)c->words);
+    c->words = NULL;
+    c->array = array;
+    c->size = size;
+}
+
+//
+// BitmapContainerCopy - make dst a copy of src
+//
+static void
+BitmapContainerCopy (ctable_BitmapContainer *dst, ctable_BitmapContainer *src)
+{
+    dst->high = src->high;
+    dst->n = src->n;
+    dst->array = NULL;
+    dst->words = NULL;
+
+    if (src->words) {
+	dst->size = 0;
+	dst->words = (uint64_t *)ckalloc (CTABLE_BITMAP_WORDS * sizeof (uint64_t));
+	memcpy (dst->words, src->words, CTABLE_BITMAP_WORDS * sizeof (uint64_t));
+    } else {
+	dst->size = src->n > 4 ? src->n : 4;
+	dst->array = (uint16_t *)ckalloc (dst->size * sizeof (uint16_t));
+	memcpy (dst->array, src->array, src->n * sizeof (uint16_t));
+    }
+}
+
+//
+// BitmapArrayFind - the position of low in an array container, or where it
+// would go
+//
+static int
+BitmapArrayFind (ctable_BitmapContainer *c, uint16_t low, int *found)
+{
+    int lo = 0;
+    int hi = c->n;
+
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+
+	if (c->array[mid] < low) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+
+    *found = lo < c->n && c->array[lo] == low;
+    return lo;
+}
+
+//
+// BitmapContainerAdd - put low in the container
+//
+static void
+BitmapContainerAdd (ctable_BitmapContainer *c, uint16_t low)
+{
+    int found;
+    int pos;
+
+    if (c->words) {
+	if (!BitmapWordTest (c->words, low)) {
+	    c->words[low >> 6] |= (uint64_t)1 << (low & 63);
+	    c->n++;
+	}
+	return;
+    }
+
+    pos = BitmapArrayFind (c, low, &found);
+    if (found) {
+	return;
+    }
+
+    if (c->n >= CTABLE_BITMAP_ARRAY_MAX) {
+	BitmapContainerToWords (c);
+	BitmapContainerAdd (c, low);
+	return;
+    }
+
+    if (c->n >= c->size) {
+	c->size *= 2;
+	c->array = (uint16_t *)ckrealloc ((char *)c->array, c->size * sizeof (uint16_t));
+    }
+
+    memmove (&c->array[pos + 1], &c->array[pos], (c->n - pos) * sizeof (uint16_t));
+    c->array[pos] = low;
+    c->n++;
+}
+
+//
+// BitmapContainerRemove - take low out of the container
+//
+static void
+BitmapContainerRemove (ctable_BitmapContainer *c, uint16_t low)
+{
+    int found;
+    int pos;
+
+    if (c->words) {
+	if (BitmapWordTest (c->words, low)) {
+	    c->words[low >> 6] &= ~((uint64_t)1 << (low & 63));
+	    c->n--;
+	    if (c->n < CTABLE_BITMAP_ARRAY_MIN) {
+		BitmapContainerToArray (c);
+	    }
+	}
+	return;
+    }
+
+    pos = BitmapArrayFind (c, low, &found);
+    if (!found) {
+	return;
+    }
+
+    memmove (&c->array[pos], &c->array[pos + 1], (c->n - pos - 1) * sizeof (uint16_t));
+    c->n--;
+}
+
+//
+// BitmapContainerOr - add the numbers in src to dst
+//
+static void
+BitmapContainerOr (ctable_BitmapContainer *dst, ctable_BitmapContainer *src)
+{
+    int i;
+
+    if (!dst->words && (src->words || dst->n + src->n > CTABLE_BITMAP_ARRAY_MAX)) {
+	BitmapContainerToWords (dst);
+    }
+
+    if (dst->words) {
+	if (src->words) {
+	    int n = 0;
+
+	    for (i = 0; i < CTABLE_BITMAP_WORDS; i++) {
+		dst->words[i] |= src->words[i];
+		n += BitmapPopCount (dst->words[i]);
+	    }
+	    dst->n = n;
+	} else {
+	    for (i = 0; i < src->n; i++) {
+		uint16_t low = src->array[i];
+
+		if (!BitmapWordTest (dst->words, low)) {
+		    dst->words[low >> 6] |= (uint64_t)1 << (low & 63);
+		    dst->n++;
+		}
+	    }
+	}
+	return;
+    }
+
+    // two arrays that fit in one, merged from the top down in place
+    if (dst->n + src->n > dst->size) {
+	dst->size = dst->n + src->n;
+	dst->array = (uint16_t *)ckrealloc ((char *)dst->array, dst->size * sizeof (uint16_t));
+    }
+
+    {
+	int d = dst->n - 1;
+	int s = src->n - 1;
+	int out = dst->n + src->n - 1;
+	int dups = 0;
+
+	while (s >= 0) {
+	    if (d >= 0 && dst->array[d] > src->array[s]) {
+		dst->array[out--] = dst->array[d--];
+	    } else {
+		if (d >= 0 && dst->array[d] == src->array[s]) {
+		    d--;
+		    dups++;
+		}
+		dst->array[out--] = src->array[s--];
+	    }
+	}
+
+	// the duplicates left a gap at the bottom
+	if (dups > 0) {
+	    memmove (&dst->array[d + 1], &dst->array[out + 1], (dst->n + src->n - out - 1) * sizeof (uint16_t));
+	}
+	dst->n += src->n - dups;
+    }
+}
+
+//
+// BitmapContainerAnd - keep only the numbers in dst that are also in src
+//
+static void
+BitmapContainerAnd (ctable_BitmapContainer *dst, ctable_BitmapContainer *src)
+{
+    int i;
+    int n = 0;
+
+    if (dst->words && src->words) {
+	for (i = 0; i < CTABLE_BITMAP_WORDS; i++) {
+	    dst->words[i] &= src->words[i];
+	    n += BitmapPopCount (dst->words[i]);
+	}
+	dst->n = n;
+	if (n < CTABLE_BITMAP_ARRAY_MIN) {
+	    BitmapContainerToArray (dst);
+	}
+	return;
+    }
+
+    if (dst->words) {
+	uint16_t *array = (uint16_t *)ckalloc ((src->n > 4 ? src->n : 4) * sizeof (uint16_t));
+
+	for (i = 0; i < src->n; i++) {
+	    if (BitmapWordTest (dst->words, src->array[i])) {
+		array[n++] = src->array[i];
+	    }
+	}
+	ckfree ((char *)dst->words);
+	dst->words = NULL;
+	dst->array = array;
+	dst->size = src->n > 4 ? src->n : 4;
+	dst->n = n;
+	return;
+    }
+
+    if (src->words) {
+	for (i = 0; i < dst->n; i++) {
+	    if (BitmapWordTest (src->words, dst->array[i])) {
+		dst->array[n++] = dst->array[i];
+	    }
+	}
+	dst->n = n;
+	return;
+    }
+
+    {
+	int s = 0;
+
+	for (i = 0; i < dst->n && s < src->n; ) {
+	    if (dst->array[i] < src->array[s]) {
+		i++;
+	    } else if (dst->array[i] > src->array[s]) {
+		s++;
+	    } else {
+		dst->array[n++] = dst->array[i++];
+		s++;
+	    }
+	}
+	dst->n = n;
+    }
+}
+
+//
+// BitmapFindContainer - the position of the container for high, or where it
+// would go
+//
+static int
+BitmapFindContainer (ctable_Bitmap *bm, uint16_t high, int *found)
+{
+    int lo = 0;
+    int hi = bm->nContainers;
+
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+
+	if (bm->containers[mid].high < high) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+
+    *found = lo < bm->nContainers && bm->containers[lo].high == high;
+    return lo;
+}
+
+//
+// ctable_BitmapInit - make bm an empty bitmap
+//
+void
+ctable_BitmapInit (ctable_Bitmap *bm)
+{
+    bm->containers = NULL;
+    bm->nContainers = 0;
+    bm->size = 0;
+}
+
+//
+// ctable_BitmapFree - free everything in the bitmap, leaving it empty
+//
+void
+ctable_BitmapFree (ctable_Bitmap *bm)
+{
+    int i;
+
+    for (i = 0; i < bm->nContainers; i++) {
+	BitmapContainerFree (&bm->containers[i]);
+    }
+    if (bm->containers) {
+	ckfree ((char *)bm->containers);
+    }
+    ctable_BitmapInit (bm);
+}
+
+//
+// ctable_BitmapAdd - put a number in the bitmap
+//
+void
+ctable_BitmapAdd (ctable_Bitmap *bm, unsigned int number)
+{
+    uint16_t                high = (uint16_t)(number >> 16);
+    int                     found;
+    int                     pos = BitmapFindContainer (bm, high, &found);
+    ctable_BitmapContainer *c;
+
+    if (!found) {
+	if (bm->nContainers >= bm->size) {
+	    bm->size = bm->size ? bm->size * 2 : 4;
+	    bm->containers = (ctable_BitmapContainer *)ckrealloc ((char *)bm->containers, bm->size * sizeof (ctable_BitmapContainer));
+	}
+	memmove (&bm->containers[pos + 1], &bm->containers[pos], (bm->nContainers - pos) * sizeof (ctable_BitmapContainer));
+	bm->nContainers++;
+
+	c = &bm->containers[pos];
+	c->high = high;
+	c->n = 0;
+	c->size = 4;
+	c->array = (uint16_t *)ckalloc (c->size * sizeof (uint16_t));
+	c->words = NULL;
+    }
+
+    BitmapContainerAdd (&bm->containers[pos], (uint16_t)(number & 0xffff));
+}
+
+//
+// ctable_BitmapRemove - take a number out of the bitmap
+//
+void
+ctable_BitmapRemove (ctable_Bitmap *bm, unsigned int number)
+{
+    int                     found;
+    int                     pos = BitmapFindContainer (bm, (uint16_t)(number >> 16), &found);
+    ctable_BitmapContainer *c;
+
+    if (!found) {
+	return;
+    }
+
+    c = &bm->containers[pos];
+
+    BitmapContainerRemove (c, (uint16_t)(number & 0xffff));
+
+    if (c->n == 0) {
+	BitmapContainerFree (c);
+	memmove (c, c + 1, (bm->nContainers - pos - 1) * sizeof (ctable_BitmapContainer));
+	bm->nContainers--;
+    }
+}
+
+//
+// ctable_BitmapCount - how many numbers are in the bitmap
+//
+size_t
+ctable_BitmapCount (ctable_Bitmap *bm)
+{
+    size_t n = 0;
+    int    i;
+
+    for (i = 0; i < bm->nContainers; i++) {
+	n += bm->containers[i].n;
+    }
+    return n;
+}
+
+//
+// ctable_BitmapFirst - the lowest number in a bitmap that isn't empty
+//
+unsigned int
+ctable_BitmapFirst (ctable_Bitmap *bm)
+{
+    ctable_BitmapContainer *c = &bm->containers[0];
+    unsigned int            base = (unsigned int)c->high << 16;
+    int                     i;
+
+    if (!c->words) {
+	return base | c->array[0];
+    }
+
+    for (i = 0; c->words[i] == 0; i++) {
+	continue;
+    }
+    return base | (unsigned int)((i << 6) + BitmapLowestBit (c->words[i]));
+}
+
+//
+// ctable_BitmapOr - add the numbers in src to dst
+//
+void
+ctable_BitmapOr (ctable_Bitmap *dst, ctable_Bitmap *src)
+{
+    ctable_BitmapContainer *merged;
+    int                     size = dst->nContainers + src->nContainers;
+    int                     d = 0;
+    int                     s = 0;
+    int                     n = 0;
+
+    if (src->nContainers == 0) {
+	return;
+    }
+
+    merged = (ctable_BitmapContainer *)ckalloc (size * sizeof (ctable_BitmapContainer));
+
+    while (d < dst->nContainers || s < src->nContainers) {
+	if (s >= src->nContainers || (d < dst->nContainers && dst->containers[d].high < src->containers[s].high)) {
+	    merged[n++] = dst->containers[d++];
+	} else if (d >= dst->nContainers || src->containers[s].high < dst->containers[d].high) {
+	    BitmapContainerCopy (&merged[n++], &src->containers[s++]);
+	} else {
+	    BitmapContainerOr (&dst->containers[d], &src->containers[s++]);
+	    merged[n++] = dst->containers[d++];
+	}
+    }
+
+    if (dst->containers) {
+	ckfree ((char *)dst->containers);
+    }
+    dst->containers = merged;
+    dst->nContainers = n;
+    dst->size = size;
+}
+
+//
+// ctable_BitmapAnd - keep only the numbers in dst that are also in src
+//
+void
+ctable_BitmapAnd (ctable_Bitmap *dst, ctable_Bitmap *src)
+{
+    int d;
+    int s = 0;
+    int n = 0;
+
+    for (d = 0; d < dst->nContainers; d++) {
+	ctable_BitmapContainer *c = &dst->containers[d];
+
+	while (s < src->nContainers && src->containers[s].high < c->high) {
+	    s++;
+	}
+
+	if (s < src->nContainers && src->containers[s].high == c->high) {
+	    BitmapContainerAnd (c, &src->containers[s]);
+	}
+
+	if (s >= src->nContainers || src->containers[s].high != c->high || c->n == 0) {
+	    BitmapContainerFree (c);
+	    continue;
+	}
+
+	dst->containers[n++] = *c;
+    }
+
+    dst->nContainers = n;
+}
+
+//
+// ctable_BitmapNumbers - fill numbers with the numbers in the bitmap, lowest
+// first, it has to have room for ctable_BitmapCount of them
+//
+size_t
+ctable_BitmapNumbers (ctable_Bitmap *bm, unsigned int *numbers)
+{
+    size_t n = 0;
+    int    i;
+    int    j;
+
+    for (i = 0; i < bm->nContainers; i++) {
+	ctable_BitmapContainer *c = &bm->containers[i];
+	unsigned int            base = (unsigned int)c->high << 16;
+
+	if (!c->words) {
+	    for (j = 0; j < c->n; j++) {
+		numbers[n++] = base | c->array[j];
+	    }
+	    continue;
+	}
+
+	for (j = 0; j < CTABLE_BITMAP_WORDS; j++) {
+	    uint64_t w;
+
+	    for (w = c->words[j]; w != 0; w &= w - 1) {
+		numbers[n++] = base | (unsigned int)((j << 6) + BitmapLowestBit (w));
+	    }
+	}
+    }
+
+    return n;
+}
+
+//
+// BitmapIndexFind - the position of the entry for the row's value, or where
+// it would go
+//
+static int
+BitmapIndexFind (ctable_BitmapIndex *index, cmp_f cmp, ctable_BaseRow *row, int *found)
+{
+    int lo = 0;
+    int hi = index->nEntries;
+
+    *found = 0;
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+	int c = cmp (index->entries[mid]->row, row);
+
+	if (c == 0) {
+	    *found = 1;
+	    return mid;
+	}
+
+	if (c < 0) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+
+    return lo;
+}
+
+//
+// ctable_BitmapIndexNew - create an empty index, of values or of trigrams
+//
+ctable_BitmapIndex *
+ctable_BitmapIndexNew (int trigrams)
+{
+    ctable_BitmapIndex *index = (ctable_BitmapIndex *)ckalloc (sizeof *index);
+
+    index->entries = NULL;
+    index->nEntries = 0;
+    index->size = 0;
+    index->trigrams = NULL;
+
+    if (trigrams) {
+	index->trigrams = (Tcl_HashTable *)ckalloc (sizeof (Tcl_HashTable));
+	Tcl_InitHashTable (index->trigrams, TCL_ONE_WORD_KEYS);
+    }
+    return index;
+}
+
+//
+// ctable_BitmapIndexDelete - free the index but not the rows in it
+//
+void
+ctable_BitmapIndexDelete (ctable_BitmapIndex *index)
+{
+    int i;
+
+    for (i = 0; i < index->nEntries; i++) {
+	ctable_BitmapFree (&index->entries[i]->bits);
+	ckfree ((char *)index->entries[i]);
+    }
+    if (index->entries) {
+	ckfree ((char *)index->entries);
+    }
+
+    if (index->trigrams) {
+	Tcl_HashEntry  *hashEntry;
+	Tcl_HashSearch  hashSearch;
+
+	for (hashEntry = Tcl_FirstHashEntry (index->trigrams, &hashSearch); hashEntry != NULL; hashEntry = Tcl_NextHashEntry (&hashSearch)) {
+	    ctable_Bitmap *bm = (ctable_Bitmap *)Tcl_GetHashValue (hashEntry);
+
+	    ctable_BitmapFree (bm);
+	    ckfree ((char *)bm);
+	}
+	Tcl_DeleteHashTable (index->trigrams);
+	ckfree ((char *)index->trigrams);
+    }
+    ckfree ((char *)index);
+}
+
+//
+// ctable_BitmapIndexInsert - put the row's number in the bitmap for its value
+//
+void
+ctable_BitmapIndexInsert (ctable_BitmapIndex *index, cmp_f cmp, ctable_BaseRow *row, unsigned int number)
+{
+    int                      found;
+    int                      pos = BitmapIndexFind (index, cmp, row, &found);
+    ctable_BitmapIndexEntry *entry;
+
+    if (!found) {
+	if (index->nEntries >= index->size) {
+	    index->size = index->size ? index->size * 2 : 8;
+	    index->entries = (ctable_BitmapIndexEntry **)ckrealloc ((char *)index->entries, index->size * sizeof (ctable_BitmapIndexEntry *));
+	}
+	memmove (&index->entries[pos + 1], &index->entries[pos], (index->nEntries - pos) * sizeof (ctable_BitmapIndexEntry *));
+	index->nEntries++;
+
+	entry = (ctable_BitmapIndexEntry *)ckalloc (sizeof *entry);
+	entry->row = row;
+	ctable_BitmapInit (&entry->bits);
+	index->entries[pos] = entry;
+    }
+
+    ctable_BitmapAdd (&index->entries[pos]->bits, number);
+}
+
+//
+// ctable_BitmapIndexErase - take the row's number out of the bitmap for its
+// value, before the value changes. If the row was the one the entry was
+// compared against, another row with the value takes its place.
+//
+void
+ctable_BitmapIndexErase (ctable_BitmapIndex *index, cmp_f cmp, ctable_RowNumbers *numbers, ctable_BaseRow *row)
+{
+    int                      found;
+    int                      pos = BitmapIndexFind (index, cmp, row, &found);
+    ctable_BitmapIndexEntry *entry;
+
+    if (!found) {
+	return;
+    }
+
+    entry = index->entries[pos];
+    ctable_BitmapRemove (&entry->bits, row->_rowNumber);
+
+    if (entry->bits.nContainers == 0) {
+	ctable_BitmapFree (&entry->bits);
+	ckfree ((char *)entry);
+	memmove (&index->entries[pos], &index->entries[pos + 1], (index->nEntries - pos - 1) * sizeof (ctable_BitmapIndexEntry *));
+	index->nEntries--;
+	return;
+    }
+
+    if (entry->row == row) {
+	entry->row = numbers->rows[ctable_BitmapFirst (&entry->bits)];
+    }
+}
+
+//
+// TrigramFold - lower case a byte of a trigram, only for ASCII so the
+// bytes of a multibyte character are left alone
+//
+static inline unsigned char
+TrigramFold (unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+#define TrigramKey(t)	((char *)(uintptr_t)(t))
+
+//
+// ctable_TrigramIndexInsert - put the row's number in the bitmap of each
+// trigram in its string
+//
+void
+ctable_TrigramIndexInsert (ctable_BitmapIndex *index, const char *string, int length, unsigned int number)
+{
+    const unsigned char *s = (const unsigned char *)string;
+    uint32_t             trigram;
+    int                  i;
+
+    if (length < 3) {
+	return;
+    }
+
+    trigram = (TrigramFold (s[0]) << 8) | TrigramFold (s[1]);
+    for (i = 2; i < length; i++) {
+	Tcl_HashEntry *hashEntry;
+	ctable_Bitmap *bm;
+	int            isNew;
+
+	trigram = ((trigram << 8) | TrigramFold (s[i])) & 0xffffff;
+
+	hashEntry = Tcl_CreateHashEntry (index->trigrams, TrigramKey (trigram), &isNew);
+	if (isNew) {
+	    bm = (ctable_Bitmap *)ckalloc (sizeof (ctable_Bitmap));
+	    ctable_BitmapInit (bm);
+	    Tcl_SetHashValue (hashEntry, bm);
+	} else {
+	    bm = (ctable_Bitmap *)Tcl_GetHashValue (hashEntry);
+	}
+
+	ctable_BitmapAdd (bm, number);
+    }
+}
+
+//
+// ctable_TrigramIndexErase - take the row's number out of the bitmaps of the
+// trigrams in its string, before the string changes
+//
+void
+ctable_TrigramIndexErase (ctable_BitmapIndex *index, const char *string, int length, unsigned int number)
+{
+    const unsigned char *s = (const unsigned char *)string;
+    uint32_t             trigram;
+    int                  i;
+
+    if (length < 3) {
+	return;
+    }
+
+    trigram = (TrigramFold (s[0]) << 8) | TrigramFold (s[1]);
+    for (i = 2; i < length; i++) {
+	Tcl_HashEntry *hashEntry;
+	ctable_Bitmap *bm;
+
+	trigram = ((trigram << 8) | TrigramFold (s[i])) & 0xffffff;
+
+	// a trigram that's in the string twice is gone the second time
+	hashEntry = Tcl_FindHashEntry (index->trigrams, TrigramKey (trigram));
+	if (hashEntry == NULL) {
+	    continue;
+	}
+
+	bm = (ctable_Bitmap *)Tcl_GetHashValue (hashEntry);
+	ctable_BitmapRemove (bm, number);
+
+	if (bm->nContainers == 0) {
+	    ctable_BitmapFree (bm);
+	    ckfree ((char *)bm);
+	    Tcl_DeleteHashEntry (hashEntry);
+	}
+    }
+}
+
+//
+// ctable_TrigramIndexFind - the bitmap of the rows with the trigram, NULL if
+// there are none
+//
+ctable_Bitmap *
+ctable_TrigramIndexFind (ctable_BitmapIndex *index, uint32_t trigram)
+{
+    Tcl_HashEntry *hashEntry = Tcl_FindHashEntry (index->trigrams, TrigramKey (trigram));
+
+    if (hashEntry == NULL) {
+	return NULL;
+    }
+    return (ctable_Bitmap *)Tcl_GetHashValue (hashEntry);
+}
+
+//
+// ctable_TrigramsOfPattern - fill trigrams with the trigrams in the runs of
+// plain characters in a match pattern, up to CTABLE_TRIGRAMS_MAX of them.
+// Any string the pattern matches has them all.
+//
+// A literal pattern is matched a character at a time up to its first "*",
+// the others are glob patterns where "?" and "[...]" stand for characters
+// that can't be known and "\" quotes the next one.
+//
+// Without case, bytes outside ASCII aren't used since whether they match
+// depends on the locale. Tcl's own glob matching lowers whole characters
+// and there a Kelvin sign matches "k" and a dotted capital I matches "i",
+// so with unicodeNocase those two letters aren't used either.
+//
+int
+ctable_TrigramsOfPattern (const char *pattern, int literal, int nocase, int unicodeNocase, uint32_t *trigrams)
+{
+    const unsigned char *p = (const unsigned char *)pattern;
+    uint32_t             run = 0;
+    int                  runLength = 0;
+    int                  n = 0;
+
+    while (*p != '\0' && n < CTABLE_TRIGRAMS_MAX) {
+	unsigned char c = *p++;
+
+	if (c == '*') {
+	    if (literal) {
+		break;
+	    }
+	    runLength = 0;
+	    continue;
+	}
+
+	if (!literal) {
+	    if (c == '?') {
+		runLength = 0;
+		continue;
+	    }
+
+	    if (c == '[') {
+		// skipping too far only leaves fewer trigrams, so a quoted
+		// "]" is taken as quoted whether or not Tcl agrees
+		while (*p != '\0' && *p != ']') {
+		    if (*p++ == '\\' && *p != '\0') {
+			p++;
+		    }
+		}
+		if (*p == ']') {
+		    p++;
+		}
+		runLength = 0;
+		continue;
+	    }
+
+	    if (c == '\\') {
+		if (*p == '\0') {
+		    break;
+		}
+		c = *p++;
+	    }
+	}
+
+	c = TrigramFold (c);
+	if (nocase && (c >= 0x80 || (unicodeNocase && (c == 'i' || c == 'k')))) {
+	    runLength = 0;
+	    continue;
+	}
+
+	run = ((run << 8) | c) & 0xffffff;
+	if (++runLength >= 3) {
+	    trigrams[n++] = run;
+	}
+    }
+
+    return n;
+}
+
+//
+// ctable_RowNumbersNew - create an empty row numbering
+//
+ctable_RowNumbers *
+ctable_RowNumbersNew (void)
+{
+    ctable_RowNumbers *numbers = (ctable_RowNumbers *)ckalloc (sizeof *numbers);
+
+    numbers->size = 1024;
+    numbers->rows = (ctable_BaseRow **)ckalloc (numbers->size * sizeof (ctable_BaseRow *));
+    numbers->rows[0] = NULL;
+    numbers->next = 1;
+    numbers->freeSize = 0;
+    numbers->nFree = 0;
+    numbers->free = NULL;
+    return numbers;
+}
+
+//
+// ctable_RowNumbersDelete - free the numbering, the rows are going away too
+// or are left with numbers that mean nothing
+//
+void
+ctable_RowNumbersDelete (ctable_RowNumbers *numbers)
+{
+    ckfree ((char *)numbers->rows);
+    if (numbers->free) {
+	ckfree ((char *)numbers->free);
+    }
+    ckfree ((char *)numbers);
+}
+
+//
+// ctable_RowNumberAssign - give the row a number if it doesn't have one yet,
+// reusing a number given back before making a new one
+//
+unsigned int
+ctable_RowNumberAssign (ctable_RowNumbers *numbers, ctable_BaseRow *row)
+{
+    unsigned int number = row->_rowNumber;
+
+    if (number != 0) {
+	return number;
+    }
+
+    if (numbers->nFree > 0) {
+	number = numbers->free[--numbers->nFree];
+    } else {
+	number = numbers->next++;
+	if (number >= numbers->size) {
+	    numbers->size *= 2;
+	    numbers->rows = (ctable_BaseRow **)ckrealloc ((char *)numbers->rows, numbers->size * sizeof (ctable_BaseRow *));
+	}
+    }
+
+    numbers->rows[number] = row;
+    row->_rowNumber = number;
+    return number;
+}
+
+//
+// ctable_RowNumberRelease - give back a deleted row's number
+//
+void
+ctable_RowNumberRelease (ctable_RowNumbers *numbers, ctable_BaseRow *row)
+{
+    unsigned int number = row->_rowNumber;
+
+    if (number == 0) {
+	return;
+    }
+
+    if (numbers->nFree >= numbers->freeSize) {
+	numbers->freeSize = numbers->freeSize ? numbers->freeSize * 2 : 64;
+	numbers->free = (unsigned int *)ckrealloc ((char *)numbers->free, numbers->freeSize * sizeof (unsigned int));
+    }
+
+    numbers->free[numbers->nFree++] = number;
+    numbers->rows[number] = NULL;
+    row->_rowNumber = 0;
+}
@@ -0,0 +1,119 @@
+// $Id$
+
+#ifndef CTABLE_BITMAPINDEX_H
+#define CTABLE_BITMAPINDEX_H
+
+#include <stdint.h>
+
+/*
+  Bitmap index layout
+
+  For fields with only a few distinct values, booleans and enum-like
+  strings, where a skip list is a handful of nodes each with a huge run
+  of rows. The field keeps its skip list, which still walks the rows in
+  order, and alongside it each distinct value gets a bitmap of the rows
+  that have it. Searching with several comparisons on bitmap indexed
+  fields ANDs the comparisons' bitmaps a word at a time to find the rows
+  that can match before any row is looked at.
+
+  The bitmaps are over a dense numbering of the table's rows. A row gets
+  a number the first time it goes in a bitmap index and keeps it until
+  it's deleted, when the number is reused for a later row. The numbers
+  map back to the rows through the table's ctable_RowNumbers.
+
+  A bitmap is kept Roaring style, split into containers by the upper 16
+  bits of the numbers. A container with few numbers in it is a sorted
+  array of the lower 16 bits, once it holds more than an array would
+  take it's 1024 words of bits.
+
+  A trigram index is kept the same way for string fields, but rather
+  than a bitmap for each value there's one for each run of three bytes,
+  lower cased, that turns up anywhere in the values. Every row matching
+  "*foo*" has "foo" in it, so the rows a match pattern can find are in
+  the bitmaps of all the trigrams in the pattern's literal runs, and
+  only those rows are given to the matcher.
+
+  The bitmaps and the row numbers are the master's own, shared memory
+  readers walk a bitmap indexed field's skip list like any other.
+*/
+
+// numbers in an array container before it becomes a bitmap, where the
+// two take the same space, and numbers in a bitmap container before it
+// goes back to being an array, lower so one row in and out at the limit
+// doesn't flip it back and forth
+#define CTABLE_BITMAP_ARRAY_MAX		4096
+#define CTABLE_BITMAP_ARRAY_MIN		2048
+
+#define CTABLE_BITMAP_WORDS		1024
+
+// most trigrams taken from a match pattern, more would narrow the rows
+// down little further
+#define CTABLE_TRIGRAMS_MAX		32
+
+typedef struct ctable_BitmapContainer {
+  uint16_t        high;     /* Upper 16 bits of the numbers in it */
+  int             n;        /* Numbers in it */
+  int             size;     /* Slots in array, 0 if it's words */
+  uint16_t       *array;    /* Sorted lower 16 bits */
+  uint64_t       *words;    /* Or a bit for each of the 65536 */
+} ctable_BitmapContainer;
+
+typedef struct ctable_Bitmap {
+  ctable_BitmapContainer *containers; /* Sorted by high */
+  int                     nContainers;
+  int                     size;
+} ctable_Bitmap;
+
+typedef struct ctable_BitmapIndexEntry {
+  ctable_BaseRow *row;      /* A row with the value, to compare against */
+  ctable_Bitmap   bits;     /* Numbers of the rows with the value */
+} ctable_BitmapIndexEntry;
+
+typedef struct ctable_BitmapIndex {
+  ctable_BitmapIndexEntry **entries; /* Sorted by value */
+  int                       nEntries;
+  int                       size;
+  Tcl_HashTable            *trigrams; /* Trigram to ctable_Bitmap, if a trigram index */
+} ctable_BitmapIndex;
+
+typedef struct ctable_RowNumbers {
+  ctable_BaseRow **rows;    /* Row with each number, 0 is never used */
+  unsigned int     next;    /* Lowest number never given out */
+  unsigned int     size;
+  unsigned int    *free;    /* Numbers given back */
+  unsigned int     nFree;
+  unsigned int     freeSize;
+} ctable_RowNumbers;
+
+void              ctable_BitmapInit ( ctable_Bitmap *bm );
+void              ctable_BitmapFree ( ctable_Bitmap *bm );
+void              ctable_BitmapAdd ( ctable_Bitmap *bm, unsigned int number );
+void              ctable_BitmapRemove ( ctable_Bitmap *bm, unsigned int number );
+size_t            ctable_BitmapCount ( ctable_Bitmap *bm );
+unsigned int      ctable_BitmapFirst ( ctable_Bitmap *bm );
+
+/* Combine src into dst, leaving src as it was */
+void              ctable_BitmapOr ( ctable_Bitmap *dst, ctable_Bitmap *src );
+void              ctable_BitmapAnd ( ctable_Bitmap *dst, ctable_Bitmap *src );
+
+/* The numbers in ascending order, returns how many */
+size_t            ctable_BitmapNumbers ( ctable_Bitmap *bm, unsigned int *numbers );
+
+ctable_BitmapIndex *ctable_BitmapIndexNew ( int trigrams );
+void              ctable_BitmapIndexDelete ( ctable_BitmapIndex *index );
+void              ctable_BitmapIndexInsert ( ctable_BitmapIndex *index, cmp_f cmp, ctable_BaseRow *row, unsigned int number );
+void              ctable_BitmapIndexErase ( ctable_BitmapIndex *index, cmp_f cmp, ctable_RowNumbers *numbers, ctable_BaseRow *row );
+
+void              ctable_TrigramIndexInsert ( ctable_BitmapIndex *index, const char *string, int length, unsigned int number );
+void              ctable_TrigramIndexErase ( ctable_BitmapIndex *index, const char *string, int length, unsigned int number );
+ctable_Bitmap    *ctable_TrigramIndexFind ( ctable_BitmapIndex *index, uint32_t trigram );
+
+/* The trigrams a string matching the pattern has to have, returns how many */
+int               ctable_TrigramsOfPattern ( const char *pattern, int literal, int nocase, int unicodeNocase, uint32_t *trigrams );
+
+ctable_RowNumbers *ctable_RowNumbersNew ( void );
+void              ctable_RowNumbersDelete ( ctable_RowNumbers *numbers );
+unsigned int      ctable_RowNumberAssign ( ctable_RowNumbers *numbers, ctable_BaseRow *row );
+void              ctable_RowNumberRelease ( ctable_RowNumbers *numbers, ctable_BaseRow *row );
+
+#endif
@@ -0,0 +1,947 @@
+// $Id$
+
+/*
+  B+tree index, see ctable_btree.h for the layout.
+
+  The master is the only process that changes a tree. Everything it
+  changes in an inner node or the list of leaves happens while the tree
+  generation is odd, and everything it moves around in a leaf while the
+  leaf's version is odd. A reader notes the generation before it goes
+  down the tree and the leaf's version before it reads a slot, and only
+  trusts what it read if neither has moved since. Freed nodes and rows
+  stay readable until the readers have moved on to a later cycle, so a
+  reader that goes astray never reads anything it can't get back from.
+*/
+#include "jsw_slib.h"
+#include "ctable_btree.h"
+#ifdef WITH_SHARED_TABLES
+#include "shared.h"
+#endif
+
+#ifdef __GNUC__
+# define BtreeWriteBarrier()	__atomic_thread_fence(__ATOMIC_RELEASE)
+# define BtreeReadBarrier()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#else
+# define BtreeWriteBarrier()
+# define BtreeReadBarrier()
+#endif
+
+// times a reader tries to get down the tree before it gives up
+#define BTREE_PLACE_TRIES	100
+
+#define BtreeLeafSize() (sizeof (ctable_BtreeNode))
+#define BtreeInnerSize() (sizeof (ctable_BtreeNode) + (CTABLE_BTREE_FANOUT + 1) * sizeof (ctable_BtreeNode *))
+
+//
+// BtreeAlloc - allocate tree memory, in shared memory if it has a share
+//
+static void *
+BtreeAlloc (void *share, size_t size)
+{
+    void *mem;
+
+#ifdef WITH_SHARED_TABLES
+    if (share) {
+	mem = shmalloc ((shm_t *)share, size);
+	if (!mem) {
+	    Tcl_Panic ("Can't allocate shared memory for btree");
+	}
+	return mem;
+    }
+#endif
+    mem = ckalloc (size);
+    return mem;
+}
+
+//
+// BtreeFree - free tree memory, shared memory is only released once the
+// readers are done with it
+//
+static void
+BtreeFree (void *share, void *mem)
+{
+#ifdef WITH_SHARED_TABLES
+    if (share) {
+	shmfree ((shm_t *)share, (char *)mem);
+	return;
+    }
+#endif
+    ckfree ((char *)mem);
+}
+
+static ctable_BtreeNode *
+BtreeNewNode (void *share, int leaf)
+{
+    ctable_BtreeNode *node;
+    int               i;
+
+    node = (ctable_BtreeNode *)BtreeAlloc (share, leaf ? BtreeLeafSize() : BtreeInnerSize());
+    node->version = 0;
+    node->leaf = leaf;
+    node->nKeys = 0;
+    node->prev = node->next = NULL;
+    for (i = 0; i < CTABLE_BTREE_FANOUT; i++) {
+	node->keys[i] = NULL;
+    }
+    if (!leaf) {
+	for (i = 0; i <= CTABLE_BTREE_FANOUT; i++) {
+	    node->children[i] = NULL;
+	}
+    }
+    return node;
+}
+
+//
+// BtreeBeginChange / BtreeEndChange - mark the tree as being restructured
+//
+INLINE static void
+BtreeBeginChange (ctable_Btree *tree)
+{
+    tree->generation++;
+    BtreeWriteBarrier ();
+}
+
+INLINE static void
+BtreeEndChange (ctable_Btree *tree)
+{
+    BtreeWriteBarrier ();
+    tree->generation++;
+}
+
+INLINE static void
+BtreeBeginLeaf (ctable_BtreeNode *leaf)
+{
+    leaf->version++;
+    BtreeWriteBarrier ();
+}
+
+INLINE static void
+BtreeEndLeaf (ctable_BtreeNode *leaf)
+{
+    BtreeWriteBarrier ();
+    leaf->version++;
+}
+
+//
+// BtreeUpperBound - index of the first key greater than row, which is
+// the child of an inner node to go down for row
+//
+INLINE static int
+BtreeUpperBound (ctable_BtreeNode *node, int nKeys, cmp_f cmp, ctable_BaseRow *row)
+{
+    int lo = 0, hi = nKeys;
+
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+	ctable_BaseRow *key = node->keys[mid];
+
+	// a reader can catch a slot on its way somewhere else
+	if (key == NULL || cmp (row, key) >= 0) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    return lo;
+}
+
+//
+// BtreeLowerBound - index of the first key not less than row
+//
+INLINE static int
+BtreeLowerBound (ctable_BtreeNode *node, int nKeys, cmp_f cmp, ctable_BaseRow *row)
+{
+    int lo = 0, hi = nKeys;
+
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+	ctable_BaseRow *key = node->keys[mid];
+
+	if (key == NULL || cmp (key, row) < 0) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    return lo;
+}
+
+//
+// ctable_BtreeNew - create an empty tree
+//
+ctable_Btree *
+ctable_BtreeNew (void *share)
+{
+    ctable_Btree *tree = (ctable_Btree *)BtreeAlloc (share, sizeof *tree);
+
+    tree->root = BtreeNewNode (share, 1);
+    tree->size = 0;
+    tree->values = 0;
+    tree->height = 1;
+    tree->nodeIdx = -1;
+    tree->generation = 0;
+    return tree;
+}
+
+static void
+BtreeDeleteNode (ctable_BtreeNode *node, void *share)
+{
+    int i;
+
+    if (!node->leaf) {
+	for (i = 0; i <= node->nKeys; i++) {
+	    BtreeDeleteNode (node->children[i], share);
+	}
+    }
+    BtreeFree (share, node);
+}
+
+//
+// ctable_BtreeDelete - free the tree but not the rows in it. If this is
+// the last use of the shared memory segment there's no point freeing it
+// piece by piece.
+//
+void
+ctable_BtreeDelete (ctable_Btree *tree, void *share, int final)
+{
+    if (final && share) {
+	return;
+    }
+
+    BtreeDeleteNode (tree->root, share);
+    BtreeFree (share, tree);
+}
+
+//
+// BtreePath - where an insert or erase went down the tree
+//
+// node[level] is the node at each level, from the root at 0 down to the
+// leaf at height-1, child[level] the child taken below it, and
+// sep[level] the inner key holding the first row under node[level], or
+// NULL if it's on the far left of the tree.
+//
+typedef struct BtreePath {
+    ctable_BtreeNode  *node[CTABLE_BTREE_MAX_HEIGHT];
+    int                child[CTABLE_BTREE_MAX_HEIGHT];
+    ctable_BaseRow   **sep[CTABLE_BTREE_MAX_HEIGHT];
+} BtreePath;
+
+static ctable_BtreeNode *
+BtreeDescend (ctable_Btree *tree, cmp_f cmp, ctable_BaseRow *row, BtreePath *path)
+{
+    ctable_BtreeNode *node = tree->root;
+    ctable_BaseRow  **sep = NULL;
+    int               level;
+
+    for (level = 0; !node->leaf; level++) {
+	int ci = BtreeUpperBound (node, node->nKeys, cmp, row);
+
+	path->node[level] = node;
+	path->child[level] = ci;
+	path->sep[level] = sep;
+
+	if (ci > 0) {
+	    sep = &node->keys[ci - 1];
+	}
+	node = node->children[ci];
+    }
+
+    path->node[level] = node;
+    path->child[level] = 0;
+    path->sep[level] = sep;
+    return node;
+}
+
+//
+// BtreeSetSep - a node's first row changed, update the inner key holding it
+//
+INLINE static void
+BtreeSetSep (ctable_Btree *tree, ctable_BaseRow **sep, ctable_BaseRow *row)
+{
+    if (sep != NULL && *sep != row) {
+	BtreeBeginChange (tree);
+	*sep = row;
+	BtreeEndChange (tree);
+    }
+}
+
+//
+// BtreeMoveSlot - move the row list in one leaf slot to another, the
+// first row's prev is the only thing that knows where its slot is
+//
+INLINE static void
+BtreeMoveSlot (ctable_BtreeNode *to, int toPos, ctable_BtreeNode *from, int fromPos, int nodeIdx)
+{
+    ctable_BaseRow *row = from->keys[fromPos];
+
+    to->keys[toPos] = row;
+    row->_ll_nodes[nodeIdx].prev = &to->keys[toPos];
+}
+
+//
+// BtreeLeafInsert - add a new value to a leaf that has room for it, the
+// caller has marked the leaf as changing
+//
+static void
+BtreeLeafInsert (ctable_BtreeNode *leaf, int pos, ctable_BaseRow *row, int nodeIdx)
+{
+    int j;
+
+    for (j = leaf->nKeys; j > pos; j--) {
+	BtreeMoveSlot (leaf, j, leaf, j - 1, nodeIdx);
+    }
+
+    // start a one row list in the slot, readers never see it half done
+    row->_ll_nodes[nodeIdx].next = NULL;
+    row->_ll_nodes[nodeIdx].prev = &leaf->keys[pos];
+    row->_ll_nodes[nodeIdx].head = &leaf->keys[pos];
+    BtreeWriteBarrier ();
+    leaf->keys[pos] = row;
+    leaf->nKeys++;
+}
+
+//
+// BtreeInnerInsert - put key and the child to its right into an inner
+// node at level, splitting it and the ones above it as needed
+//
+static void
+BtreeInnerInsert (ctable_Btree *tree, void *share, BtreePath *path, int level, ctable_BaseRow *key, ctable_BtreeNode *child)
+{
+    ctable_BtreeNode *node;
+    ctable_BtreeNode *right;
+    ctable_BaseRow   *keys[CTABLE_BTREE_FANOUT + 1];
+    ctable_BtreeNode *children[CTABLE_BTREE_FANOUT + 2];
+    ctable_BaseRow   *up;
+    int               ci, j, mid;
+
+    if (level < 0) {
+	// split the root, the tree gets a level taller
+	ctable_BtreeNode *root = BtreeNewNode (share, 0);
+
+	if (tree->height >= CTABLE_BTREE_MAX_HEIGHT) {
+	    Tcl_Panic ("btree index too tall");
+	}
+
+	root->keys[0] = key;
+	root->children[0] = tree->root;
+	root->children[1] = child;
+	root->nKeys = 1;
+	BtreeWriteBarrier ();
+	tree->root = root;
+	tree->height++;
+	return;
+    }
+
+    node = path->node[level];
+    ci = path->child[level];
+
+    if (node->nKeys < CTABLE_BTREE_FANOUT) {
+	for (j = node->nKeys; j > ci; j--) {
+	    node->keys[j] = node->keys[j - 1];
+	    node->children[j + 1] = node->children[j];
+	}
+	node->keys[ci] = key;
+	node->children[ci + 1] = child;
+	node->nKeys++;
+	return;
+    }
+
+    for (j = 0; j < ci; j++) {
+	keys[j] = node->keys[j];
+    }
+    keys[ci] = key;
+    for (j = ci; j < CTABLE_BTREE_FANOUT; j++) {
+	keys[j + 1] = node->keys[j];
+    }
+    for (j = 0; j <= ci; j++) {
+	children[j] = node->children[j];
+    }
+    children[ci + 1] = child;
+    for (j = ci + 1; j <= CTABLE_BTREE_FANOUT; j++) {
+	children[j + 1] = node->children[j];
+    }
+
+    // the middle key goes up, the keys either side of it stay below
+    mid = (CTABLE_BTREE_FANOUT + 1) / 2;
+    up = keys[mid];
+
+    right = BtreeNewNode (share, 0);
+    for (j = mid + 1; j <= CTABLE_BTREE_FANOUT; j++) {
+	right->keys[j - mid - 1] = keys[j];
+    }
+    for (j = mid + 1; j <= CTABLE_BTREE_FANOUT + 1; j++) {
+	right->children[j - mid - 1] = children[j];
+    }
+    right->nKeys = CTABLE_BTREE_FANOUT - mid;
+
+    for (j = 0; j < mid; j++) {
+	node->keys[j] = keys[j];
+    }
+    for (j = 0; j <= mid; j++) {
+	node->children[j] = children[j];
+    }
+    node->nKeys = mid;
+    for (j = mid; j < CTABLE_BTREE_FANOUT; j++) {
+	node->keys[j] = NULL;
+	node->children[j + 1] = NULL;
+    }
+
+    BtreeInnerInsert (tree, share, path, level - 1, up, right);
+}
+
+//
+// ctable_BtreeInsert - add a row to the tree, linking it to any rows
+// already there with the same value
+//
+// Returns 0 if unique is set and there's already a row with the value.
+//
+int
+ctable_BtreeInsert (ctable_Btree *tree, cmp_f cmp, void *share, ctable_BaseRow *row, int nodeIdx, int unique)
+{
+    BtreePath         path;
+    ctable_BtreeNode *leaf = BtreeDescend (tree, cmp, row, &path);
+    int               level = tree->height - 1;
+    int               pos = BtreeLowerBound (leaf, leaf->nKeys, cmp, row);
+
+    tree->nodeIdx = nodeIdx;
+
+    if (pos < leaf->nKeys && cmp (row, leaf->keys[pos]) == 0) {
+	if (unique) {
+	    return 0;
+	}
+
+	ctable_ListInsertHead (&leaf->keys[pos], row, nodeIdx);
+	if (pos == 0) {
+	    BtreeSetSep (tree, path.sep[level], row);
+	}
+    } else if (leaf->nKeys < CTABLE_BTREE_FANOUT) {
+	tree->values++;
+	BtreeBeginLeaf (leaf);
+	BtreeLeafInsert (leaf, pos, row, nodeIdx);
+	BtreeEndLeaf (leaf);
+	if (pos == 0) {
+	    BtreeSetSep (tree, path.sep[level], row);
+	}
+    } else {
+	ctable_BtreeNode *right = BtreeNewNode (share, 1);
+	int               half = CTABLE_BTREE_FANOUT / 2;
+	int               j;
+
+	tree->values++;
+	BtreeBeginChange (tree);
+	BtreeBeginLeaf (leaf);
+
+	for (j = half; j < CTABLE_BTREE_FANOUT; j++) {
+	    BtreeMoveSlot (right, j - half, leaf, j, nodeIdx);
+	    leaf->keys[j] = NULL;
+	}
+	right->nKeys = CTABLE_BTREE_FANOUT - half;
+	leaf->nKeys = half;
+
+	if (pos <= half) {
+	    BtreeLeafInsert (leaf, pos, row, nodeIdx);
+	} else {
+	    BtreeLeafInsert (right, pos - half, row, nodeIdx);
+	}
+
+	if (pos == 0) {
+	    if (path.sep[level] != NULL) {
+		*path.sep[level] = row;
+	    }
+	}
+
+	right->prev = leaf;
+	right->next = leaf->next;
+	BtreeWriteBarrier ();
+	if (leaf->next) {
+	    leaf->next->prev = right;
+	}
+	leaf->next = right;
+
+	BtreeEndLeaf (leaf);
+
+	BtreeInnerInsert (tree, share, &path, level - 1, right->keys[0], right);
+	BtreeEndChange (tree);
+    }
+
+    tree->size++;
+    return 1;
+}
+
+//
+// BtreeInnerRemove - take child ci and the key to its left out of the
+// inner node at level, removing the node itself if that empties it
+//
+static void
+BtreeInnerRemove (ctable_Btree *tree, void *share, BtreePath *path, int level)
+{
+    ctable_BtreeNode *node = path->node[level];
+    int               ci = path->child[level];
+    int               j;
+
+    if (node->nKeys == 0) {
+	// that was its only child
+	if (level == 0) {
+	    tree->root = BtreeNewNode (share, 1);
+	    tree->height = 1;
+	} else {
+	    BtreeInnerRemove (tree, share, path, level - 1);
+	}
+	BtreeFree (share, node);
+	return;
+    }
+
+    if (ci == 0) {
+	// the second child becomes the first, and its first row is now
+	// the first row under this node
+	ctable_BaseRow *first = node->keys[0];
+
+	for (j = 0; j < node->nKeys - 1; j++) {
+	    node->keys[j] = node->keys[j + 1];
+	}
+	for (j = 0; j < node->nKeys; j++) {
+	    node->children[j] = node->children[j + 1];
+	}
+	if (path->sep[level] != NULL) {
+	    *path->sep[level] = first;
+	}
+    } else {
+	for (j = ci - 1; j < node->nKeys - 1; j++) {
+	    node->keys[j] = node->keys[j + 1];
+	}
+	for (j = ci; j < node->nKeys; j++) {
+	    node->children[j] = node->children[j + 1];
+	}
+    }
+    node->nKeys--;
+    node->keys[node->nKeys] = NULL;
+    node->children[node->nKeys + 1] = NULL;
+}
+
+//
+// ctable_BtreeErase - take a row out of the tree, and the value with it
+// if it's the last row with that value
+//
+// Returns 0 if the row's value isn't in the tree.
+//
+int
+ctable_BtreeErase (ctable_Btree *tree, cmp_f cmp, void *share, ctable_BaseRow *row, int nodeIdx)
+{
+    BtreePath         path;
+    ctable_BtreeNode *leaf = BtreeDescend (tree, cmp, row, &path);
+    int               level = tree->height - 1;
+    int               pos = BtreeLowerBound (leaf, leaf->nKeys, cmp, row);
+    int               j;
+
+    if (pos >= leaf->nKeys || cmp (row, leaf->keys[pos]) != 0) {
+	return 0;
+    }
+
+    tree->size--;
+
+    if (row->_ll_nodes[nodeIdx].next != NULL || row->_ll_nodes[nodeIdx].prev != &leaf->keys[pos]) {
+	// other rows have the value, just unlink this one
+	ctable_ListRemove (row, nodeIdx);
+	if (pos == 0) {
+	    BtreeSetSep (tree, path.sep[level], leaf->keys[0]);
+	}
+	return 1;
+    }
+
+    row->_ll_nodes[nodeIdx].prev = NULL;
+    tree->values--;
+
+    if (leaf->nKeys > 1 || level == 0) {
+	BtreeBeginLeaf (leaf);
+	for (j = pos; j < leaf->nKeys - 1; j++) {
+	    BtreeMoveSlot (leaf, j, leaf, j + 1, nodeIdx);
+	}
+	leaf->nKeys--;
+	leaf->keys[leaf->nKeys] = NULL;
+	BtreeEndLeaf (leaf);
+
+	if (pos == 0 && leaf->nKeys > 0) {
+	    BtreeSetSep (tree, path.sep[level], leaf->keys[0]);
+	}
+	return 1;
+    }
+
+    // the leaf's last value is going, so is the leaf
+    BtreeBeginChange (tree);
+
+    BtreeBeginLeaf (leaf);
+    if (leaf->prev) {
+	BtreeBeginLeaf (leaf->prev);
+	leaf->prev->next = leaf->next;
+	BtreeEndLeaf (leaf->prev);
+    }
+    if (leaf->next) {
+	leaf->next->prev = leaf->prev;
+    }
+    BtreeEndLeaf (leaf);
+
+    BtreeInnerRemove (tree, share, &path, level - 1);
+    BtreeFree (share, leaf);
+
+    // a root with one child is just in the way
+    while (!tree->root->leaf && tree->root->nKeys == 0) {
+	ctable_BtreeNode *root = tree->root;
+
+	tree->root = root->children[0];
+	tree->height--;
+	BtreeFree (share, root);
+    }
+
+    BtreeEndChange (tree);
+    return 1;
+}
+
+//
+// ctable_BtreeBuild - fill an empty tree from n rows sorted by cmp, leaf
+// by leaf and then each level of inner nodes over them
+//
+void
+ctable_BtreeBuild (ctable_Btree *tree, cmp_f cmp, void *share, ctable_BaseRow **rows, size_t n, int nodeIdx)
+{
+    ctable_BtreeNode **nodes;
+    ctable_BaseRow   **firsts;
+    ctable_BtreeNode  *leaf = NULL;
+    size_t             nNodes = 0;
+    size_t             i;
+    int                height = 1;
+
+    if (tree->size != 0 || n == 0) {
+	for (i = 0; i < n; i++) {
+	    ctable_BtreeInsert (tree, cmp, share, rows[i], nodeIdx, 0);
+	}
+	return;
+    }
+
+    tree->nodeIdx = nodeIdx;
+
+    // at most one leaf per row
+    nodes = (ctable_BtreeNode **)ckalloc (n * sizeof *nodes);
+    firsts = (ctable_BaseRow **)ckalloc (n * sizeof *firsts);
+
+    for (i = 0; i < n; i++) {
+	if (leaf != NULL && cmp (rows[i], leaf->keys[leaf->nKeys - 1]) == 0) {
+	    ctable_ListInsertHead (&leaf->keys[leaf->nKeys - 1], rows[i], nodeIdx);
+	    continue;
+	}
+
+	if (leaf == NULL || leaf->nKeys == CTABLE_BTREE_FANOUT) {
+	    ctable_BtreeNode *next = BtreeNewNode (share, 1);
+
+	    if (leaf != NULL) {
+		leaf->next = next;
+		next->prev = leaf;
+	    }
+	    leaf = next;
+	    nodes[nNodes++] = leaf;
+	}
+
+	ctable_ListInit (&leaf->keys[leaf->nKeys], __FILE__, __LINE__);
+	ctable_ListInsertHead (&leaf->keys[leaf->nKeys], rows[i], nodeIdx);
+	leaf->nKeys++;
+	tree->values++;
+    }
+
+    // first rows have to be picked up after the dups went in at the head
+    for (i = 0; i < nNodes; i++) {
+	firsts[i] = nodes[i]->keys[0];
+    }
+
+    while (nNodes > 1) {
+	size_t up = 0;
+
+	for (i = 0; i < nNodes; i += CTABLE_BTREE_FANOUT + 1) {
+	    ctable_BtreeNode *node = BtreeNewNode (share, 0);
+	    size_t            j;
+
+	    for (j = i; j < nNodes && j < i + CTABLE_BTREE_FANOUT + 1; j++) {
+		node->children[j - i] = nodes[j];
+		if (j > i) {
+		    node->keys[j - i - 1] = firsts[j];
+		}
+	    }
+	    node->nKeys = (short)(j - i - 1);
+
+	    firsts[up] = firsts[i];
+	    nodes[up++] = node;
+	}
+
+	nNodes = up;
+	height++;
+    }
+
+    BtreeFree (share, tree->root);
+
+    tree->height = height;
+    tree->size = n;
+    BtreeWriteBarrier ();
+    tree->root = nodes[0];
+
+    ckfree ((char *)nodes);
+    ckfree ((char *)firsts);
+}
+
+//
+// BtreeSettle - having put the cursor at a slot in a leaf, move on past
+// the end of the leaf to the next one if need be and pick up the row
+//
+// The leaf version in the cursor has to be the one it was read under. A
+// reader that finds the leaf changed since then is no longer valid.
+//
+static int
+BtreeSettle (ctable_BtreeCursor *cur)
+{
+    ctable_BtreeNode *leaf = cur->leaf;
+
+    while (leaf != NULL) {
+	if (cur->pos < leaf->nKeys && cur->pos < CTABLE_BTREE_FANOUT) {
+	    cur->row = leaf->keys[cur->pos];
+	    BtreeReadBarrier ();
+	    if (leaf->version != cur->version || cur->row == NULL) {
+		cur->valid = 0;
+		break;
+	    }
+	    return 1;
+	}
+
+	leaf = leaf->next;
+	BtreeReadBarrier ();
+	if (cur->leaf->version != cur->version) {
+	    cur->valid = 0;
+	    break;
+	}
+
+	cur->leaf = leaf;
+	cur->pos = 0;
+	if (leaf != NULL) {
+	    cur->version = leaf->version;
+	    BtreeReadBarrier ();
+	    if (cur->version & 1) {
+		cur->valid = 0;
+		break;
+	    }
+	}
+    }
+
+    cur->leaf = NULL;
+    cur->row = NULL;
+    return 0;
+}
+
+//
+// ctable_BtreePlace - put the cursor at the first or last value in the
+// tree, or the first one at or after row
+//
+// A reader racing the master tries again from the top until it gets a
+// consistent view, or gives up and marks the cursor invalid.
+//
+void
+ctable_BtreePlace (ctable_Btree *tree, cmp_f cmp, ctable_BtreeCursor *cur, ctable_BaseRow *row, int how)
+{
+    int tries;
+
+    for (tries = 0; tries < BTREE_PLACE_TRIES; tries++) {
+	unsigned int      generation = tree->generation;
+	ctable_BtreeNode *node;
+	int               level = 0;
+	int               nKeys;
+	int               pos;
+
+	if (generation & 1) {
+	    continue;
+	}
+	BtreeReadBarrier ();
+
+	node = tree->root;
+	while (node != NULL && !node->leaf && level++ < CTABLE_BTREE_MAX_HEIGHT) {
+	    nKeys = node->nKeys;
+	    if (nKeys > CTABLE_BTREE_FANOUT) {
+		break;
+	    }
+
+	    switch (how) {
+		case BTREE_PLACE_FIRST: pos = 0; break;
+		case BTREE_PLACE_LAST: pos = nKeys; break;
+		default: pos = BtreeUpperBound (node, nKeys, cmp, row); break;
+	    }
+	    node = node->children[pos];
+	}
+
+	if (node == NULL || !node->leaf) {
+	    continue;
+	}
+
+	cur->leaf = node;
+	cur->version = node->version;
+	cur->generation = generation;
+	BtreeReadBarrier ();
+	if (cur->version & 1) {
+	    continue;
+	}
+
+	nKeys = node->nKeys;
+	if (nKeys > CTABLE_BTREE_FANOUT) {
+	    continue;
+	}
+
+	switch (how) {
+	    case BTREE_PLACE_FIRST: pos = 0; break;
+	    case BTREE_PLACE_LAST: pos = nKeys - 1; break;
+	    case BTREE_PLACE_GE: pos = BtreeLowerBound (node, nKeys, cmp, row); break;
+	    default: pos = BtreeUpperBound (node, nKeys, cmp, row); break;
+	}
+	if (pos < 0) {
+	    // empty tree
+	    pos = 0;
+	}
+	cur->pos = pos;
+	cur->valid = 1;
+
+	BtreeSettle (cur);
+	if (!cur->valid) {
+	    continue;
+	}
+
+	BtreeReadBarrier ();
+	if (tree->generation == generation) {
+	    return;
+	}
+    }
+
+    cur->leaf = NULL;
+    cur->row = NULL;
+    cur->valid = 0;
+}
+
+//
+// ctable_BtreeEstimate - guess how many rows come before row, or up to and
+// including it if inclusive is set, from where it falls in each node on
+// the way down. Each child is taken to hold rows in proportion to how full
+// it is, and every value in a leaf as many rows as the others. Good enough
+// to plan a search by without keeping counts in the nodes.
+//
+// A reader that can't get down the tree consistently guesses half.
+//
+size_t
+ctable_BtreeEstimate (ctable_Btree *tree, cmp_f cmp, ctable_BaseRow *row, int inclusive)
+{
+    int tries;
+
+    for (tries = 0; tries < BTREE_PLACE_TRIES; tries++) {
+	unsigned int      generation = tree->generation;
+	ctable_BtreeNode *node;
+	int               level = 0;
+	int               nKeys;
+	int               pos;
+	double            before = 0.0;
+	double            width = 1.0;
+	double            left = 0.0;
+	double            under = 0.0;
+	double            total;
+	int               i;
+
+	if (generation & 1) {
+	    continue;
+	}
+	BtreeReadBarrier ();
+
+	node = tree->root;
+	while (node != NULL && !node->leaf && level++ < CTABLE_BTREE_MAX_HEIGHT) {
+	    nKeys = node->nKeys;
+	    if (nKeys > CTABLE_BTREE_FANOUT) {
+		break;
+	    }
+
+	    pos = inclusive ? BtreeUpperBound (node, nKeys, cmp, row) : BtreeLowerBound (node, nKeys, cmp, row);
+
+	    total = 0.0;
+	    for (i = 0; i <= nKeys; i++) {
+		ctable_BtreeNode *child = node->children[i];
+		double            weight = (child == NULL) ? 1.0 : child->nKeys + !child->leaf;
+
+		if (i == pos) {
+		    under = weight;
+		} else if (i < pos) {
+		    left += weight;
+		}
+		total += weight;
+	    }
+	    if (total > 0.0) {
+		before += width * left / total;
+		width *= under / total;
+	    }
+	    left = under = 0.0;
+	    node = node->children[pos];
+	}
+
+	if (node == NULL || !node->leaf) {
+	    continue;
+	}
+
+	nKeys = node->nKeys;
+	if (nKeys > CTABLE_BTREE_FANOUT) {
+	    continue;
+	}
+	if (nKeys > 0) {
+	    pos = inclusive ? BtreeUpperBound (node, nKeys, cmp, row) : BtreeLowerBound (node, nKeys, cmp, row);
+	    before += width * pos / nKeys;
+	}
+
+	BtreeReadBarrier ();
+	if (tree->generation == generation) {
+	    return (size_t)(before * tree->size + 0.5);
+	}
+    }
+
+    return tree->size / 2;
+}
+
+//
+// ctable_BtreeNext - step the cursor on to the next value
+//
+// If the master changed the tree under its own cursor it finds its place
+// again from the row it was on. A reader can't, it just notes that the
+// cursor is no longer valid.
+//
+// Returns 0 at the end of the tree or if the cursor's no longer valid.
+//
+int
+ctable_BtreeNext (ctable_Btree *tree, cmp_f cmp, ctable_BtreeCursor *cur, int reader)
+{
+    if (cur->leaf == NULL || !cur->valid) {
+	return 0;
+    }
+
+    if (reader) {
+	// the leaf is all a reader has to go on
+	if (cur->leaf->version != cur->version) {
+	    cur->valid = 0;
+	    return 0;
+	}
+    } else if (cur->leaf->version != cur->version || tree->generation != cur->generation) {
+	ctable_BtreePlace (tree, cmp, cur, cur->row, BTREE_PLACE_GT);
+	return cur->row != NULL;
+    }
+
+    cur->pos++;
+    return BtreeSettle (cur);
+}
+
+//
+// ctable_BtreeValid - is what the cursor read still good
+//
+int
+ctable_BtreeValid (ctable_BtreeCursor *cur)
+{
+    if (!cur->valid) {
+	return 0;
+    }
+    BtreeReadBarrier ();
+    return cur->leaf == NULL || cur->leaf->version == cur->version;
+}
+
+// vim: set ts=8 sw=4 sts=4 noet :
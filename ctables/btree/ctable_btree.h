@@ -0,0 +1,90 @@
+// $Id$
+
+#ifndef CTABLE_BTREE_H
+#define CTABLE_BTREE_H
+
+/*
+  B+tree index layout
+
+  An alternative to the skip list for indexing a field. Each node holds
+  up to CTABLE_BTREE_FANOUT row pointers, so a range scan walks an array
+  of rows a few cache lines long instead of chasing a pointer per row,
+  and a lookup goes through a handful of nodes rather than a node per
+  level of the skip list.
+
+  The leaves hold one slot per distinct value, which is the head of the
+  list of rows with that value, linked through the row's _ll_nodes the
+  same as the rows hanging off a skip list node. Slots move about as the
+  tree changes, so only the first row's prev pointer is kept pointing at
+  its slot, the tree finds a row's slot by value when it's removed.
+
+  Inner nodes hold the head row of the first slot under each child but
+  the first, and keep it up to date as the head changes, so they never
+  point at a row that's not in the index.
+
+  Shared memory readers walk the master's tree while it changes it. The
+  tree generation is odd while the master is changing the tree, and each
+  leaf's version while its slots are moving, so a reader can tell when
+  what it read may not be right and start over.
+*/
+
+// keys per node, a leaf is about four cache lines of row pointers
+#define CTABLE_BTREE_FANOUT	32
+
+// deepest tree that can be built, far more than 2^32 rows need
+#define CTABLE_BTREE_MAX_HEIGHT	16
+
+typedef struct ctable_BtreeNode ctable_BtreeNode;
+
+struct ctable_BtreeNode {
+  volatile unsigned int  version;  /* Leaves: odd while slots are moving */
+  short                  leaf;     /* 1 for a leaf, 0 for an inner node */
+  short                  nKeys;    /* Keys in use */
+  ctable_BtreeNode      *prev;     /* Leaves: neighbours in key order */
+  ctable_BtreeNode      *next;
+  ctable_BaseRow        *keys[CTABLE_BTREE_FANOUT];
+                                   /* Leaves: row list for each value.
+                                      Inner nodes: first row under each
+                                      child but the first */
+  ctable_BtreeNode      *children[]; /* Inner nodes: nKeys + 1 children */
+};
+
+typedef struct ctable_Btree {
+  ctable_BtreeNode      *root;
+  size_t                 size;     /* Rows in the index */
+  size_t                 values;   /* Distinct values, slots in the leaves */
+  int                    height;   /* Levels, 1 for a lone leaf */
+  int                    nodeIdx;  /* Row list the rows are linked on */
+  volatile unsigned int  generation; /* Odd while the tree is changing */
+} ctable_Btree;
+
+typedef struct ctable_BtreeCursor {
+  ctable_BtreeNode      *leaf;     /* Leaf the cursor is in, NULL at end */
+  int                    pos;      /* Slot within the leaf */
+  ctable_BaseRow        *row;      /* Row list at the cursor */
+  unsigned int           version;  /* Leaf version when it got there */
+  unsigned int           generation; /* Tree generation when placed */
+  int                    valid;    /* 0 if a reader lost its place */
+} ctable_BtreeCursor;
+
+ctable_Btree   *ctable_BtreeNew ( void *share );
+void            ctable_BtreeDelete ( ctable_Btree *tree, void *share, int final );
+
+int             ctable_BtreeInsert ( ctable_Btree *tree, cmp_f cmp, void *share, ctable_BaseRow *row, int nodeIdx, int unique );
+int             ctable_BtreeErase ( ctable_Btree *tree, cmp_f cmp, void *share, ctable_BaseRow *row, int nodeIdx );
+void            ctable_BtreeBuild ( ctable_Btree *tree, cmp_f cmp, void *share, ctable_BaseRow **rows, size_t n, int nodeIdx );
+
+/* Cursor placement, see BTREE_PLACE_* */
+void            ctable_BtreePlace ( ctable_Btree *tree, cmp_f cmp, ctable_BtreeCursor *cur, ctable_BaseRow *row, int how );
+int             ctable_BtreeNext ( ctable_Btree *tree, cmp_f cmp, ctable_BtreeCursor *cur, int reader );
+int             ctable_BtreeValid ( ctable_BtreeCursor *cur );
+
+/* Rows before row, or up to and including it, estimated from the tree */
+size_t          ctable_BtreeEstimate ( ctable_Btree *tree, cmp_f cmp, ctable_BaseRow *row, int inclusive );
+
+#define BTREE_PLACE_FIRST	0	/* First value */
+#define BTREE_PLACE_LAST	1	/* Last value */
+#define BTREE_PLACE_GE		2	/* First value not less than row */
+#define BTREE_PLACE_GT		3	/* First value greater than row */
+
+#endif
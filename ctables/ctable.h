@@ -190,6 +190,8 @@ struct ctable_BaseRow {
 #ifdef WITH_SHARED_TABLES
     cell_t		_row_cycle;
 #endif
+    // number in the table's bitmap indexes, 0 if it hasn't been in one
+    unsigned int	_rowNumber;
     // _ll_nodes absolutely must be the last thing defined in the base row
     ctable_LinkedListNode _ll_nodes[0];
 };
@@ -251,9 +253,13 @@ struct cursor {
 #define CTABLE_COMP_NOTMATCH_CASE 13
 #define CTABLE_COMP_RANGE 14
 #define CTABLE_COMP_IN 15
+#define CTABLE_COMP_WITHIN 16
+
+// how many comparison types there are
+#define CTABLE_NUM_COMP_TYPES 17
 
 // These must line up with the CTABLE_COMP terms above
-#define CTABLE_SEARCH_TERMS {"false", "true", "null", "notnull", "<", "<=", "=", "!=", ">=", ">", "match", "notmatch", "match_case", "notmatch_case", "range", "in", (char *)NULL}
+#define CTABLE_SEARCH_TERMS {"false", "true", "null", "notnull", "<", "<=", "=", "!=", ">=", ">", "match", "notmatch", "match_case", "notmatch_case", "range", "in", "within", (char *)NULL}
 
 
 // when setting, incr'ing, read_tabsepping, etc, we can control at the
@@ -287,6 +293,15 @@ struct cursor {
 struct CTable;
 typedef int (*filterFunction_t)(Tcl_Interp *interp, struct CTable *ctable, ctable_BaseRow *row, Tcl_Obj *filter, int sequence);
 typedef int (*fieldCompareFunction_t) (const ctable_BaseRow *row1, const ctable_BaseRow *row2);
+typedef unsigned int (*fieldHashFunction_t) (const ctable_BaseRow *row);
+
+// a number a search compares rows with, copied out of the row it was set
+// in so the comparison doesn't have to go to that row for it
+typedef union ctable_SearchValue {
+    long                     l;
+    Tcl_WideInt              w;
+    double                   d;
+} ctable_SearchValue;
 
 // ctable sort struct - this controls everything about a sort
 struct CTableSort {
@@ -319,11 +334,17 @@ struct CTableSearchComponent {
     ctable_BaseRow          *row2;
     ctable_BaseRow          *row3;
     fieldCompareFunction_t   compareFunction;
+    int                      predicate;    // case of search_compare's switch
+                                           // on field and comparison type
+                                           // that makes it, -1 if none does
+    ctable_SearchValue       value1;       // row1's and row2's values, for
+    ctable_SearchValue       value2;       // the cases comparing numbers
     Tcl_Obj                **inListObj;
     ctable_BaseRow	   **inListRows;
     int                      inCount;
     int                      fieldID;
     int                      comparisonType;
+    double                   estimate;     // rows it accepts, while planning
 };
 
 // ctable search filter struct - one for each "-filter" expression in a
@@ -400,6 +421,10 @@ struct CTableSearch {
     Tcl_Obj				*pollCodeBody;
     int					 nextPoll;
 
+    // threads to compare the rows with when looking at every row, 0 to
+    // pick by the number of CPUs and the size of the table
+    int					 threads;
+
     Tcl_Channel                          tabsepChannel;
     int                                  writingTabsepIncludeFieldNames;
     CONST char				*sepstr;
@@ -414,6 +439,10 @@ struct CTableSearch {
     // already been taken care of
     int                                  alreadySearched;
 
+    // set if the index walk alone decides which rows match, so the rows
+    // it finds aren't compared at all
+    int                                  indexOnly;
+
     // offsetLimit is calculated from offset and limit
     int                                  offsetLimit;
 
@@ -421,6 +450,11 @@ struct CTableSearch {
     // searching with sorting, and for completing a transaction after searching
     ctable_BaseRow                     **tranTable;
 
+    // when a sort only wants its first offsetLimit rows, tranTable holds
+    // just that many of the matches as a heap with the one that sorts last
+    // on top, and this is its size. 0 if tranTable holds every match.
+    int                                  topRows;
+
     // how to quote quotable strings and reptresent nulls in write_tabsep
     int					 quoteType;
     char				*nullString;
@@ -436,18 +470,40 @@ struct CTableSearch {
     int                                  searchField;
 };
 
+// index types for a field, must line up with indexTypes in gentable.tcl
+#define CTABLE_INDEXTYPE_SKIPLIST	0
+#define CTABLE_INDEXTYPE_BTREE		1
+#define CTABLE_INDEXTYPE_HASH		2
+#define CTABLE_INDEXTYPE_BITMAP		3
+#define CTABLE_INDEXTYPE_TRIGRAM	4
+
 struct ctable_FieldInfo {
     CONST char              *name;
     Tcl_Obj                 *nameObj;
     CONST char             **propKeys;
     char                   **propValues;
     fieldCompareFunction_t   compareFunction;
+    fieldHashFunction_t      hashFunction;
     int                      number;
     int                      needsQuoting;
     int                      indexNumber;
     int                      unique;
     int			     canBeNull;
+    int                      indexType;
     enum ctable_types        type;
+
+    // composite indexes this field is part of, ended by -1
+    int                     *composites;
+
+    // for a composite index, the fields it's ordered by, and functions
+    // comparing the first one, the first two, ... through all of them
+    int                      nCompositeFields;
+    int                     *compositeFields;
+    fieldCompareFunction_t  *prefixCompareFunctions;
+
+    // for a partial index, the search -compare list a row has to match
+    // to be in it, NULL if every row is
+    CONST char              *where;
 };
 
 struct ctable_CreatorTable {
@@ -462,6 +518,9 @@ struct ctable_CreatorTable {
     enum ctable_types    *fieldTypes;
     int                  *fieldsThatNeedQuoting;
     int			  keyField;
+    int			  keyHashType;
+    int			  keyIndexType;
+    int			  keyType;
 
     ctable_FieldInfo    **fields;
 
@@ -469,6 +528,10 @@ struct ctable_CreatorTable {
     int		       nPublicFields;
     int                nLinkedLists;
 
+    // fields plus composite indexes, which come after the fields in
+    // fields and skipLists
+    int                nIndexes;
+
     CONST char		   **filterNames;
     CONST filterFunction_t  *filterFunctions;
     int			     nFilters;
@@ -494,6 +557,7 @@ struct ctable_CreatorTable {
     int (*array_set_with_nulls) (Tcl_Interp *interp, Tcl_Obj *arrayNameObj, ctable_BaseRow *row, int field);
 
     int (*search_compare) (Tcl_Interp *interp, CTableSearch *searchControl, ctable_BaseRow *pointer);
+    int (*search_predicate) (CTableSearchComponent *component);
     int (*sort_compare) (void *clientData, const ctable_BaseRow *pointer1, const ctable_BaseRow *pointer2);
 
     void (*delete_row) (struct CTable *ctable, ctable_BaseRow *row, int indexCtl);
@@ -507,6 +571,25 @@ struct ctable_CreatorTable {
     CT_LIST_HEAD(instances, CTable) instances;
 };
 
+//
+// ctable_IndexAdvisor - what "index advise" has seen of the searches that
+// had to compare every row, kept for each field and comparison type
+//
+typedef struct ctable_AdvisorCounts {
+    long				 scans;
+    long				 examined;
+    long				 matched;
+} ctable_AdvisorCounts;
+
+typedef struct ctable_IndexAdvisor {
+    Tcl_Interp				*interp;
+    long				 minScans;
+    double				 maxFraction;
+    int					 create;
+    int					 createPending;
+    ctable_AdvisorCounts		*counts;
+} ctable_IndexAdvisor;
+
 struct CTable {
     ctable_CreatorTable                 *creator;
     ctable_HashTable                    *keyTablePtr;
@@ -517,6 +600,9 @@ struct CTable {
     int                                  autoRowNumber;
     int                                  destroying;
     CTableSearch			*searches;
+    CTableSearch		       **wheres;
+    struct ctable_BitmapIndex	       **bitmaps;
+    struct ctable_RowNumbers		*rowNumbers;
     char				*nullKeyValue;
 #ifdef WITH_SHARED_TABLES
     int					 was_locked;
@@ -536,6 +622,8 @@ struct CTable {
     int					 performanceCallbackEnable:1;
     char				*performanceCallback;
     double				 performanceCallbackThreshold;
+    ctable_IndexAdvisor			*advisor;
+    long				*indexSearches;	// searches that used each index
 
     Tcl_Command                          commandInfo;
     long                                 count;
@@ -550,6 +638,12 @@ struct CTable {
 };
 
 CTABLE_INTERNAL int ctable_CreateIndex (Tcl_Interp *interp, CTable *ctable, int fieldNum, int depth);
+CTABLE_INTERNAL int *ctable_SuspendIndexes (CTable *ctable);
+CTABLE_INTERNAL int ctable_ResumeIndexes (Tcl_Interp *interp, CTable *ctable, int *depths);
+CTABLE_INTERNAL int ctable_IndexAdvise (Tcl_Interp *interp, CTable *ctable, int objc, Tcl_Obj *CONST objv[]);
+CTABLE_INTERNAL void ctable_FreeIndexAdvisor (CTable *ctable);
+CTABLE_INTERNAL int ctable_IndexEstimate (Tcl_Interp *interp, CTable *ctable, int objc, Tcl_Obj *CONST objv[]);
+CTABLE_INTERNAL long ctable_IndexSearches (CTable *ctable, int field);
 
 // Helpers
 #define is_hidden_obj(obj) (Tcl_GetString(obj)[0] == '_')
@@ -59,42 +59,6 @@ ctable_ListRemove (ctable_BaseRow *row, int i)
     row->_ll_nodes[i].prev = NULL;
 }
 
-//
-// ctable_ListRemoveMightBeTheLastOne - remove a row from a list
-//
-CTABLE_INTERNAL INLINE int
-ctable_ListRemoveMightBeTheLastOne (ctable_BaseRow *row, int i)
-{
-    int mightBeTheLastOne;
-
-#ifdef LISTDEBUG
-    fprintf(stderr, "ctable_ListRemoveMightBeTheLastOne(0x%lx, %d)\n", (long)row, i);
-#endif
-#ifdef SANITY_CHECKS
-    if(!row->_ll_nodes[i].prev) {
-	Tcl_Panic("Removing row not in list (0x%lx, %d)!", (long)row, i);
-    }
-#endif
-    // if there's an object following me, make his prev be my prev
-    if (row->_ll_nodes[i].next != NULL) {
-        // set the next guy's prev ptr to be my prev ptr
-        row->_ll_nodes[i].next->_ll_nodes[i].prev = row->_ll_nodes[i].prev;
-	mightBeTheLastOne = 0;
-    } else {
-	// else note that there was nothing following me
-        mightBeTheLastOne = 1;
-    }
-
-    // make my prev's next (or header) point to my next
-    *row->_ll_nodes[i].prev = row->_ll_nodes[i].next;
-
-    // i'm removed
-    row->_ll_nodes[i].prev = NULL;
-
-    return mightBeTheLastOne;
-}
-
-
 CTABLE_INTERNAL INLINE void
 ctable_ListInsertHead (ctable_BaseRow **listPtr, ctable_BaseRow *row, int i)
 {
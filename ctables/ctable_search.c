@@ -17,11 +17,18 @@
 
 #include "ctable_batch.c"
 
+#include "ctable_btree.c"
+
+#include "ctable_hashindex.c"
+
+#include "ctable_bitmapindex.c"
+
 #include "jsw_slib.c"
 
 #include "speedtableHash.c"
 
 #include <time.h>
+#include <math.h>
 
 // forward references
 CTABLE_INTERNAL struct cursor *
@@ -32,6 +39,8 @@ CTABLE_INTERNAL int
 ctable_CreateCursorCommand(Tcl_Interp *interp, struct cursor *cursor);
 CTABLE_INTERNAL Tcl_Obj *
 ctable_CursorToName(struct cursor *cursor);
+static void
+ctable_TeardownSearch (CTableSearch *search);
 
 //#define INDEXDEBUG
 // #define MEGADEBUG
@@ -317,6 +326,101 @@ CTABLE_INTERNAL void ctable_FreeInRows(CTable *ctable, CTableSearchComponent *co
     }
 }
 
+//
+// ctable_CreateWithinRows - make the first and last addresses of a "within"
+// term's address/length prefix into row1 and row2. Addresses are ordered
+// byte by byte from the network end, so the addresses in a prefix are the
+// range between them and an index walks them like any other range.
+//
+static int
+ctable_CreateWithinRows (Tcl_Interp *interp, CTable *ctable, CTableSearchComponent *component, Tcl_Obj *prefixObj) {
+    int             isMac = (ctable->creator->fieldTypes[component->fieldID] == CTABLE_TYPE_MAC);
+    int             nBytes = isMac ? 6 : 4;
+    int             bits = nBytes * 8;
+    char           *prefix = Tcl_GetString (prefixObj);
+    char           *slash = strchr (prefix, '/');
+    char            address[32];
+    unsigned char   ends[2][6];
+    int             i;
+
+    if (slash != NULL) {
+	char *end;
+
+	bits = (int)strtol (slash + 1, &end, 10);
+	if (end == slash + 1 || *end != '\0' || bits < 0 || bits > nBytes * 8 || slash - prefix >= (int)sizeof address) {
+	    goto bad;
+	}
+	memcpy (address, prefix, slash - prefix);
+	address[slash - prefix] = '\0';
+    } else {
+	if (strlen (prefix) >= sizeof address) {
+	    goto bad;
+	}
+	strcpy (address, prefix);
+    }
+
+    if (isMac) {
+	struct ether_addr *mac = ether_aton (address);
+
+	if (mac == NULL) {
+	    goto bad;
+	}
+	memcpy (ends[0], mac, nBytes);
+    } else {
+	struct in_addr inet;
+
+	if (!inet_aton (address, &inet)) {
+	    goto bad;
+	}
+	memcpy (ends[0], &inet, nBytes);
+    }
+
+    // the first address has the bits past the prefix clear, the last
+    // has them set
+    for (i = 0; i < nBytes; i++) {
+	int           keep = bits - i * 8;
+	unsigned char mask = keep >= 8 ? 0xff : keep <= 0 ? 0 : (unsigned char)(0xff << (8 - keep));
+
+	ends[0][i] &= mask;
+	ends[1][i] = ends[0][i] | (unsigned char)~mask;
+    }
+
+    for (i = 0; i < 2; i++) {
+	ctable_BaseRow *row = (*ctable->creator->make_empty_row) (ctable);
+	Tcl_Obj        *endObj;
+	int             result;
+
+	if (isMac) {
+	    endObj = Tcl_NewStringObj (ether_ntoa ((struct ether_addr *)ends[i]), -1);
+	} else {
+	    struct in_addr inet;
+
+	    memcpy (&inet, ends[i], nBytes);
+	    endObj = Tcl_NewStringObj (inet_ntoa (inet), -1);
+	}
+
+	Tcl_IncrRefCount (endObj);
+	result = (*ctable->creator->set) (interp, ctable, endObj, row, component->fieldID, CTABLE_INDEX_PRIVATE);
+	Tcl_DecrRefCount (endObj);
+
+	if (i == 0) {
+	    component->row1 = row;
+	} else {
+	    component->row2 = row;
+	}
+
+	if (result == TCL_ERROR) {
+	    return TCL_ERROR;
+	}
+    }
+
+    return TCL_OK;
+
+  bad:
+    Tcl_AppendResult (interp, "expected ", isMac ? "MAC" : "IP", " address prefix like ", isMac ? "00:40:96:00:00:00/24" : "10.0.0.0/8", " but got \"", prefix, "\"", (char *) NULL);
+    return TCL_ERROR;
+}
+
 static int
 ctable_ParseSearch (Tcl_Interp *interp, CTable *ctable, Tcl_Obj *componentListObj, CONST char **fieldNames, CTableSearch *search) {
     Tcl_Obj    **componentList;
@@ -384,6 +488,7 @@ ctable_ParseSearch (Tcl_Interp *interp, CTable *ctable, Tcl_Obj *componentListOb
 	component->inListRows = NULL;
 	component->inCount = 0;
 	component->compareFunction = ctable->creator->fields[field]->compareFunction;
+	component->predicate = -1;
 
 	if (term == CTABLE_COMP_FALSE || term == CTABLE_COMP_TRUE || term == CTABLE_COMP_NULL || term == CTABLE_COMP_NOTNULL) {
 	    if (termListCount != 2) {
@@ -402,6 +507,25 @@ ctable_ParseSearch (Tcl_Interp *interp, CTable *ctable, Tcl_Obj *componentListOb
 		    goto err;
 		}
 
+	    } else if (term == CTABLE_COMP_WITHIN) {
+		int ftype = ctable->creator->fieldTypes[field];
+
+	        if (termListCount != 3) {
+		    Tcl_AppendResult (interp, "term \"", Tcl_GetString (termList[0]), "\" require 3 arguments (term, field, address/length)", (char *) NULL);
+		    goto err;
+		}
+
+		if (ftype != CTABLE_TYPE_INET && ftype != CTABLE_TYPE_MAC) {
+		    Tcl_AppendResult (interp, "term \"", Tcl_GetString (termList[1]), "\" must be an inet or mac type for \"", Tcl_GetString (termList[0]), "\" operation", (char *) NULL);
+		    goto err;
+		}
+
+		if (ctable_CreateWithinRows (interp, ctable, component, termList[2]) == TCL_ERROR) {
+		    goto err;
+		}
+
+		continue;
+
 	    } else if (term == CTABLE_COMP_RANGE) {
 	        ctable_BaseRow *row;
 
@@ -503,6 +627,20 @@ ctable_ParseSearch (Tcl_Interp *interp, CTable *ctable, Tcl_Obj *componentListOb
 	}
     }
 
+    // see which comparisons search_compare can make on values copied out
+    // of the rows they were set in, an "in" list needs its rows for that
+    for (componentIdx = 0; componentIdx < componentListCount; componentIdx++) {
+	component = &components[componentIdx];
+
+	if (component->comparisonType == CTABLE_COMP_IN && component->fieldID != ctable->creator->keyField) {
+	    if (ctable_CreateInRows (interp, ctable, component) == TCL_ERROR) {
+		goto err;
+	    }
+	}
+
+	component->predicate = ctable->creator->search_predicate (component);
+    }
+
     // it worked, leave the components allocated
     return TCL_OK;
 }
@@ -957,7 +1095,9 @@ ctable_PostSearchCommonActions (Tcl_Interp *interp, CTable *ctable, CTableSearch
     }
 
     if(search->sortControl.nFields) {	// sorting
-      ctable_qsort_r (search->tranTable, search->matchCount, sizeof (ctable_HashEntry *), &search->sortControl, (cmp_t*) creator->sort_compare);
+      // if only the top rows were kept there's just offsetLimit of them
+      int sortCount = search->topRows ? search->offsetLimit : search->matchCount;
+      ctable_qsort_r (search->tranTable, sortCount, sizeof (ctable_HashEntry *), &search->sortControl, (cmp_t*) creator->sort_compare);
     }
 
     if (search->tranType == CTABLE_SEARCH_TRAN_CURSOR) {
@@ -1009,54 +1149,76 @@ normal_return:
 }
 
 //
-// ctable_SearchCompareRow - perform comparisons on a row
+// A sort with a limit only keeps the rows it will return when they're
+// fewer than this fraction of the table, otherwise it keeps every match
+// and sorts them all
 //
-INLINE static int
-ctable_SearchCompareRow (Tcl_Interp *interp, CTable *ctable, CTableSearch *search, ctable_BaseRow *row)
-{
-    int   compareResult;
-    int   actionResult;
+#define CTABLE_TOP_ROWS_FRACTION 4
 
-    // Handle polling
-    if(search->pollInterval && --search->nextPoll <= 0) {
-	if(ctable_search_poll(interp, ctable, search) == TCL_ERROR)
-	    return TCL_ERROR;
-	search->nextPoll = search->pollInterval;
-    }
+//
+// ctable_KeepTopRow - keep a row matched by a sort that only wants its first
+// topRows rows. tranTable is a heap with the kept row that sorts last on
+// top, so a row that sorts after it is turned away with one comparison, and
+// one that sorts before it takes its place. Rows that sort the same as the
+// last row kept lose to it, so the first ones found are kept.
+//
+static void
+ctable_KeepTopRow (CTable *ctable, CTableSearch *search, ctable_BaseRow *row)
+{
+    int (*compare) (void *, const ctable_BaseRow *, const ctable_BaseRow *) = ctable->creator->sort_compare;
+    void *sortControl = &search->sortControl;
+    ctable_BaseRow **heap = search->tranTable;
+    int n = search->matchCount;
+    int i;
 
-    // if we have a match pattern (for the key) and it doesn't match,
-    // skip this row
+    // sort_compare is handed pointers to the row pointers, like qsort
+#define TOP_ROW_COMPARE(a, b) compare (sortControl, (const ctable_BaseRow *)&(a), (const ctable_BaseRow *)&(b))
 
-    if (search->pattern != (char *) NULL) {
-	if (!Tcl_StringCaseMatch (row->hashEntry.key, search->pattern, 1)) {
-	    return TCL_CONTINUE;
+    if (n < search->topRows) {
+	// still filling the heap, move the row up past the rows it sorts after
+	for (i = n; i > 0; i = (i - 1) / 2) {
+	    int parent = (i - 1) / 2;
+	    if (TOP_ROW_COMPARE (row, heap[parent]) <= 0) {
+		break;
+	    }
+	    heap[i] = heap[parent];
 	}
+	heap[i] = row;
+	return;
     }
 
-    // check filters
-    if (search->nFilters) {
-	int i;
-	int filterResult = TCL_OK;
-
-	for(i = 0; i < search->nFilters; i++) {
-	    filterFunction_t f = search->filters[i].filterFunction;
-	    filterResult = (*f) (interp, ctable, row, search->filters[i].filterObject, search->sequence);
-	    if(filterResult != TCL_OK)
-		return filterResult;
-	}
+    if (TOP_ROW_COMPARE (row, heap[0]) >= 0) {
+	return;
     }
 
-    //
-    // run the supplied compare routine
-    //
-    compareResult = (*ctable->creator->search_compare) (interp, search, row);
-    if (compareResult == TCL_CONTINUE) {
-	return TCL_CONTINUE;
+    // replace the top and move the row down past the rows that sort after it
+    n = search->topRows;
+    i = 0;
+    for (;;) {
+	int child = 2 * i + 1;
+	if (child >= n) {
+	    break;
+	}
+	if (child + 1 < n && TOP_ROW_COMPARE (heap[child + 1], heap[child]) > 0) {
+	    child++;
+	}
+	if (TOP_ROW_COMPARE (heap[child], row) <= 0) {
+	    break;
+	}
+	heap[i] = heap[child];
+	i = child;
     }
+    heap[i] = row;
+#undef TOP_ROW_COMPARE
+}
 
-    if (compareResult == TCL_ERROR) {
-	return TCL_ERROR;
-    }
+//
+// ctable_SearchMatchRow - do what the search does with a row that matched
+//
+INLINE static int
+ctable_SearchMatchRow (Tcl_Interp *interp, CTable *ctable, CTableSearch *search, ctable_BaseRow *row)
+{
+    int   actionResult;
 
     // It's a Match 
     // Are we sorting? Plop the match in the sort table and return
@@ -1065,6 +1227,11 @@ ctable_SearchCompareRow (Tcl_Interp *interp, CTable *ctable, CTableSearch *searc
 
     if (search->tranTable == NULL) {
 	++search->matchCount;
+    } else if (search->topRows) {
+	// Sorting for a limit, keep the row if it's one of the first
+	ctable_KeepTopRow (ctable, search, row);
+	++search->matchCount;
+	return TCL_CONTINUE;
     } else {
 	/* We are buffering the results (eg, for a sort or a transaction)
 	 * so just return, we'll do the heavy lifting later. */
@@ -1119,162 +1286,2106 @@ ctable_SearchCompareRow (Tcl_Interp *interp, CTable *ctable, CTableSearch *searc
     return TCL_ERROR;
 }
 
-enum skipStart_e {
-    SKIP_START_NONE, SKIP_START_GE_ROW1, SKIP_START_GT_ROW1, SKIP_START_EQ_ROW1, SKIP_START_RESET
-};
-enum skipEnd_e {
-    SKIP_END_NONE, SKIP_END_NE_ROW1, SKIP_END_GE_ROW1, SKIP_END_GT_ROW1, SKIP_END_GE_ROW2
-};
-enum skipNext_e {
-    SKIP_NEXT_NONE, SKIP_NEXT_ROW, SKIP_NEXT_MATCH, SKIP_NEXT_IN_LIST
-};
-
-// skiplist scanning rules table.
-//   scan starts at skipStart, goes to skipEnd, and uses skipNext to traverse.
-//   score is based on an estimate of how much a scan on this field is likely
-//   to limit the search.
-// rationale:
-//   <, <=, or >= are 2 points for being constrained at one end
-//   > is only 1 point because we need to loop over "=" at start
-//   range is 4 points for being constrained at both ends
-//   = is 6 points for being a "minimum range"
-//   in is 100 points (and win) because it HAS to be done over a list
-// plus one point for being the sort field, because that saves creating and
-//   sorting the transaction table.
 //
-static struct {
-    enum skipStart_e	skipStart;
-    enum skipEnd_e	skipEnd;
-    enum skipNext_e	skipNext;
-    int			score;
-} skipTypes[] = {
-  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE, -2 }, // FALSE
-  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE, -2 }, // TRUE
-  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE, -2 }, // NULL
-  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE, -2 }, // NOTNULL
-  {SKIP_START_RESET,	SKIP_END_GE_ROW1, SKIP_NEXT_ROW,   2 }, // LT
-  {SKIP_START_RESET,	SKIP_END_GT_ROW1, SKIP_NEXT_ROW,   2 }, // LE
-  {SKIP_START_EQ_ROW1,	SKIP_END_GT_ROW1, SKIP_NEXT_ROW,   6 }, // EQ
-  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE, -2 }, // NE
-  {SKIP_START_GE_ROW1,	SKIP_END_NONE,	  SKIP_NEXT_ROW,   2 }, // GE
-  {SKIP_START_GT_ROW1,	SKIP_END_NONE,	  SKIP_NEXT_ROW,   1 }, // GT
-  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE, -2 }, // MATCH
-  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE, -2 }, // NOTMATCH
-  {SKIP_START_GE_ROW1,	SKIP_END_GE_ROW2, SKIP_NEXT_MATCH, 3 }, // MATCH_CASE
-  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE, -2 }, // NOTMATCH_CASE
-  {SKIP_START_GE_ROW1,	SKIP_END_GE_ROW2, SKIP_NEXT_ROW,   4 }, // RANGE
-  {SKIP_START_RESET,	SKIP_END_NONE, SKIP_NEXT_IN_LIST,  6 }  // IN
-};
+// ctable_SearchCompareRow - perform comparisons on a row
+//
+INLINE static int
+ctable_SearchCompareRow (Tcl_Interp *interp, CTable *ctable, CTableSearch *search, ctable_BaseRow *row)
+{
+    int   compareResult;
 
-#define SORT_SCORE 1 // being able to sort is worth 1 point
-     // TODO: see if this should be higher
-     //       if you change this, change the "not implemented"
-     //       value in the table above to -1 - SORT_SCORE
+    // Handle polling
+    if(search->pollInterval && --search->nextPoll <= 0) {
+	if(ctable_search_poll(interp, ctable, search) == TCL_ERROR)
+	    return TCL_ERROR;
+	search->nextPoll = search->pollInterval;
+    }
 
-enum walkType_e { WALK_DEFAULT, WALK_SKIP, WALK_HASH_EQ, WALK_HASH_IN };
+    // if we have a match pattern (for the key) and it doesn't match,
+    // skip this row
 
-static enum walkType_e hashTypes[] = {
-  WALK_DEFAULT, WALK_DEFAULT, WALK_DEFAULT, WALK_DEFAULT, // FALSE..NOTNULL
-  WALK_DEFAULT, WALK_DEFAULT, WALK_HASH_EQ, WALK_DEFAULT, // LT..NE
-  WALK_DEFAULT, WALK_DEFAULT, WALK_DEFAULT, WALK_DEFAULT, // GT..NOTMATCH
-  WALK_DEFAULT, WALK_DEFAULT, WALK_DEFAULT, WALK_HASH_IN  // MATCH_CASE..IN
-};
+    if (search->pattern != (char *) NULL) {
+	if (!Tcl_StringCaseMatch (row->hashEntry.key, search->pattern, 1)) {
+	    return TCL_CONTINUE;
+	}
+    }
 
-#ifdef WITH_SHARED_TABLES
-struct restart_t {
-    ctable_BaseRow	  *row1;
-    ctable_BaseRow	  *row2;
-    enum skipStart_e	   skipStart;
-    enum skipEnd_e	   skipEnd;
-    fieldCompareFunction_t compareFunction;
-};
+    // check filters
+    if (search->nFilters) {
+	int i;
+	int filterResult = TCL_OK;
 
-CTABLE_INTERNAL int ctable_SearchRestartNeeded(ctable_BaseRow *row, struct restart_t *restart)
-{
-    // check to see if we're still following the right skiplist, by seeing
-    // if the value we're following still satisfies the criteria
-    switch(restart->skipEnd) {
-	case SKIP_END_GE_ROW1: {
-	    if (restart->compareFunction (row, restart->row1) >= 0)
-		return 1;
-	    break;
-	}
-	case SKIP_END_GT_ROW1: {
-	    if (restart->compareFunction (row, restart->row1) > 0)
-		return 1;
-	    break;
-	}
-	case SKIP_END_GE_ROW2: {
-	    if (restart->compareFunction (row, restart->row2) >= 0)
-		return 1;
-	    break;
-	}
-	default: {
-	    break;
+	for(i = 0; i < search->nFilters; i++) {
+	    filterFunction_t f = search->filters[i].filterFunction;
+	    filterResult = (*f) (interp, ctable, row, search->filters[i].filterObject, search->sequence);
+	    if(filterResult != TCL_OK)
+		return filterResult;
 	}
     }
-    switch(restart->skipStart) {
-        case SKIP_START_GE_ROW1: {
-	    if (restart->compareFunction (row, restart->row1) < 0)
-		return 1;
-	    break;
-	}
-	case SKIP_START_GT_ROW1: {
-	    if (restart->compareFunction (row, restart->row1) <= 0)
-		return 1;
-	    break;
-	}
-	case SKIP_START_EQ_ROW1: {
-	    if (restart->compareFunction (row, restart->row1) != 0)
-		return 1;
-	    break;
+
+    //
+    // run the supplied compare routine, unless the index walk has already
+    // decided every comparison
+    //
+    if (!search->indexOnly) {
+	compareResult = (*ctable->creator->search_compare) (interp, search, row);
+	if (compareResult == TCL_CONTINUE) {
+	    return TCL_CONTINUE;
 	}
-        case SKIP_START_NONE:
-	case SKIP_START_RESET: {
-	    break;
+
+	if (compareResult == TCL_ERROR) {
+	    return TCL_ERROR;
 	}
     }
-    // Got through here... no restart needed
-    return 0;
+
+    return ctable_SearchMatchRow (interp, ctable, search, row);
 }
-#endif
 
+#ifdef TCL_THREADS
 //
-// ctable_PrepareTransactions - set up buffering for transactions if needed
+// Parallel scans. A search that has to look at every row, with comparisons
+// that don't need the interpreter, can have the comparing done by several
+// threads. The main thread walks the row list handing out runs of rows
+// that follow each other in it, then compares runs itself until they're
+// all done. Each thread keeps the matches of the runs it compared in a
+// buffer of its own that grows as it needs to. The runs' matches are then
+// gone through in the order of the runs, so the search gets the same rows
+// in the same order as it would from one thread, and does whatever it does
+// with them in the main thread.
 //
-CTABLE_INTERNAL void ctable_PrepareTransactions(CTable *ctable, CTableSearch *search)
+// Tables with fewer than CTABLE_PARALLEL_MIN_ROWS rows are always compared
+// by the main thread alone, starting threads would cost more than it saves.
+//
+#define CTABLE_PARALLEL_RUN_ROWS	4096	// rows in a run
+#define CTABLE_PARALLEL_MIN_ROWS	65536	// rows it takes to be worth a thread
+#define CTABLE_PARALLEL_MAX_THREADS	16
+
+typedef struct ctable_ParallelRuns ctable_ParallelRuns;
+
+typedef struct ctable_ParallelWorker {
+    ctable_ParallelRuns	 *scan;
+    ctable_BaseRow	**matches;	// matches of the runs it compared
+    int			  nMatches;
+    int			  matchesSize;	// rows matches has room for
+} ctable_ParallelWorker;
+
+struct ctable_ParallelRuns {
+    Tcl_Interp		 *interp;
+    CTable		 *ctable;
+    CTableSearch	 *search;
+
+    Tcl_Mutex		  mutex;
+    Tcl_Condition	  runReady;
+    ctable_BaseRow	**runStarts;	// first row of each run
+    int			  nRuns;	// runs handed out so far
+    int			  nextRun;	// first run nobody has taken
+    int			  allRuns;	// set once every run is handed out
+
+    // run n's matches are runMatches[n] rows from runFirst[n] in the
+    // matches of worker runWorker[n], the main thread being worker 0
+    ctable_ParallelWorker *workers;
+    int			 *runWorker;
+    int			 *runFirst;
+    int			 *runMatches;
+};
+
+//
+// ctable_ParallelScanThreads - how many threads to compare the rows with,
+// 1 if the search has to be done by the main thread alone
+//
+static int
+ctable_ParallelScanThreads (CTable *ctable, CTableSearch *search)
 {
-    // buffer results if:
-    //   We've got search actions, AND...
-    //     We're searching, or...
-    //     We're a reader table, or...
-    //     We explicitly requested bufering.
-    if (search->action == CTABLE_SEARCH_ACTION_NONE) {
-	search->bufferResults = CTABLE_BUFFER_NONE;
-    } else if(search->action == CTABLE_SEARCH_ACTION_CURSOR) {
-	search->bufferResults = CTABLE_BUFFER_DEFER;
-    } else if(search->sortControl.nFields > 0) {
-	search->bufferResults = CTABLE_BUFFER_DEFER;
-#ifdef WITH_SHARED_TABLES
-    } else if(ctable->share_type == CTABLE_SHARED_READER) {
-	search->bufferResults = CTABLE_BUFFER_DEFER;
-#endif
-    } else if(search->bufferResults < 0) {
-    	search->bufferResults = CTABLE_BUFFER_NONE;
+    int nThreads = search->threads;
+    int nRuns = (ctable->count + CTABLE_PARALLEL_RUN_ROWS - 1) / CTABLE_PARALLEL_RUN_ROWS;
+    int i;
+
+    // filters and polling run Tcl code for every row
+    if (search->nFilters || search->pollInterval) {
+	return 1;
     }
 
-    // If we're not buffering for any other reason, buffer for a transaction
-    // but set bufferResults to PROVISIONAL so we can still terminate the
+    if (ctable->count < CTABLE_PARALLEL_MIN_ROWS) {
+	return 1;
+    }
+
+#ifdef WITH_SHARED_TABLES
+    // a reader's rows can change under it, it has to check as it goes
+    if (ctable->share_type == CTABLE_SHARED_READER) {
+	return 1;
+    }
+#endif
+
+    // -code could change rows that haven't been compared yet, unless the
+    // search compares them all before running it anyway
+    if (search->codeBody != NULL && search->bufferResults != CTABLE_BUFFER_DEFER) {
+	return 1;
+    }
+
+    // with a limit and no sort, one thread stops as soon as it has enough
+    if (search->limit != 0 && search->sortControl.nFields == 0) {
+	return 1;
+    }
+
+    // getting the string of a Tcl object can change the object
+    for (i = 0; i < search->nComponents; i++) {
+	if (ctable->creator->fields[search->components[i].fieldID]->type == CTABLE_TYPE_TCLOBJ) {
+	    return 1;
+	}
+    }
+
+    if (nThreads == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+	nThreads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+	if (nThreads > CTABLE_PARALLEL_MAX_THREADS) {
+	    nThreads = CTABLE_PARALLEL_MAX_THREADS;
+	}
+	if (nThreads > ctable->count / CTABLE_PARALLEL_MIN_ROWS) {
+	    nThreads = ctable->count / CTABLE_PARALLEL_MIN_ROWS;
+	}
+    }
+
+    if (nThreads > nRuns) {
+	nThreads = nRuns;
+    }
+
+    return nThreads < 1 ? 1 : nThreads;
+}
+
+//
+// ctable_ParallelScanRun - compare the rows of a run, keeping the matches
+//
+static void
+ctable_ParallelScanRun (ctable_ParallelWorker *worker, int run)
+{
+    ctable_ParallelRuns *scan = worker->scan;
+    CTableSearch        *search = scan->search;
+    ctable_BaseRow      *row = scan->runStarts[run];
+    int                  first = worker->nMatches;
+    int                  n;
+
+    for (n = 0; n < CTABLE_PARALLEL_RUN_ROWS && row != NULL; n++, row = row->_ll_nodes[0].next) {
+	if (search->pattern != (char *) NULL && !Tcl_StringCaseMatch (row->hashEntry.key, search->pattern, 1)) {
+	    continue;
+	}
+
+	if ((*scan->ctable->creator->search_compare) (scan->interp, search, row) != TCL_OK) {
+	    continue;
+	}
+
+	if (worker->matches == NULL) {
+	    worker->matchesSize = CTABLE_PARALLEL_RUN_ROWS;
+	    worker->matches = (ctable_BaseRow **)ckalloc (sizeof (ctable_BaseRow *) * worker->matchesSize);
+	} else if (worker->nMatches == worker->matchesSize) {
+	    worker->matchesSize *= 2;
+	    worker->matches = (ctable_BaseRow **)ckrealloc ((char *)worker->matches, sizeof (ctable_BaseRow *) * worker->matchesSize);
+	}
+	worker->matches[worker->nMatches++] = row;
+    }
+
+    scan->runWorker[run] = (int)(worker - scan->workers);
+    scan->runFirst[run] = first;
+    scan->runMatches[run] = worker->nMatches - first;
+}
+
+//
+// ctable_ParallelScanRuns - compare runs as they're handed out until
+// they've all been taken
+//
+static void
+ctable_ParallelScanRuns (ctable_ParallelWorker *worker)
+{
+    ctable_ParallelRuns *scan = worker->scan;
+    int                  run;
+
+    for (;;) {
+	Tcl_MutexLock (&scan->mutex);
+	while (scan->nextRun >= scan->nRuns && !scan->allRuns) {
+	    Tcl_ConditionWait (&scan->runReady, &scan->mutex, NULL);
+	}
+	if (scan->nextRun >= scan->nRuns) {
+	    Tcl_MutexUnlock (&scan->mutex);
+	    return;
+	}
+	run = scan->nextRun++;
+	Tcl_MutexUnlock (&scan->mutex);
+
+	ctable_ParallelScanRun (worker, run);
+    }
+}
+
+static Tcl_ThreadCreateType
+ctable_ParallelScanThread (ClientData clientData)
+{
+    ctable_ParallelScanRuns ((ctable_ParallelWorker *)clientData);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+//
+// ctable_ParallelScan - look at every row with nThreads threads, returns
+// what the search loop would have finished with
+//
+static int
+ctable_ParallelScan (Tcl_Interp *interp, CTable *ctable, CTableSearch *search, int nThreads)
+{
+    ctable_ParallelRuns  scan;
+    Tcl_ThreadId        *threads;
+    ctable_BaseRow      *row;
+    int                  maxRuns = (ctable->count + CTABLE_PARALLEL_RUN_ROWS - 1) / CTABLE_PARALLEL_RUN_ROWS;
+    int                  nStarted = 0;
+    int                  result = TCL_OK;
+    int                  run;
+    int                  i;
+    int                  n;
+
+    // set up the "in" rows now, the threads mustn't
+    for (i = 0; i < search->nComponents; i++) {
+	CTableSearchComponent *component = &search->components[i];
+
+	if (component->comparisonType == CTABLE_COMP_IN && component->inListRows == NULL) {
+	    if (ctable_CreateInRows (interp, ctable, component) == TCL_ERROR) {
+		return TCL_ERROR;
+	    }
+	}
+    }
+
+    memset (&scan, 0, sizeof scan);
+    scan.interp = interp;
+    scan.ctable = ctable;
+    scan.search = search;
+    scan.runStarts = (ctable_BaseRow **)ckalloc (sizeof (ctable_BaseRow *) * maxRuns);
+    scan.runWorker = (int *)ckalloc (sizeof (int) * maxRuns);
+    scan.runFirst = (int *)ckalloc (sizeof (int) * maxRuns);
+    scan.runMatches = (int *)ckalloc (sizeof (int) * maxRuns);
+    scan.workers = (ctable_ParallelWorker *)ckalloc (sizeof (ctable_ParallelWorker) * nThreads);
+    memset (scan.workers, 0, sizeof (ctable_ParallelWorker) * nThreads);
+    for (i = 0; i < nThreads; i++) {
+	scan.workers[i].scan = &scan;
+    }
+
+    // if a thread can't be started, the ones that did will do its share
+    threads = (Tcl_ThreadId *)ckalloc (sizeof (Tcl_ThreadId) * nThreads);
+    for (i = 1; i < nThreads; i++) {
+	if (Tcl_CreateThread (&threads[nStarted], ctable_ParallelScanThread, (ClientData)&scan.workers[nStarted + 1], TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) == TCL_OK) {
+	    nStarted++;
+	}
+    }
+
+    n = 0;
+    CTABLE_LIST_FOREACH (ctable->ll_head, row, 0) {
+	if (n++ % CTABLE_PARALLEL_RUN_ROWS == 0) {
+	    if (scan.nRuns >= maxRuns) {
+		break;
+	    }
+	    Tcl_MutexLock (&scan.mutex);
+	    scan.runStarts[scan.nRuns++] = row;
+	    Tcl_ConditionNotify (&scan.runReady);
+	    Tcl_MutexUnlock (&scan.mutex);
+	}
+    }
+
+    Tcl_MutexLock (&scan.mutex);
+    scan.allRuns = 1;
+    Tcl_ConditionNotify (&scan.runReady);
+    Tcl_MutexUnlock (&scan.mutex);
+
+    ctable_ParallelScanRuns (&scan.workers[0]);
+
+    for (i = 0; i < nStarted; i++) {
+	int threadResult;
+	Tcl_JoinThread (threads[i], &threadResult);
+    }
+    ckfree ((char *)threads);
+    Tcl_ConditionFinalize (&scan.runReady);
+    Tcl_MutexFinalize (&scan.mutex);
+
+    for (run = 0; run < scan.nRuns && result == TCL_OK; run++) {
+	ctable_BaseRow **matches = &scan.workers[scan.runWorker[run]].matches[scan.runFirst[run]];
+
+	for (i = 0; i < scan.runMatches[run]; i++) {
+	    int matchResult = ctable_SearchMatchRow (interp, ctable, search, matches[i]);
+
+	    if ((matchResult == TCL_CONTINUE) || (matchResult == TCL_OK)) {
+		continue;
+	    }
+
+	    // break stops the search like running out of rows, return and
+	    // error are what the search finishes with
+	    result = matchResult;
+	    break;
+	}
+    }
+
+    for (i = 0; i < nThreads; i++) {
+	if (scan.workers[i].matches != NULL) {
+	    ckfree ((char *)scan.workers[i].matches);
+	}
+    }
+    ckfree ((char *)scan.workers);
+    ckfree ((char *)scan.runStarts);
+    ckfree ((char *)scan.runWorker);
+    ckfree ((char *)scan.runFirst);
+    ckfree ((char *)scan.runMatches);
+
+    return result == TCL_BREAK ? TCL_OK : result;
+}
+#endif
+
+enum skipStart_e {
+    SKIP_START_NONE, SKIP_START_GE_ROW1, SKIP_START_GT_ROW1, SKIP_START_EQ_ROW1, SKIP_START_RESET
+};
+enum skipEnd_e {
+    SKIP_END_NONE, SKIP_END_NE_ROW1, SKIP_END_GE_ROW1, SKIP_END_GT_ROW1, SKIP_END_GE_ROW2, SKIP_END_GT_ROW2
+};
+enum skipNext_e {
+    SKIP_NEXT_NONE, SKIP_NEXT_ROW, SKIP_NEXT_MATCH, SKIP_NEXT_IN_LIST
+};
+
+// skiplist scanning rules table.
+//   scan starts at skipStart, goes to skipEnd, and uses skipNext to traverse.
+//   guess is the fraction of the rows the comparison is taken to accept
+//   when there's no index on its field to count them, per value for "in".
+// rationale:
+//   = picks out one value of many, and < or > about a third of them
+//   range, within and an anchored match are about a quarter, being
+//     constrained at both ends
+//   the negations accept what their comparison doesn't
+// see ctable_EstimateRows for how an index does better.
+//
+static struct {
+    enum skipStart_e	skipStart;
+    enum skipEnd_e	skipEnd;
+    enum skipNext_e	skipNext;
+    double		guess;
+} skipTypes[] = {
+  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE,  0.5  }, // FALSE
+  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE,  0.5  }, // TRUE
+  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE,  0.1  }, // NULL
+  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE,  0.9  }, // NOTNULL
+  {SKIP_START_RESET,	SKIP_END_GE_ROW1, SKIP_NEXT_ROW,   0.33 }, // LT
+  {SKIP_START_RESET,	SKIP_END_GT_ROW1, SKIP_NEXT_ROW,   0.33 }, // LE
+  {SKIP_START_EQ_ROW1,	SKIP_END_GT_ROW1, SKIP_NEXT_ROW,   0.1  }, // EQ
+  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE,  0.9  }, // NE
+  {SKIP_START_GE_ROW1,	SKIP_END_NONE,	  SKIP_NEXT_ROW,   0.33 }, // GE
+  {SKIP_START_GT_ROW1,	SKIP_END_NONE,	  SKIP_NEXT_ROW,   0.33 }, // GT
+  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE,  0.25 }, // MATCH
+  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE,  0.75 }, // NOTMATCH
+  {SKIP_START_GE_ROW1,	SKIP_END_GE_ROW2, SKIP_NEXT_MATCH, 0.25 }, // MATCH_CASE
+  {SKIP_START_NONE,	SKIP_END_NONE,	  SKIP_NEXT_NONE,  0.75 }, // NOTMATCH_CASE
+  {SKIP_START_GE_ROW1,	SKIP_END_GE_ROW2, SKIP_NEXT_ROW,   0.25 }, // RANGE
+  {SKIP_START_RESET,	SKIP_END_NONE, SKIP_NEXT_IN_LIST,  0.1  }, // IN
+  {SKIP_START_GE_ROW1,	SKIP_END_GT_ROW2, SKIP_NEXT_ROW,   0.25 }  // WITHIN
+};
+
+enum walkType_e { WALK_DEFAULT, WALK_SKIP, WALK_HASH_EQ, WALK_HASH_IN, WALK_BITMAP, WALK_INTERSECT };
+
+static enum walkType_e hashTypes[] = {
+  WALK_DEFAULT, WALK_DEFAULT, WALK_DEFAULT, WALK_DEFAULT, // FALSE..NOTNULL
+  WALK_DEFAULT, WALK_DEFAULT, WALK_HASH_EQ, WALK_DEFAULT, // LT..NE
+  WALK_DEFAULT, WALK_DEFAULT, WALK_DEFAULT, WALK_DEFAULT, // GT..NOTMATCH
+  WALK_DEFAULT, WALK_DEFAULT, WALK_DEFAULT, WALK_HASH_IN, // MATCH_CASE..IN
+  WALK_DEFAULT                                             // WITHIN
+};
+
+#ifdef WITH_SHARED_TABLES
+struct restart_t {
+    ctable_BaseRow	  *row1;
+    ctable_BaseRow	  *row2;
+    enum skipStart_e	   skipStart;
+    enum skipEnd_e	   skipEnd;
+    fieldCompareFunction_t compareFunction;
+    fieldCompareFunction_t startCompareFunction;
+};
+
+CTABLE_INTERNAL int ctable_SearchRestartNeeded(ctable_BaseRow *row, struct restart_t *restart)
+{
+    // check to see if we're still following the right skiplist, by seeing
+    // if the value we're following still satisfies the criteria
+    switch(restart->skipEnd) {
+	case SKIP_END_GE_ROW1: {
+	    if (restart->compareFunction (row, restart->row1) >= 0)
+		return 1;
+	    break;
+	}
+	case SKIP_END_GT_ROW1: {
+	    if (restart->compareFunction (row, restart->row1) > 0)
+		return 1;
+	    break;
+	}
+	case SKIP_END_GE_ROW2: {
+	    if (restart->compareFunction (row, restart->row2) >= 0)
+		return 1;
+	    break;
+	}
+	case SKIP_END_GT_ROW2: {
+	    if (restart->compareFunction (row, restart->row2) > 0)
+		return 1;
+	    break;
+	}
+	default: {
+	    break;
+	}
+    }
+    switch(restart->skipStart) {
+        case SKIP_START_GE_ROW1: {
+	    if (restart->startCompareFunction (row, restart->row1) < 0)
+		return 1;
+	    break;
+	}
+	case SKIP_START_GT_ROW1: {
+	    if (restart->startCompareFunction (row, restart->row1) <= 0)
+		return 1;
+	    break;
+	}
+	case SKIP_START_EQ_ROW1: {
+	    if (restart->startCompareFunction (row, restart->row1) != 0)
+		return 1;
+	    break;
+	}
+        case SKIP_START_NONE:
+	case SKIP_START_RESET: {
+	    break;
+	}
+    }
+    // Got through here... no restart needed
+    return 0;
+}
+
+//
+// ctable_ReaderFindRow - look a key up from a reader table, in the master's
+// key hash table. The caller holds the read lock. A lookup that raced the
+// master rebuilding the table or moving a row around is tried again, up to
+// MAX_RESTARTS times.
+//
+CTABLE_INTERNAL int ctable_ReaderFindRow(Tcl_Interp *interp, CTable *ctable, CONST char *key, ctable_BaseRow **rowPtr)
+{
+    ctable_HashEntry *hashEntry;
+    int		      tries = 0;
+
+    while(!ctable_ReaderFindHashEntry(ctable->keyTablePtr, key, &hashEntry)) {
+	if(MAX_RESTARTS > 0 && ++tries > MAX_RESTARTS) {
+	    Tcl_AppendResult (interp, "restart count exceeded", (char *) NULL);
+	    return TCL_ERROR;
+	}
+	// give the master time to finish a rebuild
+	Tcl_Sleep(1);
+    }
+
+    if(hashEntry)
+	*rowPtr = (ctable_BaseRow *)((char *)hashEntry - offsetof(ctable_BaseRow, hashEntry));
+    else
+	*rowPtr = NULL;
+    return TCL_OK;
+}
+
+//
+// ctable_ReaderCanFindKeys - readers can only look up keys in the master's
+// hash table if it's the chained layout
+//
+CTABLE_INTERNAL int ctable_ReaderCanFindKeys(CTable *ctable)
+{
+    return ctable->keyTablePtr && ctable->keyTablePtr->keyIndexType == CTABLE_KEYINDEX_CHAINED;
+}
+#endif
+
+//
+// ctable_PrepareTransactions - set up buffering for transactions if needed
+//
+CTABLE_INTERNAL void ctable_PrepareTransactions(CTable *ctable, CTableSearch *search)
+{
+    // buffer results if:
+    //   We've got search actions, AND...
+    //     We're searching, or...
+    //     We're a reader table, or...
+    //     We explicitly requested bufering.
+    if (search->action == CTABLE_SEARCH_ACTION_NONE) {
+	search->bufferResults = CTABLE_BUFFER_NONE;
+    } else if(search->action == CTABLE_SEARCH_ACTION_CURSOR) {
+	search->bufferResults = CTABLE_BUFFER_DEFER;
+    } else if(search->sortControl.nFields > 0) {
+	search->bufferResults = CTABLE_BUFFER_DEFER;
+#ifdef WITH_SHARED_TABLES
+    } else if(ctable->share_type == CTABLE_SHARED_READER) {
+	search->bufferResults = CTABLE_BUFFER_DEFER;
+#endif
+    } else if(search->bufferResults < 0) {
+    	search->bufferResults = CTABLE_BUFFER_NONE;
+    }
+
+    // If we're not buffering for any other reason, buffer for a transaction
+    // but set bufferResults to PROVISIONAL so we can still terminate the
     // search early
     if(search->bufferResults == CTABLE_BUFFER_NONE && search->tranType != CTABLE_SEARCH_TRAN_NONE) {
 	search->bufferResults = CTABLE_BUFFER_PROVISIONAL;
     }
 
-    // if we're buffering,
-    // allocate a space for the search results that we'll then sort from
-    if (search->bufferResults != CTABLE_BUFFER_NONE) {
-	search->tranTable = (ctable_BaseRow **)ckalloc (sizeof (ctable_BaseRow *) * ctable->count);
+    // if we're sorting for only a few rows, only keep room for those
+    search->topRows = 0;
+    if (search->bufferResults == CTABLE_BUFFER_DEFER && search->sortControl.nFields > 0 && search->limit != 0 && search->offsetLimit < ctable->count / CTABLE_TOP_ROWS_FRACTION) {
+	search->topRows = search->offsetLimit;
+    }
+
+    // if we're buffering,
+    // allocate a space for the search results that we'll then sort from
+    if (search->topRows) {
+	search->tranTable = (ctable_BaseRow **)ckalloc (sizeof (ctable_BaseRow *) * search->topRows);
+    } else if (search->bufferResults != CTABLE_BUFFER_NONE) {
+	search->tranTable = (ctable_BaseRow **)ckalloc (sizeof (ctable_BaseRow *) * ctable->count);
+    }
+}
+
+//
+// ctable_GetIndexWhere - get the where of a partial index as a search, parsed
+// the first time it's needed and kept until the table is destroyed. sets
+// *wherePtr to NULL if the index has every row in it.
+//
+CTABLE_INTERNAL int
+ctable_GetIndexWhere (Tcl_Interp *interp, CTable *ctable, int field, CTableSearch **wherePtr) {
+    ctable_CreatorTable *creator = ctable->creator;
+    CTableSearch        *where;
+    Tcl_Obj             *whereObj;
+    int                  result;
+    int                  i;
+
+    *wherePtr = NULL;
+
+    if (creator->fields[field]->where == NULL) {
+        return TCL_OK;
+    }
+
+    if (ctable->wheres == NULL) {
+	ctable->wheres = (CTableSearch **)ckalloc (creator->nIndexes * sizeof (CTableSearch *));
+	for (i = 0; i < creator->nIndexes; i++) {
+	    ctable->wheres[i] = NULL;
+	}
+    }
+
+    if (ctable->wheres[field] != NULL) {
+	*wherePtr = ctable->wheres[field];
+        return TCL_OK;
+    }
+
+    where = (CTableSearch *)ckalloc (sizeof (CTableSearch));
+    memset (where, 0, sizeof (CTableSearch));
+    where->ctable = ctable;
+    where->alreadySearched = -1;
+
+    whereObj = Tcl_NewStringObj (creator->fields[field]->where, -1);
+    Tcl_IncrRefCount (whereObj);
+
+    result = ctable_ParseSearch (interp, ctable, whereObj, creator->fieldNames, where);
+
+    // the values of an "in" are only kept in whereObj until they're made
+    // into rows
+    for (i = 0; result == TCL_OK && i < where->nComponents; i++) {
+	result = ctable_CreateInRows (interp, ctable, &where->components[i]);
+	where->components[i].inListObj = NULL;
+    }
+
+    Tcl_DecrRefCount (whereObj);
+
+    if (result == TCL_ERROR) {
+	Tcl_AppendResult (interp, " while parsing where of index \"", creator->fields[field]->name, "\"", (char *) NULL);
+	ctable_TeardownSearch (where);
+	ckfree ((char *)where);
+        return TCL_ERROR;
+    }
+
+    ctable->wheres[field] = where;
+    *wherePtr = where;
+    return TCL_OK;
+}
+
+//
+// ctable_FreeIndexWheres - free the wheres of partial indexes parsed for the
+// table, when it's destroyed
+//
+CTABLE_INTERNAL void
+ctable_FreeIndexWheres (CTable *ctable) {
+    int field;
+
+    if (ctable->wheres == NULL) {
+        return;
+    }
+
+    for (field = 0; field < ctable->creator->nIndexes; field++) {
+	if (ctable->wheres[field] != NULL) {
+	    ctable_TeardownSearch (ctable->wheres[field]);
+	    ckfree ((char *)ctable->wheres[field]);
+	}
+    }
+
+    ckfree ((char *)ctable->wheres);
+    ctable->wheres = NULL;
+}
+
+//
+// ctable_IndexWhereMatches - does the row belong in the partial index,
+// TCL_OK if it does, TCL_CONTINUE if it doesn't, or TCL_ERROR
+//
+CTABLE_INTERNAL int
+ctable_IndexWhereMatches (Tcl_Interp *interp, CTable *ctable, ctable_BaseRow *row, int field) {
+    CTableSearch *where;
+
+    if (ctable_GetIndexWhere (interp, ctable, field, &where) == TCL_ERROR) {
+        return TCL_ERROR;
+    }
+
+    if (where == NULL) {
+        return TCL_OK;
+    }
+
+    return (*ctable->creator->search_compare) (interp, where, row);
+}
+
+//
+// ctable_ComponentAccepts - does the value of the component's field in the
+// row pass the component's comparison
+//
+static int
+ctable_ComponentAccepts (CTableSearchComponent *component, ctable_BaseRow *row) {
+    fieldCompareFunction_t compare = component->compareFunction;
+    int                    i;
+
+    switch (component->comparisonType) {
+	case CTABLE_COMP_EQ:
+	    return compare (row, component->row1) == 0;
+	case CTABLE_COMP_NE:
+	    return compare (row, component->row1) != 0;
+	case CTABLE_COMP_LT:
+	    return compare (row, component->row1) < 0;
+	case CTABLE_COMP_LE:
+	    return compare (row, component->row1) <= 0;
+	case CTABLE_COMP_GE:
+	    return compare (row, component->row1) >= 0;
+	case CTABLE_COMP_GT:
+	    return compare (row, component->row1) > 0;
+	case CTABLE_COMP_RANGE:
+	    return compare (row, component->row1) >= 0 && compare (row, component->row2) < 0;
+	case CTABLE_COMP_WITHIN:
+	    return compare (row, component->row1) >= 0 && compare (row, component->row2) <= 0;
+	case CTABLE_COMP_IN:
+	    for (i = 0; i < component->inCount; i++) {
+		if (compare (row, component->inListRows[i]) == 0) {
+		    return 1;
+		}
+	    }
+	    return 0;
+    }
+
+    return 0;
+}
+
+//
+// ctable_ComponentImplies - does every row that passes the search component's
+// comparison pass the where component's too. only answers yes when it's
+// sure, a no just means the index isn't used.
+//
+static int
+ctable_ComponentImplies (Tcl_Interp *interp, CTable *ctable, CTableSearchComponent *component, CTableSearchComponent *where) {
+    fieldCompareFunction_t compare = where->compareFunction;
+    ctable_BaseRow        *low = NULL;
+    ctable_BaseRow        *high = NULL;
+    int                    lowInclusive = 0;
+    int                    highInclusive = 0;
+    int                    i;
+
+    if (component->fieldID != where->fieldID) {
+        return 0;
+    }
+
+    // the same comparison, against the same value
+    if (component->comparisonType == where->comparisonType) {
+	switch (component->comparisonType) {
+	    case CTABLE_COMP_FALSE:
+	    case CTABLE_COMP_TRUE:
+	    case CTABLE_COMP_NULL:
+	    case CTABLE_COMP_NOTNULL:
+		return 1;
+	    case CTABLE_COMP_NE:
+	    case CTABLE_COMP_MATCH:
+	    case CTABLE_COMP_NOTMATCH:
+	    case CTABLE_COMP_MATCH_CASE:
+	    case CTABLE_COMP_NOTMATCH_CASE:
+		return compare (component->row1, where->row1) == 0;
+	}
+    }
+
+    switch (component->comparisonType) {
+	// one value, or a few, can each be tried
+	case CTABLE_COMP_EQ:
+	    return ctable_ComponentAccepts (where, component->row1);
+
+	case CTABLE_COMP_IN:
+	    if (ctable_CreateInRows (interp, ctable, component) == TCL_ERROR) {
+		// the search reports it when it gets to it
+		Tcl_ResetResult (interp);
+		return 0;
+	    }
+	    for (i = 0; i < component->inCount; i++) {
+		if (!ctable_ComponentAccepts (where, component->inListRows[i])) {
+		    return 0;
+		}
+	    }
+	    return 1;
+
+	// a range has to be inside the where's
+	case CTABLE_COMP_GE:
+	case CTABLE_COMP_GT:
+	    low = component->row1;
+	    lowInclusive = (component->comparisonType == CTABLE_COMP_GE);
+	    break;
+	case CTABLE_COMP_LE:
+	case CTABLE_COMP_LT:
+	    high = component->row1;
+	    highInclusive = (component->comparisonType == CTABLE_COMP_LE);
+	    break;
+	case CTABLE_COMP_RANGE:
+	    low = component->row1;
+	    lowInclusive = 1;
+	    high = component->row2;
+	    break;
+	case CTABLE_COMP_WITHIN:
+	    low = component->row1;
+	    lowInclusive = 1;
+	    high = component->row2;
+	    highInclusive = 1;
+	    break;
+	default:
+	    return 0;
+    }
+
+    switch (where->comparisonType) {
+	case CTABLE_COMP_GE:
+	    return low != NULL && compare (low, where->row1) >= 0;
+	case CTABLE_COMP_GT:
+	    return low != NULL && (i = compare (low, where->row1)) >= 0 && (i > 0 || !lowInclusive);
+	case CTABLE_COMP_LE:
+	    return high != NULL && compare (high, where->row1) <= 0;
+	case CTABLE_COMP_LT:
+	    return high != NULL && (i = compare (high, where->row1)) <= 0 && (i < 0 || !highInclusive);
+	case CTABLE_COMP_RANGE:
+	    return low != NULL && compare (low, where->row1) >= 0
+		&& high != NULL && (i = compare (high, where->row2)) <= 0 && (i < 0 || !highInclusive);
+	case CTABLE_COMP_WITHIN:
+	    return low != NULL && compare (low, where->row1) >= 0
+		&& high != NULL && compare (high, where->row2) <= 0;
+    }
+
+    return 0;
+}
+
+//
+// ctable_IndexWhereImplied - does every row that matches the search match the
+// where of a partial index, so walking the index can't miss any
+//
+static int
+ctable_IndexWhereImplied (Tcl_Interp *interp, CTable *ctable, CTableSearch *search, CTableSearch *where) {
+    int i;
+    int j;
+
+    for (i = 0; i < where->nComponents; i++) {
+	for (j = 0; j < search->nComponents; j++) {
+	    if (ctable_ComponentImplies (interp, ctable, &search->components[j], &where->components[i])) {
+		break;
+	    }
+	}
+
+	if (j == search->nComponents) {
+	    return 0;
+	}
+    }
+
+    return 1;
+}
+
+//
+// compositePlan_t - how a search can use a composite index: its leading
+// fields matched with "=", and a range on the field after them
+//
+struct compositePlan_t {
+    int			   nEqual;
+    ctable_BaseRow	  *lowRow;
+    ctable_BaseRow	  *highRow;
+    int			   lowInclusive;
+    int			   highInclusive;
+    int			   nUsed;	// search components the walk answers
+    int			   lastUsed;	// and the last one of them
+};
+
+//
+// ctable_CompositeSorts - would walking the composite index with its first
+// nEqual fields each held to one value give rows in the search's sort order
+//
+static int
+ctable_CompositeSorts (CTableSearch *search, ctable_FieldInfo *f, int nEqual) {
+    int next = nEqual;
+    int i;
+    int j;
+
+    if (search->sortControl.nFields == 0) {
+        return 0;
+    }
+
+    for (i = 0; i < search->sortControl.nFields; i++) {
+	int field = search->sortControl.fields[i];
+
+	if (search->sortControl.directions[i] < 0) {
+	    return 0;
+	}
+
+	// the fields held to one value can come anywhere in the sort
+	for (j = 0; j < nEqual; j++) {
+	    if (f->compositeFields[j] == field) {
+		break;
+	    }
+	}
+	if (j < nEqual) {
+	    continue;
+	}
+
+	if (next >= f->nCompositeFields || f->compositeFields[next] != field) {
+	    return 0;
+	}
+	next++;
+    }
+
+    return 1;
+}
+
+//
+// ctable_EstimateRows - estimate how many rows a comparison accepts, from
+// the index on its field if there is one. A skip list counts the rows in
+// a range exactly, a B+tree guesses from where its ends fall in the tree,
+// and any index knows how many distinct values it has for "=" and "in".
+// Without an index there's only the guess in the skipTypes table.
+//
+static double
+ctable_EstimateRows (CTable *ctable, CTableSearchComponent *component) {
+    jsw_skip_t            *skip = ctable->skipLists[component->fieldID];
+    fieldCompareFunction_t compare = ctable->creator->fields[component->fieldID]->compareFunction;
+    int                    type = component->comparisonType;
+    double                 guess = skipTypes[type].guess;
+    double                 size;
+    double                 perValue;
+    size_t                 low;
+    size_t                 high;
+
+    if (type == CTABLE_COMP_IN) {
+	guess *= component->inCount;
+    }
+
+    if (skip == NULL) {
+	return ctable->count * (guess < 1.0 ? guess : 1.0);
+    }
+
+    size = (double)jsw_ssize (skip);
+    perValue = jsw_sdistinct (skip) ? size / jsw_sdistinct (skip) : 0.0;
+
+    if (type == CTABLE_COMP_IN) {
+	return perValue * component->inCount < size ? perValue * component->inCount : size;
+    }
+
+    if (type == CTABLE_COMP_EQ && !jsw_scounted (skip)) {
+	return perValue;
+    }
+
+    if (!jsw_sordered (skip)) {
+	return size * guess;
+    }
+
+    switch (type) {
+	case CTABLE_COMP_LT: {
+	    low = 0;
+	    high = jsw_sestimate (skip, component->row1, 0, compare);
+	    break;
+	}
+	case CTABLE_COMP_LE: {
+	    low = 0;
+	    high = jsw_sestimate (skip, component->row1, 1, compare);
+	    break;
+	}
+	case CTABLE_COMP_EQ: {
+	    low = jsw_sestimate (skip, component->row1, 0, compare);
+	    high = jsw_sestimate (skip, component->row1, 1, compare);
+	    break;
+	}
+	case CTABLE_COMP_GE: {
+	    low = jsw_sestimate (skip, component->row1, 0, compare);
+	    high = jsw_ssize (skip);
+	    break;
+	}
+	case CTABLE_COMP_GT: {
+	    low = jsw_sestimate (skip, component->row1, 1, compare);
+	    high = jsw_ssize (skip);
+	    break;
+	}
+	case CTABLE_COMP_RANGE: {
+	    low = jsw_sestimate (skip, component->row1, 0, compare);
+	    high = jsw_sestimate (skip, component->row2, 0, compare);
+	    break;
+	}
+	case CTABLE_COMP_WITHIN: {
+	    low = jsw_sestimate (skip, component->row1, 0, compare);
+	    high = jsw_sestimate (skip, component->row2, 1, compare);
+	    break;
+	}
+	case CTABLE_COMP_MATCH_CASE: {
+	    // an anchored match is the range of its prefix
+	    if (component->row2 == NULL) {
+		return size * guess;
+	    }
+	    low = jsw_sestimate (skip, (ctable_BaseRow *)component->row2, 0, compare);
+	    high = jsw_sestimate (skip, component->row3, 0, compare);
+	    break;
+	}
+	default: {
+	    return size * guess;
+	}
+    }
+
+    return high > low ? (double)(high - low) : 0.0;
+}
+
+//
+// what the planner counts as the cost of a search, relative to looking at
+// a row by following the table's list of them. Walking an index goes to
+// the rows in the index's order, wherever they are in memory, which is
+// more like twice that and up to four times as much when the index's
+// order has nothing to do with the order the rows were made in. Then each
+// comparison a row gets costs a bit more, and one of a string that isn't
+// kept in the row has to fetch it as well, which costs as much as a row
+// when the rows are gone to in an index's order and less when they're
+// followed in the order they were made. A sort costs about log2 of the
+// rows sorted comparisons of the sort fields for each one.
+//
+#define CTABLE_COST_SCAN_ROW	1.0
+#define CTABLE_COST_INDEX_ROW	2.0
+#define CTABLE_COST_COMPARE	0.1
+#define CTABLE_COST_FETCH	0.5
+#define CTABLE_COST_SORT	0.25
+
+//
+// ctable_CompareCost - what checking the comparison on a row costs. An
+// "in" compares the row's value with each of its values in turn.
+//
+static double
+ctable_CompareCost (CTable *ctable, CTableSearchComponent *component) {
+    double cost = CTABLE_COST_COMPARE;
+
+    switch (ctable->creator->fields[component->fieldID]->type) {
+	case CTABLE_TYPE_VARSTRING:
+	case CTABLE_TYPE_TCLOBJ: {
+	    cost += CTABLE_COST_FETCH;
+	    break;
+	}
+	default: {
+	    break;
+	}
+    }
+
+    if (component->comparisonType == CTABLE_COMP_IN && component->inCount > 1) {
+	cost += CTABLE_COST_COMPARE * (component->inCount - 1);
+    }
+
+    return cost;
+}
+
+//
+// ctable_CompareRank - what a comparison costs for each row it turns away
+//
+static double
+ctable_CompareRank (CTable *ctable, CTableSearchComponent *component) {
+    double rejected = 1.0 - component->estimate / ctable->count;
+
+    return ctable_CompareCost (ctable, component) / (rejected > 0.001 ? rejected : 0.001);
+}
+
+//
+// ctable_OrderComparisons - put the comparisons in the order the rows the
+// search looks at should be checked against them, so the fewest rows get
+// the costly ones. Each comparison a row passes costs what it costs and
+// leaves it to be checked against the next, so the comparisons go in
+// order of how much they cost for each row they turn away. Which one is
+// first doesn't matter to which rows match, only to how quickly.
+//
+static void
+ctable_OrderComparisons (CTable *ctable, CTableSearch *search) {
+    CTableSearchComponent component;
+    double                rank;
+    int                   i;
+    int                   j;
+
+    if (ctable->count == 0) {
+	return;
+    }
+
+    for (i = 1; i < search->nComponents; i++) {
+	component = search->components[i];
+	rank = ctable_CompareRank (ctable, &component);
+
+	for (j = i; j > 0 && ctable_CompareRank (ctable, &search->components[j - 1]) > rank; j--) {
+	    search->components[j] = search->components[j - 1];
+	}
+	search->components[j] = component;
+    }
+}
+
+//
+// ctable_WalkCost - what a walk that looks at rows rows at rowCost each to
+// find matches of them costs. A walk in the order of the sort stops once
+// it reaches the limit, one that isn't has to find every match and sort
+// them. A search with no sort isn't costed by its limit, so that paging
+// through it with -offset and -limit walks the same way for every page
+// and gets its rows in the same order.
+//
+static double
+ctable_WalkCost (CTable *ctable, CTableSearch *search, double rows, double rowCost, double matches, int sorted) {
+    int sorting = search->sortControl.nFields > 0 && !sorted && search->action != CTABLE_SEARCH_ACTION_NONE;
+    int buffered = !sorted || search->action == CTABLE_SEARCH_ACTION_CURSOR;
+    double cost;
+
+#ifdef WITH_SHARED_TABLES
+    if (ctable->share_type == CTABLE_SHARED_READER) {
+	buffered = 1;
+    }
+#endif
+
+    if (matches > rows) {
+	matches = rows;
+    }
+
+    if (search->limit != 0 && !buffered && matches > search->offsetLimit) {
+	rows *= search->offsetLimit / matches;
+    }
+
+    cost = rows * rowCost;
+    if (sorting && matches > 1.0) {
+	double kept = matches;
+
+	// a sort for a limit only keeps the first rows
+	if (search->limit != 0 && search->offsetLimit + 1 < kept) {
+	    kept = search->offsetLimit + 1;
+	}
+	cost += matches * log2 (kept) * CTABLE_COST_SORT;
+    }
+
+    return cost;
+}
+
+//
+// ctable_PlanCompositeSearch - work out how the search could walk a composite
+// index, return an estimate of how many rows the walk would look at, or -1
+// if it's no help. a partial index has to have been checked to have every
+// row the search could match.
+//
+// the comparisons the walk is narrowed by are taken to be independent, so
+// each one cuts the rows in the index down by the fraction of the table it
+// was estimated to accept by itself.
+//
+static double
+ctable_PlanCompositeSearch (CTable *ctable, CTableSearch *search, int slot, struct compositePlan_t *plan) {
+    ctable_FieldInfo *f = ctable->creator->fields[slot];
+    double            rows = (double)jsw_ssize (ctable->skipLists[slot]);
+    int               i;
+
+    plan->nEqual = 0;
+    plan->lowRow = NULL;
+    plan->highRow = NULL;
+    plan->lowInclusive = 0;
+    plan->highInclusive = 0;
+    plan->nUsed = 0;
+    plan->lastUsed = -1;
+
+    // as many of the leading fields as are matched exactly...
+    while (plan->nEqual < f->nCompositeFields) {
+	for (i = 0; i < search->nComponents; i++) {
+	    if (search->components[i].fieldID == f->compositeFields[plan->nEqual] && search->components[i].comparisonType == CTABLE_COMP_EQ) {
+		break;
+	    }
+	}
+	if (i == search->nComponents) {
+	    break;
+	}
+	rows *= search->components[i].estimate / ctable->count;
+	plan->nEqual++;
+	plan->nUsed++;
+	plan->lastUsed = i;
+    }
+
+    // ...then the ends of a range on the next one
+    if (plan->nEqual < f->nCompositeFields) {
+	for (i = 0; i < search->nComponents; i++) {
+	    CTableSearchComponent *component = &search->components[i];
+
+	    if (component->fieldID != f->compositeFields[plan->nEqual]) {
+		continue;
+	    }
+
+	    switch (component->comparisonType) {
+		case CTABLE_COMP_GE:
+		case CTABLE_COMP_GT: {
+		    if (plan->lowRow != NULL) {
+			continue;
+		    }
+		    plan->lowRow = component->row1;
+		    plan->lowInclusive = (component->comparisonType == CTABLE_COMP_GE);
+		    break;
+		}
+		case CTABLE_COMP_LT:
+		case CTABLE_COMP_LE: {
+		    if (plan->highRow != NULL) {
+			continue;
+		    }
+		    plan->highRow = component->row1;
+		    plan->highInclusive = (component->comparisonType == CTABLE_COMP_LE);
+		    break;
+		}
+		case CTABLE_COMP_RANGE:
+		case CTABLE_COMP_WITHIN: {
+		    if (plan->lowRow != NULL || plan->highRow != NULL) {
+			continue;
+		    }
+		    plan->lowRow = component->row1;
+		    plan->lowInclusive = 1;
+		    plan->highRow = component->row2;
+		    plan->highInclusive = (component->comparisonType == CTABLE_COMP_WITHIN);
+		    break;
+		}
+		default: {
+		    continue;
+		}
+	    }
+	    rows *= component->estimate / ctable->count;
+	    plan->nUsed++;
+	    plan->lastUsed = i;
+	}
+    }
+
+    // a partial index the search can use is worth walking for its where
+    // alone
+    if (plan->nUsed == 0 && f->where == NULL) {
+        return -1;
+    }
+
+    return rows;
+}
+
+//
+// ctable_CopyIndexField - copy a field from one row into another, for
+// building the rows a composite index is positioned on
+//
+static int
+ctable_CopyIndexField (Tcl_Interp *interp, CTable *ctable, ctable_BaseRow *from, ctable_BaseRow *to, int field) {
+    Tcl_Obj *valueObj = ctable->creator->get (interp, from, field);
+    int      result;
+
+    Tcl_IncrRefCount (valueObj);
+    result = ctable->creator->set (interp, ctable, valueObj, to, field, CTABLE_INDEX_PRIVATE);
+    Tcl_DecrRefCount (valueObj);
+
+    return result;
+}
+
+//
+// ctable_BitmapAccepts - would every row with the value of the bitmap entry's
+// row pass the comparison, or at least might they. Only comparisons that
+// are the same for every row with a value are answered from the bitmaps.
+//
+static int
+ctable_BitmapAccepts (Tcl_Interp *interp, CTable *ctable, CTableSearchComponent *component, ctable_BaseRow *row) {
+    CTableSearch one;
+
+    switch (component->comparisonType) {
+	case CTABLE_COMP_TRUE:
+	case CTABLE_COMP_FALSE:
+	    memset (&one, 0, sizeof one);
+	    one.ctable = ctable;
+	    one.components = component;
+	    one.nComponents = 1;
+	    one.alreadySearched = -1;
+	    return (*ctable->creator->search_compare) (interp, &one, row) == TCL_OK;
+    }
+
+    return ctable_ComponentAccepts (component, row);
+}
+
+//
+// ctable_ComponentTrigrams - the trigrams a match on a trigram indexed field
+// needs the rows to have, none if it isn't one or the pattern has no three
+// plain characters in a row
+//
+static int
+ctable_ComponentTrigrams (CTable *ctable, CTableSearchComponent *component, uint32_t *trigrams) {
+    struct ctableSearchMatchStruct *sm = (struct ctableSearchMatchStruct *)component->clientData;
+    const char                     *pattern;
+
+    if (component->comparisonType != CTABLE_COMP_MATCH && component->comparisonType != CTABLE_COMP_MATCH_CASE) {
+	return 0;
+    }
+
+    pattern = ctable->creator->get_string (component->row1, component->fieldID, NULL, NULL);
+    return ctable_TrigramsOfPattern (pattern, sm->type == CTABLE_STRING_MATCH_ANCHORED, sm->nocase, sm->type == CTABLE_STRING_MATCH_PATTERN, trigrams);
+}
+
+//
+// ctable_TrigramSearch - the rows with all of the trigrams, the rarest
+// trigram's rows to start with so the ANDs have the least to do. Returns 0
+// if the pattern has no trigrams, which says nothing about which rows
+// match it, so they have to be compared instead
+//
+static int
+ctable_TrigramSearch (ctable_BitmapIndex *index, uint32_t *trigrams, int nTrigrams, ctable_Bitmap *result) {
+    ctable_Bitmap *bitmaps[CTABLE_TRIGRAMS_MAX] = { NULL };
+    ctable_Bitmap *rarest = NULL;
+    int            i;
+
+    ctable_BitmapInit (result);
+    if (nTrigrams == 0) {
+	return 0;
+    }
+
+    // a trigram no row has leaves nothing to match
+    for (i = 0; i < nTrigrams; i++) {
+	bitmaps[i] = ctable_TrigramIndexFind (index, trigrams[i]);
+	if (bitmaps[i] == NULL) {
+	    return 1;
+	}
+	if (rarest == NULL || ctable_BitmapCount (bitmaps[i]) < ctable_BitmapCount (rarest)) {
+	    rarest = bitmaps[i];
+	}
+    }
+
+    ctable_BitmapOr (result, rarest);
+    for (i = 0; i < nTrigrams && result->nContainers > 0; i++) {
+	if (bitmaps[i] != rarest) {
+	    ctable_BitmapAnd (result, bitmaps[i]);
+	}
+    }
+    return 1;
+}
+
+//
+// ctable_CountIndexSearch - count a search that used the index, for
+// "index searches"
+//
+static void
+ctable_CountIndexSearch (CTable *ctable, int field) {
+    if (ctable->indexSearches == NULL) {
+	ctable->indexSearches = (long *)ckalloc (ctable->creator->nIndexes * sizeof (long));
+	memset (ctable->indexSearches, 0, ctable->creator->nIndexes * sizeof (long));
+    }
+    ctable->indexSearches[field]++;
+}
+
+//
+// ctable_IndexSearches - how many searches have used the index
+//
+CTABLE_INTERNAL long
+ctable_IndexSearches (CTable *ctable, int field) {
+    return ctable->indexSearches == NULL ? 0 : ctable->indexSearches[field];
+}
+
+//
+// ctable_BitmapSearch - find the rows that can match the comparisons on
+// fields with bitmap indexes, by ORing together the bitmaps of the values
+// each comparison accepts and ANDing what that gets for each comparison.
+// A match on a field with a trigram index gets the AND of the bitmaps of
+// the trigrams in its pattern. No row is looked at until the bitmaps are
+// done with, and the rows they leave are still compared in full.
+//
+// the bitmaps are only used if they narrow the search by two comparisons
+// or more, or if there's no index walk to do it instead. Returns 1 and a
+// ckalloc'ed array of the row numbers if they're used, 0 if not, and -1
+// if an "in" list can't be made into rows. *exactPtr is set if the rows
+// are exactly the ones that match, with every comparison answered from
+// the bitmaps of the values it accepts.
+//
+static int
+ctable_BitmapSearch (Tcl_Interp *interp, CTable *ctable, CTableSearch *search, int haveWalk, unsigned int **numbersPtr, size_t *nNumbersPtr, int *exactPtr) {
+    ctable_Bitmap  result;
+    ctable_Bitmap  accepted;
+    uint32_t       trigrams[CTABLE_TRIGRAMS_MAX];
+    int            nUsable = 0;
+    int            nExact = 0;
+    int            first = 1;
+    int            i;
+    int            j;
+
+    for (i = 0; i < search->nComponents; i++) {
+	CTableSearchComponent *component = &search->components[i];
+
+	if (ctable->bitmaps[component->fieldID] == NULL || ctable->skipLists[component->fieldID] == NULL) {
+	    continue;
+	}
+
+	if (ctable->bitmaps[component->fieldID]->trigrams != NULL) {
+	    if (ctable_ComponentTrigrams (ctable, component, trigrams) > 0) {
+		nUsable++;
+	    }
+	    continue;
+	}
+
+	switch (component->comparisonType) {
+	    case CTABLE_COMP_TRUE: case CTABLE_COMP_FALSE:
+	    case CTABLE_COMP_LT: case CTABLE_COMP_LE: case CTABLE_COMP_EQ:
+	    case CTABLE_COMP_GE: case CTABLE_COMP_GT:
+	    case CTABLE_COMP_RANGE: case CTABLE_COMP_IN:
+	    case CTABLE_COMP_WITHIN:
+		nUsable++;
+	}
+    }
+
+    if (nUsable == 0 || (nUsable == 1 && haveWalk)) {
+	return 0;
+    }
+
+    ctable_BitmapInit (&result);
+
+    for (i = 0; i < search->nComponents; i++) {
+	CTableSearchComponent *component = &search->components[i];
+	ctable_BitmapIndex    *index = ctable->bitmaps[component->fieldID];
+
+	if (index == NULL || ctable->skipLists[component->fieldID] == NULL) {
+	    continue;
+	}
+
+	if (index->trigrams != NULL) {
+	    int nTrigrams = ctable_ComponentTrigrams (ctable, component, trigrams);
+
+	    if (!ctable_TrigramSearch (index, trigrams, nTrigrams, &accepted)) {
+		continue;
+	    }
+	} else {
+	    switch (component->comparisonType) {
+		case CTABLE_COMP_IN:
+		    if (ctable_CreateInRows (interp, ctable, component) == TCL_ERROR) {
+			ctable_BitmapFree (&result);
+			return -1;
+		    }
+		    break;
+		case CTABLE_COMP_TRUE: case CTABLE_COMP_FALSE:
+		case CTABLE_COMP_LT: case CTABLE_COMP_LE: case CTABLE_COMP_EQ:
+		case CTABLE_COMP_GE: case CTABLE_COMP_GT:
+		case CTABLE_COMP_RANGE: case CTABLE_COMP_WITHIN:
+		    break;
+		default:
+		    continue;
+	    }
+
+	    ctable_BitmapInit (&accepted);
+	    for (j = 0; j < index->nEntries; j++) {
+		if (ctable_BitmapAccepts (interp, ctable, component, index->entries[j]->row)) {
+		    ctable_BitmapOr (&accepted, &index->entries[j]->bits);
+		}
+	    }
+	    nExact++;
+	}
+	ctable_CountIndexSearch (ctable, component->fieldID);
+
+	if (first) {
+	    result = accepted;
+	    first = 0;
+	} else {
+	    ctable_BitmapAnd (&result, &accepted);
+	    ctable_BitmapFree (&accepted);
+	}
+
+	if (result.nContainers == 0) {
+	    break;
+	}
+    }
+
+    // when nothing's left the comparisons not looked at can't add any
+    *exactPtr = (nExact == search->nComponents || result.nContainers == 0);
+
+    *numbersPtr = (unsigned int *)ckalloc ((ctable_BitmapCount (&result) + 1) * sizeof (unsigned int));
+    *nNumbersPtr = ctable_BitmapNumbers (&result, *numbersPtr);
+    ctable_BitmapFree (&result);
+
+    return 1;
+}
+
+//
+// Index intersection. A search with comparisons on two or more fields
+// with skip list, B+tree or hash indexes can gather the rows each of
+// those indexes finds, sort them by address, and look at only the rows
+// every one of them found. The indexes reach their rows through the rows
+// themselves, so gathering a second index's rows costs about what walking
+// it would. It only pays when the comparisons the first index's rows
+// would otherwise each be checked against cost more, like a long "in"
+// list, and it's costed against walking a single index like any other
+// plan.
+//
+
+//
+// ctable_IntersectUsable - can the rows a comparison accepts be gathered
+// from its field's index. Bitmap and trigram indexes are combined by
+// ctable_BitmapSearch instead, and an index an outer search is walking
+// can't be moved out from under it.
+//
+static int
+ctable_IntersectUsable (CTable *ctable, CTableSearch *search, CTableSearchComponent *component) {
+    int           field = component->fieldID;
+    CTableSearch *s;
+
+    if (ctable->skipLists[field] == NULL || (ctable->bitmaps != NULL && ctable->bitmaps[field] != NULL)) {
+	return 0;
+    }
+
+    switch (component->comparisonType) {
+	case CTABLE_COMP_EQ: case CTABLE_COMP_IN: {
+	    break;
+	}
+	case CTABLE_COMP_LT: case CTABLE_COMP_LE: case CTABLE_COMP_GE:
+	case CTABLE_COMP_GT: case CTABLE_COMP_RANGE: case CTABLE_COMP_WITHIN: {
+	    if (ctable->creator->fields[field]->indexType == CTABLE_INDEXTYPE_HASH) {
+		return 0;
+	    }
+	    break;
+	}
+	default: {
+	    return 0;
+	}
+    }
+
+    for (s = search->previousSearch; s; s = s->previousSearch) {
+	if (s->searchField == field) {
+	    return 0;
+	}
+    }
+
+    return 1;
+}
+
+//
+// ctable_CompareRowAddresses - qsort function to put rows in address order
+//
+static int
+ctable_CompareRowAddresses (const void *a, const void *b) {
+    uintptr_t row1 = (uintptr_t)*(ctable_BaseRow * const *)a;
+    uintptr_t row2 = (uintptr_t)*(ctable_BaseRow * const *)b;
+
+    return (row1 > row2) - (row1 < row2);
+}
+
+//
+// ctable_IntersectGather - gather the rows a comparison's index finds for
+// it, in address order with none twice. returns a ckalloc'ed array of
+// them, or NULL if an "in" list can't be made into rows
+//
+static ctable_BaseRow **
+ctable_IntersectGather (Tcl_Interp *interp, CTable *ctable, CTableSearchComponent *component, size_t *nRowsPtr) {
+    ctable_FieldInfo       *f = ctable->creator->fields[component->fieldID];
+    jsw_skip_t             *skipList = ctable->skipLists[component->fieldID];
+    fieldCompareFunction_t  compareFunction = f->compareFunction;
+    enum skipStart_e        skipStart = skipTypes[component->comparisonType].skipStart;
+    enum skipEnd_e          skipEnd = skipTypes[component->comparisonType].skipEnd;
+    enum skipNext_e         skipNext = skipTypes[component->comparisonType].skipNext;
+    ctable_BaseRow        **rows;
+    ctable_BaseRow         *row;
+    ctable_BaseRow         *walkRow;
+    size_t                  size = (size_t)component->estimate + 16;
+    size_t                  nRows = 0;
+    size_t                  i;
+    int                     inIndex = 0;
+
+    if (component->comparisonType == CTABLE_COMP_IN) {
+	if (ctable_CreateInRows (interp, ctable, component) == TCL_ERROR) {
+	    return NULL;
+	}
+    }
+
+    rows = (ctable_BaseRow **)ckalloc (size * sizeof (ctable_BaseRow *));
+
+    switch (skipStart) {
+	case SKIP_START_EQ_ROW1: {
+	    jsw_sfind (skipList, component->row1);
+	    break;
+	}
+	case SKIP_START_GE_ROW1:
+	case SKIP_START_GT_ROW1: {
+	    jsw_sfind_equal_or_greater (skipList, component->row1, compareFunction);
+	    if (skipStart == SKIP_START_GT_ROW1) {
+		while ((row = jsw_srow (skipList)) != NULL && compareFunction (row, component->row1) <= 0) {
+		    jsw_snext (skipList);
+		}
+	    }
+	    break;
+	}
+	default: {
+	    jsw_sreset (skipList);
+	}
+    }
+
+    while (1) {
+	if (skipNext == SKIP_NEXT_IN_LIST) {
+	    while (inIndex < component->inCount && jsw_sfind (skipList, component->inListRows[inIndex]) == NULL) {
+		inIndex++;
+	    }
+	    if (inIndex++ >= component->inCount) {
+		break;
+	    }
+	}
+
+	row = jsw_srow (skipList);
+	if (row == NULL) {
+	    break;
+	}
+
+	if ((skipEnd == SKIP_END_GE_ROW1 && compareFunction (row, component->row1) >= 0)
+	 || (skipEnd == SKIP_END_GT_ROW1 && compareFunction (row, component->row1) > 0)
+	 || (skipEnd == SKIP_END_GE_ROW2 && compareFunction (row, component->row2) >= 0)
+	 || (skipEnd == SKIP_END_GT_ROW2 && compareFunction (row, component->row2) > 0)) {
+	    break;
+	}
+
+	CTABLE_LIST_FOREACH (row, walkRow, f->indexNumber) {
+	    if (nRows == size) {
+		size *= 2;
+		rows = (ctable_BaseRow **)ckrealloc ((char *)rows, size * sizeof (ctable_BaseRow *));
+	    }
+	    rows[nRows++] = walkRow;
+	}
+
+	if (skipNext == SKIP_NEXT_ROW) {
+	    jsw_snext (skipList);
+	}
+    }
+
+    qsort (rows, nRows, sizeof (ctable_BaseRow *), ctable_CompareRowAddresses);
+
+    // an "in" list can have the same value in it more than once
+    if (skipNext == SKIP_NEXT_IN_LIST && nRows > 1) {
+	size_t kept = 1;
+
+	for (i = 1; i < nRows; i++) {
+	    if (rows[i] != rows[kept - 1]) {
+		rows[kept++] = rows[i];
+	    }
+	}
+	nRows = kept;
+    }
+
+    *nRowsPtr = nRows;
+    return rows;
+}
+
+//
+// ctable_IntersectSearch - see if gathering the rows two or more of the
+// search's comparisons accept from their indexes, and looking at only the
+// rows all of them found, costs less than bestCost. The comparisons whose
+// indexes find the fewest rows are tried first. Returns 1 and the rows as
+// a ckalloc'ed array if it's done, 0 if not, and -1 on error. *exactPtr is
+// set if every comparison was used, so the rows are exactly the ones that
+// match, otherwise they're still checked against every comparison.
+//
+static int
+ctable_IntersectSearch (Tcl_Interp *interp, CTable *ctable, CTableSearch *search, double bestCost, double matches, double compareCost, ctable_BaseRow ***rowsPtr, size_t *nRowsPtr, int *exactPtr) {
+    int             *usable;
+    int              nUsable = 0;
+    int              nUsed = 0;
+    double           gathered = 0.0;
+    double           found = ctable->count;
+    ctable_BaseRow **rows = NULL;
+    size_t           nRows = 0;
+    int              i;
+    int              j;
+
+    if (search->nComponents < 2) {
+	return 0;
+    }
+
+#ifdef WITH_SHARED_TABLES
+    // a reader has to be able to start a walk over if the master moves
+    // things about, and it can't do that partway through a gather
+    if (ctable->share_type == CTABLE_SHARED_READER) {
+	return 0;
+    }
+#endif
+
+    usable = (int *)ckalloc (search->nComponents * sizeof (int));
+    for (i = 0; i < search->nComponents; i++) {
+	if (!ctable_IntersectUsable (ctable, search, &search->components[i])) {
+	    continue;
+	}
+
+	for (j = nUsable; j > 0 && search->components[usable[j - 1]].estimate > search->components[i].estimate; j--) {
+	    usable[j] = usable[j - 1];
+	}
+	usable[j] = i;
+	nUsable++;
+    }
+
+    // each index costs the walk to its rows and sorting what it finds,
+    // and the rows all of them find are looked at like a walk's
+    for (i = 0; i < nUsable; i++) {
+	CTableSearchComponent *component = &search->components[usable[i]];
+	double                 rows = component->estimate;
+	double                 cost;
+
+	gathered += log2 (jsw_ssize (ctable->skipLists[component->fieldID]) + 1.0) * CTABLE_COST_INDEX_ROW
+		  + rows * (CTABLE_COST_INDEX_ROW + log2 (rows + 1.0) * CTABLE_COST_COMPARE);
+	found *= rows / ctable->count;
+
+	if (i == 0) {
+	    continue;
+	}
+
+	cost = gathered + ctable_WalkCost (ctable, search, found, CTABLE_COST_INDEX_ROW + (i + 1 == search->nComponents ? 0.0 : compareCost), matches, 0);
+	if (cost < bestCost) {
+	    bestCost = cost;
+	    nUsed = i + 1;
+	}
+    }
+
+    for (i = 0; i < nUsed; i++) {
+	CTableSearchComponent *component = &search->components[usable[i]];
+	ctable_BaseRow       **more;
+	size_t                 nMore;
+	size_t                 m;
+	size_t                 n;
+	size_t                 kept = 0;
+
+	more = ctable_IntersectGather (interp, ctable, component, &nMore);
+	if (more == NULL) {
+	    if (rows != NULL) {
+		ckfree ((char *)rows);
+	    }
+	    ckfree ((char *)usable);
+	    return -1;
+	}
+	ctable_CountIndexSearch (ctable, component->fieldID);
+
+	if (rows == NULL) {
+	    rows = more;
+	    nRows = nMore;
+	    continue;
+	}
+
+	// both are in address order, keep the rows that are in both
+	for (m = 0, n = 0; m < nRows && n < nMore; ) {
+	    if (rows[m] == more[n]) {
+		rows[kept++] = rows[m++];
+		n++;
+	    } else if ((uintptr_t)rows[m] < (uintptr_t)more[n]) {
+		m++;
+	    } else {
+		n++;
+	    }
+	}
+	nRows = kept;
+	ckfree ((char *)more);
+
+	if (nRows == 0) {
+	    break;
+	}
+    }
+
+    ckfree ((char *)usable);
+
+    if (nUsed == 0) {
+	return 0;
+    }
+
+    *rowsPtr = rows;
+    *nRowsPtr = nRows;
+    *exactPtr = (nUsed == search->nComponents);
+    return 1;
+}
+
+//
+// ctable_AdvisorUsable - could an index on the component's field, of the
+// type the field is defined with, have been walked for the comparison.
+// fields that already have an index aren't the advisor's business
+//
+static int
+ctable_AdvisorUsable (CTable *ctable, CTableSearchComponent *component) {
+    uint32_t trigrams[CTABLE_TRIGRAMS_MAX];
+
+    if (ctable->skipLists[component->fieldID] != NULL) {
+	return 0;
+    }
+
+    switch (ctable->creator->fields[component->fieldID]->indexType) {
+	case CTABLE_INDEXTYPE_HASH: {
+	    return component->comparisonType == CTABLE_COMP_EQ || component->comparisonType == CTABLE_COMP_IN;
+	}
+
+	case CTABLE_INDEXTYPE_BITMAP: {
+	    switch (component->comparisonType) {
+		case CTABLE_COMP_TRUE: case CTABLE_COMP_FALSE:
+		case CTABLE_COMP_LT: case CTABLE_COMP_LE: case CTABLE_COMP_EQ:
+		case CTABLE_COMP_GE: case CTABLE_COMP_GT:
+		case CTABLE_COMP_RANGE: case CTABLE_COMP_IN:
+		case CTABLE_COMP_WITHIN:
+		    return 1;
+	    }
+	    return 0;
+	}
+
+	case CTABLE_INDEXTYPE_TRIGRAM: {
+	    return ctable_ComponentTrigrams (ctable, component, trigrams) > 0;
+	}
+    }
+
+    // skip lists and B+trees walk ranges, and matches anchored at the start
+    switch (skipTypes[component->comparisonType].skipNext) {
+	case SKIP_NEXT_NONE: {
+	    return 0;
+	}
+	case SKIP_NEXT_MATCH: {
+	    return component->row2 != NULL;
+	}
+	default: {
+	    return 1;
+	}
+    }
+}
+
+//
+// ctable_AdvisorAdvised - have enough searches compared every row to find
+// few enough of them for an index to be advised
+//
+static int
+ctable_AdvisorAdvised (ctable_IndexAdvisor *advisor, ctable_AdvisorCounts *counts) {
+    return counts->scans > 0 && counts->scans >= advisor->minScans
+	&& counts->matched <= advisor->maxFraction * counts->examined;
+}
+
+//
+// ctable_AdvisorStart - if the index advisor is running, set up to count
+// how many of the rows a brute force search looks at are accepted by each
+// of its comparisons that an index could have been used for. returns the
+// counts, -1 for the comparisons that aren't counted, or NULL if none are
+//
+static long *
+ctable_AdvisorStart (CTable *ctable, CTableSearch *search, CTableSearch *one) {
+    long *accepted;
+    int   nUsable = 0;
+    int   i;
+
+    if (ctable->advisor == NULL || search->reqIndexField != CTABLE_SEARCH_INDEX_ANY || search->nComponents == 0) {
+	return NULL;
+    }
+
+    accepted = (long *)ckalloc (search->nComponents * sizeof (long));
+    for (i = 0; i < search->nComponents; i++) {
+	if (ctable_AdvisorUsable (ctable, &search->components[i])) {
+	    accepted[i] = 0;
+	    nUsable++;
+	} else {
+	    accepted[i] = -1;
+	}
+    }
+
+    if (nUsable == 0) {
+	ckfree ((char *)accepted);
+	return NULL;
+    }
+
+    // each comparison is tried on its own
+    memset (one, 0, sizeof *one);
+    one->ctable = ctable;
+    one->nComponents = 1;
+    one->alreadySearched = -1;
+
+    return accepted;
+}
+
+//
+// ctable_AdvisorCompare - count the comparisons that accept a row
+//
+static void
+ctable_AdvisorCompare (Tcl_Interp *interp, CTable *ctable, CTableSearch *search, CTableSearch *one, ctable_BaseRow *row, long *accepted) {
+    int i;
+
+    for (i = 0; i < search->nComponents; i++) {
+	if (accepted[i] < 0) {
+	    continue;
+	}
+
+	one->components = &search->components[i];
+	if ((*ctable->creator->search_compare) (interp, one, row) == TCL_OK) {
+	    accepted[i]++;
+	}
+    }
+}
+
+//
+// ctable_AdvisorCreateIndexes - idle callback to create the indexes the
+// advisor advises, for the fields that have been defined as indexable
+//
+static void
+ctable_AdvisorCreateIndexes (ClientData clientData) {
+    CTable              *ctable = (CTable *)clientData;
+    ctable_IndexAdvisor *advisor = ctable->advisor;
+    int                  field;
+    int                  type;
+
+    advisor->createPending = 0;
+
+    // not while a search is walking the table, the next search that has
+    // to compare every row tries again
+    if (ctable->searches != NULL) {
+	return;
+    }
+
+    for (field = 0; field < ctable->creator->nFields; field++) {
+	ctable_AdvisorCounts *counts = &advisor->counts[field * CTABLE_NUM_COMP_TYPES];
+
+	if (ctable->skipLists[field] != NULL || ctable->creator->fields[field]->indexNumber < 0) {
+	    continue;
+	}
+
+	for (type = 0; type < CTABLE_NUM_COMP_TYPES; type++) {
+	    if (ctable_AdvisorAdvised (advisor, &counts[type])) {
+		break;
+	    }
+	}
+	if (type == CTABLE_NUM_COMP_TYPES) {
+	    continue;
+	}
+
+	// the same depth "index create" uses by default
+	if (ctable_CreateIndex (advisor->interp, ctable, field, 20) == TCL_ERROR) {
+	    Tcl_AddErrorInfo (advisor->interp, "\n    (creating an index the index advisor advised)");
+	    Tcl_BackgroundError (advisor->interp);
+	    return;
+	}
+
+	// start counting again, in case the index is dropped
+	memset (counts, 0, CTABLE_NUM_COMP_TYPES * sizeof (ctable_AdvisorCounts));
+    }
+}
+
+//
+// ctable_AdvisorRecord - add what a brute force search saw to the
+// advisor's counts, and if it's creating the indexes it advises and one
+// is now advised, create it once the interpreter is idle
+//
+static void
+ctable_AdvisorRecord (CTable *ctable, CTableSearch *search, long examined, long *accepted) {
+    ctable_IndexAdvisor *advisor = ctable->advisor;
+    int                  create = 0;
+    int                  i;
+
+    // the search's code could have stopped the advisor
+    if (advisor == NULL) {
+	return;
+    }
+
+    for (i = 0; i < search->nComponents; i++) {
+	CTableSearchComponent *component = &search->components[i];
+	ctable_AdvisorCounts  *counts;
+
+	if (accepted[i] < 0) {
+	    continue;
+	}
+
+	counts = &advisor->counts[component->fieldID * CTABLE_NUM_COMP_TYPES + component->comparisonType];
+	counts->scans++;
+	counts->examined += examined;
+	counts->matched += accepted[i];
+
+	if (ctable_AdvisorAdvised (advisor, counts) && ctable->creator->fields[component->fieldID]->indexNumber >= 0) {
+	    create = 1;
+	}
+    }
+
+    if (create && advisor->create && !advisor->createPending) {
+	advisor->createPending = 1;
+	Tcl_DoWhenIdle (ctable_AdvisorCreateIndexes, (ClientData)ctable);
+    }
+}
+
+//
+// ctable_FreeIndexAdvisor - stop the index advisor and forget what it's
+// counted
+//
+CTABLE_INTERNAL void
+ctable_FreeIndexAdvisor (CTable *ctable) {
+    if (ctable->advisor == NULL) {
+	return;
+    }
+
+    if (ctable->advisor->createPending) {
+	Tcl_CancelIdleCall (ctable_AdvisorCreateIndexes, (ClientData)ctable);
+    }
+
+    ckfree ((char *)ctable->advisor->counts);
+    ckfree ((char *)ctable->advisor);
+    ctable->advisor = NULL;
+}
+
+//
+// ctable_IndexAdvise - "index advise" lists the field and comparison pairs
+// that are advised to be indexed, "index advise start" starts the advisor
+// or changes its settings, "stop" stops it, "reset" starts its counts
+// over and "counts" lists all of them
+//
+CTABLE_INTERNAL int
+ctable_IndexAdvise (Tcl_Interp *interp, CTable *ctable, int objc, Tcl_Obj *CONST objv[]) {
+    static CONST char *options[] = {"start", "stop", "reset", "counts", (char *)NULL};
+    enum options {OPT_START, OPT_STOP, OPT_RESET, OPT_COUNTS};
+    static CONST char *searchTerms[] = CTABLE_SEARCH_TERMS;
+    ctable_IndexAdvisor *advisor = ctable->advisor;
+    int                  optIndex = OPT_COUNTS;
+    int                  field;
+    int                  type;
+    Tcl_Obj             *resultObj;
+
+    if (objc > 3) {
+	if (Tcl_GetIndexFromObj (interp, objv[3], options, "option", TCL_EXACT, &optIndex) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+    }
+
+    switch (optIndex) {
+	case OPT_START: {
+	    long   minScans = 10;
+	    double maxFraction = 0.1;
+	    int    create = 0;
+
+	    if (objc > 7) {
+		Tcl_WrongNumArgs (interp, 4, objv, "?minScans? ?maxFraction? ?create?");
+		return TCL_ERROR;
+	    }
+
+	    if (objc > 4 && Tcl_GetLongFromObj (interp, objv[4], &minScans) == TCL_ERROR) {
+		return TCL_ERROR;
+	    }
+	    if (objc > 5 && Tcl_GetDoubleFromObj (interp, objv[5], &maxFraction) == TCL_ERROR) {
+		return TCL_ERROR;
+	    }
+	    if (objc > 6 && Tcl_GetBooleanFromObj (interp, objv[6], &create) == TCL_ERROR) {
+		return TCL_ERROR;
+	    }
+
+	    if (maxFraction < 0.0 || maxFraction > 1.0) {
+		Tcl_AppendResult (interp, "maxFraction must be between 0 and 1", (char *)NULL);
+		return TCL_ERROR;
+	    }
+
+#ifdef WITH_SHARED_TABLES
+	    if (create && ctable->share_type == CTABLE_SHARED_READER) {
+		Tcl_AppendResult (interp, "can't create indexes on a read-only table", (char *)NULL);
+		return TCL_ERROR;
+	    }
+#endif
+
+	    if (advisor == NULL) {
+		size_t size = ctable->creator->nFields * CTABLE_NUM_COMP_TYPES * sizeof (ctable_AdvisorCounts);
+
+		advisor = (ctable_IndexAdvisor *)ckalloc (sizeof (ctable_IndexAdvisor));
+		advisor->createPending = 0;
+		advisor->counts = (ctable_AdvisorCounts *)ckalloc (size);
+		memset (advisor->counts, 0, size);
+		ctable->advisor = advisor;
+	    }
+
+	    advisor->interp = interp;
+	    advisor->minScans = minScans;
+	    advisor->maxFraction = maxFraction;
+	    advisor->create = create;
+	    return TCL_OK;
+	}
+
+	case OPT_STOP: {
+	    if (objc != 4) {
+		Tcl_WrongNumArgs (interp, 4, objv, "");
+		return TCL_ERROR;
+	    }
+
+	    ctable_FreeIndexAdvisor (ctable);
+	    return TCL_OK;
+	}
+
+	case OPT_RESET: {
+	    if (objc != 4) {
+		Tcl_WrongNumArgs (interp, 4, objv, "");
+		return TCL_ERROR;
+	    }
+
+	    if (advisor != NULL) {
+		memset (advisor->counts, 0, ctable->creator->nFields * CTABLE_NUM_COMP_TYPES * sizeof (ctable_AdvisorCounts));
+	    }
+	    return TCL_OK;
+	}
+    }
+
+    if (objc > 4) {
+	Tcl_WrongNumArgs (interp, 4, objv, "");
+	return TCL_ERROR;
+    }
+
+    if (advisor == NULL) {
+	return TCL_OK;
+    }
+
+    // each one as {field comparison scans examined matched}
+    resultObj = Tcl_GetObjResult (interp);
+    for (field = 0; field < ctable->creator->nFields; field++) {
+	for (type = 0; type < CTABLE_NUM_COMP_TYPES; type++) {
+	    ctable_AdvisorCounts *counts = &advisor->counts[field * CTABLE_NUM_COMP_TYPES + type];
+	    Tcl_Obj              *adviceObj;
+
+	    if (counts->scans == 0) {
+		continue;
+	    }
+
+	    if (objc == 3 && (ctable->skipLists[field] != NULL || !ctable_AdvisorAdvised (advisor, counts))) {
+		continue;
+	    }
+
+	    adviceObj = Tcl_NewObj ();
+	    Tcl_ListObjAppendElement (interp, adviceObj, ctable->creator->fields[field]->nameObj);
+	    Tcl_ListObjAppendElement (interp, adviceObj, Tcl_NewStringObj (searchTerms[type], -1));
+	    Tcl_ListObjAppendElement (interp, adviceObj, Tcl_NewLongObj (counts->scans));
+	    Tcl_ListObjAppendElement (interp, adviceObj, Tcl_NewLongObj (counts->examined));
+	    Tcl_ListObjAppendElement (interp, adviceObj, Tcl_NewLongObj (counts->matched));
+	    Tcl_ListObjAppendElement (interp, resultObj, adviceObj);
+	}
+    }
+
+    return TCL_OK;
+}
+
+//
+// ctable_IndexEstimate - "index estimate" returns how many rows each of a
+// list of comparisons is estimated to accept, the figures the search
+// planner works from
+//
+CTABLE_INTERNAL int
+ctable_IndexEstimate (Tcl_Interp *interp, CTable *ctable, int objc, Tcl_Obj *CONST objv[]) {
+    CTableSearch  search;
+    Tcl_Obj      *resultObj;
+    int           i;
+
+    if (objc != 4) {
+	Tcl_WrongNumArgs (interp, 3, objv, "compareList");
+	return TCL_ERROR;
+    }
+
+    memset (&search, 0, sizeof search);
+    search.ctable = ctable;
+    search.alreadySearched = -1;
+
+    if (ctable_ParseSearch (interp, ctable, objv[3], ctable->creator->fieldNames, &search) == TCL_ERROR) {
+	return TCL_ERROR;
+    }
+
+    resultObj = Tcl_NewObj ();
+    for (i = 0; i < search.nComponents; i++) {
+	double rows = ctable_EstimateRows (ctable, &search.components[i]);
+
+	Tcl_ListObjAppendElement (interp, resultObj, Tcl_NewWideIntObj ((Tcl_WideInt)(rows + 0.5)));
     }
+    Tcl_SetObjResult (interp, resultObj);
+
+    ctable_TeardownSearch (&search);
+    return TCL_OK;
 }
 
 //
@@ -1304,18 +3415,25 @@ ctable_PerformSearch (Tcl_Interp *interp, CTable *ctable, CTableSearch *search)
     ctable_BaseRow        *row2 = NULL;
     char	  	  *key = NULL;
 
-    int			   bestScore = 0;
+    double		   bestCost = 0.0;
+    double		   matches = 0.0;
+    double		   compareCost = 0.0;
 
     jsw_skip_t   	  *skipList = NULL;
     int           	   skipField = 0;
     int			   inOrderWalk = 0;
 
     fieldCompareFunction_t compareFunction = NULL;
+    fieldCompareFunction_t startCompareFunction = NULL;
     int                    indexNumber = -1;
     int                    comparisonType = 0;
 
     int			   sortField = -1;
 
+    struct compositePlan_t compositePlan = {0, NULL, NULL, 0, 0, 0, -1};
+    ctable_BaseRow	  *compositeRow1 = NULL;
+    ctable_BaseRow	  *compositeRow2 = NULL;
+
     enum walkType_e	   walkType	= WALK_DEFAULT;
 
     enum skipStart_e	   skipStart = SKIP_START_NONE;
@@ -1323,6 +3441,7 @@ ctable_PerformSearch (Tcl_Interp *interp, CTable *ctable, CTableSearch *search)
     enum skipNext_e	   skipNext = SKIP_NEXT_NONE;
 
     int			   myCount;
+    size_t		   skipRows = 0;
 
     int			   inIndex = 0;
     Tcl_Obj		 **inListObj = NULL;
@@ -1331,6 +3450,17 @@ ctable_PerformSearch (Tcl_Interp *interp, CTable *ctable, CTableSearch *search)
 
     int			   canUseHash = 1;
 
+    unsigned int	  *bitmapRows = NULL;
+    size_t		   nBitmapRows = 0;
+    int			   bitmapExact = 0;
+    long		  *advisorAccepted = NULL;
+    size_t		   bitmapIndex = 0;
+
+    ctable_BaseRow	 **intersectRows = NULL;
+    size_t		   nIntersectRows = 0;
+    size_t		   intersectIndex = 0;
+    int			   intersectExact = 0;
+
     CTableSearch         *s;
 
 #ifdef WITH_SHARED_TABLES
@@ -1382,24 +3512,48 @@ restart_search:
 	row1 = NULL;
 	row2 = NULL;
 	key = NULL;
-	bestScore = 0;
+	bestCost = 0.0;
+	matches = 0.0;
+	compareCost = 0.0;
 
 	skipList = NULL;
         skipField = 0;
         inOrderWalk = 0;
 
         compareFunction = NULL;
+        startCompareFunction = NULL;
         indexNumber = -1;
         comparisonType = 0;
 
         sortField = -1;
 
+	if (compositeRow1) {
+	    creator->delete_row (ctable, compositeRow1, CTABLE_INDEX_PRIVATE);
+	    compositeRow1 = NULL;
+	}
+	if (compositeRow2) {
+	    creator->delete_row (ctable, compositeRow2, CTABLE_INDEX_PRIVATE);
+	    compositeRow2 = NULL;
+	}
+
         walkType = WALK_DEFAULT;
 
+	if (bitmapRows) {
+	    ckfree ((char *)bitmapRows);
+	    bitmapRows = NULL;
+	}
+
+	if (intersectRows) {
+	    ckfree ((char *)intersectRows);
+	    intersectRows = NULL;
+	}
+
         skipStart = SKIP_START_NONE;
         skipEnd = SKIP_END_NONE;
         skipNext = SKIP_NEXT_NONE;
     
+        skipRows = 0;
+
         inIndex = 0;
         inListObj = NULL;
         inCount = 0;
@@ -1417,6 +3571,7 @@ restart_search:
 
     search->matchCount = 0;
     search->alreadySearched = -1;
+    search->indexOnly = 0;
     if (search->tranTable != NULL) {
 	ckfree ((char *)search->tranTable);
 	search->tranTable = NULL;
@@ -1442,8 +3597,9 @@ restart_search:
         return TCL_OK;
     }
 
-    // Check to see if we're sorting on a single field
-    if (search->sortControl.nFields == 1) {
+    // Check to see if we're sorting on a single field, in the ascending
+    // order the indexes walk in
+    if (search->sortControl.nFields == 1 && search->sortControl.directions[0] > 0) {
 	sortField = search->sortControl.fields[0];
     }
 
@@ -1455,26 +3611,48 @@ restart_search:
     // Check if we can use the hash table.
 #ifdef WITH_SHARED_TABLES
     // fprintf(stderr, "ctable->share_type=%d\n", ctable->share_type);
-    if(ctable->share_type == CTABLE_SHARED_READER) {
+    if(ctable->share_type == CTABLE_SHARED_READER && !ctable_ReaderCanFindKeys(ctable)) {
 	// fprintf(stderr, "READER TABLE\n");
 	canUseHash = 0;
     }
 #endif
 
-    // if they're asking for an index search, look for the best search
-    // in the list of comparisons
+    // if they're asking for an index search, look for the cheapest walk
+    // for the comparisons
     //
-    // See the skipTypes table for the scores, but basically the tighter
-    // the constraint, the better.
+    // Each index that could be walked is costed by the rows it would look
+    // at, estimated from the index itself (see ctable_EstimateRows), plus
+    // the cost of sorting what it finds if it doesn't walk in the order of
+    // the sort. It has to beat looking at every row in the table, which
+    // is what it's up against to start with. The matches are estimated
+    // as if the comparisons were independent.
     //
     // If we can use a hash table, we use it, because it's either JUST
     // a simple hash lookup, or it's "in" which has to be handled here.
     //
     // If we're doing a client search, we don't have access to the
-    // hashtable, so we can't do a hash search.
+    // hashtable, so we can't do a hash search. A reader can use the
+    // master's, if it's chained.
     if (search->reqIndexField != CTABLE_SEARCH_INDEX_NONE && search->nComponents > 0) {
 	int index = 0;
 	int trynum;
+	int i;
+
+	matches = ctable->count;
+	for (i = 0; i < search->nComponents; i++) {
+	    search->components[i].estimate = ctable_EstimateRows (ctable, &search->components[i]);
+	    matches *= search->components[i].estimate / ctable->count;
+	}
+
+	// whichever way the search goes, the comparisons it checks each
+	// row against are checked in the order that turns rows away soonest
+	ctable_OrderComparisons (ctable, search);
+
+	compareCost = 0.0;
+	for (i = 0; i < search->nComponents; i++) {
+	    compareCost += ctable_CompareCost (ctable, &search->components[i]);
+	}
+	bestCost = ctable_WalkCost (ctable, search, ctable->count, CTABLE_COST_SCAN_ROW + compareCost, matches, 0);
 
 	if(search->reqIndexField != CTABLE_SEARCH_INDEX_ANY) {
 	    while(index < search->nComponents) {
@@ -1491,7 +3669,8 @@ restart_search:
 	        index = 0;
 	    CTableSearchComponent *component = &search->components[index];
 	    int field = component->fieldID;
-	    int score;
+	    double rows;
+	    double cost;
 
 	    comparisonType = component->comparisonType;
 
@@ -1527,6 +3706,18 @@ restart_search:
 		continue;
 	    }
 
+	    // A hash index finds values but can't walk a range of them
+	    if(creator->fields[field]->indexType == CTABLE_INDEXTYPE_HASH) {
+		if(comparisonType != CTABLE_COMP_EQ && comparisonType != CTABLE_COMP_IN) {
+		    continue;
+		}
+	    }
+
+	    // Comparisons like != have no range of the index to walk
+	    if(skipTypes[comparisonType].skipNext == SKIP_NEXT_NONE) {
+		continue;
+	    }
+
 	    // Special case - if it's a match and not anchored, skip
 	    if(skipTypes[comparisonType].skipNext == SKIP_NEXT_MATCH) {
 		if(component->row2 == NULL) {
@@ -1545,16 +3736,25 @@ restart_search:
 		continue;
 	    }
 
-	    score = skipTypes[comparisonType].score;
+	    rows = component->estimate;
+
+	    // a count of the rows in one range of a skip list doesn't need
+	    // to walk them at all
+	    if (search->nComponents == 1 && search->action == CTABLE_SEARCH_ACTION_NONE && jsw_scounted (ctable->skipLists[field]) && skipTypes[comparisonType].skipNext == SKIP_NEXT_ROW) {
+		rows = 0.0;
+	    }
 
-	    // Prefer to avoid sort
-	    if(field == sortField) score += SORT_SCORE;
+	    // The comparison walked by isn't made again, and walking the sort
+	    // field in order avoids the sort
+	    cost = log2 (jsw_ssize (ctable->skipLists[field]) + 1.0) * CTABLE_COST_INDEX_ROW
+		 + ctable_WalkCost (ctable, search, rows, CTABLE_COST_INDEX_ROW + compareCost - ctable_CompareCost (ctable, component), matches, field == sortField && skipTypes[comparisonType].skipNext != SKIP_NEXT_IN_LIST);
 
 	    // We already found a better option than this one, skip it
-	    if (bestScore > score)
+	    if (cost >= bestCost)
 		continue;
 
 	    // Got a new best candidate, save the world.
+	    bestCost = cost;
 	    skipField = field;
 	    search->searchField = field;
 
@@ -1598,22 +3798,235 @@ restart_search:
 		    break;
 		}
 		default: { // Can't happen
-		    Tcl_Panic("skipNext has unexpected value %d (comparisonType == %d, skipStart == %d, skipEnd == %d, score == %d)", skipNext, comparisonType, skipStart, skipEnd, score);
+		    Tcl_Panic("skipNext has unexpected value %d (comparisonType == %d, skipStart == %d, skipEnd == %d)", skipNext, comparisonType, skipStart, skipEnd);
 		}
 	    }
-
-	    // Score of 100 means it's mandatory
-	    if (bestScore >= 100)
-	        break;
         }
     }
 
+    // A composite index can narrow the search by several fields at once,
+    // see if one of them does better than any single field
+    if (search->reqIndexField == CTABLE_SEARCH_INDEX_ANY && search->nComponents > 0 && walkType != WALK_HASH_EQ && walkType != WALK_HASH_IN) {
+	struct compositePlan_t plan;
+	int slot;
+	int bestSlot = -1;
+
+	for (slot = creator->nFields; slot < creator->nIndexes; slot++) {
+	    double rows;
+	    double cost;
+	    double compared;
+
+	    if (!ctable->skipLists[slot]) {
+		continue;
+	    }
+
+	    for(s = search->previousSearch; s; s = s->previousSearch) {
+		if(s->searchField == slot) {
+		    break;
+		}
+	    }
+	    if(s) {
+		continue;
+	    }
+
+	    // a partial index can only be walked if every row that matches
+	    // the search matches its where
+	    if (creator->fields[slot]->where != NULL) {
+		CTableSearch *where;
+
+		if (ctable_GetIndexWhere (interp, ctable, slot, &where) == TCL_ERROR) {
+		    finalResult = TCL_ERROR;
+		    goto clean_and_return;
+		}
+
+		if (!ctable_IndexWhereImplied (interp, ctable, search, where)) {
+		    continue;
+		}
+	    }
+
+	    rows = ctable_PlanCompositeSearch (ctable, search, slot, &plan);
+	    if (rows < 0) {
+		continue;
+	    }
+
+	    // every comparison is made again unless the walk answers all of
+	    // them, or only the one
+	    if (plan.nUsed == search->nComponents) {
+		compared = 0.0;
+		if (search->action == CTABLE_SEARCH_ACTION_NONE && jsw_scounted (ctable->skipLists[slot])) {
+		    rows = 0.0;
+		}
+	    } else {
+		compared = compareCost - (plan.nUsed == 1 ? ctable_CompareCost (ctable, &search->components[plan.lastUsed]) : 0.0);
+	    }
+
+	    cost = log2 (jsw_ssize (ctable->skipLists[slot]) + 1.0) * CTABLE_COST_INDEX_ROW
+		 + ctable_WalkCost (ctable, search, rows, CTABLE_COST_INDEX_ROW + compared, matches, ctable_CompositeSorts (search, creator->fields[slot], plan.nEqual));
+
+	    // on a tie a single field's index is simpler to walk
+	    if (cost >= bestCost) {
+		continue;
+	    }
+
+	    bestCost = cost;
+	    bestSlot = slot;
+	    compositePlan = plan;
+	}
+
+	if (bestSlot >= 0) {
+	    ctable_FieldInfo *f = creator->fields[bestSlot];
+	    int               nEqual = compositePlan.nEqual;
+	    int               i;
+
+	    skipField = bestSlot;
+	    search->searchField = bestSlot;
+	    skipList = ctable->skipLists[bestSlot];
+	    walkType = WALK_SKIP;
+	    skipNext = SKIP_NEXT_ROW;
+	    inOrderWalk = 1;
+	    indexNumber = f->indexNumber;
+	    inListObj = NULL;
+	    inListRows = NULL;
+	    inCount = 0;
+
+	    // if the walk answers more than one of the comparisons, they're all
+	    // checked again on each row
+	    search->alreadySearched = (compositePlan.nUsed == 1) ? compositePlan.lastUsed : -1;
+
+	    // the rows to position the walk with, holding the values the
+	    // leading fields are matched against and the ends of the range
+	    compositeRow1 = (*creator->make_empty_row) (ctable);
+	    compositeRow2 = (*creator->make_empty_row) (ctable);
+	    for (i = 0; i < nEqual; i++) {
+		int field = f->compositeFields[i];
+		int j;
+
+		for (j = 0; j < search->nComponents; j++) {
+		    if (search->components[j].fieldID == field && search->components[j].comparisonType == CTABLE_COMP_EQ) {
+			break;
+		    }
+		}
+
+		if (ctable_CopyIndexField (interp, ctable, search->components[j].row1, compositeRow1, field) == TCL_ERROR
+		 || ctable_CopyIndexField (interp, ctable, search->components[j].row1, compositeRow2, field) == TCL_ERROR) {
+		    finalResult = TCL_ERROR;
+		    goto clean_and_return;
+		}
+	    }
+	    if (compositePlan.lowRow != NULL) {
+		if (ctable_CopyIndexField (interp, ctable, compositePlan.lowRow, compositeRow1, f->compositeFields[nEqual]) == TCL_ERROR) {
+		    finalResult = TCL_ERROR;
+		    goto clean_and_return;
+		}
+	    }
+	    if (compositePlan.highRow != NULL) {
+		if (ctable_CopyIndexField (interp, ctable, compositePlan.highRow, compositeRow2, f->compositeFields[nEqual]) == TCL_ERROR) {
+		    finalResult = TCL_ERROR;
+		    goto clean_and_return;
+		}
+	    }
+	    row1 = compositeRow1;
+	    row2 = compositeRow2;
+
+	    // start at the low end of the range, or failing that the first
+	    // row with the leading fields' values
+	    if (compositePlan.lowRow != NULL) {
+		startCompareFunction = f->prefixCompareFunctions[nEqual];
+		skipStart = compositePlan.lowInclusive ? SKIP_START_GE_ROW1 : SKIP_START_GT_ROW1;
+	    } else if (nEqual > 0) {
+		startCompareFunction = f->prefixCompareFunctions[nEqual - 1];
+		skipStart = SKIP_START_GE_ROW1;
+	    } else {
+		startCompareFunction = f->prefixCompareFunctions[0];
+		skipStart = SKIP_START_RESET;
+	    }
+
+	    // and stop at the high end of the range, or the last row with the
+	    // leading fields' values
+	    if (compositePlan.highRow != NULL) {
+		compareFunction = f->prefixCompareFunctions[nEqual];
+		skipEnd = compositePlan.highInclusive ? SKIP_END_GT_ROW2 : SKIP_END_GE_ROW2;
+	    } else if (nEqual > 0) {
+		compareFunction = f->prefixCompareFunctions[nEqual - 1];
+		skipEnd = SKIP_END_GT_ROW1;
+	    } else {
+		compareFunction = f->prefixCompareFunctions[0];
+		skipEnd = SKIP_END_NONE;
+	    }
+	}
+    }
+
+    // Bitmap indexes narrow the search by all of the comparisons on their
+    // fields at once
+    if (search->reqIndexField == CTABLE_SEARCH_INDEX_ANY && search->nComponents > 0 && ctable->bitmaps != NULL && walkType != WALK_HASH_EQ && walkType != WALK_HASH_IN) {
+	switch (ctable_BitmapSearch (interp, ctable, search, walkType != WALK_DEFAULT, &bitmapRows, &nBitmapRows, &bitmapExact)) {
+	    case -1: {
+		finalResult = TCL_ERROR;
+		goto clean_and_return;
+	    }
+	    case 1: {
+		walkType = WALK_BITMAP;
+		inOrderWalk = 0;
+		skipList = NULL;
+		search->searchField = -1;
+		search->alreadySearched = -1;
+		break;
+	    }
+	}
+    }
+
+    // Or two or more indexes can narrow it together, by the rows every
+    // one of them finds
+    if (search->reqIndexField == CTABLE_SEARCH_INDEX_ANY && walkType != WALK_HASH_EQ && walkType != WALK_HASH_IN && walkType != WALK_BITMAP) {
+	switch (ctable_IntersectSearch (interp, ctable, search, bestCost, matches, compareCost, &intersectRows, &nIntersectRows, &intersectExact)) {
+	    case -1: {
+		finalResult = TCL_ERROR;
+		goto clean_and_return;
+	    }
+	    case 1: {
+		walkType = WALK_INTERSECT;
+		inOrderWalk = 0;
+		skipList = NULL;
+		search->searchField = -1;
+		search->alreadySearched = -1;
+		break;
+	    }
+	}
+    }
+
+    if (walkType == WALK_SKIP) {
+	ctable_CountIndexSearch (ctable, skipField);
+    }
+
+    // If the walk answers every comparison by itself the rows it finds
+    // don't need comparing, and can be counted without looking at them
+    if (walkType == WALK_SKIP && skipNext == SKIP_NEXT_ROW) {
+	if (skipField >= creator->nFields) {
+	    search->indexOnly = (compositePlan.nUsed == search->nComponents);
+	} else {
+	    search->indexOnly = (search->nComponents == 1 && search->alreadySearched == 0 && search->components[0].comparisonType != CTABLE_COMP_MATCH_CASE);
+	}
+    } else if (walkType == WALK_BITMAP) {
+	search->indexOnly = bitmapExact;
+    } else if (walkType == WALK_INTERSECT) {
+	search->indexOnly = intersectExact;
+    }
+
+    // a single field's index is positioned the same way it's walked
+    if (startCompareFunction == NULL) {
+	startCompareFunction = compareFunction;
+    }
+
 
     // if we're sorting on the field we're searching, AND we can eliminate
     // the sort because we know we're walking in order, then eliminate the
     // sort step
     if (inOrderWalk) {
-        if (search->sortControl.nFields == 1) {
+        if (skipField >= creator->nFields) {
+	    if (ctable_CompositeSorts (search, creator->fields[skipField], compositePlan.nEqual)) {
+		search->sortControl.nFields = 0;
+	    }
+	} else if (search->sortControl.nFields == 1) {
 	    if(sortField == skipField) {
 		search->sortControl.nFields = 0;
 	    }
@@ -1623,37 +4036,152 @@ restart_search:
     // Prepare transaction buffering if necessary
     ctable_PrepareTransactions(ctable, search);
 
-    // Prepare for background operations
-    if(search->pollInterval) search->nextPoll = search->pollInterval;
+    // Prepare for background operations
+    if(search->pollInterval) search->nextPoll = search->pollInterval;
+
+#ifdef INDEXDEBUG
+fprintf(stderr, "Starting search.\n");
+fprintf(stderr, "  walkType == %d\n", walkType);
+fprintf(stderr, "  sortField == %d\n", sortField);
+fprintf(stderr, "  skipField == %d\n", skipField);
+fprintf(stderr, "  skipList == 0x%0ld\n", (long)skipList);
+if(skipList) {
+fprintf(stderr, "    skipNext == %d\n", skipNext);
+fprintf(stderr, "    skipStart == %d\n", skipStart);
+fprintf(stderr, "    skipEnd == %d\n", skipEnd);
+}
+fprintf(stderr, "  search->sortControl.nFields == %d\n", search->sortControl.nFields);
+int ii;
+fprintf(stderr, "  search->nComponents == %d\n", search->nComponents);
+for(ii = 0; ii < search->nComponents; ii++) {
+CTableSearchComponent *component = &search->components[ii];
+fprintf(stderr, "    search->components[%d].fieldID == %d\n", ii, component->fieldID);
+fprintf(stderr, "    search->components[%d].comparisonType == %d\n", ii, component->comparisonType);
+}
+#endif
+
+    if (walkType == WALK_DEFAULT) {
+	CTableSearch advisorSearch;
+	long         examined = 0;
+#ifdef TCL_THREADS
+	int          nThreads;
+#endif
+#ifdef INDEXDEBUG
+fprintf(stderr, "WALK_DEFAULT\n");
+#endif
+	// if the index advisor is running, count what an index would
+	// have saved
+	advisorAccepted = ctable_AdvisorStart (ctable, search, &advisorSearch);
+
+#ifdef TCL_THREADS
+	// the index advisor looks at every row as it goes, so it doesn't
+	// get a parallel scan
+	if (advisorAccepted == NULL && (nThreads = ctable_ParallelScanThreads (ctable, search)) > 1) {
+	    compareResult = ctable_ParallelScan (interp, ctable, search, nThreads);
+	    if (compareResult == TCL_ERROR) {
+		finalResult = TCL_ERROR;
+		goto clean_and_return;
+	    }
+	    if (compareResult == TCL_RETURN) {
+		finalResult = TCL_RETURN;
+	    }
+	    goto search_complete;
+	}
+#endif
+
+	// walk the hash table links.
+	CTABLE_LIST_FOREACH (ctable->ll_head, row, 0) {
+	    if (advisorAccepted != NULL) {
+		ctable_AdvisorCompare (interp, ctable, search, &advisorSearch, row, advisorAccepted);
+		examined++;
+	    }
+
+	    compareResult = ctable_SearchCompareRow (interp, ctable, search, row);
+	    if ((compareResult == TCL_CONTINUE) || (compareResult == TCL_OK))
+		continue;
+
+	    if (compareResult == TCL_BREAK)
+		break;
+
+	    if (compareResult == TCL_RETURN) {
+		finalResult = TCL_RETURN;
+		break;
+	    }
+
+	    if (compareResult == TCL_ERROR) {
+		finalResult = TCL_ERROR;
+		goto clean_and_return;
+	    }
+        }
+
+	if (advisorAccepted != NULL) {
+	    ctable_AdvisorRecord (ctable, search, examined, advisorAccepted);
+	}
+    } else if(walkType == WALK_BITMAP) {
+#ifdef INDEXDEBUG
+fprintf(stderr, "WALK_BITMAP\n");
+#endif
+	// if the bitmaps answered everything, the rows they left can be
+	// counted or skipped past the same as a counted index's
+	if (search->indexOnly && search->tranTable == NULL
+	    && search->nFilters == 0
+	    && search->pattern == NULL && search->pollInterval == 0) {
+	    if (search->action == CTABLE_SEARCH_ACTION_NONE || (size_t)search->offset >= nBitmapRows) {
+		search->matchCount = nBitmapRows;
+		if (search->limit != 0 && search->matchCount > search->offsetLimit)
+		    search->matchCount = search->offsetLimit;
+		goto search_complete;
+	    }
+
+	    bitmapIndex = (size_t)search->offset;
+	    search->matchCount = search->offset;
+	}
+
+	// look at just the rows the bitmaps left, rows can't be deleted
+	// while a search is going so they're all still there
+	for (; bitmapIndex < nBitmapRows; bitmapIndex++) {
+	    row = ctable->rowNumbers->rows[bitmapRows[bitmapIndex]];
+
+	    compareResult = ctable_SearchCompareRow (interp, ctable, search, row);
+	    if ((compareResult == TCL_CONTINUE) || (compareResult == TCL_OK))
+		continue;
+
+	    if (compareResult == TCL_BREAK)
+		break;
+
+	    if (compareResult == TCL_RETURN) {
+		finalResult = TCL_RETURN;
+		break;
+	    }
 
+	    if (compareResult == TCL_ERROR) {
+		finalResult = TCL_ERROR;
+		goto clean_and_return;
+	    }
+	}
+    } else if(walkType == WALK_INTERSECT) {
 #ifdef INDEXDEBUG
-fprintf(stderr, "Starting search.\n");
-fprintf(stderr, "  walkType == %d\n", walkType);
-fprintf(stderr, "  sortField == %d\n", sortField);
-fprintf(stderr, "  skipField == %d\n", skipField);
-fprintf(stderr, "  skipList == 0x%0ld\n", (long)skipList);
-if(skipList) {
-fprintf(stderr, "    skipNext == %d\n", skipNext);
-fprintf(stderr, "    skipStart == %d\n", skipStart);
-fprintf(stderr, "    skipEnd == %d\n", skipEnd);
-}
-fprintf(stderr, "  search->sortControl.nFields == %d\n", search->sortControl.nFields);
-int ii;
-fprintf(stderr, "  search->nComponents == %d\n", search->nComponents);
-for(ii = 0; ii < search->nComponents; ii++) {
-CTableSearchComponent *component = &search->components[ii];
-fprintf(stderr, "    search->components[%d].fieldID == %d\n", ii, component->fieldID);
-fprintf(stderr, "    search->components[%d].comparisonType == %d\n", ii, component->comparisonType);
-}
+fprintf(stderr, "WALK_INTERSECT\n");
 #endif
+	// if the indexes answered everything, the rows they found can be
+	// counted or skipped past without looking at them
+	if (search->indexOnly && search->tranTable == NULL
+	    && search->nFilters == 0
+	    && search->pattern == NULL && search->pollInterval == 0) {
+	    if (search->action == CTABLE_SEARCH_ACTION_NONE || (size_t)search->offset >= nIntersectRows) {
+		search->matchCount = nIntersectRows;
+		if (search->limit != 0 && search->matchCount > search->offsetLimit)
+		    search->matchCount = search->offsetLimit;
+		goto search_complete;
+	    }
 
-    if (walkType == WALK_DEFAULT) {
-#ifdef INDEXDEBUG
-fprintf(stderr, "WALK_DEFAULT\n");
-#endif
-	// walk the hash table links.
-	CTABLE_LIST_FOREACH (ctable->ll_head, row, 0) {
-	    compareResult = ctable_SearchCompareRow (interp, ctable, search, row);
+	    intersectIndex = (size_t)search->offset;
+	    search->matchCount = search->offset;
+	}
+
+	// look at just the rows every index found
+	for (; intersectIndex < nIntersectRows; intersectIndex++) {
+	    compareResult = ctable_SearchCompareRow (interp, ctable, search, intersectRows[intersectIndex]);
 	    if ((compareResult == TCL_CONTINUE) || (compareResult == TCL_OK))
 		continue;
 
@@ -1669,7 +4197,7 @@ fprintf(stderr, "WALK_DEFAULT\n");
 		finalResult = TCL_ERROR;
 		goto clean_and_return;
 	    }
-        }
+	}
     } else if(walkType == WALK_HASH_EQ || walkType == WALK_HASH_IN) {
 #ifdef INDEXDEBUG
 fprintf(stderr, "WALK_HASH_*\n");
@@ -1685,6 +4213,14 @@ fprintf(stderr, "WALK_HASH_*\n");
 		key = Tcl_GetString(inListObj[inIndex++]);
 
 	    // Look it up
+#ifdef WITH_SHARED_TABLES
+	    if(ctable->share_type == CTABLE_SHARED_READER) {
+		if(ctable_ReaderFindRow(interp, ctable, key, &row2) == TCL_ERROR) {
+		    finalResult = TCL_ERROR;
+		    goto clean_and_return;
+		}
+	    } else
+#endif
 	    row2 = creator->find_row(ctable, key);
 
 	    // Throw away this key
@@ -1748,9 +4284,10 @@ fprintf(stderr, "WALK_SKIP\n");
 	    main_restart.skipStart = skipStart;
 	    main_restart.skipEnd = skipEnd;
 	    main_restart.compareFunction = compareFunction;
+	    main_restart.startCompareFunction = startCompareFunction;
 
-	    // clone the skiplist
-	    skipListCopy = jsw_private_copy(skipList, getpid(), compareFunction);
+	    // clone the skiplist, it keeps its own order
+	    skipListCopy = jsw_private_copy(skipList, getpid(), creator->fields[skipField]->compareFunction, creator->fields[skipField]->hashFunction);
 	    if(skipListCopy)
 		skipList = skipListCopy;
 	}
@@ -1767,17 +4304,22 @@ if(!row1) Tcl_Panic("Can't happen! Row1 is null for '=' comparison.");
 
 	    case SKIP_START_GE_ROW1: {
 if(!row1) Tcl_Panic("Can't happen! Row1 is null for '>=' comparison.");
-		jsw_sfind_equal_or_greater (skipList, row1);
+		jsw_sfind_equal_or_greater (skipList, row1, startCompareFunction);
 		break;
 	    }
 
 	    case SKIP_START_GT_ROW1: {
 if(!row1) Tcl_Panic("Can't happen! Row1 is null for '>' comparison.");
-		jsw_sfind_equal_or_greater (skipList, row1);
+		jsw_sfind_equal_or_greater (skipList, row1, startCompareFunction);
 		while (1) {
-                    if ((row = jsw_srow (skipList)) == NULL)
+                    row = jsw_srow (skipList);
+#ifdef WITH_SHARED_TABLES
+		    if (main_cycle != LOST_HORIZON && !jsw_svalid (skipList))
+			goto restart_search;
+#endif
+                    if (row == NULL)
 		        goto search_complete;
-	    	    if (compareFunction (row, row1) > 0)
+	    	    if (startCompareFunction (row, row1) > 0)
 			break;
 		    jsw_snext(skipList);
 		}
@@ -1794,6 +4336,53 @@ if(!row1) Tcl_Panic("Can't happen! Row1 is null for '>' comparison.");
 	    }
 	}
 
+	// If the index is the only thing to check, every row in the range
+	// matches, and an index that counts its rows can tell how many
+	// there are or skip past the offset without walking them.
+	if (search->indexOnly && search->tranTable == NULL
+	    && search->nFilters == 0
+	    && search->pattern == NULL && search->pollInterval == 0
+	    && jsw_scounted (skipList)) {
+	    size_t start = jsw_srank (skipList);
+	    size_t end;
+	    size_t total;
+
+	    switch(skipEnd) {
+		case SKIP_END_GE_ROW1: {
+		    end = jsw_sposition (skipList, row1, 0, compareFunction);
+		    break;
+		}
+		case SKIP_END_GT_ROW1: {
+		    end = jsw_sposition (skipList, row1, 1, compareFunction);
+		    break;
+		}
+		case SKIP_END_GE_ROW2: {
+		    end = jsw_sposition (skipList, (ctable_BaseRow *)row2, 0, compareFunction);
+		    break;
+		}
+		case SKIP_END_GT_ROW2: {
+		    end = jsw_sposition (skipList, (ctable_BaseRow *)row2, 1, compareFunction);
+		    break;
+		}
+		default: {
+		    end = jsw_ssize (skipList);
+		}
+	    }
+	    total = end > start ? end - start : 0;
+
+	    if (search->action == CTABLE_SEARCH_ACTION_NONE || (size_t)search->offset >= total) {
+		search->matchCount = total;
+		if (search->limit != 0 && search->matchCount > search->offsetLimit)
+		    search->matchCount = search->offsetLimit;
+		goto search_complete;
+	    }
+
+	    if (search->offset > 0) {
+		skipRows = jsw_sseek (skipList, start + search->offset);
+		search->matchCount = search->offset;
+	    }
+	}
+
 #ifdef MEGADEBUG
 #ifdef WITH_SHARED_TABLES
 if(ctable->share_type == CTABLE_SHARED_READER)
@@ -1827,11 +4416,23 @@ if(!row) Tcl_Panic("Can't happen, null row in 'in' comparison");
 		  // If there's a match for this row, break out of the loop
                   if (jsw_sfind (skipList, row) != NULL)
 		      break;
+#ifdef WITH_SHARED_TABLES
+		  // a miss may only be the master moving things about
+		  if (main_cycle != LOST_HORIZON && !jsw_svalid (skipList))
+		      goto restart_search;
+#endif
 	        }
 	    }
 
 	    // Now we can fetch whatever we found.
-            if ((row = jsw_srow (skipList)) == NULL)
+            row = jsw_srow (skipList);
+#ifdef WITH_SHARED_TABLES
+	    // A B+tree can't follow the master's changes the way a skip
+	    // list can, if the master moved what we just read start over
+	    if (main_cycle != LOST_HORIZON && !jsw_svalid (skipList))
+		goto restart_search;
+#endif
+            if (row == NULL)
 		goto search_complete;
 #ifdef SANITY_CHECKS
 	creator->sanity_check_pointer(ctable, (void *)row, CTABLE_INDEX_NORMAL, "ctablePerformSearch : row");
@@ -1865,7 +4466,8 @@ if(num_restarts == 0) fprintf(stderr, "%d: main restart: main_cycle=%ld; row->_r
 	        loop_restart.row2 = row;
 	        loop_restart.skipStart = SKIP_START_EQ_ROW1;
 	        loop_restart.skipEnd = SKIP_END_NE_ROW1;
-	        loop_restart.compareFunction = compareFunction;
+	        loop_restart.compareFunction = creator->fields[skipField]->compareFunction;
+	        loop_restart.startCompareFunction = loop_restart.compareFunction;
 	    }
 #endif
 
@@ -1886,6 +4488,11 @@ if(num_restarts == 0) fprintf(stderr, "%d: main restart: main_cycle=%ld; row->_r
 			goto search_complete;
 		    break;
 		}
+	        case SKIP_END_GT_ROW2: {
+		    if (compareFunction (row, row2) > 0)
+			goto search_complete;
+		    break;
+		}
 		default: {
 		    // may not be a terminating condition, or it may
 		    // have been taken care of above
@@ -1899,6 +4506,12 @@ if(num_restarts == 0) fprintf(stderr, "%d: main restart: main_cycle=%ld; row->_r
 
             CTABLE_LIST_FOREACH (row, walkRow, indexNumber) {
 
+		// rows the offset skipped in the node we landed in
+		if (skipRows > 0) {
+		    skipRows--;
+		    continue;
+		}
+
 #ifdef WITH_SHARED_TABLES
 		// If we're a reader and this row has changed since we started
 		// then check if it changed the list we're following, if so...
@@ -1973,6 +4586,26 @@ if(num_restarts == 0) fprintf(stderr, "%d: loop restart: loop_cycle=%ld; row->_r
 	search->tranTable = NULL;
     }
 
+    if (compositeRow1) {
+	creator->delete_row (ctable, compositeRow1, CTABLE_INDEX_PRIVATE);
+    }
+    if (compositeRow2) {
+	creator->delete_row (ctable, compositeRow2, CTABLE_INDEX_PRIVATE);
+    }
+
+    if (intersectRows) {
+	ckfree ((char *)intersectRows);
+	intersectRows = NULL;
+    }
+
+    if (bitmapRows) {
+	ckfree ((char *)bitmapRows);
+    }
+
+    if (advisorAccepted) {
+	ckfree ((char *)advisorAccepted);
+    }
+
     if (finalResult != TCL_ERROR && (search->codeBody == NULL || finalResult != TCL_RETURN)) {
 	if(search->cursor) {
 	    // We got here so we can create the command
@@ -2019,12 +4652,12 @@ ctable_SetupSearch (Tcl_Interp *interp, CTable *ctable, Tcl_Obj *CONST objv[], i
 
     static int staticSequence = 0;
 
-    static CONST char *searchOptions[] = {"-array", "-array_with_nulls", "-array_get", "-array_get_with_nulls", "-code", "-compare", "-countOnly", "-fields", "-get", "-glob", "-key", "-with_field_names", "-limit", "-nokeys", "-offset", "-sort", "-write_tabsep", "-tab", "-delete", "-update", "-buffer", "-index", "-poll_code", "-poll_interval", "-quote", "-null", "-filter", "-cursor", (char *)NULL};
+    static CONST char *searchOptions[] = {"-array", "-array_with_nulls", "-array_get", "-array_get_with_nulls", "-code", "-compare", "-countOnly", "-fields", "-get", "-glob", "-key", "-with_field_names", "-limit", "-nokeys", "-offset", "-sort", "-write_tabsep", "-tab", "-delete", "-update", "-buffer", "-index", "-poll_code", "-poll_interval", "-quote", "-null", "-filter", "-cursor", "-threads", (char *)NULL};
 
-    enum searchOptions {SEARCH_OPT_ARRAY_NAMEOBJ, SEARCH_OPT_ARRAYWITHNULLS_NAMEOBJ, SEARCH_OPT_ARRAYGET_NAMEOBJ, SEARCH_OPT_ARRAYGETWITHNULLS_NAMEOBJ, SEARCH_OPT_CODE, SEARCH_OPT_COMPARE, SEARCH_OPT_COUNTONLY, SEARCH_OPT_FIELDS, SEARCH_OPT_GET_NAMEOBJ, SEARCH_OPT_GLOB, SEARCH_OPT_KEYVAR_NAMEOBJ, SEARCH_OPT_WITH_FIELD_NAMES, SEARCH_OPT_LIMIT, SEARCH_OPT_DONT_INCLUDE_KEY, SEARCH_OPT_OFFSET, SEARCH_OPT_SORT, SEARCH_OPT_WRITE_TABSEP, SEARCH_OPT_TAB, SEARCH_OPT_DELETE, SEARCH_OPT_UPDATE, SEARCH_OPT_BUFFER, SEARCH_OPT_INDEX, SEARCH_OPT_POLL_CODE, SEARCH_OPT_POLL_INTERVAL, SEARCH_OPT_QUOTE_TYPE, SEARCH_OPT_NULL_STRING, SEARCH_OPT_FILTER, SEARCH_OPT_CURSOR};
+    enum searchOptions {SEARCH_OPT_ARRAY_NAMEOBJ, SEARCH_OPT_ARRAYWITHNULLS_NAMEOBJ, SEARCH_OPT_ARRAYGET_NAMEOBJ, SEARCH_OPT_ARRAYGETWITHNULLS_NAMEOBJ, SEARCH_OPT_CODE, SEARCH_OPT_COMPARE, SEARCH_OPT_COUNTONLY, SEARCH_OPT_FIELDS, SEARCH_OPT_GET_NAMEOBJ, SEARCH_OPT_GLOB, SEARCH_OPT_KEYVAR_NAMEOBJ, SEARCH_OPT_WITH_FIELD_NAMES, SEARCH_OPT_LIMIT, SEARCH_OPT_DONT_INCLUDE_KEY, SEARCH_OPT_OFFSET, SEARCH_OPT_SORT, SEARCH_OPT_WRITE_TABSEP, SEARCH_OPT_TAB, SEARCH_OPT_DELETE, SEARCH_OPT_UPDATE, SEARCH_OPT_BUFFER, SEARCH_OPT_INDEX, SEARCH_OPT_POLL_CODE, SEARCH_OPT_POLL_INTERVAL, SEARCH_OPT_QUOTE_TYPE, SEARCH_OPT_NULL_STRING, SEARCH_OPT_FILTER, SEARCH_OPT_CURSOR, SEARCH_OPT_THREADS};
     if (objc < 2) {
       wrong_args:
-	Tcl_WrongNumArgs (interp, 2, objv, "?-array_get varName? ?-array_get_with_nulls varName? ?-code codeBody? ?-compare list? ?-filter list? ?-countOnly 0|1? ?-fields fieldList? ?-get varName? ?-glob pattern? ?-key varName? ?-with_field_names 0|1?  ?-limit limit? ?-nokeys 0|1? ?-offset offset? ?-sort {?-?field1..}? ?-write_tabsep channel? ?-tab value? ?-delete 0|1? ?-update {fields value...}? ?-buffer 0|1? ?-poll_interval interval? ?-poll_code codeBody? ?-quote type?");
+	Tcl_WrongNumArgs (interp, 2, objv, "?-array_get varName? ?-array_get_with_nulls varName? ?-code codeBody? ?-compare list? ?-filter list? ?-countOnly 0|1? ?-fields fieldList? ?-get varName? ?-glob pattern? ?-key varName? ?-with_field_names 0|1?  ?-limit limit? ?-nokeys 0|1? ?-offset offset? ?-sort {?-?field1..}? ?-write_tabsep channel? ?-tab value? ?-delete 0|1? ?-update {fields value...}? ?-buffer 0|1? ?-poll_interval interval? ?-poll_code codeBody? ?-quote type? ?-threads count?");
 	return TCL_ERROR;
     }
 
@@ -2067,6 +4700,7 @@ ctable_SetupSearch (Tcl_Interp *interp, CTable *ctable, Tcl_Obj *CONST objv[], i
     search->pollInterval = 0;
     search->nextPoll = -1;
     search->pollCodeBody = NULL;
+    search->threads = 0;
     search->sortControl.fields = NULL;
     search->sortControl.directions = NULL;
     search->sortControl.nFields = 0;
@@ -2086,7 +4720,9 @@ ctable_SetupSearch (Tcl_Interp *interp, CTable *ctable, Tcl_Obj *CONST objv[], i
     search->quoteType = CTABLE_QUOTE_NONE;
     search->matchCount = 0;
     search->alreadySearched = -1;
+    search->indexOnly = 0;
     search->tranTable = NULL;
+    search->topRows = 0;
     search->offsetLimit = search->offset + search->limit;
     search->cursorName = NULL;
     search->cursor = NULL;
@@ -2285,6 +4921,19 @@ ctable_SetupSearch (Tcl_Interp *interp, CTable *ctable, Tcl_Obj *CONST objv[], i
 	    break;
 	  }
 	
+	  case SEARCH_OPT_THREADS: {
+	    if (Tcl_GetIntFromObj (interp, objv[i++], &search->threads) == TCL_ERROR) {
+	        Tcl_AppendResult (interp, " while processing threads option", (char *) NULL);
+	        return TCL_ERROR;
+	    }
+
+	    if (search->threads < 0) {
+		Tcl_AppendResult (interp, "threads must be zero or more", (char *) NULL);
+		return TCL_ERROR;
+	    }
+	    break;
+	  }
+
 	  case SEARCH_OPT_DELETE: {
 	    int do_delete;
 	    if (Tcl_GetIntFromObj (interp, objv[i++], &do_delete) == TCL_ERROR) {
@@ -2717,6 +5366,12 @@ ctable_DropIndex (CTable *ctable, int field, int final) {
     // Delete the skiplist
     jsw_sdelete_skiplist (skip, final);
 
+    // and the bitmaps alongside it, the rows keep their numbers
+    if (ctable->bitmaps != NULL && ctable->bitmaps[field] != NULL) {
+	ctable_BitmapIndexDelete (ctable->bitmaps[field]);
+	ctable->bitmaps[field] = NULL;
+    }
+
     // Don't need to reset the bucket list if it's just going to be deleted
     if(final) return;
 
@@ -2737,11 +5392,28 @@ CTABLE_INTERNAL void
 ctable_DropAllIndexes (CTable *ctable, int final) {
     int field;
 
-    for (field = 0; field < ctable->creator->nFields; field++) {
+    for (field = 0; field < ctable->creator->nIndexes; field++) {
         ctable_DropIndex (ctable, field, final);
     }
 }
 
+//
+// ctable_FreeRowNumbers - free the bitmap indexes' row numbering once all of
+// the rows are gone
+//
+CTABLE_INTERNAL void
+ctable_FreeRowNumbers (CTable *ctable) {
+    if (ctable->rowNumbers != NULL) {
+	ctable_RowNumbersDelete (ctable->rowNumbers);
+	ctable->rowNumbers = NULL;
+    }
+
+    if (ctable->bitmaps != NULL) {
+	ckfree ((char *)ctable->bitmaps);
+	ctable->bitmaps = NULL;
+    }
+}
+
 //
 // ctable_IndexCount -- set the Tcl interpreter obj result to the
 //                      number of items in the index
@@ -2771,6 +5443,7 @@ ctable_DumpIndex (CTable *ctable, int field) {
     ctable_BaseRow *row;
     Tcl_Obj    *utilityObj = Tcl_NewObj ();
     CONST char *s;
+    int         stringField = field;
 
     if (skip == NULL) {
         return TCL_OK;
@@ -2778,8 +5451,13 @@ ctable_DumpIndex (CTable *ctable, int field) {
 
     jsw_dump_head (skip);
 
+    // a composite index shows its leading field
+    if (field >= ctable->creator->nFields) {
+        stringField = ctable->creator->fields[field]->compositeFields[0];
+    }
+
     for (jsw_sreset (skip); (row = jsw_srow (skip)) != NULL; jsw_snext(skip)) {
-        s = ctable->creator->get_string (row, field, NULL, utilityObj);
+        s = ctable->creator->get_string (row, stringField, NULL, utilityObj);
 	jsw_dump (s, skip, ctable->creator->fields[field]->indexNumber);
     }
 
@@ -2789,6 +5467,31 @@ ctable_DumpIndex (CTable *ctable, int field) {
 }
 
 
+//
+// ctable_LappendIndexValue - append a row's value in an index to a list, a
+// field's value, or for a composite index a list of its fields' values
+//
+static int
+ctable_LappendIndexValue (Tcl_Interp *interp, CTable *ctable, Tcl_Obj *listObj, ctable_BaseRow *row, int field) {
+    ctable_FieldInfo *f = ctable->creator->fields[field];
+    Tcl_Obj          *valueObj;
+    int               i;
+
+    if (field < ctable->creator->nFields) {
+        return ctable->creator->lappend_field (interp, listObj, row, field);
+    }
+
+    valueObj = Tcl_NewObj ();
+    for (i = 0; i < f->nCompositeFields; i++) {
+	if (ctable->creator->lappend_field (interp, valueObj, row, f->compositeFields[i]) == TCL_ERROR) {
+	    Tcl_DecrRefCount (valueObj);
+	    return TCL_ERROR;
+	}
+    }
+
+    return Tcl_ListObjAppendElement (interp, listObj, valueObj);
+}
+
 //
 // ctable_ListIndex - return a list of all of the index values 
 //
@@ -2807,7 +5510,7 @@ ctable_ListIndex (Tcl_Interp *interp, CTable *ctable, int fieldNum) {
 
     for (jsw_sreset (skip); (p = jsw_srow (skip)) != NULL; jsw_snext(skip)) {
 
-        if (ctable->creator->lappend_field (interp, resultObj, p, fieldNum) == TCL_ERROR) {
+        if (ctable_LappendIndexValue (interp, ctable, resultObj, p, fieldNum) == TCL_ERROR) {
 	    Tcl_AppendResult (interp, " while walking index fields", (char *) NULL);
 	    return TCL_ERROR;
 	}
@@ -2816,6 +5519,77 @@ ctable_ListIndex (Tcl_Interp *interp, CTable *ctable, int fieldNum) {
     return TCL_OK;
 }
 
+//
+// ctable_FieldIsNull - is the field of the row null, asked of the table's
+// own search compare since nothing else knows
+//
+static int
+ctable_FieldIsNull (CTable *ctable, ctable_BaseRow *row, int field) {
+    CTableSearchComponent component;
+    CTableSearch          one;
+
+    memset (&component, 0, sizeof component);
+    component.fieldID = field;
+    component.comparisonType = CTABLE_COMP_NULL;
+
+    memset (&one, 0, sizeof one);
+    one.ctable = ctable;
+    one.components = &component;
+    one.nComponents = 1;
+    one.alreadySearched = -1;
+
+    return (*ctable->creator->search_compare) (NULL, &one, row) == TCL_OK;
+}
+
+//
+// ctable_BitmapIndexAddRow - put the row in the field's bitmaps, by its
+// value or by the trigrams of its string
+//
+static void
+ctable_BitmapIndexAddRow (CTable *ctable, int field, ctable_BaseRow *row) {
+    ctable_BitmapIndex *index = ctable->bitmaps[field];
+    unsigned int        number = ctable_RowNumberAssign (ctable->rowNumbers, row);
+    const char         *string;
+    int                 length;
+
+    if (index->trigrams == NULL) {
+	ctable_BitmapIndexInsert (index, ctable->creator->fields[field]->compareFunction, row, number);
+	return;
+    }
+
+    // a null can't match anything, and its string can change after it's
+    // indexed
+    if (ctable_FieldIsNull (ctable, row, field)) {
+	return;
+    }
+
+    string = ctable->creator->get_string (row, field, &length, NULL);
+    ctable_TrigramIndexInsert (index, string, length, number);
+}
+
+//
+// ctable_BitmapIndexRemoveRow - take the row out of the field's bitmaps,
+// before its value changes
+//
+static void
+ctable_BitmapIndexRemoveRow (CTable *ctable, int field, ctable_BaseRow *row) {
+    ctable_BitmapIndex *index = ctable->bitmaps[field];
+    const char         *string;
+    int                 length;
+
+    if (index->trigrams == NULL) {
+	ctable_BitmapIndexErase (index, ctable->creator->fields[field]->compareFunction, ctable->rowNumbers, row);
+	return;
+    }
+
+    if (row->_rowNumber == 0 || ctable_FieldIsNull (ctable, row, field)) {
+	return;
+    }
+
+    string = ctable->creator->get_string (row, field, &length, NULL);
+    ctable_TrigramIndexErase (index, string, length, row->_rowNumber);
+}
+
 CTABLE_INTERNAL INLINE void
 ctable_RemoveFromIndex (CTable *ctable, void *vRow, int field) {
     jsw_skip_t *skip = ctable->skipLists[field];
@@ -2841,20 +5615,12 @@ if(field == TRACKFIELD) {
 //printf("not in list\n");
 	return;
     }
-    if (ctable_ListRemoveMightBeTheLastOne (row, index)) {
-//printf("i might be the last one, field %d\n", field);
-        // it might be the last one, see if it really was
-//printf ("row->_ll_nodes[index].head %lx\n", (long unsigned int)row->_ll_nodes[index].head);
-	if (*row->_ll_nodes[index].head == NULL) {
-//printf("erasing last entry field %d\n", field);
-            // put the pointer back so the compare routine will have
-	    // something to match
-            *row->_ll_nodes[index].head = row;
-	    if (!jsw_serase (skip, row)) {
-		fprintf (stderr, "Attempted to remove non-existent field %s\n", ctable->creator->fields[field]->name);
-	    }
-	    *row->_ll_nodes[index].head = NULL; // don't think this is needed, but do it anyway
-	}
+    if (!jsw_serase_linked (skip, row, index)) {
+	fprintf (stderr, "Attempted to remove non-existent field %s\n", ctable->creator->fields[field]->name);
+    }
+
+    if (ctable->bitmaps != NULL && ctable->bitmaps[field] != NULL) {
+	ctable_BitmapIndexRemoveRow (ctable, field, row);
     }
 #ifdef SEARCHDEBUG
 if(field == TRACKFIELD) {
@@ -2883,11 +5649,16 @@ ctable_RemoveFromAllIndexes (CTable *ctable, ctable_BaseRow *row) {
     // NB slightly gross, we shouldn't have to look at all of the fields
     // to even see which ones could be indexed but the programmer is
     // in a hurry
-    for (field = 0; field < ctable->creator->nFields; field++) {
+    for (field = 0; field < ctable->creator->nIndexes; field++) {
 	if (ctable->skipLists[field] != NULL) {
 	    ctable_RemoveFromIndex (ctable, row, field);
 	}
     }
+
+    // it's on its way out, its number can go to a new row
+    if (ctable->rowNumbers != NULL) {
+	ctable_RowNumberRelease (ctable->rowNumbers, row);
+    }
 }
 
 //
@@ -2912,6 +5683,15 @@ ctable_InsertIntoIndex (Tcl_Interp *interp, CTable *ctable, ctable_BaseRow *row,
 	Tcl_Panic ("Double insert row for field %s", ctable->creator->fields[field]->name);
     }
 
+    // a partial index leaves out the rows that don't match its where
+    if (creator->fields[field]->where != NULL) {
+	int result = ctable_IndexWhereMatches (interp, ctable, row, field);
+
+	if (result != TCL_OK) {
+	    return (result == TCL_CONTINUE) ? TCL_OK : TCL_ERROR;
+	}
+    }
+
 #ifdef SANITY_CHECKS
     creator->sanity_check_pointer(ctable, (void *)row, CTABLE_INDEX_NORMAL, "ctable_InsertIntoIndex : row");
     creator->sanity_check_pointer(ctable, (void *)skip, CTABLE_INDEX_NORMAL, "ctable_InsertIntoIndex : skip");
@@ -2939,6 +5719,10 @@ if(field == TRACKFIELD) {
         return TCL_ERROR;
     }
 
+    if (ctable->bitmaps != NULL && ctable->bitmaps[field] != NULL) {
+	ctable_BitmapIndexAddRow (ctable, field, row);
+    }
+
 # ifdef SEARCHDEBUG
     // ctable_verifyField(ctable, field, 0);
 if(field == TRACKFIELD) {
@@ -2951,6 +5735,61 @@ fflush(stdout);
     return TCL_OK;
 }
 
+//
+// ctable_NewBitmapIndex - make the empty bitmaps for a bitmap index, and the
+// row numbering they're over if this is the table's first
+//
+static void
+ctable_NewBitmapIndex (CTable *ctable, int field) {
+    int i;
+
+    if (ctable->bitmaps == NULL) {
+	ctable->bitmaps = (ctable_BitmapIndex **)ckalloc (ctable->creator->nIndexes * sizeof (ctable_BitmapIndex *));
+	for (i = 0; i < ctable->creator->nIndexes; i++) {
+	    ctable->bitmaps[i] = NULL;
+	}
+    }
+
+    if (ctable->rowNumbers == NULL) {
+	ctable->rowNumbers = ctable_RowNumbersNew ();
+    }
+
+    ctable->bitmaps[field] = ctable_BitmapIndexNew (ctable->creator->fields[field]->indexType == CTABLE_INDEXTYPE_TRIGRAM);
+}
+
+//
+// ctable_NewIndex - make an empty index of the field's index type, in shared
+// memory if readers will be following it
+//
+// a bitmap index is a skip list like any other, with bitmaps of the rows
+// with each value kept alongside it, and a trigram index is the same with
+// bitmaps of the rows with each trigram
+//
+static jsw_skip_t *
+ctable_NewIndex (CTable *ctable, int field, int depth) {
+    ctable_FieldInfo *f = ctable->creator->fields[field];
+    void             *share = NULL;
+
+#ifdef WITH_SHARED_TABLES
+    if(ctable->share_type == CTABLE_SHARED_MASTER)
+        share = ctable->share;
+#endif
+
+    if (f->indexType == CTABLE_INDEXTYPE_BTREE) {
+        return jsw_snew_btree (depth, f->compareFunction, share);
+    }
+
+    if (f->indexType == CTABLE_INDEXTYPE_HASH) {
+        return jsw_snew_hash (depth, f->compareFunction, f->hashFunction, share);
+    }
+
+    if (f->indexType == CTABLE_INDEXTYPE_BITMAP || f->indexType == CTABLE_INDEXTYPE_TRIGRAM) {
+	ctable_NewBitmapIndex (ctable, field);
+    }
+
+    return jsw_snew (depth, f->compareFunction, share);
+}
+
 //
 // ctable_CreateIndex - create an index on a specified field of a specified
 // ctable.
@@ -2960,6 +5799,7 @@ ctable_CreateIndex (Tcl_Interp *interp, CTable *ctable, int field, int depth) {
     ctable_BaseRow *row;
 
     jsw_skip_t      *skip;
+    CTableSearch    *where;
 
     // make sure the field has an index set up for it
     // in the linked list nodes of the row.
@@ -2981,12 +5821,12 @@ ctable_CreateIndex (Tcl_Interp *interp, CTable *ctable, int field, int depth) {
         return TCL_OK;
     }
 
-#ifdef WITH_SHARED_TABLES
-    if(ctable->share_type == CTABLE_SHARED_MASTER)
-        skip = jsw_snew (depth, ctable->creator->fields[field]->compareFunction, ctable->share);
-    else
-#endif
-        skip = jsw_snew (depth, ctable->creator->fields[field]->compareFunction, NULL);
+    // a partial index's where is checked before there's an index to undo
+    if (ctable_GetIndexWhere (interp, ctable, field, &where) == TCL_ERROR) {
+        return TCL_ERROR;
+    }
+
+    skip = ctable_NewIndex (ctable, field, depth);
 
     // we should plug the list in last, so that concurrent users don't
     // walk an incomplete skiplist, but ctable_InsertIntoIndex needs this
@@ -3005,6 +5845,10 @@ ctable_CreateIndex (Tcl_Interp *interp, CTable *ctable, int field, int depth) {
 	    // rows, etc
 	    jsw_sdelete_skiplist (skip, 0);
 	    ctable->skipLists[field] = NULL;
+	    if (ctable->bitmaps != NULL && ctable->bitmaps[field] != NULL) {
+		ctable_BitmapIndexDelete (ctable->bitmaps[field]);
+		ctable->bitmaps[field] = NULL;
+	    }
 	    Tcl_AppendResult (interp, " while creating index", (char *) NULL);
 	    return TCL_ERROR;
 	}
@@ -3013,6 +5857,135 @@ ctable_CreateIndex (Tcl_Interp *interp, CTable *ctable, int field, int depth) {
     return TCL_OK;
 }
 
+//
+// ctable_SuspendIndexes - drop a table's indexes for a bulk load, so that
+// rows can be added without any index maintenance.
+//
+// unique indexes are kept, a row that breaks one is refused as it's read
+// like it would be without a bulk load, rather than being found once it's
+// too late to keep out of the table.
+//
+// returns a ckalloc'ed array with the depth of each dropped index, or 0
+// for indexes that weren't dropped, for ctable_ResumeIndexes to rebuild
+// them from.
+//
+CTABLE_INTERNAL int *
+ctable_SuspendIndexes (CTable *ctable) {
+    int *depths = (int *)ckalloc (ctable->creator->nIndexes * sizeof (int));
+    int  field;
+
+    for (field = 0; field < ctable->creator->nIndexes; field++) {
+	if (ctable->skipLists[field] == NULL || ctable->creator->fields[field]->unique) {
+	    depths[field] = 0;
+	    continue;
+	}
+
+	depths[field] = (int)jsw_sdepth (ctable->skipLists[field]);
+	ctable_DropIndex (ctable, field, 0);
+    }
+
+    return depths;
+}
+
+//
+// qsort_r comparison for ctable_ResumeIndexes, the thunk is the field.
+//
+static int
+ctable_BuildCompare (void *thunk, const void *vRow1, const void *vRow2) {
+    ctable_FieldInfo *f = (ctable_FieldInfo *)thunk;
+
+    return f->compareFunction (*(ctable_BaseRow **)vRow1, *(ctable_BaseRow **)vRow2);
+}
+
+//
+// ctable_ResumeIndexes - rebuild the indexes dropped by ctable_SuspendIndexes
+// and free the depths array.
+//
+// rather than inserting the rows one at a time, the rows are sorted on each
+// field and the skip list is built bottom up from the sorted rows in one
+// pass.
+//
+CTABLE_INTERNAL int
+ctable_ResumeIndexes (Tcl_Interp *interp, CTable *ctable, int *depths) {
+    ctable_BaseRow  **rows = NULL;
+    ctable_BaseRow  **buildRows;
+    ctable_BaseRow   *row;
+    long              nRows = 0;
+    long              nBuildRows;
+    int               field;
+    int               status = TCL_OK;
+
+    for (field = 0; field < ctable->creator->nIndexes; field++) {
+	ctable_FieldInfo *f = ctable->creator->fields[field];
+	jsw_skip_t       *skip;
+	long              i;
+
+	// poll code may have put an index back while the load was running
+	if (depths[field] == 0 || ctable->skipLists[field] != NULL) {
+	    continue;
+	}
+
+	// gather the rows once, each index sorts them its own way
+	if (rows == NULL) {
+	    rows = (ctable_BaseRow **)ckalloc ((ctable->count + 1) * sizeof (ctable_BaseRow *));
+	    CTABLE_LIST_FOREACH (ctable->ll_head, row, 0) {
+		rows[nRows++] = row;
+	    }
+	}
+
+	// a partial index is built from just the rows that match its where
+	buildRows = rows;
+	nBuildRows = nRows;
+	if (f->where != NULL) {
+	    int result = TCL_OK;
+
+	    buildRows = (ctable_BaseRow **)ckalloc ((nRows + 1) * sizeof (ctable_BaseRow *));
+	    nBuildRows = 0;
+	    for (i = 0; i < nRows; i++) {
+		result = ctable_IndexWhereMatches (interp, ctable, rows[i], field);
+		if (result == TCL_ERROR) {
+		    break;
+		}
+		if (result == TCL_OK) {
+		    buildRows[nBuildRows++] = rows[i];
+		}
+	    }
+
+	    if (result == TCL_ERROR) {
+		ckfree ((char *)buildRows);
+		status = TCL_ERROR;
+		continue;
+	    }
+	}
+
+	ctable_qsort_r (buildRows, nBuildRows, sizeof (ctable_BaseRow *), (void *)f, ctable_BuildCompare);
+
+	skip = ctable_NewIndex (ctable, field, depths[field]);
+
+	jsw_sbuild_linked (skip, buildRows, nBuildRows, f->indexNumber);
+
+	if (ctable->bitmaps != NULL && ctable->bitmaps[field] != NULL) {
+	    for (i = 0; i < nBuildRows; i++) {
+		ctable_BitmapIndexAddRow (ctable, field, buildRows[i]);
+	    }
+	}
+
+	if (buildRows != rows) {
+	    ckfree ((char *)buildRows);
+	}
+
+	// only plug the list in once it's complete
+	ctable->skipLists[field] = skip;
+    }
+
+    if (rows) {
+	ckfree ((char *)rows);
+    }
+    ckfree ((char *)depths);
+
+    return status;
+}
+
 CTABLE_INTERNAL int
 ctable_LappendIndexLowAndHi (Tcl_Interp *interp, CTable *ctable, int field) {
     jsw_skip_t            *skip = ctable->skipLists[field];
@@ -3031,14 +6004,26 @@ ctable_LappendIndexLowAndHi (Tcl_Interp *interp, CTable *ctable, int field) {
         return TCL_OK;
     }
 
-    if (ctable->creator->lappend_field (interp, resultObj, row, ctable->creator->fieldList[field]) == TCL_ERROR) {
+    // a hash index has its values in no order, look at them all for the lowest
+    if (!jsw_sordered (skip)) {
+	ctable_BaseRow *walkRow;
+	fieldCompareFunction_t compareFunction = ctable->creator->fields[field]->compareFunction;
+
+	for (; (walkRow = jsw_srow (skip)) != NULL; jsw_snext (skip)) {
+	    if (compareFunction (walkRow, row) < 0) {
+		row = walkRow;
+	    }
+	}
+    }
+
+    if (ctable_LappendIndexValue (interp, ctable, resultObj, row, field) == TCL_ERROR) {
         return TCL_ERROR;
     }
 
     jsw_findlast (skip);
     row = jsw_srow (skip);
 
-    if (ctable->creator->lappend_field (interp, resultObj, row, ctable->creator->fieldList[field]) == TCL_ERROR) {
+    if (ctable_LappendIndexValue (interp, ctable, resultObj, row, field) == TCL_ERROR) {
         return TCL_ERROR;
     }
 
@@ -36,6 +36,11 @@ namespace eval ctable {
     variable sharedLog
     variable sanityChecks
     variable keyCompileVariables
+    variable keyHashTypes
+    variable keyIndexTypes
+    variable keyTypes
+    variable indexTypes
+    variable searchTerms
 
     # If loaded directly, rather than as a package
     if {![info exists srcDir]} {
@@ -90,6 +95,21 @@ namespace eval ctable {
 
     set reservedWords "bool char short int long wide float double"
 
+    ## keyHashTypes must line up with the CTABLE_HASH_* defines in speedtables.h
+    set keyHashTypes "tcl wyhash"
+
+    ## keyIndexTypes must line up with the CTABLE_KEYINDEX_* defines
+    set keyIndexTypes "chained open incremental"
+
+    ## keyTypes must line up with the CTABLE_KEYTYPE_* defines
+    set keyTypes "string int wide"
+
+    ## indexTypes must line up with the CTABLE_INDEXTYPE_* defines in ctable.h
+    set indexTypes "skiplist btree hash bitmap trigram"
+
+    ## searchTerms must line up with CTABLE_SEARCH_TERMS in ctable.h
+    set searchTerms "false true null notnull < <= = != >= > match notmatch match_case notmatch_case range in within"
+
 set fp [open $srcDir/template.c-subst]
 set metaTableSource [read $fp]
 close $fp
@@ -351,6 +371,11 @@ int ${table}_reinsert_row(Tcl_Interp *interp, CTable *ctable, char *value, struc
     char *mem = NULL;
 #endif
 
+    if (!ctable_ValidHashKey (ctable->keyTablePtr, value)) {
+	Tcl_AppendResult (interp, "expected integer key but got \"", value, "\" when setting key field", (char *)NULL);
+	return TCL_ERROR;
+    }
+
     // Check for duplicates
     oldrow = ctable_FindHashEntry(ctable->keyTablePtr, value);
     if(oldrow) {
@@ -380,10 +405,22 @@ int ${table}_reinsert_row(Tcl_Interp *interp, CTable *ctable, char *value, struc
 	${table}_deleteHashEntry (ctable, row);
     } else {
         // This shouldn't be possible, but just in case
+	${table}_forgetInlineKey(ctable, row);
 	ckfree(row->hashEntry.key);
 	row->hashEntry.key = ctable->nullKeyValue;
     }
 
+    // Short keys go in the row, unless they're already in shared memory
+    // where a reader could be looking at the old one
+    if(flags == KEY_VOLATILE) {
+	char *inlineKey = ${table}_inlineKey(row, value);
+
+	if(inlineKey) {
+	    key = inlineKey;
+	    flags = KEY_STATIC;
+	}
+    }
+
     // Insert existing row with new key
     newrow = ctable_StoreHashEntry(ctable->keyTablePtr, key, &row->hashEntry, flags, &isNew);
 
@@ -407,7 +444,7 @@ int ${table}_reinsert_row(Tcl_Interp *interp, CTable *ctable, char *value, struc
     if(indexCtl == CTABLE_INDEX_NEW) {
 	int field;
         // Add to indexes.
-        for(field = 0; field < ${TABLE}_NFIELDS; field++) {
+        for(field = 0; field < ctable->creator->nIndexes; field++) {
 	    if (ctable_InsertIntoIndex (interp, ctable, row, field) == TCL_ERROR) {
 		return TCL_ERROR;
 	    }
@@ -476,7 +513,7 @@ proc gen_null_check_during_set_source {table fieldName {elseCase ""}} {
         return $elseCase
     }
 
-    if {[info exists field(indexed)] && $field(indexed)} {
+    if {[is_indexable $fieldName]} {
         set handleNullIndex $nullIndexDuringSetSource
     } else {
         set handleNullIndex ""
@@ -533,7 +570,7 @@ proc gen_unset_null_during_set_source {table fieldName {elsecode {}}} {
 	if {"$elsecode" != ""} {
 	    set elsecode " else { if(!obj_is_null) { $elsecode } }"
 	}
-	if {[info exists field(indexed)] && $field(indexed)} {
+	if {[is_indexable $fieldName]} {
 	    return "[string range [subst -nobackslashes -nocommands $unsetNullDuringSetSource] 1 end-1]$elsecode"
 	} else {
 	    return "[string range [subst -nobackslashes -nocommands $unsetNullDuringSetSource_unindexed] 1 end-1]$elsecode"
@@ -562,9 +599,7 @@ proc gen_ctable_remove_from_index {fieldName} {
     variable fields
     variable removeFromIndexSource
 
-    upvar ::ctable::fields::$fieldName field
-
-    if {[info exists field(indexed)] && $field(indexed)} {
+    if {[is_indexable $fieldName]} {
         return $removeFromIndexSource
     } else {
         return ""
@@ -588,9 +623,7 @@ proc gen_ctable_insert_into_index {fieldName} {
     variable fields
     variable insertIntoIndexSource
 
-    upvar ::ctable::fields::$fieldName field
-
-    if {[info exists field(indexed)] && $field(indexed)} {
+    if {[is_indexable $fieldName]} {
         return $insertIntoIndexSource
     } else {
         return ""
@@ -612,8 +645,9 @@ variable boolSetSource {
 [gen_unset_null_during_set_source $table $fieldName \
 	"if (row->$fieldName == boolean)
 	    return TCL_OK;"]
-
+[gen_ctable_remove_from_index $fieldName]
         row->$fieldName = boolean;
+[gen_ctable_insert_into_index $fieldName]
         [gen_if_equal $fieldName _dirty "return TCL_OK; // Don't set dirty for meta-fields"]
 	break;
       }
@@ -651,9 +685,12 @@ variable keySetSource {
 	switch (indexCtl) {
 	    case CTABLE_INDEX_PRIVATE: {
 		// fake hash entry for search
+		${table}_forgetInlineKey(ctable, row);
 		if(row->hashEntry.key != ctable->nullKeyValue) [gen_deallocate_private ctable row->hashEntry.key];
-		row->hashEntry.key = (char *)[gen_allocate_private ctable "strlen(value)+1"];
-		strcpy(row->hashEntry.key, value);
+		if((row->hashEntry.key = ${table}_inlineKey(row, value)) == NULL) {
+		    row->hashEntry.key = (char *)[gen_allocate_private ctable "strlen(value)+1"];
+		    strcpy(row->hashEntry.key, value);
+		}
 		break;
 	    }
 	    case CTABLE_INDEX_NORMAL:
@@ -1049,6 +1086,17 @@ variable keySortSource {
       }
 }
 
+#
+# intKeySortSource - code we run subst over to generate a compare of
+# an integer key for use in a sort.
+#
+variable intKeySortSource {
+      case $fieldEnum: {
+        result = direction * ctable_CompareIntKeys (row1->hashEntry.key, row2->hashEntry.key);
+	break;
+      }
+}
+
 #####
 #
 # Generating Code For Search Comparisons
@@ -1373,7 +1421,7 @@ variable keyCompSource {
 	      }
 	  }
 
-          strcmpResult = strcmp (row->hashEntry.key, row1->hashEntry.key);
+          strcmpResult = [key_strcmp] (row->hashEntry.key, row1->hashEntry.key);
 [gen_standard_comp_switch_source $fieldName]
         }
 }
@@ -1405,6 +1453,7 @@ ctable_BaseRow *${table}_make_empty_row (CTable *ctable) {
 struct $table *${table}_find_or_create (Tcl_Interp *interp, CTable *ctable, const char *key, int *indexCtlPtr) {
     int flags = KEY_VOLATILE;
     const char *key_value = key;
+    char *inlineKey;
     struct $table *row = NULL;
 
     static struct $table *savedRow = NULL;
@@ -1416,6 +1465,11 @@ struct $table *${table}_find_or_create (Tcl_Interp *interp, CTable *ctable, cons
     struct $table *nextRow = savedRow;
 #endif
 
+    if (!ctable_ValidHashKey (ctable->keyTablePtr, key)) {
+	Tcl_AppendResult (interp, "expected integer key but got \"", key, "\"", (char *)NULL);
+	return NULL;
+    }
+
     // Make sure the preallocated row is prepared
     if(!nextRow) {
 #ifdef WITH_SHARED_TABLES
@@ -1433,8 +1487,13 @@ struct $table *${table}_find_or_create (Tcl_Interp *interp, CTable *ctable, cons
         ${table}_init (ctable, nextRow);
     }
 
+    // Short keys go in the row itself, which isn't visible to anyone yet
+    if((inlineKey = ${table}_inlineKey(nextRow, key)) != NULL) {
+	key_value = inlineKey;
+	flags = KEY_STATIC;
+    }
 #ifdef WITH_SHARED_TABLES
-    if(isShared) {
+    else if(isShared) {
         char *new_key_value = (char *)shmalloc(ctable->share, strlen(key)+1);
 	if(!new_key_value) {
 	    if(ctable->share_panic) ${table}_shmpanic(ctable);
@@ -1462,7 +1521,7 @@ struct $table *${table}_find_or_create (Tcl_Interp *interp, CTable *ctable, cons
 
 #ifdef WITH_SHARED_TABLES
 	// Discard the copy of the key we used
-	if(flags == KEY_STATIC) {
+	if(flags == KEY_STATIC && !inlineKey) {
 	    // Don't need to "shmfree" because the key was never made visible to
 	    // any readers.
 	    shmdealloc(ctable->share, (char*)key_value);
@@ -2023,6 +2082,12 @@ ${table}_set_from_tabsep (Tcl_Interp *interp, CTable *ctable, CONST char *string
 			}
 
 			if (${table}_set (interp, ctable, utilityObj, row, fieldIds[col], indexCtl) == TCL_ERROR) {
+				// a new row that can't be set, like one that breaks a
+				// unique index, isn't left in the table half made
+				if (indexCtl == CTABLE_INDEX_NEW) {
+					${table}_delete (ctable, (ctable_BaseRow *)row, CTABLE_INDEX_NORMAL);
+					ctable->count--;
+				}
 				Tcl_DecrRefCount (utilityObj);
 				return TCL_ERROR;
 			}
@@ -2239,6 +2304,8 @@ proc new_table {name} {
     variable keyField
     variable keyFieldName
     variable filters
+    variable compositeIndexes
+    variable compositeList
     variable rawCode
 
     set table $name
@@ -2250,6 +2317,8 @@ proc new_table {name} {
     unset -nocomplain keyField
     unset -nocomplain keyFieldName
     unset -nocomplain filters
+    unset -nocomplain compositeIndexes
+    set compositeList ""
     unset -nocomplain rawCode
 
     foreach var [info vars ::ctable::fields::*] {
@@ -2300,6 +2369,363 @@ proc cfilter {filterName args} {
     set filters($filterName) $args
 }
 
+#
+# composite indexes
+#
+
+#
+# Defining word for an index over several fields of a CTable, ordered by the
+# first field, then the second, and so on - mostly error checking, the rest
+# is done in sanity_check once all the fields are defined
+#
+# with "where", only the rows matching the list of search -compare
+# expressions are in the index
+#
+proc compositeindex {indexName fieldNames args} {
+    variable compositeIndexes
+    variable compositeList
+    variable reservedWords
+
+    if {[lsearch -exact $reservedWords $indexName] >= 0} {
+        error "illegal composite index name \"$indexName\" -- it's a reserved word"
+    }
+
+    if {![is_legal $indexName]} {
+        error "composite index name \"$indexName\" must start with a letter and can only contain letters, numbers, and underscores"
+    }
+
+    if {[llength $args] % 2 != 0} {
+        error "number of values in composite index '$indexName' definition arguments ('$args') must be even"
+    }
+
+    if {[info exists compositeIndexes($indexName)]} {
+	error "duplicate definition of composite index '$indexName'"
+    }
+
+    if {[llength $fieldNames] == 0} {
+	error "no fields provided for composite index '$indexName'"
+    }
+
+    array set index $args
+
+    foreach arg [array names index] {
+	if {$arg != "indextype" && $arg != "where"} {
+	    error "unknown option \"$arg\" for composite index '$indexName', must be indextype or where"
+	}
+    }
+
+    if {![info exists index(indextype)]} {
+	set index(indextype) skiplist
+    }
+
+    if {[lsearch -exact $::ctable::indexTypes $index(indextype)] < 0} {
+	error "unknown indextype \"$index(indextype)\" for composite index \"$indexName\", must be one of: $::ctable::indexTypes"
+    }
+
+    # a composite index is walked in order from its leading fields
+    if {$index(indextype) == "hash"} {
+	error "composite index \"$indexName\" can't be a hash index, it has to keep its values in order"
+    }
+
+    # and has as many values as there are combinations of them
+    if {$index(indextype) == "bitmap"} {
+	error "composite index \"$indexName\" can't be a bitmap index, that's for fields with few values"
+    }
+
+    if {$index(indextype) == "trigram"} {
+	error "composite index \"$indexName\" can't be a trigram index, only varstrings can"
+    }
+
+    if {![info exists index(where)]} {
+	set index(where) ""
+    } elseif {[llength $index(where)] == 0} {
+	error "empty where for composite index '$indexName'"
+    }
+
+    foreach compare $index(where) {
+	if {[llength $compare] < 2} {
+	    error "where expression \"$compare\" of composite index '$indexName' must be a term, a field and any values"
+	}
+	if {[lsearch -exact $::ctable::searchTerms [lindex $compare 0]] < 0} {
+	    error "unknown term \"[lindex $compare 0]\" in where of composite index '$indexName', must be one of: $::ctable::searchTerms"
+	}
+    }
+
+    set compositeIndexes($indexName) [list fields $fieldNames indextype $index(indextype) where $index(where)]
+    lappend compositeList $indexName
+}
+
+#
+# composite_fields - return the fields of a composite index, in order
+#
+proc composite_fields {indexName} {
+    variable compositeIndexes
+
+    array set index $compositeIndexes($indexName)
+    return $index(fields)
+}
+
+#
+# composite_where_fields - return the fields the where of a composite index
+#  looks at
+#
+proc composite_where_fields {indexName} {
+    variable compositeIndexes
+
+    array set index $compositeIndexes($indexName)
+    set result ""
+    foreach compare $index(where) {
+	lappend result [lindex $compare 1]
+    }
+    return $result
+}
+
+#
+# composite_indexes_of_field - return the composite indexes a field is part
+#  of, or that only have the rows with some values of it
+#
+proc composite_indexes_of_field {fieldName} {
+    variable compositeList
+
+    set result ""
+    foreach indexName $compositeList {
+	if {[lsearch -exact [concat [composite_fields $indexName] [composite_where_fields $indexName]] $fieldName] >= 0} {
+	    lappend result $indexName
+	}
+    }
+    return $result
+}
+
+#
+# is_indexable - is there an index that has to be kept up to date when the
+#  field changes, the field's own or a composite index
+#
+proc is_indexable {fieldName} {
+    upvar ::ctable::fields::$fieldName field
+
+    if {[info exists field(indexed)] && $field(indexed)} {
+	return 1
+    }
+    return [expr {[llength [composite_indexes_of_field $fieldName]] > 0}]
+}
+
+#
+# gen_composite_index_maintenance - the code generated to keep a field's
+#  index up to date is written for the field's own index, if the field is
+#  part of a composite index, make it look after those too.
+#
+# A new row is put into a composite index as soon as the first of the
+# composite's fields is set, so it has to come out again before the next
+# one is set, not just when an existing row changes.
+#
+proc gen_composite_index_maintenance {fieldName code} {
+    variable table
+
+    if {[llength [composite_indexes_of_field $fieldName]] == 0} {
+	return $code
+    }
+
+    return [string map [list \
+	"indexCtl == CTABLE_INDEX_NORMAL" "indexCtl != CTABLE_INDEX_PRIVATE" \
+	"ctable->skipLists\[field\] != NULL" "${table}_field_indexed (ctable, field)" \
+	"ctable_RemoveFromIndex (" "${table}_remove_from_field_indexes (" \
+	"ctable_InsertIntoIndex (" "${table}_insert_into_field_indexes (" \
+    ] $code]
+}
+
+variable compositeIndexMaintenanceSource {
+//
+// ${table}_field_indexed - is there an index to keep up to date when the
+// field changes, its own or a composite index it's part of
+//
+static int
+${table}_field_indexed (CTable *ctable, int field) {
+    int *composite;
+
+    if (ctable->skipLists[field] != NULL) {
+        return 1;
+    }
+
+    for (composite = ctable->creator->fields[field]->composites; *composite >= 0; composite++) {
+	if (ctable->skipLists[*composite] != NULL) {
+	    return 1;
+	}
+    }
+
+    return 0;
+}
+
+//
+// ${table}_remove_from_field_indexes - take the row out of the field's index
+// and out of the composite indexes the field is part of, before the field
+// changes
+//
+// this is done for new rows too, a new row is put in a composite index as
+// soon as one of the composite's fields is set and has to be moved when the
+// next one is. indexes the row isn't in yet are left alone.
+//
+static void
+${table}_remove_from_field_indexes (CTable *ctable, void *vRow, int field) {
+    int *composite;
+
+    ctable_RemoveFromIndex (ctable, vRow, field);
+
+    for (composite = ctable->creator->fields[field]->composites; *composite >= 0; composite++) {
+	ctable_RemoveFromIndex (ctable, vRow, *composite);
+    }
+}
+
+//
+// ${table}_insert_into_field_indexes - put the row back in the field's index
+// and the composite indexes the field is part of, after the field has changed
+//
+static int
+${table}_insert_into_field_indexes (Tcl_Interp *interp, CTable *ctable, ctable_BaseRow *row, int field) {
+    int *composite;
+
+    if (ctable_InsertIntoIndex (interp, ctable, row, field) == TCL_ERROR) {
+        return TCL_ERROR;
+    }
+
+    for (composite = ctable->creator->fields[field]->composites; *composite >= 0; composite++) {
+	if (ctable_InsertIntoIndex (interp, ctable, row, *composite) == TCL_ERROR) {
+	    return TCL_ERROR;
+	}
+    }
+
+    return TCL_OK;
+}
+
+}
+
+#
+# gen_composite_index_maintenance_functions - emit what the set functions of
+#  a table with composite indexes use to keep them up to date
+#
+proc gen_composite_index_maintenance_functions {table} {
+    variable compositeList
+    variable compositeIndexMaintenanceSource
+
+    if {[llength $compositeList] > 0} {
+	emit [string range [subst -nobackslashes -nocommands $compositeIndexMaintenanceSource] 1 end-1]
+    }
+}
+
+#
+# gen_composite_indexes - emit the compare functions for composite indexes and
+#  the tables describing them, and the names of everything that can be
+#  indexed
+#
+proc gen_composite_indexes {} {
+    variable table
+    variable fieldList
+    variable compositeIndexes
+    variable compositeList
+    variable leftCurly
+    variable rightCurly
+
+    set TABLE [string toupper $table]
+
+    emit "#define ${TABLE}_NCOMPOSITES [llength $compositeList]"
+    emit "#define ${TABLE}_NINDEXES (${TABLE}_NFIELDS + ${TABLE}_NCOMPOSITES)"
+    emit ""
+
+    # a composite index compares its first field, then its second, and so
+    # on, a search can position itself with just the leading ones
+    foreach indexName $compositeList {
+	set compareList ""
+	set nFields 0
+	foreach fieldName [composite_fields $indexName] {
+	    incr nFields
+
+	    emit "// compare the first $nFields fields of composite index '$indexName' of the '$table' table..."
+	    emit "static int ${table}_composite_${indexName}_compare_$nFields (const ctable_BaseRow *row1, const ctable_BaseRow *row2) $leftCurly"
+	    if {$nFields > 1} {
+		emit "    int result = ${table}_composite_${indexName}_compare_[expr {$nFields - 1}] (row1, row2);"
+		emit ""
+		emit "    if (result != 0) $leftCurly"
+		emit "        return result;"
+		emit "    $rightCurly"
+	    }
+	    emit "    return ${table}_field_${fieldName}_compare (row1, row2);"
+	    emit "$rightCurly"
+	    emit ""
+
+	    append compareList "\n    ${table}_composite_${indexName}_compare_$nFields,"
+	}
+
+	emit "static fieldCompareFunction_t ${table}_composite_${indexName}_compare_functions\[] = $leftCurly[string range $compareList 0 end-1]\n$rightCurly;"
+
+	set fieldNumbers ""
+	foreach fieldName [composite_fields $indexName] {
+	    append fieldNumbers "\n    [lsearch -exact $fieldList $fieldName],"
+	}
+	emit "static int ${table}_composite_${indexName}_fields\[] = $leftCurly[string range $fieldNumbers 0 end-1]\n$rightCurly;"
+	emit ""
+    }
+
+    # per-composite arrays, each ended by an entry that's never used so
+    # there's something in them when there are no composite indexes
+    set compositeFields "static int *${table}_composite_fields\[] = $leftCurly"
+    set compositeNFields "static int ${table}_composite_nfields\[] = $leftCurly"
+    set compositeCompares "static fieldCompareFunction_t *${table}_composite_compare_functions\[] = $leftCurly"
+    set compositeTypes "static int ${table}_composite_index_types\[] = $leftCurly"
+    set compositeWheres "static CONST char *${table}_composite_wheres\[] = $leftCurly"
+    foreach indexName $compositeList {
+	array set index $compositeIndexes($indexName)
+
+	append compositeFields "\n    ${table}_composite_${indexName}_fields,"
+	append compositeNFields "\n    [llength $index(fields)],"
+	append compositeCompares "\n    ${table}_composite_${indexName}_compare_functions,"
+	append compositeTypes "\n    [lsearch -exact $::ctable::indexTypes $index(indextype)],"
+	if {[llength $index(where)] == 0} {
+	    append compositeWheres "\n    NULL,"
+	} else {
+	    append compositeWheres "\n    \"[cquote $index(where)]\","
+	}
+    }
+    emit "$compositeFields\n    NULL\n$rightCurly;"
+    emit "$compositeNFields\n    0\n$rightCurly;"
+    emit "$compositeCompares\n    NULL\n$rightCurly;"
+    emit "$compositeTypes\n    -1\n$rightCurly;"
+    emit "$compositeWheres\n    NULL\n$rightCurly;\n"
+
+    # the composite indexes each field is part of, by index number
+    emit "static int ${table}_no_composites\[] = $leftCurly -1 $rightCurly;"
+    foreach fieldName $fieldList {
+	set indexes [composite_indexes_of_field $fieldName]
+	if {[llength $indexes] == 0} {
+	    continue
+	}
+	set numbers ""
+	foreach indexName $indexes {
+	    append numbers " [expr {[llength $fieldList] + [lsearch -exact $compositeList $indexName]}],"
+	}
+	emit "static int ${table}_field_${fieldName}_composites\[] = $leftCurly$numbers -1 $rightCurly;"
+    }
+
+    set composites "static int *${table}_composites\[] = $leftCurly"
+    foreach fieldName $fieldList {
+	if {[llength [composite_indexes_of_field $fieldName]] == 0} {
+	    append composites "\n    ${table}_no_composites,"
+	} else {
+	    append composites "\n    ${table}_field_${fieldName}_composites,"
+	}
+    }
+    emit "[string range $composites 0 end-1]\n$rightCurly;\n"
+
+    # what the index commands accept, fields then composite indexes
+    emit "static CONST char *${table}_index_names\[] = $leftCurly"
+    foreach fieldName $fieldList {
+	emit "    \"$fieldName\","
+    }
+    foreach indexName $compositeList {
+	emit "    \"$indexName\","
+    }
+    emit "    (char *) NULL"
+    emit "$rightCurly;\n"
+}
+
 #
 # Generate code to declare a memoized argument from a list of arguments
 #
@@ -2502,6 +2928,21 @@ proc deffield {fieldName argList {listName nonBooleans}} {
 	error "field '$fieldName' is the wrong type for a key"
     }
 
+    if {[info exists argHash(indextype)]} {
+	if {[lsearch -exact $::ctable::indexTypes $argHash(indextype)] < 0} {
+	    error "unknown indextype \"$argHash(indextype)\" for field \"$fieldName\", must be one of: $::ctable::indexTypes"
+	}
+	if {$argHash(indextype) == "hash" && $argHash(type) == "key"} {
+	    error "key \"$fieldName\" is found through the table's own hash table, it can't have a hash index"
+	}
+	if {$argHash(indextype) == "bitmap" && $argHash(type) == "key"} {
+	    error "key \"$fieldName\" has a different value in every row, it can't have a bitmap index"
+	}
+	if {$argHash(indextype) == "trigram" && $argHash(type) != "varstring"} {
+	    error "field \"$fieldName\" is a $argHash(type), only varstrings can have a trigram index"
+	}
+    }
+
     # If it's got a default value, then it must be notnull
     if {[info exists argHash(default)]} {
 	if {[info exists argHash(notnull)]} {
@@ -2655,6 +3096,29 @@ proc key {name args} {
 	return
     }
 
+    # Check the hash function, if one was asked for
+    array set argHash $args
+    if {[info exists argHash(hash)]} {
+	if {[lsearch -exact $::ctable::keyHashTypes $argHash(hash)] < 0} {
+	    error "unknown hash \"$argHash(hash)\" for key \"$name\", must be one of: $::ctable::keyHashTypes"
+	}
+    }
+    if {[info exists argHash(keyindex)]} {
+	if {[lsearch -exact $::ctable::keyIndexTypes $argHash(keyindex)] < 0} {
+	    error "unknown keyindex \"$argHash(keyindex)\" for key \"$name\", must be one of: $::ctable::keyIndexTypes"
+	}
+    }
+    if {[info exists argHash(keytype)]} {
+	if {[lsearch -exact $::ctable::keyTypes $argHash(keytype)] < 0} {
+	    error "unknown keytype \"$argHash(keytype)\" for key \"$name\", must be one of: $::ctable::keyTypes"
+	}
+    }
+    if {[info exists argHash(inline)]} {
+	if {![string is integer -strict $argHash(inline)] || $argHash(inline) < 2} {
+	    error "inline for key \"$name\" must be a buffer size of at least 2 bytes, got \"$argHash(inline)\""
+	}
+    }
+
     deffield $name [linsert $args 0 type key needsQuoting 1 notnull 1]
     set ::ctable::keyField [lsearch $::ctable::fieldList $name]
     if {$::ctable::keyField == -1} {
@@ -2686,6 +3150,104 @@ proc ctable_type_to_enum {type} {
     return "CTABLE_TYPE_[string toupper $type]"
 }
 
+#
+# key_hash_type_to_enum - return the CTABLE_HASH_* define for the hash
+#  function selected by the key field of the table being defined
+#
+proc key_hash_type_to_enum {} {
+    variable keyFieldName
+
+    upvar ::ctable::fields::$keyFieldName field
+    if {![info exists field(hash)]} {
+	return "CTABLE_HASH_TCL"
+    }
+    return "CTABLE_HASH_[string toupper $field(hash)]"
+}
+
+#
+# key_index_type_to_enum - return the CTABLE_KEYINDEX_* define for the
+#  layout of the key hash table selected by the key field
+#
+proc key_index_type_to_enum {} {
+    variable keyFieldName
+
+    upvar ::ctable::fields::$keyFieldName field
+    if {![info exists field(keyindex)]} {
+	return "CTABLE_KEYINDEX_CHAINED"
+    }
+    return "CTABLE_KEYINDEX_[string toupper $field(keyindex)]"
+}
+
+#
+# key_type_to_enum - return the CTABLE_KEYTYPE_* define for the type of
+#  the keys selected by the key field
+#
+proc key_type_to_enum {} {
+    return "CTABLE_KEYTYPE_[string toupper [key_type]]"
+}
+
+#
+# key_type - return the keytype of the key field, "string" unless the key
+#  was declared with an integer keytype
+#
+proc key_type {} {
+    variable keyFieldName
+
+    if {![info exists keyFieldName]} {
+	return "string"
+    }
+    upvar ::ctable::fields::$keyFieldName field
+    if {![info exists field(keytype)]} {
+	return "string"
+    }
+    return $field(keytype)
+}
+
+#
+# key_inline_size - return the size of the buffer short keys are kept in
+#  inside the row, or 0 if the key field didn't ask for one.  Integer keys
+#  always get a buffer their longest canonical form fits in, sign and null
+#  included, so they are never allocated.
+#
+proc key_inline_size {} {
+    variable keyFieldName
+
+    if {![info exists keyFieldName]} {
+	return 0
+    }
+    upvar ::ctable::fields::$keyFieldName field
+    if {[info exists field(inline)]} {
+	set size $field(inline)
+    } else {
+	set size 0
+    }
+    switch [key_type] {
+	int {
+	    # -2147483648
+	    if {$size < 12} {
+		set size 12
+	    }
+	}
+	wide {
+	    # -9223372036854775808
+	    if {$size < 21} {
+		set size 21
+	    }
+	}
+    }
+    return $size
+}
+
+#
+# key_strcmp - return the function used to order two keys
+#
+proc key_strcmp {} {
+    if {[key_type] == "string"} {
+	return "strcmp"
+    }
+    return "ctable_CompareIntKeys"
+}
+
 #
 # gen_ctable_type_stuff - # generate an array of char pointers to the type names
 #
@@ -2712,6 +3274,7 @@ proc gen_defaults_subr {struct} {
     variable withSharedTables
     variable withDirty
     variable fieldList
+    variable compositeList
     variable leftCurly
     variable rightCurly
 
@@ -2909,6 +3472,17 @@ emit "fprintf(stderr, \"Inserting $fieldName into new row for $struct\\n\");"
         incr fieldnum
     }
 
+    # composite indexes come after the fields
+    foreach indexName $compositeList {
+	incr listnum
+	emit "// Composite index \"$indexName\" ($fieldnum) index $listnum:"
+	emit "    if(ctable->skipLists\[$fieldnum] && row->_ll_nodes\[$listnum].prev == NULL) $leftCurly"
+	emit "        if (ctable_InsertIntoIndex (interp, ctable, row, $fieldnum) == TCL_ERROR)"
+	emit "            return TCL_ERROR;"
+	emit "    $rightCurly"
+        incr fieldnum
+    }
+
     emit "    return TCL_OK;"
 
     emit "$rightCurly"
@@ -2918,6 +3492,7 @@ emit "fprintf(stderr, \"Inserting $fieldName into new row for $struct\\n\");"
 variable deleteRowHelperSource {
 void ${table}_deleteKey(CTable *ctable, struct ${table} *row, int free_shared)
 {
+    ${table}_forgetInlineKey(ctable, row);
     if(row->hashEntry.key == ctable->nullKeyValue)
 	return;
 
@@ -2933,6 +3508,7 @@ void ${table}_deleteKey(CTable *ctable, struct ${table} *row, int free_shared)
 
 void ${table}_deleteHashEntry(CTable *ctable, struct ${table} *row)
 {
+    ${table}_forgetInlineKey(ctable, row);
 #ifdef WITH_SHARED_TABLES
     if(row->hashEntry.key != ctable->nullKeyValue && ctable->share_type == CTABLE_SHARED_MASTER) {
 	shmfree(ctable->share, (void *)row->hashEntry.key);
@@ -2943,6 +3519,49 @@ void ${table}_deleteHashEntry(CTable *ctable, struct ${table} *row)
 }
 }
 
+#
+# gen_inline_key_functions - gen the functions that keep short keys in the
+#  row's own key buffer, when the key field asked for one, instead of
+#  allocating them. Without a buffer every key is allocated as usual.
+#
+proc gen_inline_key_functions {} {
+    variable table
+    variable leftCurly
+    variable rightCurly
+
+    set size [key_inline_size]
+
+    emit "//"
+    emit "// ${table}_inlineKey - copy a key that fits into the row's key buffer,"
+    emit "// returning the copy, or NULL if the key has to be allocated"
+    emit "//"
+    emit "static INLINE char *${table}_inlineKey(struct $table *row, const char *key) $leftCurly"
+    if {$size > 0} {
+	emit "    size_t length = strlen(key);"
+	emit ""
+	emit "    if (length >= $size)"
+	emit "        return NULL;"
+	emit "    memcpy(row->_keyInline, key, length + 1);"
+	emit "    return row->_keyInline;"
+    } else {
+	emit "    return NULL;"
+    }
+    emit "$rightCurly"
+    emit ""
+
+    emit "//"
+    emit "// ${table}_forgetInlineKey - a key in the row's key buffer was never"
+    emit "// allocated, so drop it instead of letting it be freed"
+    emit "//"
+    emit "static INLINE void ${table}_forgetInlineKey(CTable *ctable, struct $table *row) $leftCurly"
+    if {$size > 0} {
+	emit "    if (row->hashEntry.key == row->_keyInline)"
+	emit "        row->hashEntry.key = ctable->nullKeyValue;"
+    }
+    emit "$rightCurly"
+    emit ""
+}
+
 #
 # gen_delete_subr - gen code to delete (free) a row
 #
@@ -2955,6 +3574,8 @@ proc gen_delete_subr {subr struct} {
     variable withSharedTables
     variable deleteRowHelperSource
 
+    gen_inline_key_functions
+
     emit [string range [subst -nobackslashes -nocommands $deleteRowHelperSource] 1 end-1]
 
     emit "void ${subr}(CTable *ctable, ctable_BaseRow *vRow, int indexCtl) {"
@@ -2970,6 +3591,7 @@ proc gen_delete_subr {subr struct} {
     emit "      case CTABLE_INDEX_NORMAL:"
     emit "        // If there's an index, AND we're not deleting all indices"
     emit "        ctable_RemoveFromAllIndexes (ctable, row);"
+    emit "        ${table}_forgetInlineKey(ctable, row);"
     if {$withSharedTables} {
 	emit "        ${table}_deleteKey(ctable, row, TRUE);"
     }
@@ -3059,10 +3681,46 @@ proc gen_obj_is_null_subr {} {
 proc sanity_check {} {
     variable fieldList
     variable table
+    variable compositeList
 
     if {[llength $fieldList] == 0} {
         error "no fields defined in table \"$table\" -- at least one field must be defined in a table"
     }
+
+    # composite indexes share the index commands' names with fields
+    foreach indexName $compositeList {
+	if {[lsearch -exact $fieldList $indexName] >= 0} {
+	    error "composite index \"$indexName\" has the same name as a field of table \"$table\""
+	}
+
+	foreach fieldName [composite_fields $indexName] {
+	    if {[lsearch -exact $fieldList $fieldName] < 0} {
+		error "composite index \"$indexName\" of table \"$table\" refers to field \"$fieldName\" which isn't defined"
+	    }
+
+	    upvar ::ctable::fields::$fieldName field
+	    if {$field(type) == "key" || $field(type) == "boolean"} {
+		error "composite index \"$indexName\" can't include $field(type) field \"$fieldName\""
+	    }
+	}
+
+	if {[llength [lsort -unique [composite_fields $indexName]]] != [llength [composite_fields $indexName]]} {
+	    error "composite index \"$indexName\" names the same field more than once"
+	}
+
+	# rows move in and out of the index as the fields in the where are
+	# set, which these types don't keep indexes up to date on
+	foreach fieldName [composite_where_fields $indexName] {
+	    if {[lsearch -exact $fieldList $fieldName] < 0} {
+		error "where of composite index \"$indexName\" of table \"$table\" refers to field \"$fieldName\" which isn't defined"
+	    }
+
+	    upvar ::ctable::fields::$fieldName field
+	    if {$field(type) == "key" || $field(type) == "tclobj"} {
+		error "where of composite index \"$indexName\" can't refer to $field(type) field \"$fieldName\""
+	    }
+	}
+    }
 }
 
 #
@@ -3072,12 +3730,14 @@ proc sanity_check {} {
 # currently one defined for every row for a master linked list and one
 # defined for each field that is defined indexed and not unique
 # for use with skip lists to have indexes on fields of rows that have
-# duplicate entries like, for instance, latitude and/or longitude.
+# duplicate entries like, for instance, latitude and/or longitude, plus
+# one for each composite index.
 #
 proc determine_how_many_linked_lists_and_gen_field_index_table {} {
     variable nonBooleans
     variable fields
     variable fieldList
+    variable compositeList
     variable booleans
     variable table
     variable leftCurly
@@ -3114,6 +3774,14 @@ if 0 {
 
     emit "[string range $result 0 end-1]\n$rightCurly;"
 
+    # and one for each composite index, numbered after the fields'
+    set result "int ${table}_composite_index_numbers\[\] = $leftCurly"
+    foreach indexName $compositeList {
+	append result "\n[format "%6d" $nLinkedLists],"
+        incr nLinkedLists
+    }
+    emit "$result\n    -1\n$rightCurly;"
+
     return $nLinkedLists
 }
 
@@ -3170,7 +3838,10 @@ proc gen_struct {} {
 	    }
 
 	    key {
-		# Do nothing, it's in the hashEntry
+		# The key is in the hashEntry, short ones can live here
+		if {[key_inline_size] > 0} {
+		    putfield char "_keyInline\[[key_inline_size]\]"
+		}
 	    }
 
 	    default {
@@ -3248,7 +3919,7 @@ proc emit_set_num_field {fieldName type} {
 
     set optname [field_to_enum $fieldName]
 
-    emit [string range [subst $numberSetSource] 1 end-1]
+    emit [gen_composite_index_maintenance $fieldName [string range [subst $numberSetSource] 1 end-1]]
 }
 
 #
@@ -3261,7 +3932,7 @@ proc emit_set_standard_field {fieldName setSourceVarName} {
     variable table
 
     set optname [field_to_enum $fieldName]
-    emit [string range [subst [set $setSourceVarName]] 1 end-1]
+    emit [gen_composite_index_maintenance $fieldName [string range [subst [set $setSourceVarName]] 1 end-1]]
 }
 
 #
@@ -3272,7 +3943,7 @@ proc emit_set_varstring_field {table fieldName} {
 
     set optname [field_to_enum $fieldName]
 
-    emit [string range [subst $varstringSetSource] 1 end-1]
+    emit [gen_composite_index_maintenance $fieldName [string range [subst $varstringSetSource] 1 end-1]]
 }
 
 #
@@ -3292,7 +3963,7 @@ proc emit_set_fixedstring_field {fieldName length} {
 
     set optname [field_to_enum $fieldName]
 
-    emit [string range [subst $fixedstringSetSource] 1 end-1]
+    emit [gen_composite_index_maintenance $fieldName [string range [subst $fixedstringSetSource] 1 end-1]]
 }
 
 variable fieldIncrSource {
@@ -3411,7 +4082,7 @@ proc emit_incr_num_field {fieldName} {
 
     set optname [field_to_enum $fieldName]
 
-    emit [string range [subst $numberIncrSource] 1 end-1]
+    emit [gen_composite_index_maintenance $fieldName [string range [subst $numberIncrSource] 1 end-1]]
 }
 
 #
@@ -3625,7 +4296,7 @@ proc gen_set_null_function {table} {
         if {[info exists field(notnull)] && $field(notnull)} {
             emit [subst -nobackslashes -nocommands $setNullNotNullSource]
         } else {
-            emit [subst -nobackslashes -nocommands $setNullSource]
+            emit [gen_composite_index_maintenance $myField [subst -nobackslashes -nocommands $setNullSource]]
         }
     }
 
@@ -3691,6 +4362,7 @@ proc put_init_command_source {table} {
     set NFIELDS [string toupper $table]_NFIELDS
     set NLINKED_LISTS [string toupper $table]_NLINKED_LISTS
     set NFILTERS [string toupper $table]_NFILTERS
+    set NINDEXES [string toupper $table]_NINDEXES
 
     emit [subst -nobackslashes -nocommands $extensionFragmentSource]
 }
@@ -4034,6 +4706,8 @@ proc gen_code {} {
 
     gen_clean_function $table
 
+    gen_composite_index_maintenance_functions $table
+
     gen_set_function $table
 
     gen_set_null_function $table
@@ -4046,8 +4720,14 @@ proc gen_code {} {
 
     gen_field_compare_functions
 
+    gen_field_hash_functions
+
+    gen_composite_indexes
+
     gen_sort_compare_function
 
+    gen_search_predicate_function
+
     gen_search_compare_function
 
     gen_make_key_functions
@@ -4450,6 +5130,9 @@ proc gen_field_names {} {
     emit ""
 
     emit "int      ${table}_keyField = $keyField;"
+    emit "int      ${table}_keyHashType = [key_hash_type_to_enum];"
+    emit "int      ${table}_keyIndexType = [key_index_type_to_enum];"
+    emit "int      ${table}_keyType = [key_type_to_enum];"
 
     emit "static CONST char *${table}_fields\[] = $leftCurly"
     foreach fieldName $fieldList {
@@ -4501,6 +5184,20 @@ proc gen_field_names {} {
     }
     emit "[string range $unique 0 end-1]\n$rightCurly;\n"
 
+    emit "// define per-field array for ${table} saying what kind of index each field gets"
+    set indexTypes "int ${table}_index_types\[\] = $leftCurly"
+    foreach myField $fieldList {
+	upvar ::ctable::fields::$myField field
+
+	if {[info exists field(indextype)]} {
+	    set indexType [lsearch -exact $::ctable::indexTypes $field(indextype)]
+	} else {
+	    set indexType 0
+	}
+	append indexTypes "\n    $indexType,"
+    }
+    emit "[string range $indexTypes 0 end-1]\n$rightCurly;\n"
+
     emit "// define objects that will be filled with the corresponding field names"
     foreach fieldName $fieldList {
         emit "Tcl_Obj *[field_to_nameObj $table $fieldName];"
@@ -4889,7 +5586,7 @@ proc gen_field_compare_null_check_source {table fieldName} {
 #
 variable fieldCompareHeaderSource {
 // field compare function for field '$fieldName' of the '$table' table...
-int ${table}_field_${fieldName}_compare(const ctable_BaseRow *vPointer1, const ctable_BaseRow *vPointer2) $leftCurly
+CTABLE_INTERNAL int ${table}_field_${fieldName}_compare(const ctable_BaseRow *vPointer1, const ctable_BaseRow *vPointer2) $leftCurly
     struct ${table} *row1, *row2;
 
     row1 = (struct $table *) vPointer1;
@@ -4911,7 +5608,7 @@ $rightCurly
 #
 variable keyCompareSource {
 // field compare function for key of the '$table' table...
-int ${table}_key_compare(const ctable_BaseRow *vPointer1, const ctable_BaseRow *vPointer2) $leftCurly
+CTABLE_INTERNAL int ${table}_key_compare(const ctable_BaseRow *vPointer1, const ctable_BaseRow *vPointer2) $leftCurly
     struct ${table} *row1, *row2;
 
     row1 = (struct $table *) vPointer1;
@@ -4927,6 +5624,21 @@ int ${table}_key_compare(const ctable_BaseRow *vPointer1, const ctable_BaseRow *
 $rightCurly
 }
 
+#
+# intKeyCompareSource - code for defining a key compare function for
+#  integer keys
+#
+variable intKeyCompareSource {
+// field compare function for key of the '$table' table...
+CTABLE_INTERNAL int ${table}_key_compare(const ctable_BaseRow *vPointer1, const ctable_BaseRow *vPointer2) $leftCurly
+    struct ${table} *row1, *row2;
+
+    row1 = (struct $table *) vPointer1;
+    row2 = (struct $table *) vPointer2;
+    return ctable_CompareIntKeys(row1->hashEntry.key, row2->hashEntry.key);
+$rightCurly
+}
+
 #
 # boolFieldCompSource - code we run subst over to generate a compare of a
 # boolean (bit) for use in a field comparison routine.
@@ -5131,12 +5843,17 @@ proc gen_field_compare_functions {} {
     variable fieldCompareHeaderSource
     variable fieldCompareTrailerSource
     variable keyCompareSource
+    variable intKeyCompareSource
     variable fieldList
 
     # generate all of the field compare functions
     foreach fieldName $fieldList {
 	if [is_key $fieldName] {
-	    emit [subst -nobackslashes $keyCompareSource]
+	    if {[key_type] == "string"} {
+		emit [subst -nobackslashes $keyCompareSource]
+	    } else {
+		emit [subst -nobackslashes $intKeyCompareSource]
+	    }
 	    continue
 	}
 	emit [string range [subst -nobackslashes $fieldCompareHeaderSource] 1 end-1]
@@ -5158,6 +5875,114 @@ proc gen_field_compare_functions {} {
     emit "[string range $typeList 0 end-1]\n$rightCurly;\n"
 }
 
+#
+# fieldHashHeaderSource - code for defining a field hash function
+#
+variable fieldHashHeaderSource {
+// field hash function for field '$fieldName' of the '$table' table...
+unsigned int ${table}_field_${fieldName}_hash(const ctable_BaseRow *vPointer) $leftCurly
+    struct ${table} *row = (struct $table *) vPointer;
+
+}
+
+#
+# fieldHashNullCheckSource - nulls all compare the same, so they all hash
+#  the same
+#
+variable fieldHashNullCheckSource {
+    if (row->_${fieldName}IsNull) {
+	return 0;
+    }
+}
+
+variable varstringHashNullCheckSource {
+    if (row->_${fieldName}IsNull || !row->$fieldName) {
+	return 0;
+    }
+}
+
+#
+# gen_field_hash - emit code to hash a field for a field hash function, it
+#  has to hash alike everything the field's compare function says is equal
+#
+proc gen_field_hash {fieldName} {
+    variable fieldHashNullCheckSource
+    variable varstringHashNullCheckSource
+
+    upvar ::ctable::fields::$fieldName field
+
+    if {$field(type) == "varstring"} {
+	emit [string range [subst -nobackslashes -nocommands $varstringHashNullCheckSource] 1 end-1]
+    } elseif {![info exists field(notnull)] || !$field(notnull)} {
+	emit [string range [subst -nobackslashes -nocommands $fieldHashNullCheckSource] 1 end-1]
+    }
+
+    switch $field(type) {
+	int - long - wide - short - char - boolean {
+	    emit "    return ctable_HashIndexWide ((Tcl_WideInt)row->$fieldName);"
+	}
+
+	double - float {
+	    emit "    return ctable_HashIndexDouble ((double)row->$fieldName);"
+	}
+
+	fixedstring {
+	    emit "    return ctable_HashIndexString (row->$fieldName, $field(length));"
+	}
+
+	varstring {
+	    emit "    return ctable_HashIndexString (row->$fieldName, (size_t)-1);"
+	}
+
+	inet {
+	    emit "    return ctable_HashIndexBytes (&row->$fieldName, sizeof(struct in_addr));"
+	}
+
+	mac {
+	    emit "    return ctable_HashIndexBytes (&row->$fieldName, sizeof(struct ether_addr));"
+	}
+
+	tclobj {
+	    emit "    return ctable_HashIndexString (Tcl_GetString (row->$fieldName), (size_t)-1);"
+	}
+
+	default {
+	    error "attempt to emit hash source for field of unknown type $field(type)"
+	}
+    }
+}
+
+#
+# gen_field_hash_functions - generate a hash function for each field that
+# has a hash index, and an array of them indexed by field number with NULL
+# for the fields that don't
+#
+proc gen_field_hash_functions {} {
+    variable table
+    variable leftCurly
+    variable rightCurly
+    variable fieldHashHeaderSource
+    variable fieldList
+
+    set hashList ""
+    foreach fieldName $fieldList {
+	upvar ::ctable::fields::$fieldName field
+
+	if {![info exists field(indextype)] || $field(indextype) != "hash"} {
+	    append hashList "\n    NULL,"
+	    continue
+	}
+
+	emit [string range [subst -nobackslashes $fieldHashHeaderSource] 1 end-1]
+	gen_field_hash $fieldName
+	emit "$rightCurly\n"
+	append hashList "\n    ${table}_field_${fieldName}_hash,"
+    }
+
+    emit "// array of table's field hash routines indexed by field number"
+    emit "fieldHashFunction_t ${table}_hash_functions\[] = $leftCurly[string range $hashList 0 end-1]\n$rightCurly;\n"
+}
+
 #####
 #
 # Sort Comparison Function Generation
@@ -5229,6 +6054,7 @@ proc gen_sort_comp {} {
     variable varstringSortSource
     variable boolSortSource
     variable keySortSource
+    variable intKeySortSource
     variable tclobjSortSource
 
     foreach fieldName $fieldList {
@@ -5238,7 +6064,11 @@ proc gen_sort_comp {} {
 
 	switch $field(type) {
 	    key {
-		emit [string range [subst -nobackslashes $keySortSource] 1 end-1]
+		if {[key_type] == "string"} {
+		    emit [string range [subst -nobackslashes $keySortSource] 1 end-1]
+		} else {
+		    emit [string range [subst -nobackslashes $intKeySortSource] 1 end-1]
+		}
 	    }
 
 	    int {
@@ -5333,6 +6163,16 @@ int ${table}_search_compare(Tcl_Interp *interp, CTableSearch *searchControl, cta
 
       component = &searchControl->components[i];
 
+      // the comparisons search_predicate set up are made right here,
+      // numbers against the values it copied out of the search's rows
+      switch (component->predicate) $leftCurly
+}
+
+variable searchCompareMiddleSource {
+	default:
+	  break;
+      $rightCurly
+
       row1 = (struct $table *)component->row1;
       compType = component->comparisonType;
 
@@ -5404,6 +6244,21 @@ int ${table}_search_compare(Tcl_Interp *interp, CTableSearch *searchControl, cta
 	  }
 	  continue;
 	}
+
+        case CTABLE_COMP_WITHIN: {
+	  struct $table *row2;
+
+	  if (component->compareFunction ((ctable_BaseRow *)row, (ctable_BaseRow *)row1) < 0) {
+	      return TCL_CONTINUE;
+	  }
+
+	  row2 = (struct $table *)component->row2;
+
+	  if (component->compareFunction ((ctable_BaseRow *)row, (ctable_BaseRow *)row2) > 0) {
+	      return TCL_CONTINUE;
+	  }
+	  continue;
+	}
       }
 
       switch (component->fieldID) $leftCurly
@@ -5430,15 +6285,275 @@ proc gen_search_compare_function {} {
     variable leftCurly
     variable rightCurly
     variable searchCompareHeaderSource
+    variable searchCompareMiddleSource
     variable searchCompareTrailerSource
 
     emit [string range [subst -nobackslashes -nocommands $searchCompareHeaderSource] 1 end-1]
 
+    gen_search_predicate_cases
+
+    emit [string range [subst -nobackslashes -nocommands $searchCompareMiddleSource] 1 end-1]
+
     gen_search_comp
 
     emit [string range [subst -nobackslashes -nocommands $searchCompareTrailerSource] 1 end-1]
 }
 
+#
+# search_predicate_kind - how search_compare's switch on field and
+# comparison type compares a field: "key" for the key, which only has its
+# compare function, "l", "w" or "d" for numbers compared with a value of
+# that member of ctable_SearchValue, "boolean", or "other" for everything
+# else, which goes through its compare function
+#
+proc search_predicate_kind {fieldName} {
+    upvar ::ctable::fields::$fieldName field
+
+    if {[is_key $fieldName]} {
+	return key
+    }
+
+    switch $field(type) {
+	int - long - short - char {
+	    return l
+	}
+	wide {
+	    return w
+	}
+	double - float {
+	    return d
+	}
+	boolean {
+	    return boolean
+	}
+	default {
+	    return other
+	}
+    }
+}
+
+#
+# the comparisons search_compare's switch makes for each kind of field
+#
+variable searchPredicateTypes
+array set searchPredicateTypes {
+    key {LT LE EQ NE GE GT RANGE}
+    l {NULL NOTNULL TRUE FALSE LT LE EQ NE GE GT RANGE IN}
+    w {NULL NOTNULL TRUE FALSE LT LE EQ NE GE GT RANGE IN}
+    d {NULL NOTNULL TRUE FALSE LT LE EQ NE GE GT RANGE IN}
+    boolean {NULL NOTNULL TRUE FALSE LT LE EQ NE GE GT RANGE IN}
+    other {NULL NOTNULL LT LE EQ NE GE GT RANGE IN}
+}
+
+#
+# gen_search_predicate_function - generate the function that sets a search
+# component up to be compared by search_compare's switch on field and
+# comparison type, returning its case or -1 if the comparison is left to
+# the code after it. Numbers have the values they're compared with copied
+# out of the component's rows, unless they're null.
+#
+proc gen_search_predicate_function {} {
+    variable table
+    variable fieldList
+    variable leftCurly
+    variable rightCurly
+    variable searchPredicateTypes
+
+    emit "// set a search comparison up for search_compare's switch on field and"
+    emit "// comparison type, return its case or -1 if the switch doesn't make it"
+    # only numbers have values copied out of the rows
+    set numbers 0
+    foreach fieldName $fieldList {
+	if {[lsearch {l w d} [search_predicate_kind $fieldName]] >= 0} {
+	    set numbers 1
+	}
+    }
+
+    emit "int ${table}_search_predicate (CTableSearchComponent *component) $leftCurly"
+    if {$numbers} {
+	emit "    struct $table *row1 = (struct $table *)component->row1;"
+	emit "    struct $table *row2 = (struct $table *)component->row2;"
+	emit ""
+    }
+    emit "    switch (component->fieldID) $leftCurly"
+    foreach fieldName $fieldList {
+	upvar ::ctable::fields::$fieldName field
+
+	set kind [search_predicate_kind $fieldName]
+	set nullable [expr {$kind != "key" && (![info exists field(notnull)] || !$field(notnull))}]
+
+	emit "      case [field_to_enum $fieldName]:"
+	emit "        switch (component->comparisonType) $leftCurly"
+	if {[lsearch {l w d} $kind] >= 0} {
+	    emit "          case CTABLE_COMP_LT: case CTABLE_COMP_LE: case CTABLE_COMP_EQ:"
+	    emit "          case CTABLE_COMP_NE: case CTABLE_COMP_GE: case CTABLE_COMP_GT:"
+	    if {$nullable} {
+		emit "            if (row1->_${fieldName}IsNull) return -1;"
+	    }
+	    emit "            component->value1.$kind = row1->$fieldName;"
+	    emit "            break;"
+	    emit "          case CTABLE_COMP_RANGE:"
+	    if {$nullable} {
+		emit "            if (row1->_${fieldName}IsNull || row2->_${fieldName}IsNull) return -1;"
+	    }
+	    emit "            component->value1.$kind = row1->$fieldName;"
+	    emit "            component->value2.$kind = row2->$fieldName;"
+	    emit "            break;"
+	}
+	if {[lsearch $searchPredicateTypes($kind) IN] >= 0} {
+	    emit "          case CTABLE_COMP_IN:"
+	    emit "            if (component->inCount > 0 && component->inListRows == NULL) return -1;"
+	    emit "            break;"
+	}
+	foreach type $searchPredicateTypes($kind) {
+	    if {[lsearch {l w d} $kind] >= 0 && [lsearch {LT LE EQ NE GE GT RANGE} $type] >= 0} {
+		continue
+	    }
+	    if {$type == "IN"} {
+		continue
+	    }
+	    emit "          case CTABLE_COMP_$type:"
+	}
+	emit "            break;"
+	emit "          default:"
+	emit "            return -1;"
+	emit "        $rightCurly"
+	emit "        break;"
+    }
+    emit "    $rightCurly"
+    emit ""
+    emit "    return component->fieldID * CTABLE_NUM_COMP_TYPES + component->comparisonType;"
+    emit "$rightCurly"
+    emit ""
+}
+
+#
+# gen_search_predicate_cases - emit the cases of search_compare's switch on
+# field and comparison type. Numbers are compared right here, with the
+# values search_predicate copied, and a row that's null sorts after them
+# the same as in the field's compare function. Other types call their
+# compare function, directly rather than through the component.
+#
+proc gen_search_predicate_cases {} {
+    variable table
+    variable fieldList
+    variable leftCurly
+    variable rightCurly
+    variable searchPredicateTypes
+
+    # what a number has to be to be kept, and whether a null is
+    set numberTests {
+	LT {{$a < $v1} 0}
+	LE {{!($a > $v1)} 0}
+	EQ {{!($a < $v1) && !($a > $v1)} 0}
+	NE {{$a < $v1 || $a > $v1} 1}
+	GE {{!($a < $v1)} 1}
+	GT {{$a > $v1} 1}
+	RANGE {{!($a < $v1) && $a < $v2} 0}
+    }
+
+    set compareTests {
+	LT {$compare (vPointer, component->row1) < 0}
+	LE {$compare (vPointer, component->row1) <= 0}
+	EQ {$compare (vPointer, component->row1) == 0}
+	NE {$compare (vPointer, component->row1) != 0}
+	GE {$compare (vPointer, component->row1) >= 0}
+	GT {$compare (vPointer, component->row1) > 0}
+	RANGE {$compare (vPointer, component->row1) >= 0 && $compare (vPointer, component->row2) < 0}
+    }
+
+    foreach fieldName $fieldList {
+	upvar ::ctable::fields::$fieldName field
+
+	set kind [search_predicate_kind $fieldName]
+	set nullable [expr {$kind != "key" && (![info exists field(notnull)] || !$field(notnull))}]
+	set base "[field_to_enum $fieldName] * CTABLE_NUM_COMP_TYPES"
+	set a row->$fieldName
+	set v1 component->value1.$kind
+	set v2 component->value2.$kind
+	set isNull row->_${fieldName}IsNull
+
+	if {$kind == "key"} {
+	    set compare ${table}_key_compare
+	} else {
+	    set compare ${table}_field_${fieldName}_compare
+	}
+
+	foreach type $searchPredicateTypes($kind) {
+	    emit "	case $base + CTABLE_COMP_$type:"
+
+	    switch -glob $kind,$type {
+		*,NULL {
+		    set keep 0
+		    if {$nullable} {
+			set keep $isNull
+		    }
+		}
+		*,NOTNULL {
+		    set keep 1
+		    if {$nullable} {
+			set keep "!$isNull"
+		    }
+		}
+		*,TRUE {
+		    set keep $a
+		    if {$nullable} {
+			set keep "!$isNull && $a"
+		    }
+		}
+		*,FALSE {
+		    set keep "!$a"
+		    if {$nullable} {
+			set keep "!$isNull && !$a"
+		    }
+		}
+		l,IN - w,IN - d,IN {
+		    emit "	  for (inIndex = 0; inIndex < component->inCount; inIndex++) $leftCurly"
+		    emit "	      struct $table *inRow = (struct $table *)component->inListRows\[inIndex\];"
+		    emit ""
+		    if {$nullable} {
+			emit "	      if ($isNull ? inRow->_${fieldName}IsNull : !inRow->_${fieldName}IsNull && !($a < inRow->$fieldName) && !($a > inRow->$fieldName)) $leftCurly"
+		    } else {
+			emit "	      if (!($a < inRow->$fieldName) && !($a > inRow->$fieldName)) $leftCurly"
+		    }
+		    emit "		  break;"
+		    emit "	      $rightCurly"
+		    emit "	  $rightCurly"
+		    set keep "inIndex < component->inCount"
+		}
+		*,IN {
+		    emit "	  for (inIndex = 0; inIndex < component->inCount; inIndex++) $leftCurly"
+		    emit "	      if ($compare (vPointer, component->inListRows\[inIndex\]) == 0) $leftCurly"
+		    emit "		  break;"
+		    emit "	      $rightCurly"
+		    emit "	  $rightCurly"
+		    set keep "inIndex < component->inCount"
+		}
+		l,* - w,* - d,* {
+		    set test [dict get $numberTests $type]
+		    set keep [subst -nocommands [lindex $test 0]]
+		    if {$nullable} {
+			if {[lindex $test 1]} {
+			    set keep "$isNull || ($keep)"
+			} else {
+			    set keep "!$isNull && ($keep)"
+			}
+		    }
+		}
+		default {
+		    set keep [subst -nocommands [dict get $compareTests $type]]
+		}
+	    }
+
+	    emit "	  if (!($keep)) $leftCurly"
+	    emit "	      return TCL_CONTINUE;"
+	    emit "	  $rightCurly"
+	    emit "	  continue;"
+	    emit ""
+	}
+    }
+}
+
 #
 # gen_search_comp - emit code to compare fields for searching
 #
@@ -5876,13 +6991,15 @@ proc install_ch_files {includeDir} {
     variable srcDir
     variable withSharedTables
 
-    lappend subdirs skiplists hash
+    lappend subdirs skiplists hash btree hashindex bitmapindex
 
     set copyFiles {
 	ctable.h ctable_search.c ctable_lists.c ctable_batch.c
 	boyer_moore.c jsw_rand.c jsw_rand.h jsw_slib.c jsw_slib.h
 	speedtables.h speedtableHash.c ctable_io.c ctable_qsort.c
-	ethers.c
+	ethers.c ctable_btree.c ctable_btree.h
+	ctable_hashindex.c ctable_hashindex.h
+	ctable_bitmapindex.c ctable_bitmapindex.h
     }
 
     if {$withSharedTables} {
@@ -14,6 +14,11 @@
 
 //#include "tclInt.h"
 #include <tcl.h>
+#include <limits.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /*
  * When there are this many entries per bucket, on average, rebuild the hash
@@ -22,6 +27,106 @@
 
 #define REBUILD_MULTIPLIER	3
 
+/*
+ * When a table is being rehashed incrementally, this many old buckets are
+ * migrated on every lookup or insert. Since the table grows 16-fold and
+ * the old table averages REBUILD_MULTIPLIER entries per bucket, migration
+ * is always long finished by the time the table needs to grow again.
+ */
+
+#define REHASH_STEP		8
+
+/*
+ * One lookup in this many has the number of entries it compared counted,
+ * for the average reported by ctable_HashStatsObj. Must be a power of 2.
+ */
+
+#define PROBE_SAMPLE_INTERVAL	64
+
+/*
+ * Number of chain lengths (or probe counts) the statistics histograms
+ * keep separately, longer ones are lumped together.
+ */
+
+#define NUM_COUNTERS		10
+
+/*
+ * Shared memory readers walk the master's chains while the master changes
+ * them. The master fills in anything it links into a chain before the link
+ * is stored, and readers load the link before what it points to.
+ */
+
+#ifdef __GNUC__
+# define HashWriteBarrier()	__atomic_thread_fence(__ATOMIC_RELEASE)
+# define HashReadBarrier()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#else
+# define HashWriteBarrier()
+# define HashReadBarrier()
+#endif
+
+/*
+ * Bucket and control arrays of a table in shared memory come from the
+ * segment, and are handed back through the garbage pool so that readers
+ * still walking them stay safe until they unlock.
+ */
+
+static void *
+HashAlloc(ctable_HashTable *tablePtr, size_t nbytes)
+{
+#ifdef WITH_SHARED_TABLES
+    if (tablePtr->share) {
+	void *memory = shmalloc ((shm_t *)tablePtr->share, nbytes);
+
+	if (!memory) {
+	    Tcl_Panic ("Can't allocate shared memory for key hash table");
+	}
+	return memory;
+    }
+#endif
+    return ckalloc ((unsigned) nbytes);
+}
+
+static void
+HashFree(ctable_HashTable *tablePtr, void *memory)
+{
+#ifdef WITH_SHARED_TABLES
+    if (tablePtr->share) {
+	shmfree ((shm_t *)tablePtr->share, memory);
+	return;
+    }
+#endif
+    ckfree ((char *) memory);
+}
+
+/*
+ * Lookup sampling and rebuild timing for the statistics.
+ */
+
+static inline int
+HashSampleLookup(ctable_HashTable *tablePtr)
+{
+    return (++tablePtr->lookups & (PROBE_SAMPLE_INTERVAL - 1)) == 0;
+}
+
+static inline void
+HashSampleProbes(ctable_HashTable *tablePtr, int sampled, int probes)
+{
+    if (sampled) {
+	tablePtr->sampledLookups++;
+	tablePtr->sampledProbes += probes;
+    }
+}
+
+static void
+HashRebuildDone(ctable_HashTable *tablePtr, Tcl_Time *startPtr)
+{
+    Tcl_Time now;
+
+    Tcl_GetTime (&now);
+    tablePtr->rebuilds++;
+    tablePtr->rebuildMicroseconds += (Tcl_WideInt)(now.sec - startPtr->sec) * 1000000 + (now.usec - startPtr->usec);
+}
+
 /*
  * The following macro takes a preliminary integer hash value and produces an
  * index into a hash tables bucket list. The idea is to make it so that
@@ -32,18 +137,224 @@
 #define RANDOM_INDEX(tablePtr, i) \
     (((((long) (i))*1103515245) >> (tablePtr)->downShift) & (tablePtr)->mask)
 
+/*
+ * The same for the bucket array being migrated out of during an
+ * incremental rehash.
+ */
+
+#define OLD_RANDOM_INDEX(tablePtr, i) \
+    (((((long) (i))*1103515245) >> (tablePtr)->oldDownShift) & (tablePtr)->oldMask)
+
 /*
  * Prototypes for the string hash key methods.
  */
 
 static int		CompareStringKeys(ctable_HashTable *tablePtr, VOID *keyPtr, ctable_HashEntry *hPtr);
 static unsigned int	HashStringKey(ctable_HashTable *tablePtr, VOID *keyPtr);
+static unsigned int	WyHashStringKey(ctable_HashTable *tablePtr, VOID *keyPtr);
 
 /*
  * Function prototypes for static functions in this file:
  */
 
 static void		RebuildTable(ctable_HashTable *tablePtr);
+static void		RehashStep(ctable_HashTable *tablePtr, int nBuckets);
+
+/*
+ * Prototypes for the open addressing layout.
+ */
+
+static void		OpenInitHashTable(ctable_HashTable *tablePtr);
+static inline ctable_HashEntry *OpenInitOrStoreHashEntry(ctable_HashTable *tablePtr, CONST char *key, ctable_HashEntry *newEntry, int flags, int *newPtr);
+static void		OpenDeleteHashEntry(ctable_HashTable *tablePtr, ctable_HashEntry *entryPtr);
+static CONST char *	OpenHashStats(ctable_HashTable *tablePtr);
+static void		OpenProbeHistogram(ctable_HashTable *tablePtr,
+			    int *count, int *overflowPtr, int *longestPtr,
+			    double *averagePtr);
+static void		OpenPresizeTable(ctable_HashTable *tablePtr, int expected);
+
+/*
+ * Constants and primitives for the wyhash key hash, after Wang Yi's
+ * public domain wyhash (final version 4).
+ */
+
+#define WY_P0	0xa0761d6478bd642full
+#define WY_P1	0xe7037ed1a0b428dbull
+#define WY_P2	0x8ebc6af09c88c6e3ull
+#define WY_P3	0x589965cc75374cc3ull
+
+/*
+ * WyMum - 64x64->128 bit multiply, returning the low and high halves
+ * in place of the operands.
+ */
+static inline void
+WyMum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = *a;
+
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t
+WyMix(uint64_t a, uint64_t b)
+{
+    WyMum(&a, &b);
+    return a ^ b;
+}
+
+// unaligned native-order loads; memcpy compiles down to a single move
+static inline uint64_t
+WyRead8(const unsigned char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t
+WyRead4(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/*
+ * HashKey - hash a key with whichever function the table was set up with.
+ */
+static inline unsigned int
+HashKey(ctable_HashTable *tablePtr, CONST char *key)
+{
+    if (tablePtr->hashType == CTABLE_HASH_WYHASH) {
+	return WyHashStringKey (tablePtr, (VOID *) key);
+    }
+    return HashStringKey (tablePtr, (VOID *) key);
+}
+
+/*
+ * ParseIntKey - convert the key of a table with integer keys to its value.
+ * Only the canonical decimal form of a number is accepted, so that two
+ * keys with the same value are also the same string.
+ */
+static inline int
+ParseIntKey(int keyType, CONST char *key, int64_t *valuePtr)
+{
+    CONST char *p = key;
+    uint64_t value = 0;
+    uint64_t limit;
+    int negative = 0;
+
+    if (*p == '-') {
+	negative = 1;
+	p++;
+    }
+
+    if (*p < '0' || *p > '9' || (*p == '0' && (p[1] != '\0' || negative))) {
+	return 0;
+    }
+
+    if (keyType == CTABLE_KEYTYPE_INT) {
+	limit = negative ? (uint64_t)INT32_MAX + 1 : (uint64_t)INT32_MAX;
+    } else {
+	limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    }
+
+    for (; *p; p++) {
+	unsigned int digit = (unsigned int)(*p - '0');
+
+	if (digit > 9 || value > (limit - digit) / 10) {
+	    return 0;
+	}
+	value = value * 10 + digit;
+    }
+
+    *valuePtr = negative ? (int64_t)(0 - value) : (int64_t)value;
+    return 1;
+}
+
+/*
+ * HashKeyWords - hash a key into the two words stored in a hash entry.
+ * String keys only use the first; integer keys are mixed into both, with
+ * an invertible mix so that equal words mean equal keys. Returns 0 if the
+ * key can't be in the table.
+ */
+static inline int
+HashKeyWords(ctable_HashTable *tablePtr, CONST char *key, unsigned int *hashPtr, unsigned int *hashHighPtr)
+{
+    int64_t value;
+    uint64_t m;
+
+    if (tablePtr->keyType == CTABLE_KEYTYPE_STRING) {
+	*hashPtr = HashKey (tablePtr, key);
+	*hashHighPtr = 0;
+	return 1;
+    }
+
+    if (!ParseIntKey (tablePtr->keyType, key, &value)) {
+	return 0;
+    }
+
+    // splitmix64 finalizer, each step of which can be undone
+    m = (uint64_t)value ^ tablePtr->seed;
+    m ^= m >> 30;
+    m *= 0xbf58476d1ce4e5b9ull;
+    m ^= m >> 27;
+    m *= 0x94d049bb133111ebull;
+    m ^= m >> 31;
+
+    *hashPtr = (unsigned int)m;
+    *hashHighPtr = (unsigned int)(m >> 32);
+    return 1;
+}
+
+/*
+ * EntryHasKey - check whether the entry holds the key whose hash words
+ * are hash and hashHigh. Integer keys never need to look at the string.
+ */
+static inline int
+EntryHasKey(ctable_HashTable *tablePtr, CONST char *key, unsigned int hash, unsigned int hashHigh, ctable_HashEntry *hPtr)
+{
+    if (hash != (unsigned int)(hPtr->hash) || hashHigh != hPtr->hashHigh) {
+	return 0;
+    }
+    return tablePtr->keyType != CTABLE_KEYTYPE_STRING
+	|| !CompareStringKeys(tablePtr, (VOID *) key, hPtr);
+}
+
+/*
+ * BucketFor - return the chain a hash belongs in. While a table is being
+ * rehashed incrementally, entries whose old bucket hasn't been migrated
+ * yet still live (and are inserted) there.
+ */
+static inline ctable_HashEntry **
+BucketFor(ctable_HashTable *tablePtr, unsigned int hash)
+{
+    if (tablePtr->oldBuckets) {
+	int oldIndex = OLD_RANDOM_INDEX (tablePtr, hash);
+
+	if (oldIndex >= tablePtr->rehashIndex) {
+	    return &tablePtr->oldBuckets[oldIndex];
+	}
+    }
+    return &tablePtr->buckets[RANDOM_INDEX (tablePtr, hash)];
+}
 
 
 /*
@@ -65,28 +376,77 @@ static void		RebuildTable(ctable_HashTable *tablePtr);
  */
 
 void
-ctable_InitHashTable(ctable_HashTable *tablePtr)
-				/* Pointer to table record, which is supplied
+ctable_InitHashTable(
+    ctable_HashTable *tablePtr,	/* Pointer to table record, which is supplied
 				 * by the caller. */
+    int hashType,		/* CTABLE_HASH_* function to hash keys with. */
+    int keyIndexType,		/* CTABLE_KEYINDEX_* layout of the table. */
+    int keyType,		/* CTABLE_KEYTYPE_* of the keys. */
+    void *share)		/* Shared memory segment to allocate bucket
+				 * arrays in, or NULL. */
 {
     int i;
+    Tcl_Time now;
 
 #if (CTABLE_SMALL_HASH_TABLE != 16)
     Tcl_Panic("ctable_InitCustomHashTable: CTABLE_SMALL_HASH_TABLE is %d, not 16",
 	    CTABLE_SMALL_HASH_TABLE);
 #endif
 
-    tablePtr->buckets = tablePtr->staticBuckets;
+    /*
+     * A table being reset may have readers in it. They're kept out by an
+     * odd generation until the buckets are empty again, and the mask
+     * shrinks before the buckets do, so a reader never indexes the static
+     * buckets with a bigger table's mask.
+     */
+
+    tablePtr->generation |= 1;
+    HashWriteBarrier ();
+    tablePtr->downShift = 26;
+    tablePtr->mask = 15;
+    HashWriteBarrier ();
 
     for (i = 0; i < CTABLE_SMALL_HASH_TABLE; i++) {
         tablePtr->staticBuckets[i] = 0;
     }
 
+    tablePtr->buckets = tablePtr->staticBuckets;
+
     tablePtr->numBuckets = CTABLE_SMALL_HASH_TABLE;
     tablePtr->numEntries = 0;
     tablePtr->rebuildSize = CTABLE_SMALL_HASH_TABLE*REBUILD_MULTIPLIER;
-    tablePtr->downShift = 26;
-    tablePtr->mask = 15;
+    tablePtr->share = share;
+    tablePtr->hashType = hashType;
+    tablePtr->keyIndexType = keyIndexType;
+    tablePtr->ctrl = NULL;
+    tablePtr->numTombstones = 0;
+    tablePtr->oldBuckets = NULL;
+    tablePtr->oldNumBuckets = 0;
+    tablePtr->rehashIndex = 0;
+    tablePtr->keyType = keyType;
+    tablePtr->lookups = 0;
+    tablePtr->sampledLookups = 0;
+    tablePtr->sampledProbes = 0;
+    tablePtr->rebuilds = 0;
+    tablePtr->rebuildMicroseconds = 0;
+
+    /*
+     * Seed each table differently, so that a set of keys that collides
+     * in one table doesn't collide in every table. The seed only has to
+     * be stable for the life of the table, since hashes are never saved.
+     */
+
+    Tcl_GetTime (&now);
+    tablePtr->seed = WyMix ((uint64_t)(size_t)tablePtr ^ WY_P0,
+	    ((uint64_t)now.sec << 20) ^ (uint64_t)now.usec ^ WY_P1);
+
+    if (keyIndexType == CTABLE_KEYINDEX_OPEN) {
+	OpenInitHashTable (tablePtr);
+    }
+
+    // the empty buckets and the new seed are in place, let readers back in
+    HashWriteBarrier ();
+    tablePtr->generation++;
 }
 
 /*
@@ -138,29 +498,46 @@ ctable_InitOrStoreHashEntry(
 				 * was created. */
 {
     ctable_HashEntry *hPtr;
-    unsigned int hash;
-    int index;
+    ctable_HashEntry **bucketPtr;
+    unsigned int hash, hashHigh;
+    int sampled, probes = 0;
+
+    if (tablePtr->keyIndexType == CTABLE_KEYINDEX_OPEN) {
+	return OpenInitOrStoreHashEntry (tablePtr, key, newEntry, flags, newPtr);
+    }
+
+    /*
+     * Pay off a little of any rehash in progress.
+     */
+
+    if (tablePtr->oldBuckets) {
+	RehashStep (tablePtr, REHASH_STEP);
+    }
 
-    hash = HashStringKey (tablePtr, (VOID *) key);
-    index = RANDOM_INDEX (tablePtr, hash);
+    if (!HashKeyWords (tablePtr, key, &hash, &hashHigh)) {
+	if (newPtr)
+	    *newPtr = 0;
+	return NULL;
+    }
+    bucketPtr = BucketFor (tablePtr, hash);
+    sampled = HashSampleLookup (tablePtr);
 
     /*
      * Search all of the entries in the appropriate bucket.
      */
 
-    for (hPtr = tablePtr->buckets[index]; hPtr != NULL;
+    for (hPtr = *bucketPtr; hPtr != NULL;
 	    hPtr = hPtr->nextPtr) {
 
-	if (hash != (unsigned int)(hPtr->hash)) {
-	    continue;
-	}
-
-	if (!CompareStringKeys(tablePtr, (VOID *) key, hPtr)) {
+	probes++;
+	if (EntryHasKey (tablePtr, key, hash, hashHigh, hPtr)) {
+	    HashSampleProbes (tablePtr, sampled, probes);
 	    if (newPtr)
 		*newPtr = 0;
 	    return hPtr;
 	}
     }
+    HashSampleProbes (tablePtr, sampled, probes);
 
     if (!newPtr)
 	return NULL;
@@ -185,8 +562,10 @@ ctable_InitOrStoreHashEntry(
     }
 
     hPtr->hash = hash;
-    hPtr->nextPtr = tablePtr->buckets[index];
-    tablePtr->buckets[index] = hPtr;
+    hPtr->hashHigh = hashHigh;
+    hPtr->nextPtr = *bucketPtr;
+    HashWriteBarrier ();
+    *bucketPtr = hPtr;
     tablePtr->numEntries++;
 
     /*
@@ -297,6 +676,138 @@ ctable_FindHashEntry(
 {
     return ctable_InitHashEntry (tablePtr, key, NULL);
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ctable_ReaderFindHashEntry --
+ *
+ *	Look up a key in a chained table in shared memory from a reader
+ *	process, without locking out the master. The caller must hold a
+ *	read lock on the segment, so nothing the lookup looks at is freed
+ *	underneath it.
+ *
+ * Results:
+ *	1 if the lookup didn't overlap a change that could have hidden the
+ *	key from it, with the matching entry, or NULL, in *entryPtr.
+ *	0 if the lookup has to be tried again.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+ctable_ReaderFindHashEntry(
+    ctable_HashTable *tablePtr,	/* Table in which to lookup entry. */
+    CONST char *key,		/* Key to use to find matching entry. */
+    ctable_HashEntry **entryPtr)/* Store the matching entry here. */
+{
+    ctable_HashEntry *hPtr;
+    ctable_HashEntry **buckets;
+    unsigned int generation = tablePtr->generation;
+    unsigned int hash, hashHigh;
+    int mask, downShift;
+
+    *entryPtr = NULL;
+
+    if (generation & 1) {
+	return 0;
+    }
+    HashReadBarrier ();
+
+    if (!HashKeyWords (tablePtr, key, &hash, &hashHigh)) {
+	return 1;
+    }
+
+    // a mask that changed under us may not fit the buckets we got
+    mask = tablePtr->mask;
+    HashReadBarrier ();
+    buckets = tablePtr->buckets;
+    downShift = tablePtr->downShift;
+    HashReadBarrier ();
+    if (tablePtr->mask != mask) {
+	return 0;
+    }
+
+    hPtr = buckets[((((long) hash)*1103515245) >> downShift) & mask];
+    for (; hPtr != NULL; hPtr = hPtr->nextPtr) {
+	HashReadBarrier ();
+	if (EntryHasKey (tablePtr, key, hash, hashHigh, hPtr)) {
+	    *entryPtr = hPtr;
+	    return 1;
+	}
+    }
+
+    // not there, unless it was moved out of our way
+    HashReadBarrier ();
+    return tablePtr->generation == generation;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ctable_ValidHashKey --
+ *
+ *	Check whether a string can be used as a key in a hash table.
+ *	Any string is a valid key unless the table has integer keys.
+ *
+ * Results:
+ *	1 if the key is valid, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+ctable_ValidHashKey(ctable_HashTable *tablePtr, CONST char *key)
+{
+    int64_t value;
+
+    if (tablePtr->keyType == CTABLE_KEYTYPE_STRING) {
+	return 1;
+    }
+    return ParseIntKey (tablePtr->keyType, key, &value);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ctable_CompareIntKeys --
+ *
+ *	Compare two integer keys by value. Keys are in canonical decimal
+ *	form, so this only needs the signs, the lengths and a strcmp.
+ *
+ * Results:
+ *	-1, 0 or 1, as for strcmp.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+ctable_CompareIntKeys(CONST char *key1, CONST char *key2)
+{
+    int negative = (*key1 == '-');
+    size_t len1, len2;
+    int result;
+
+    if (negative != (*key2 == '-')) {
+	return negative ? -1 : 1;
+    }
+
+    len1 = strlen (key1);
+    len2 = strlen (key2);
+    if (len1 != len2) {
+	result = len1 < len2 ? -1 : 1;
+    } else {
+	result = strcmp (key1, key2);
+	result = result < 0 ? -1 : (result > 0);
+    }
+    return negative ? -result : result;
+}
 
 /*
  *----------------------------------------------------------------------
@@ -320,11 +831,13 @@ ctable_DeleteHashEntry(ctable_HashTable *tablePtr, ctable_HashEntry *entryPtr, c
 {
     ctable_HashEntry *prevPtr;
     ctable_HashEntry **bucketPtr;
-    int index;
 
-    index = RANDOM_INDEX (tablePtr, entryPtr->hash);
+    if (tablePtr->keyIndexType == CTABLE_KEYINDEX_OPEN) {
+	OpenDeleteHashEntry (tablePtr, entryPtr);
+	goto freeKey;
+    }
 
-    bucketPtr = &(tablePtr->buckets[index]);
+    bucketPtr = BucketFor (tablePtr, entryPtr->hash);
 
     if (*bucketPtr == entryPtr) {
 	*bucketPtr = entryPtr->nextPtr;
@@ -342,6 +855,10 @@ ctable_DeleteHashEntry(ctable_HashTable *tablePtr, ctable_HashEntry *entryPtr, c
 
     tablePtr->numEntries--;
 
+    // the entry may be linked in again somewhere else, like by a rekey
+    tablePtr->generation += 2;
+
+  freeKey:
     if(entryPtr->key != nullKeyValue)
         ckfree (entryPtr->key);
 }
@@ -371,8 +888,57 @@ ctable_DeleteHashTable(ctable_HashTable *tablePtr)	/* Table to delete. */
      * Free up the bucket array, if it was dynamically allocated.
      */
 
+    // readers stay out until the table is set up again
+    tablePtr->generation |= 1;
+    HashWriteBarrier ();
+
     if (tablePtr->buckets != tablePtr->staticBuckets) {
-	ckfree((char*)tablePtr->buckets);
+	HashFree(tablePtr, tablePtr->buckets);
+    }
+
+    if (tablePtr->oldBuckets && tablePtr->oldBuckets != tablePtr->staticBuckets) {
+	HashFree(tablePtr, tablePtr->oldBuckets);
+    }
+    tablePtr->oldBuckets = NULL;
+
+    if (tablePtr->ctrl) {
+	HashFree(tablePtr, tablePtr->ctrl);
+	tablePtr->ctrl = NULL;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ctable_PresizeHashTable --
+ *
+ *	Grow a hash table so that it can hold at least expected entries
+ *	without being rebuilt, for loading a known number of rows.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The table may be rebuilt with more buckets. An incremental table
+ *	finishes its migration before returning. The table never shrinks.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+ctable_PresizeHashTable(ctable_HashTable *tablePtr, int expected)
+{
+    if (tablePtr->keyIndexType == CTABLE_KEYINDEX_OPEN) {
+	OpenPresizeTable(tablePtr, expected);
+	return;
+    }
+
+    while (tablePtr->rebuildSize <= expected && tablePtr->numBuckets < INT_MAX / 16) {
+	RebuildTable(tablePtr);
+    }
+
+    if (tablePtr->oldBuckets) {
+	RehashStep (tablePtr, tablePtr->oldNumBuckets);
     }
 }
 
@@ -402,6 +968,16 @@ ctable_FirstHashEntry(
     ctable_HashSearch *searchPtr)	/* Place to store information about progress
 				 * through the table. */
 {
+    /*
+     * Entries move between bucket arrays during an incremental rehash,
+     * which would throw off the enumeration, so finish it first. A full
+     * enumeration is linear in the size of the table anyway.
+     */
+
+    if (tablePtr->oldBuckets) {
+	RehashStep (tablePtr, tablePtr->oldNumBuckets);
+    }
+
     searchPtr->tablePtr = tablePtr;
     searchPtr->nextIndex = 0;
     searchPtr->nextEntryPtr = NULL;
@@ -437,6 +1013,17 @@ ctable_NextHashEntry(ctable_HashSearch *searchPtr)
     ctable_HashEntry *hPtr;
     ctable_HashTable *tablePtr = searchPtr->tablePtr;
 
+    if (tablePtr->keyIndexType == CTABLE_KEYINDEX_OPEN) {
+	while (searchPtr->nextIndex < tablePtr->numBuckets) {
+	    int i = searchPtr->nextIndex++;
+
+	    if (!(tablePtr->ctrl[i] & 0x80)) {
+		return tablePtr->buckets[i];
+	    }
+	}
+	return NULL;
+    }
+
     while (searchPtr->nextEntryPtr == NULL) {
 	if (searchPtr->nextIndex >= tablePtr->numBuckets) {
 	    return NULL;
@@ -453,14 +1040,15 @@ ctable_NextHashEntry(ctable_HashSearch *searchPtr)
 /*
  *----------------------------------------------------------------------
  *
- * ctable_HashStats --
+ * ChainHistogram --
  *
- *	Return statistics describing the layout of the hash table in its hash
- *	buckets.
+ *	Count how many buckets of a chained (or incrementally rehashed)
+ *	table hold each number of entries.
  *
  * Results:
- *	The return value is a malloc-ed string containing information about
- *	tablePtr. It is the caller's responsibility to free this string.
+ *	count[0..NUM_COUNTERS-1] gets the number of buckets with that many
+ *	entries, *overflowPtr the number with more, *longestPtr the longest
+ *	chain and *averagePtr the average search distance for an entry.
  *
  * Side effects:
  *	None.
@@ -468,28 +1056,36 @@ ctable_NextHashEntry(ctable_HashSearch *searchPtr)
  *----------------------------------------------------------------------
  */
 
-CONST char *
-ctable_HashStats(
-    ctable_HashTable *tablePtr)	/* Table for which to produce stats. */
+static void
+ChainHistogram(
+    ctable_HashTable *tablePtr,
+    int *count,
+    int *overflowPtr,
+    int *longestPtr,
+    double *averagePtr)
 {
-#define NUM_COUNTERS 10
-    int count[NUM_COUNTERS], overflow, i, j;
+    int overflow, longest, i, j;
     double average, tmp;
     ctable_HashEntry *hPtr;
-    char *result, *p;
-
-    /*
-     * Compute a histogram of bucket usage.
-     */
 
     for (i = 0; i < NUM_COUNTERS; i++) {
 	count[i] = 0;
     }
     overflow = 0;
+    longest = 0;
     average = 0.0;
-    for (i = 0; i < tablePtr->numBuckets; i++) {
+    for (i = 0; i < tablePtr->numBuckets + tablePtr->oldNumBuckets; i++) {
 	j = 0;
-	for (hPtr = tablePtr->buckets[i]; hPtr != NULL; hPtr = hPtr->nextPtr) {
+
+	// chains not yet migrated out of the old array count as buckets too
+	if (i < tablePtr->numBuckets) {
+	    hPtr = tablePtr->buckets[i];
+	} else if (i - tablePtr->numBuckets >= tablePtr->rehashIndex) {
+	    hPtr = tablePtr->oldBuckets[i - tablePtr->numBuckets];
+	} else {
+	    continue;
+	}
+	for (; hPtr != NULL; hPtr = hPtr->nextPtr) {
 	    j++;
 	}
 	if (j < NUM_COUNTERS) {
@@ -497,12 +1093,56 @@ ctable_HashStats(
 	} else {
 	    overflow++;
 	}
+	if (j > longest) {
+	    longest = j;
+	}
 	tmp = j;
 	if (tablePtr->numEntries != 0) {
 	    average += (tmp+1.0)*(tmp/tablePtr->numEntries)/2.0;
 	}
     }
 
+    *overflowPtr = overflow;
+    *longestPtr = longest;
+    *averagePtr = average;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ctable_HashStats --
+ *
+ *	Return statistics describing the layout of the hash table in its hash
+ *	buckets.
+ *
+ * Results:
+ *	The return value is a malloc-ed string containing information about
+ *	tablePtr. It is the caller's responsibility to free this string.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+CONST char *
+ctable_HashStats(
+    ctable_HashTable *tablePtr)	/* Table for which to produce stats. */
+{
+    int count[NUM_COUNTERS], overflow, longest, i;
+    double average;
+    char *result, *p;
+
+    if (tablePtr->keyIndexType == CTABLE_KEYINDEX_OPEN) {
+	return OpenHashStats (tablePtr);
+    }
+
+    /*
+     * Compute a histogram of bucket usage.
+     */
+
+    ChainHistogram (tablePtr, count, &overflow, &longest, &average);
+
     /*
      * Print out the histogram and a few other pieces of information.
      */
@@ -520,9 +1160,86 @@ ctable_HashStats(
 	    NUM_COUNTERS, overflow);
     p += strlen(p);
     sprintf(p, "average search distance for entry: %.1f", average);
+    if (tablePtr->oldBuckets) {
+	p += strlen(p);
+	sprintf(p, "\nincremental rehash in progress: %d of %d old buckets migrated",
+		tablePtr->rehashIndex, tablePtr->oldNumBuckets);
+    }
     return result;
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ctable_HashStatsObj --
+ *
+ *	Return the hash table statistics as a key-value list, for code
+ *	that exports them rather than reads them.
+ *
+ * Results:
+ *	A new list object with a zero reference count. Chained tables get
+ *	a chain_histogram of bucket counts by entries in the bucket, open
+ *	tables a probe_histogram of entry counts by groups probed to reach
+ *	them. The last element of either counts everything past the end.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_Obj *
+ctable_HashStatsObj(
+    ctable_HashTable *tablePtr)	/* Table for which to produce stats. */
+{
+    static CONST char *layouts[] = {"chained", "open", "incremental"};
+    static CONST char *hashes[] = {"tcl", "wyhash"};
+    int count[NUM_COUNTERS], overflow, longest, i;
+    double average, load;
+    Tcl_Obj *resultObj = Tcl_NewObj ();
+    Tcl_Obj *histObj = Tcl_NewObj ();
+    int open = tablePtr->keyIndexType == CTABLE_KEYINDEX_OPEN;
+
+    if (open) {
+	OpenProbeHistogram (tablePtr, count, &overflow, &longest, &average);
+    } else {
+	ChainHistogram (tablePtr, count, &overflow, &longest, &average);
+    }
+
+    for (i = open ? 1 : 0; i < NUM_COUNTERS; i++) {
+	Tcl_ListObjAppendElement (NULL, histObj, Tcl_NewIntObj (count[i]));
+    }
+    Tcl_ListObjAppendElement (NULL, histObj, Tcl_NewIntObj (overflow));
+
+    load = tablePtr->numBuckets ? (double)tablePtr->numEntries / tablePtr->numBuckets : 0.0;
+
+#define STAT(name, obj) \
+    Tcl_ListObjAppendElement (NULL, resultObj, Tcl_NewStringObj (name, -1)); \
+    Tcl_ListObjAppendElement (NULL, resultObj, (obj))
+
+    STAT ("layout", Tcl_NewStringObj (layouts[tablePtr->keyIndexType], -1));
+    STAT ("hash", Tcl_NewStringObj (hashes[tablePtr->hashType], -1));
+    STAT ("entries", Tcl_NewIntObj (tablePtr->numEntries));
+    STAT (open ? "slots" : "buckets", Tcl_NewIntObj (tablePtr->numBuckets));
+    STAT ("load_factor", Tcl_NewDoubleObj (load));
+    STAT (open ? "probe_histogram" : "chain_histogram", histObj);
+    STAT (open ? "max_probes" : "max_chain", Tcl_NewIntObj (longest));
+    STAT ("average_search_distance", Tcl_NewDoubleObj (average));
+    if (open) {
+	STAT ("tombstones", Tcl_NewIntObj (tablePtr->numTombstones));
+    } else {
+	STAT ("rehash_remaining", Tcl_NewIntObj (tablePtr->oldBuckets ? tablePtr->oldNumBuckets - tablePtr->rehashIndex : 0));
+    }
+    STAT ("rebuilds", Tcl_NewIntObj (tablePtr->rebuilds));
+    STAT ("rebuild_usec", Tcl_NewWideIntObj (tablePtr->rebuildMicroseconds));
+    STAT ("lookups", Tcl_NewWideIntObj ((Tcl_WideInt)tablePtr->lookups));
+    STAT ("sampled_lookups", Tcl_NewWideIntObj ((Tcl_WideInt)tablePtr->sampledLookups));
+    STAT ("average_probes", Tcl_NewDoubleObj (tablePtr->sampledLookups ? (double)tablePtr->sampledProbes / tablePtr->sampledLookups : 0.0));
+#undef STAT
+
+    return resultObj;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -621,6 +1338,82 @@ HashStringKey(
     }
     return result;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WyHashStringKey --
+ *
+ *	Compute a one-word summary of a text string using the seeded
+ *	wyhash function.
+ *
+ *	Unlike the times-9 hash, which consumes one character per step,
+ *	this consumes eight bytes per multiply and mixes every input bit
+ *	into every output bit, so keys sharing a long common prefix (as
+ *	identifiers in a feed often do) still spread evenly over the
+ *	buckets. The per-table seed makes the bucket layout unpredictable
+ *	from outside, which hardens the table against chosen-key attacks.
+ *
+ * Results:
+ *	The return value is a one-word summary of the information in string.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static unsigned int
+WyHashStringKey(
+    ctable_HashTable *tablePtr,	/* Hash table, supplies the seed. */
+    VOID *keyPtr)		/* Key from which to compute hash value. */
+{
+    CONST unsigned char *p = (CONST unsigned char *) keyPtr;
+    size_t len = strlen ((CONST char *) p);
+    size_t i = len;
+    uint64_t seed = tablePtr->seed ^ WyMix (tablePtr->seed ^ WY_P0, WY_P1);
+    uint64_t a, b;
+
+    if (len <= 16) {
+	if (len >= 4) {
+	    a = (WyRead4(p) << 32) | WyRead4(p + ((len >> 3) << 2));
+	    b = (WyRead4(p + len - 4) << 32) | WyRead4(p + len - 4 - ((len >> 3) << 2));
+	} else if (len > 0) {
+	    a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+	    b = 0;
+	} else {
+	    a = b = 0;
+	}
+    } else {
+	if (i > 48) {
+	    uint64_t see1 = seed, see2 = seed;
+
+	    do {
+		seed = WyMix (WyRead8(p) ^ WY_P1, WyRead8(p + 8) ^ seed);
+		see1 = WyMix (WyRead8(p + 16) ^ WY_P2, WyRead8(p + 24) ^ see1);
+		see2 = WyMix (WyRead8(p + 32) ^ WY_P3, WyRead8(p + 40) ^ see2);
+		p += 48;
+		i -= 48;
+	    } while (i > 48);
+	    seed ^= see1 ^ see2;
+	}
+	while (i > 16) {
+	    seed = WyMix (WyRead8(p) ^ WY_P1, WyRead8(p + 8) ^ seed);
+	    i -= 16;
+	    p += 16;
+	}
+	a = WyRead8(p + i - 16);
+	b = WyRead8(p + i - 8);
+    }
+
+    a ^= WY_P1;
+    b ^= seed;
+    WyMum (&a, &b);
+    a = WyMix (a ^ WY_P0 ^ len, b ^ WY_P1);
+
+    // fold to the width of the stored hash
+    return (unsigned int)(a ^ (a >> 32));
+}
 
 /*
  *----------------------------------------------------------------------
@@ -647,28 +1440,58 @@ RebuildTable(ctable_HashTable *tablePtr)	/* Table to enlarge. */
     ctable_HashEntry **oldBuckets;
     ctable_HashEntry **oldChainPtr, **newChainPtr;
     ctable_HashEntry *hPtr;
+    Tcl_Time start;
+
+    Tcl_GetTime (&start);
+
+    // can't keep three bucket arrays live, finish the last migration
+    if (tablePtr->oldBuckets) {
+	RehashStep (tablePtr, tablePtr->oldNumBuckets);
+    }
 
     oldSize = tablePtr->numBuckets;
     oldBuckets = tablePtr->buckets;
 
+    // entries are about to move between chains
+    tablePtr->generation++;
+
     /*
      * Allocate and initialize the new bucket array, and set up hashing
-     * constants for new array size.
+     * constants for new array size. The array grows before the mask
+     * does, so a reader never indexes past the end of the buckets.
      */
 
     tablePtr->numBuckets *= 16;
-    tablePtr->buckets = (ctable_HashEntry **) ckalloc((unsigned)
-	    (tablePtr->numBuckets * sizeof(ctable_HashEntry *)));
-    for (count = tablePtr->numBuckets, newChainPtr = tablePtr->buckets;
-	    count > 0; count--, newChainPtr++) {
-	*newChainPtr = NULL;
+    newChainPtr = (ctable_HashEntry **) HashAlloc(tablePtr,
+	    tablePtr->numBuckets * sizeof(ctable_HashEntry *));
+    for (count = tablePtr->numBuckets; count > 0; count--) {
+	newChainPtr[count - 1] = NULL;
     }
+    HashWriteBarrier ();
+    tablePtr->buckets = newChainPtr;
     tablePtr->rebuildSize *= 16;
     tablePtr->downShift -= 4;
+    HashWriteBarrier ();
     tablePtr->mask = (tablePtr->mask << 4) + 15;
 
     // printf("rebuilding table from %d buckets to %d buckets\n", oldSize, tablePtr->numBuckets);
 
+    /*
+     * For an incremental table, leave the entries where they are and let
+     * RehashStep move them over a few buckets at a time.
+     */
+
+    if (tablePtr->keyIndexType == CTABLE_KEYINDEX_INCREMENTAL) {
+	tablePtr->oldBuckets = oldBuckets;
+	tablePtr->oldNumBuckets = oldSize;
+	tablePtr->oldDownShift = tablePtr->downShift + 4;
+	tablePtr->oldMask = tablePtr->mask >> 4;
+	tablePtr->rehashIndex = 0;
+	tablePtr->generation++;
+	HashRebuildDone (tablePtr, &start);
+	return;
+    }
+
     /*
      * Rehash all of the existing entries into the new bucket array.
      */
@@ -682,17 +1505,588 @@ RebuildTable(ctable_HashTable *tablePtr)	/* Table to enlarge. */
 	}
     }
 
+    HashWriteBarrier ();
+    tablePtr->generation++;
+
     /*
      * Free up the old bucket array, if it was dynamically allocated.
      */
 
     if (oldBuckets != tablePtr->staticBuckets) {
-	ckfree((char*)oldBuckets);
+	HashFree(tablePtr, oldBuckets);
+    }
+
+    HashRebuildDone (tablePtr, &start);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RehashStep --
+ *
+ *	Move the entries of up to nBuckets buckets of the bucket array an
+ *	incremental table is being rebuilt out of into the new array.
+ *	When the last old bucket has been moved, the old array is freed
+ *	and the table leaves rehashing mode.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Entries get re-hashed to new buckets.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RehashStep(ctable_HashTable *tablePtr, int nBuckets)
+{
+    ctable_HashEntry **oldChainPtr;
+    ctable_HashEntry *hPtr;
+    int index;
+
+    while (nBuckets-- > 0 && tablePtr->rehashIndex < tablePtr->oldNumBuckets) {
+	oldChainPtr = &tablePtr->oldBuckets[tablePtr->rehashIndex];
+
+	for (hPtr = *oldChainPtr; hPtr != NULL; hPtr = *oldChainPtr) {
+	    *oldChainPtr = hPtr->nextPtr;
+	    index = RANDOM_INDEX (tablePtr, hPtr->hash);
+	    hPtr->nextPtr = tablePtr->buckets[index];
+	    tablePtr->buckets[index] = hPtr;
+	}
+	tablePtr->rehashIndex++;
+    }
+
+    if (tablePtr->rehashIndex >= tablePtr->oldNumBuckets) {
+	if (tablePtr->oldBuckets != tablePtr->staticBuckets) {
+	    HashFree(tablePtr, tablePtr->oldBuckets);
+	}
+	tablePtr->oldBuckets = NULL;
+	tablePtr->oldNumBuckets = 0;
+	tablePtr->rehashIndex = 0;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Open addressing layout --
+ *
+ *	Instead of chaining the hash entries embedded in the rows, keep
+ *	the entry pointers in a flat slot array and a parallel array of
+ *	one control byte per slot. The control byte holds 7 bits of the
+ *	hash for a full slot, or marks the slot empty or deleted, so a
+ *	probe examines a whole group of slots with one compare of their
+ *	control bytes and only touches a row when those 7 bits match.
+ *
+ *	Slots are probed a group at a time, groups being aligned so the
+ *	group a slot belongs to never changes. A lookup stops at the
+ *	first group that has an empty slot.
+ *
+ *----------------------------------------------------------------------
+ */
+
+#define OPEN_GROUP_WIDTH	16
+#define OPEN_CTRL_EMPTY		((unsigned char)0x80)
+#define OPEN_CTRL_DELETED	((unsigned char)0xFE)
+
+// rebuild when 7/8 of the slots are full or deleted
+#define OPEN_MAX_LOAD(slots)	((slots) - (slots) / 8)
+
+#ifdef __GNUC__
+# define OpenLowestBit(bits) __builtin_ctz(bits)
+#else
+static inline int
+OpenLowestBit(unsigned int bits)
+{
+    int i = 0;
+
+    while (!(bits & 1)) {
+	bits >>= 1;
+	i++;
+    }
+    return i;
+}
+#endif
+
+/*
+ * OpenMix - spread the stored hash over 64 bits, so the control byte
+ * and the group number come from independent bits even for the weaker
+ * string hash.
+ */
+static inline uint64_t
+OpenMix(unsigned int hash)
+{
+    uint64_t m = hash;
+
+    m ^= m >> 33;
+    m *= 0xff51afd7ed558ccdull;
+    m ^= m >> 33;
+    m *= 0xc4ceb9fe1a85ec53ull;
+    m ^= m >> 33;
+    return m;
+}
+
+#define OPEN_H2(m)		((unsigned char)((m) & 0x7f))
+#define OPEN_GROUP(tablePtr, m)	((size_t)((m) >> 7) & (size_t)(tablePtr)->mask)
+
+/*
+ * OpenMatchByte - return a bitmask of the slots in the group starting
+ * at ctrl whose control byte is b.
+ */
+static inline unsigned int
+OpenMatchByte(CONST unsigned char *ctrl, unsigned char b)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((CONST __m128i *)ctrl);
+
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)b)));
+#else
+    unsigned int bits = 0;
+    int i;
+
+    for (i = 0; i < OPEN_GROUP_WIDTH; i++) {
+	if (ctrl[i] == b) {
+	    bits |= 1 << i;
+	}
+    }
+    return bits;
+#endif
+}
+
+/*
+ * OpenMatchFree - return a bitmask of the empty or deleted slots in the
+ * group starting at ctrl (the ones with the high bit set).
+ */
+static inline unsigned int
+OpenMatchFree(CONST unsigned char *ctrl)
+{
+#ifdef __SSE2__
+    return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((CONST __m128i *)ctrl));
+#else
+    unsigned int bits = 0;
+    int i;
+
+    for (i = 0; i < OPEN_GROUP_WIDTH; i++) {
+	if (ctrl[i] & 0x80) {
+	    bits |= 1 << i;
+	}
     }
+    return bits;
+#endif
+}
+
+/*
+ * OpenAllocSlots - set up empty slot and control arrays for nSlots slots.
+ * The smallest table uses the static buckets for its slots.
+ */
+static void
+OpenAllocSlots(ctable_HashTable *tablePtr, int nSlots)
+{
+    if (nSlots == CTABLE_SMALL_HASH_TABLE) {
+	tablePtr->buckets = tablePtr->staticBuckets;
+    } else {
+	tablePtr->buckets = (ctable_HashEntry **) HashAlloc(tablePtr,
+		nSlots * sizeof(ctable_HashEntry *));
+    }
+    memset(tablePtr->buckets, 0, nSlots * sizeof(ctable_HashEntry *));
 
-    // printf("done\n");
+    tablePtr->ctrl = (unsigned char *) HashAlloc(tablePtr, nSlots);
+    memset(tablePtr->ctrl, OPEN_CTRL_EMPTY, nSlots);
+
+    tablePtr->numBuckets = nSlots;
+    tablePtr->mask = nSlots / OPEN_GROUP_WIDTH - 1;
+    tablePtr->rebuildSize = OPEN_MAX_LOAD(nSlots);
+    tablePtr->numTombstones = 0;
 }
 
+/*
+ * OpenInitHashTable - set up an empty open addressing table, called from
+ * ctable_InitHashTable after the common fields are set up.
+ */
+static void
+OpenInitHashTable(ctable_HashTable *tablePtr)
+{
+#if (CTABLE_SMALL_HASH_TABLE % 16 != 0)
+    Tcl_Panic("OpenInitHashTable: CTABLE_SMALL_HASH_TABLE is not a multiple of the group width");
+#endif
+    OpenAllocSlots(tablePtr, CTABLE_SMALL_HASH_TABLE);
+}
+
+/*
+ * OpenPlaceEntry - put an entry known not to be in the table into the
+ * first free slot on its probe sequence.
+ */
+static inline void
+OpenPlaceEntry(ctable_HashTable *tablePtr, ctable_HashEntry *hPtr)
+{
+    uint64_t m = OpenMix(hPtr->hash);
+    size_t group = OPEN_GROUP(tablePtr, m);
+    size_t probe = 0;
+    size_t slot;
+    unsigned int bits;
+
+    while (!(bits = OpenMatchFree(tablePtr->ctrl + group * OPEN_GROUP_WIDTH))) {
+	probe++;
+	group = (group + probe) & (size_t)tablePtr->mask;
+    }
+
+    slot = group * OPEN_GROUP_WIDTH + OpenLowestBit(bits);
+    if (tablePtr->ctrl[slot] == OPEN_CTRL_DELETED) {
+	tablePtr->numTombstones--;
+    }
+    tablePtr->ctrl[slot] = OPEN_H2(m);
+    tablePtr->buckets[slot] = hPtr;
+}
+
+/*
+ * OpenResizeTable - move the entries of an open addressing table into
+ * fresh arrays of newSize slots, dropping any deleted slots.
+ */
+static inline void
+OpenResizeTable(ctable_HashTable *tablePtr, int newSize)
+{
+    ctable_HashEntry **oldSlots = tablePtr->buckets;
+    ctable_HashEntry *smallSlots[CTABLE_SMALL_HASH_TABLE];
+    unsigned char *oldCtrl = tablePtr->ctrl;
+    int oldSize = tablePtr->numBuckets;
+    int i;
+    Tcl_Time start;
+
+    Tcl_GetTime (&start);
+
+    // the static slots may be reused for the new table
+    if (oldSlots == tablePtr->staticBuckets) {
+	memcpy(smallSlots, oldSlots, sizeof smallSlots);
+	oldSlots = smallSlots;
+    }
+
+    OpenAllocSlots(tablePtr, newSize);
+
+    for (i = 0; i < oldSize; i++) {
+	if (!(oldCtrl[i] & 0x80)) {
+	    OpenPlaceEntry(tablePtr, oldSlots[i]);
+	}
+    }
+
+    if (oldSlots != smallSlots) {
+	HashFree(tablePtr, oldSlots);
+    }
+    HashFree(tablePtr, oldCtrl);
+
+    HashRebuildDone (tablePtr, &start);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * OpenRebuildTable --
+ *
+ *	This function is invoked when too many slots of an open addressing
+ *	table are full or deleted. If the table is mostly live entries,
+ *	the number of slots is doubled, otherwise the table is rebuilt at
+ *	the same size to clear out the deleted slots.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory gets reallocated and entries get moved to new slots.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+OpenRebuildTable(ctable_HashTable *tablePtr)
+{
+    int newSize = tablePtr->numBuckets;
+
+    if (tablePtr->numEntries >= tablePtr->rebuildSize / 2) {
+	newSize *= 2;
+    }
+
+    OpenResizeTable(tablePtr, newSize);
+}
+
+/*
+ * OpenPresizeTable - double the slots of an open addressing table until
+ * expected entries fit under the load limit.
+ */
+static void
+OpenPresizeTable(ctable_HashTable *tablePtr, int expected)
+{
+    int newSize = tablePtr->numBuckets;
+
+    while (OPEN_MAX_LOAD(newSize) < expected && newSize < INT_MAX / 2) {
+	newSize *= 2;
+    }
+    if (newSize > tablePtr->numBuckets) {
+	OpenResizeTable(tablePtr, newSize);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * OpenInitOrStoreHashEntry --
+ *
+ *	Open addressing version of ctable_InitOrStoreHashEntry, with the
+ *	same arguments and results.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static inline ctable_HashEntry *
+OpenInitOrStoreHashEntry(
+    ctable_HashTable *tablePtr,	/* Table in which to lookup entry. */
+    CONST char *key,		/* Key to use to find or create matching
+				 * entry. */
+    ctable_HashEntry *newEntry,	/* if not null, use this entry */
+    int flags,			/* options */
+    int *newPtr)		/* Store info here telling whether a new entry
+				 * was created. */
+{
+    ctable_HashEntry *hPtr;
+    unsigned int hash, hashHigh;
+    uint64_t m;
+    unsigned char h2;
+    size_t group;
+    size_t probe = 0;
+    int sampled;
+
+    // make room up front, so the probe below is the one we insert with
+    if (newEntry && tablePtr->numEntries + tablePtr->numTombstones >= tablePtr->rebuildSize) {
+	OpenRebuildTable(tablePtr);
+    }
+
+    if (!HashKeyWords (tablePtr, key, &hash, &hashHigh)) {
+	if (newPtr)
+	    *newPtr = 0;
+	return NULL;
+    }
+    m = OpenMix(hash);
+    h2 = OPEN_H2(m);
+    group = OPEN_GROUP(tablePtr, m);
+    sampled = HashSampleLookup (tablePtr);
+
+    for (;;) {
+	CONST unsigned char *ctrl = tablePtr->ctrl + group * OPEN_GROUP_WIDTH;
+	ctable_HashEntry **slots = tablePtr->buckets + group * OPEN_GROUP_WIDTH;
+	unsigned int bits = OpenMatchByte(ctrl, h2);
+
+	while (bits) {
+	    hPtr = slots[OpenLowestBit(bits)];
+	    if (EntryHasKey (tablePtr, key, hash, hashHigh, hPtr)) {
+		HashSampleProbes (tablePtr, sampled, (int)probe + 1);
+		if (newPtr)
+		    *newPtr = 0;
+		return hPtr;
+	    }
+	    bits &= bits - 1;
+	}
+
+	if (OpenMatchByte(ctrl, OPEN_CTRL_EMPTY)) {
+	    break;
+	}
+
+	probe++;
+	group = (group + probe) & (size_t)tablePtr->mask;
+    }
+    HashSampleProbes (tablePtr, sampled, (int)probe + 1);
+
+    if (!newPtr || !newEntry)
+	return NULL;
+
+    *newPtr = 1;
+
+    hPtr = newEntry;
+    if((flags & KEY_MASK) == KEY_VOLATILE) {
+        hPtr->key = (char *) ckalloc (strlen (key) + 1);
+        strcpy (hPtr->key, key);
+    } else {
+	hPtr->key = (char *)key;
+    }
+    hPtr->hash = hash;
+    hPtr->hashHigh = hashHigh;
+    hPtr->nextPtr = NULL;
+
+    OpenPlaceEntry(tablePtr, hPtr);
+    tablePtr->numEntries++;
+
+    return hPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * OpenDeleteHashEntry --
+ *
+ *	Remove an entry from an open addressing table. If the entry's
+ *	group still has an empty slot, no probe can have passed through
+ *	the group, so the slot can go back to empty; otherwise it is
+ *	marked deleted so probes keep going past it.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The entry's slot is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+OpenDeleteHashEntry(ctable_HashTable *tablePtr, ctable_HashEntry *entryPtr)
+{
+    uint64_t m = OpenMix(entryPtr->hash);
+    unsigned char h2 = OPEN_H2(m);
+    size_t group = OPEN_GROUP(tablePtr, m);
+    size_t probe = 0;
+
+    for (;;) {
+	unsigned char *ctrl = tablePtr->ctrl + group * OPEN_GROUP_WIDTH;
+	ctable_HashEntry **slots = tablePtr->buckets + group * OPEN_GROUP_WIDTH;
+	unsigned int bits = OpenMatchByte(ctrl, h2);
+
+	while (bits) {
+	    int i = OpenLowestBit(bits);
+
+	    if (slots[i] == entryPtr) {
+		if (OpenMatchByte(ctrl, OPEN_CTRL_EMPTY)) {
+		    ctrl[i] = OPEN_CTRL_EMPTY;
+		} else {
+		    ctrl[i] = OPEN_CTRL_DELETED;
+		    tablePtr->numTombstones++;
+		}
+		slots[i] = NULL;
+		tablePtr->numEntries--;
+		return;
+	    }
+	    bits &= bits - 1;
+	}
+
+	if (OpenMatchByte(ctrl, OPEN_CTRL_EMPTY)) {
+	    Tcl_Panic("entry not found in ctable_DeleteHashEntry");
+	}
+
+	probe++;
+	group = (group + probe) & (size_t)tablePtr->mask;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * OpenProbeHistogram --
+ *
+ *	Count how many entries of an open addressing table are found in
+ *	each probe.
+ *
+ * Results:
+ *	count[1..NUM_COUNTERS-1] gets the number of entries found in that
+ *	probe, *overflowPtr the number found later, *longestPtr the most
+ *	probes any entry needs and *averagePtr the average.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+OpenProbeHistogram(
+    ctable_HashTable *tablePtr,
+    int *count,
+    int *overflowPtr,
+    int *longestPtr,
+    double *averagePtr)
+{
+    int overflow, longest, i, j;
+    double average;
+
+    for (i = 0; i < NUM_COUNTERS; i++) {
+	count[i] = 0;
+    }
+    overflow = 0;
+    longest = 0;
+    average = 0.0;
+
+    for (i = 0; i < tablePtr->numBuckets; i++) {
+	size_t group;
+
+	if (tablePtr->ctrl[i] & 0x80) {
+	    continue;
+	}
+
+	group = OPEN_GROUP(tablePtr, OpenMix(tablePtr->buckets[i]->hash));
+	for (j = 1; group != (size_t)i / OPEN_GROUP_WIDTH; j++) {
+	    group = (group + j) & (size_t)tablePtr->mask;
+	}
+
+	if (j < NUM_COUNTERS) {
+	    count[j]++;
+	} else {
+	    overflow++;
+	}
+	if (j > longest) {
+	    longest = j;
+	}
+	average += j;
+    }
+    if (tablePtr->numEntries != 0) {
+	average /= tablePtr->numEntries;
+    }
+
+    *overflowPtr = overflow;
+    *longestPtr = longest;
+    *averagePtr = average;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * OpenHashStats --
+ *
+ *	Open addressing version of ctable_HashStats, giving a histogram
+ *	of how many groups must be probed to reach each entry.
+ *
+ * Results:
+ *	The return value is a malloc-ed string containing information about
+ *	tablePtr. It is the caller's responsibility to free this string.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static CONST char *
+OpenHashStats(ctable_HashTable *tablePtr)
+{
+    int count[NUM_COUNTERS], overflow, longest, i;
+    double average;
+    char *result, *p;
+
+    OpenProbeHistogram (tablePtr, count, &overflow, &longest, &average);
+
+    result = (char *) ckalloc((unsigned) (NUM_COUNTERS*60) + 300);
+    sprintf(result, "%d entries in table, %d slots, %d deleted slots\n",
+	    tablePtr->numEntries, tablePtr->numBuckets, tablePtr->numTombstones);
+    p = result + strlen(result);
+    for (i = 1; i < NUM_COUNTERS; i++) {
+	sprintf(p, "number of entries found in probe %d: %d\n", i, count[i]);
+	p += strlen(p);
+    }
+    sprintf(p, "number of entries found in probe %d or later: %d\n",
+	    NUM_COUNTERS, overflow);
+    p += strlen(p);
+    sprintf(p, "average probes for entry: %.1f", average);
+    return result;
+}
+
+
 
 /*
  * Local Variables:
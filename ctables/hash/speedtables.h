@@ -18,6 +18,8 @@
 #ifndef _SPEEDTABLES_H
 #define _SPEEDTABLES_H
 
+#include <stdint.h>
+
 /*
  * Flags
  */
@@ -26,6 +28,27 @@
 #define KEY_STATIC	0x2	// Key is static
 #define KEY_VOLATILE	0x0	// Key needs to be copied and freed
 
+/*
+ * Key hash functions, selected per table by the "hash" option on the key
+ */
+#define CTABLE_HASH_TCL		0	// Classic Tcl times-9 string hash
+#define CTABLE_HASH_WYHASH	1	// Seeded word-at-a-time hash (wyhash)
+
+/*
+ * Key index layouts, selected per table by the "keyindex" option on the key
+ */
+#define CTABLE_KEYINDEX_CHAINED	0	// Chained buckets, as in Tcl
+#define CTABLE_KEYINDEX_OPEN	1	// Open addressing with control bytes
+#define CTABLE_KEYINDEX_INCREMENTAL 2	// Chained buckets, rehashed a few
+					// buckets at a time when grown
+
+/*
+ * Key types, selected per table by the "keytype" option on the key
+ */
+#define CTABLE_KEYTYPE_STRING	0	// Any string
+#define CTABLE_KEYTYPE_INT	1	// Decimal 32 bit integer
+#define CTABLE_KEYTYPE_WIDE	2	// Decimal 64 bit integer
+
 /*
  * Forward declarations of ctable_HashTable and related types.
  */
@@ -57,6 +80,9 @@ struct ctable_HashEntry {
 				 * or NULL for end of chain. */
     char             *key;
     unsigned int      hash;	/* Hash value. */
+    unsigned int      hashHigh;	/* Integer keys: high word of the hash. The
+				 * two words are an invertible mix of the
+				 * key's value, so they identify the key. */
 };
 
 /*
@@ -87,6 +113,39 @@ struct ctable_HashTable {
 				 * Designed to use high-order bits of
 				 * randomized keys. */
     int mask;			/* Mask value used in hashing function. */
+    int hashType;		/* CTABLE_HASH_* function used to hash keys. */
+    uint64_t seed;		/* Per-table seed for seeded hash types. */
+    int keyIndexType;		/* CTABLE_KEYINDEX_* layout of the table. For
+				 * open addressing, buckets is the slot array,
+				 * numBuckets the number of slots, mask the
+				 * mask for the number of slot groups, and
+				 * rebuildSize the number of used (full or
+				 * deleted) slots that forces a rebuild. */
+    unsigned char *ctrl;	/* Open addressing: control byte per slot,
+				 * empty, deleted, or 7 bits of the hash. */
+    int numTombstones;		/* Open addressing: number of deleted slots. */
+    ctable_HashEntry **oldBuckets;
+				/* Incremental rehash: bucket array entries
+				 * are being migrated out of, or NULL. */
+    int oldNumBuckets;		/* Incremental rehash: size of oldBuckets. */
+    int oldDownShift;		/* Incremental rehash: hashing constants */
+    int oldMask;		/* for oldBuckets. */
+    int rehashIndex;		/* Incremental rehash: buckets in oldBuckets
+				 * below this index have been migrated. */
+    int keyType;		/* CTABLE_KEYTYPE_* of the keys. */
+    void *share;		/* Shared memory segment the bucket arrays
+				 * are allocated in, or NULL. */
+    volatile unsigned int generation;
+				/* Bumped when entries may have moved between
+				 * chains, so shared memory readers can tell
+				 * their lookup raced the master. Odd while
+				 * the table is being rebuilt. */
+    unsigned int lookups;	/* Statistics: lookups by the master, */
+    unsigned int sampledLookups;/* how many of them were sampled, and */
+    Tcl_WideInt sampledProbes;	/* the entries (or groups) they compared. */
+    int rebuilds;		/* Statistics: times the table was grown, */
+    Tcl_WideInt rebuildMicroseconds;
+				/* and the time spent doing it. */
 };
 
 /*
@@ -103,10 +162,20 @@ typedef struct ctable_HashSearch {
 } ctable_HashSearch;
 
 
-void ctable_InitHashTable (ctable_HashTable *tablePtr);
+void ctable_InitHashTable (ctable_HashTable *tablePtr, int hashType, int keyIndexType, int keyType, void *share);
+
+int ctable_ValidHashKey (ctable_HashTable *tablePtr, CONST char *key);
+
+int ctable_CompareIntKeys (CONST char *key1, CONST char *key2);
 
 ctable_HashEntry *  ctable_NextHashEntry (ctable_HashSearch * searchPtr);
 
+int ctable_ReaderFindHashEntry (ctable_HashTable *tablePtr, CONST char *key, ctable_HashEntry **entryPtr);
+
+void ctable_PresizeHashTable (ctable_HashTable *tablePtr, int expected);
+
+Tcl_Obj *ctable_HashStatsObj (ctable_HashTable *tablePtr);
+
 #endif /* _SPEEDTABLES_H */
 
 /*
@@ -0,0 +1,475 @@
+// $Id$
+
+/*
+  Hash index, see ctable_hashindex.h for the layout.
+
+  The master is the only process that changes an index. A new entry is
+  complete before it's put at the head of its chain, and an entry that's
+  gone is linked around, not changed, so a reader partway down a chain
+  always gets to the end of it. Doubling the table moves every entry to
+  a new chain, which happens while the generation is odd; a reader notes
+  the generation before it goes down a chain and looks again if it moved.
+  Freed entries and bucket arrays stay readable until the readers have
+  moved on to a later cycle.
+*/
+#include "jsw_slib.h"
+#include "ctable_hashindex.h"
+#ifdef WITH_SHARED_TABLES
+#include "shared.h"
+#endif
+
+#ifdef __GNUC__
+# define HashIndexWriteBarrier()	__atomic_thread_fence(__ATOMIC_RELEASE)
+# define HashIndexReadBarrier()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#else
+# define HashIndexWriteBarrier()
+# define HashIndexReadBarrier()
+#endif
+
+// times a reader looks for a value before it gives up
+#define HASHINDEX_FIND_TRIES	100
+
+//
+// HashIndexAlloc - allocate index memory, in shared memory if it has a share
+//
+static void *
+HashIndexAlloc (void *share, size_t size)
+{
+    void *mem;
+
+#ifdef WITH_SHARED_TABLES
+    if (share) {
+	mem = shmalloc ((shm_t *)share, size);
+	if (!mem) {
+	    Tcl_Panic ("Can't allocate shared memory for hash index");
+	}
+	return mem;
+    }
+#endif
+    mem = ckalloc (size);
+    return mem;
+}
+
+//
+// HashIndexFree - free index memory, shared memory is only released once
+// the readers are done with it
+//
+static void
+HashIndexFree (void *share, void *mem)
+{
+#ifdef WITH_SHARED_TABLES
+    if (share) {
+	shmfree ((shm_t *)share, (char *)mem);
+	return;
+    }
+#endif
+    ckfree ((char *)mem);
+}
+
+static ctable_HashIndexEntry **
+HashIndexNewBuckets (void *share, size_t nBuckets)
+{
+    ctable_HashIndexEntry **buckets;
+    size_t                  i;
+
+    buckets = (ctable_HashIndexEntry **)HashIndexAlloc (share, nBuckets * sizeof *buckets);
+    for (i = 0; i < nBuckets; i++) {
+	buckets[i] = NULL;
+    }
+    return buckets;
+}
+
+//
+// ctable_HashIndexNew - create an empty index
+//
+ctable_HashIndex *
+ctable_HashIndexNew (void *share)
+{
+    ctable_HashIndex *index = (ctable_HashIndex *)HashIndexAlloc (share, sizeof *index);
+
+    index->buckets = HashIndexNewBuckets (share, CTABLE_HASHINDEX_BUCKETS);
+    index->nBuckets = CTABLE_HASHINDEX_BUCKETS;
+    index->nEntries = 0;
+    index->size = 0;
+    index->generation = 0;
+    return index;
+}
+
+//
+// ctable_HashIndexDelete - free the index but not the rows in it. If this
+// is the last use of the shared memory segment there's no point freeing it
+// piece by piece.
+//
+void
+ctable_HashIndexDelete (ctable_HashIndex *index, void *share, int final)
+{
+    ctable_HashIndexEntry *entry;
+    ctable_HashIndexEntry *next;
+    size_t                 i;
+
+    if (final && share) {
+	return;
+    }
+
+    for (i = 0; i < index->nBuckets; i++) {
+	for (entry = index->buckets[i]; entry != NULL; entry = next) {
+	    next = entry->next;
+	    HashIndexFree (share, entry);
+	}
+    }
+    HashIndexFree (share, index->buckets);
+    HashIndexFree (share, index);
+}
+
+//
+// HashIndexResize - move every entry to a table of nBuckets buckets
+//
+// The new buckets are in place before the count of them grows, so a
+// reader that gets the count and the buckets from either side of the
+// change never looks past the end of the buckets.
+//
+static void
+HashIndexResize (ctable_HashIndex *index, void *share, size_t nBuckets)
+{
+    ctable_HashIndexEntry **oldBuckets = index->buckets;
+    ctable_HashIndexEntry **buckets = HashIndexNewBuckets (share, nBuckets);
+    ctable_HashIndexEntry  *entry;
+    ctable_HashIndexEntry  *next;
+    size_t                  i;
+
+    index->generation++;
+    HashIndexWriteBarrier ();
+
+    for (i = 0; i < index->nBuckets; i++) {
+	for (entry = oldBuckets[i]; entry != NULL; entry = next) {
+	    ctable_HashIndexEntry **bucket = &buckets[entry->hash & (nBuckets - 1)];
+
+	    next = entry->next;
+	    entry->next = *bucket;
+	    *bucket = entry;
+	}
+    }
+
+    index->buckets = buckets;
+    HashIndexWriteBarrier ();
+    index->nBuckets = nBuckets;
+
+    HashIndexWriteBarrier ();
+    index->generation++;
+
+    HashIndexFree (share, oldBuckets);
+}
+
+//
+// HashIndexAddEntry - make an entry for a value that's not in the index,
+// with row as its only row
+//
+static ctable_HashIndexEntry *
+HashIndexAddEntry (ctable_HashIndex *index, void *share, unsigned int hash, ctable_BaseRow *row, int nodeIdx)
+{
+    ctable_HashIndexEntry  *entry;
+    ctable_HashIndexEntry **bucket;
+
+    if (index->nEntries >= index->nBuckets * CTABLE_HASHINDEX_LOAD) {
+	HashIndexResize (index, share, index->nBuckets * 2);
+    }
+
+    entry = (ctable_HashIndexEntry *)HashIndexAlloc (share, sizeof *entry);
+    entry->hash = hash;
+    ctable_ListInit (&entry->row, __FILE__, __LINE__);
+    ctable_ListInsertHead (&entry->row, row, nodeIdx);
+
+    bucket = &index->buckets[hash & (index->nBuckets - 1)];
+    entry->next = *bucket;
+    HashIndexWriteBarrier ();
+    *bucket = entry;
+
+    index->nEntries++;
+    return entry;
+}
+
+//
+// ctable_HashIndexInsert - put a row in the index, in the list of rows
+// with its value if there is one
+//
+// Returns 0 if unique is set and there's already a row with the value.
+//
+int
+ctable_HashIndexInsert (ctable_HashIndex *index, cmp_f cmp, hash_f hash, void *share, ctable_BaseRow *row, int nodeIdx, int unique)
+{
+    unsigned int           h = hash (row);
+    ctable_HashIndexEntry *entry;
+
+    for (entry = index->buckets[h & (index->nBuckets - 1)]; entry != NULL; entry = entry->next) {
+	if (entry->hash == h && cmp (row, entry->row) == 0) {
+	    break;
+	}
+    }
+
+    if (entry != NULL) {
+	if (unique) {
+	    return 0;
+	}
+	ctable_ListInsertHead (&entry->row, row, nodeIdx);
+    } else {
+	HashIndexAddEntry (index, share, h, row, nodeIdx);
+    }
+
+    index->size++;
+    return 1;
+}
+
+//
+// ctable_HashIndexErase - take a row out of the index, and its value too
+// if it's the last row with that value
+//
+// The row's list head is the entry's, so the entry is found from that
+// rather than the row's value, which may already have changed.
+//
+int
+ctable_HashIndexErase (ctable_HashIndex *index, void *share, ctable_BaseRow *row, int nodeIdx)
+{
+    ctable_HashIndexEntry  *entry;
+    ctable_HashIndexEntry **link;
+
+    entry = (ctable_HashIndexEntry *)((char *)row->_ll_nodes[nodeIdx].head - offsetof (ctable_HashIndexEntry, row));
+
+    index->size--;
+
+    if (row->_ll_nodes[nodeIdx].next != NULL || row->_ll_nodes[nodeIdx].prev != &entry->row) {
+	// other rows have the value, just unlink this one
+	ctable_ListRemove (row, nodeIdx);
+	return 1;
+    }
+
+    // it's the last one, take the entry out of its chain while the row is
+    // still in it for anyone looking at it, then take the row out
+    for (link = &index->buckets[entry->hash & (index->nBuckets - 1)]; *link != entry; link = &(*link)->next) {
+	if (*link == NULL) {
+	    Tcl_Panic ("hash index entry 0x%lx for row 0x%lx isn't in its bucket", (long)entry, (long)row);
+	}
+    }
+    *link = entry->next;
+    HashIndexWriteBarrier ();
+
+    ctable_ListRemove (row, nodeIdx);
+    index->nEntries--;
+    HashIndexFree (share, entry);
+    return 1;
+}
+
+//
+// ctable_HashIndexBuild - fill the index from n rows sorted by cmp, with the
+// table sized for them up front and an entry made for each run of rows with
+// the same value
+//
+void
+ctable_HashIndexBuild (ctable_HashIndex *index, cmp_f cmp, hash_f hash, void *share, ctable_BaseRow **rows, size_t n, int nodeIdx)
+{
+    ctable_HashIndexEntry *entry = NULL;
+    size_t                 nBuckets = index->nBuckets;
+    size_t                 i;
+
+    if (index->size != 0) {
+	for (i = 0; i < n; i++) {
+	    ctable_HashIndexInsert (index, cmp, hash, share, rows[i], nodeIdx, 0);
+	}
+	return;
+    }
+
+    while (nBuckets * CTABLE_HASHINDEX_LOAD < n) {
+	nBuckets *= 2;
+    }
+    if (nBuckets != index->nBuckets) {
+	HashIndexResize (index, share, nBuckets);
+    }
+
+    for (i = 0; i < n; i++) {
+	if (entry != NULL && cmp (rows[i], entry->row) == 0) {
+	    ctable_ListInsertHead (&entry->row, rows[i], nodeIdx);
+	    continue;
+	}
+	entry = HashIndexAddEntry (index, share, hash (rows[i]), rows[i], nodeIdx);
+    }
+
+    index->size = n;
+}
+
+//
+// ctable_HashIndexFind - put the cursor on the entry with the row's value,
+// or at the end if there isn't one
+//
+// A reader that can't get a look at the chain without the master moving
+// it notes that the cursor isn't valid.
+//
+void
+ctable_HashIndexFind (ctable_HashIndex *index, cmp_f cmp, hash_f hash, ctable_HashIndexCursor *cur, ctable_BaseRow *row)
+{
+    unsigned int h = hash (row);
+    int          tries;
+
+    cur->walking = 0;
+
+    for (tries = 0; tries < HASHINDEX_FIND_TRIES; tries++) {
+	unsigned int           generation = index->generation;
+	ctable_HashIndexEntry **buckets;
+	ctable_HashIndexEntry  *entry;
+	ctable_BaseRow         *first = NULL;
+	size_t                  nBuckets;
+
+	if (generation & 1) {
+	    continue;
+	}
+	HashIndexReadBarrier ();
+
+	nBuckets = index->nBuckets;
+	HashIndexReadBarrier ();
+	buckets = index->buckets;
+
+	for (entry = buckets[h & (nBuckets - 1)]; entry != NULL; entry = entry->next) {
+	    // a reader can catch an entry on its way out
+	    if (entry->hash == h && (first = entry->row) != NULL && cmp (row, first) == 0) {
+		break;
+	    }
+	}
+
+	HashIndexReadBarrier ();
+	if (index->generation != generation) {
+	    continue;
+	}
+
+	cur->entry = entry;
+	cur->row = entry ? first : NULL;
+	cur->valid = 1;
+	return;
+    }
+
+    cur->entry = NULL;
+    cur->row = NULL;
+    cur->valid = 0;
+}
+
+//
+// HashIndexSettle - move the cursor on from entry to the first entry with
+// rows in it, in entry's bucket or the ones after it
+//
+static int
+HashIndexSettle (ctable_HashIndex *index, ctable_HashIndexCursor *cur, ctable_HashIndexEntry *entry)
+{
+    while (1) {
+	for (; entry != NULL; entry = entry->next) {
+	    if ((cur->row = entry->row) != NULL) {
+		cur->entry = entry;
+		return 1;
+	    }
+	}
+
+	if (++cur->bucket >= index->nBuckets) {
+	    break;
+	}
+	entry = index->buckets[cur->bucket];
+    }
+
+    cur->entry = NULL;
+    cur->row = NULL;
+    return 0;
+}
+
+//
+// ctable_HashIndexFirst - put the cursor on the first entry, to go through
+// all of them in no particular order
+//
+void
+ctable_HashIndexFirst (ctable_HashIndex *index, ctable_HashIndexCursor *cur)
+{
+    cur->walking = 1;
+    cur->valid = 1;
+    cur->bucket = 0;
+    HashIndexSettle (index, cur, index->buckets[0]);
+}
+
+//
+// ctable_HashIndexNext - step the cursor on to the next entry, or after a
+// find to the end, as there's only the one entry with a value
+//
+// Returns 0 at the end of the index.
+//
+int
+ctable_HashIndexNext (ctable_HashIndex *index, ctable_HashIndexCursor *cur)
+{
+    if (cur->entry == NULL) {
+	return 0;
+    }
+
+    if (!cur->walking) {
+	cur->entry = NULL;
+	cur->row = NULL;
+	return 0;
+    }
+
+    return HashIndexSettle (index, cur, cur->entry->next);
+}
+
+//
+// ctable_HashIndexBytes - FNV-1a hash of length bytes
+//
+unsigned int
+ctable_HashIndexBytes (const void *bytes, size_t length)
+{
+    const unsigned char *p = (const unsigned char *)bytes;
+    unsigned int         h = 2166136261U;
+
+    while (length-- > 0) {
+	h = (h ^ *p++) * 16777619U;
+    }
+    return h;
+}
+
+//
+// ctable_HashIndexString - FNV-1a hash of a string, up to max bytes of it
+// for a fixed length string
+//
+unsigned int
+ctable_HashIndexString (const char *string, size_t max)
+{
+    const unsigned char *p = (const unsigned char *)string;
+    unsigned int         h = 2166136261U;
+
+    while (max-- > 0 && *p != '\0') {
+	h = (h ^ *p++) * 16777619U;
+    }
+    return h;
+}
+
+//
+// ctable_HashIndexWide - hash of an integer, mixed so that nearby values
+// land in different buckets
+//
+unsigned int
+ctable_HashIndexWide (Tcl_WideInt value)
+{
+    Tcl_WideUInt h = (Tcl_WideUInt)value;
+
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+//
+// ctable_HashIndexDouble - hash of a double, 0.0 and -0.0 compare the same
+// so they have to hash the same
+//
+unsigned int
+ctable_HashIndexDouble (double value)
+{
+    Tcl_WideInt bits;
+
+    if (value == 0.0) {
+	return ctable_HashIndexWide (0);
+    }
+    memcpy (&bits, &value, sizeof bits);
+    return ctable_HashIndexWide (bits);
+}
+
+// vim: set ts=8 sw=4 sts=4 noet :
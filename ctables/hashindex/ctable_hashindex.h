@@ -0,0 +1,74 @@
+// $Id$
+
+#ifndef CTABLE_HASHINDEX_H
+#define CTABLE_HASHINDEX_H
+
+/*
+  Hash index layout
+
+  An alternative to the skip list for fields that are only ever searched
+  for with "=" and "in". Finding a value hashes it and looks down one
+  bucket's chain instead of comparing its way down the levels of a skip
+  list, but the values are kept in no order, so the index can't walk a
+  range or stand in for a sort.
+
+  Each entry in a chain is the head of the list of rows with one value,
+  linked through the row's _ll_nodes the same as the rows hanging off a
+  skip list node. Entries never move once they're made, a row's list
+  head pointer leads back to its entry, so a row comes out of the index
+  without looking its value up again.
+
+  Shared memory readers follow the master's chains while it changes
+  them. Entries are put at the head of a chain fully made, and taken out
+  by linking around them, so a reader on a chain always gets to its end.
+  Growing the table moves every entry, the generation is odd while it
+  does and a reader that sees it change looks again.
+*/
+
+// buckets in a new index, and entries per bucket before it doubles
+#define CTABLE_HASHINDEX_BUCKETS	16
+#define CTABLE_HASHINDEX_LOAD		2
+
+typedef struct ctable_HashIndexEntry ctable_HashIndexEntry;
+
+struct ctable_HashIndexEntry {
+  ctable_HashIndexEntry *next;     /* Next entry in the bucket */
+  unsigned int           hash;     /* Hash of the value */
+  ctable_BaseRow        *row;      /* Rows with the value */
+};
+
+typedef struct ctable_HashIndex {
+  ctable_HashIndexEntry **buckets;
+  size_t                  nBuckets; /* Always a power of two */
+  size_t                  nEntries; /* Distinct values */
+  size_t                  size;     /* Rows in the index */
+  volatile unsigned int   generation; /* Odd while entries are moving */
+} ctable_HashIndex;
+
+typedef struct ctable_HashIndexCursor {
+  ctable_HashIndexEntry *entry;    /* Entry at the cursor, NULL at end */
+  ctable_BaseRow        *row;      /* Row list at the cursor */
+  size_t                 bucket;   /* Bucket the entry is in */
+  int                    walking;  /* 1 if going through every entry */
+  int                    valid;    /* 0 if a reader lost its place */
+} ctable_HashIndexCursor;
+
+ctable_HashIndex *ctable_HashIndexNew ( void *share );
+void              ctable_HashIndexDelete ( ctable_HashIndex *index, void *share, int final );
+
+int               ctable_HashIndexInsert ( ctable_HashIndex *index, cmp_f cmp, hash_f hash, void *share, ctable_BaseRow *row, int nodeIdx, int unique );
+int               ctable_HashIndexErase ( ctable_HashIndex *index, void *share, ctable_BaseRow *row, int nodeIdx );
+void              ctable_HashIndexBuild ( ctable_HashIndex *index, cmp_f cmp, hash_f hash, void *share, ctable_BaseRow **rows, size_t n, int nodeIdx );
+
+/* Cursor placement, on the row's value or the first of all entries */
+void              ctable_HashIndexFind ( ctable_HashIndex *index, cmp_f cmp, hash_f hash, ctable_HashIndexCursor *cur, ctable_BaseRow *row );
+void              ctable_HashIndexFirst ( ctable_HashIndex *index, ctable_HashIndexCursor *cur );
+int               ctable_HashIndexNext ( ctable_HashIndex *index, ctable_HashIndexCursor *cur );
+
+/* Hashes for the generated field hash functions */
+unsigned int      ctable_HashIndexBytes ( const void *bytes, size_t length );
+unsigned int      ctable_HashIndexString ( const char *string, size_t max );
+unsigned int      ctable_HashIndexWide ( Tcl_WideInt value );
+unsigned int      ctable_HashIndexDouble ( double value );
+
+#endif
@@ -34,6 +34,7 @@ struct ctable_BaseRow {
 #ifdef WITH_SHARED_TABLES
     cell_t		_row_cycle;
 #endif
+    unsigned int	_rowNumber;
     // _ll_nodes absolutely must be the last thing defined in the base row
     ctable_LinkedListNode _ll_nodes[0];
 };
@@ -455,12 +455,12 @@ void read_unlock(shm_t   *shm)
     self->cycle = LOST_HORIZON;
 }
 
-// Go through each garbage block and, if it's not in use by any readers, return it to the free list.
+// Can memory given up in the write cycle "cycle" be used again, because no
+// reader can still be looking at it.
 // Callable only by master.
-void garbage_collect(shm_t   *shm)
+int shmcollectable(shm_t *shm, cell_t cycle)
 {
     cell_t       horizon = shm->horizon;
-    int          collected = 0;
 
     if(horizon != LOST_HORIZON) {
         horizon -= TWILIGHT_ZONE;
@@ -468,13 +468,22 @@ void garbage_collect(shm_t   *shm)
             horizon--;
     }
 
+    int delta = horizon - cycle;
+    return horizon == LOST_HORIZON || cycle == LOST_HORIZON || delta > 0;
+}
+
+// Go through each garbage block and, if it's not in use by any readers, return it to the free list.
+// Callable only by master.
+void garbage_collect(shm_t   *shm)
+{
+    int          collected = 0;
+
     assert(shm->garbage != NULL && "master is missing garbage queue");
 
     while(!shm->garbage->empty()) {
 	garbage_t &garbp = shm->garbage->front();
 
-        int delta = horizon - garbp.cycle;
-        if(horizon == LOST_HORIZON || garbp.cycle == LOST_HORIZON || delta > 0) {
+        if(shmcollectable(shm, garbp.cycle)) {
             shmdealloc_raw(shm, garbp.memory);
 	    shm->garbage->pop_front();
             collected++;
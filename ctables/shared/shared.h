@@ -154,6 +154,7 @@ volatile reader_t *pid2reader(volatile mapheader_t *map, int pid);
 int read_lock(shm_t *shm);
 void read_unlock(shm_t *shm);
 void garbage_collect(shm_t *shm);
+int shmcollectable(shm_t *shm, cell_t cycle);
 cell_t oldest_reader_cycle(shm_t *shm);
 void shared_perror(const char *text);
 void shmpanic(const char *message);
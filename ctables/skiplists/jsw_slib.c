@@ -10,6 +10,8 @@
 */
 #include "jsw_rand.h"
 #include "jsw_slib.h"
+#include "ctable_btree.h"
+#include "ctable_hashindex.h"
 #ifdef WITH_SHARED_TABLES
 #include "shared.h"
 #endif
@@ -32,11 +34,63 @@ typedef struct jsw_node {
   struct jsw_node        *next[];   /* Dynamic array of next links */
 } jsw_node_t;
 
+//
+// Each link also has a span, the number of rows from the node it's in up to
+// the node it points to, or to the end of the list if it's NULL. The spans
+// follow the links in the node. The span of a node's bottom link is the
+// number of rows in the node, and the head's links start at row 0, so adding
+// up the spans on the way down the list gives the position of any row.
+//
+#define SPAN(node) ((size_t *)(void *)((char *)(node)->next + (node)->height * sizeof (jsw_node_t *)))
+
+// bytes in a node of a given height, with its links and their spans
+#define NODE_SIZE(height) (sizeof (jsw_node_t) + (height) * (sizeof (jsw_node_t *) + sizeof (size_t)))
+
+//
+// Nodes are carved out of slabs, one size class for each height, rather
+// than allocated one at a time, and the slabs are freed all at once when
+// the list is deleted. A class's first slab holds a few nodes and each one
+// after that twice as many, up to JSW_SLAB_BYTES, so lists with few rows
+// don't take much more than they need. Freed nodes are kept on their
+// class's free list to be used again.
+//
+// Shared memory readers can still be looking at a node after the master
+// takes it out of the list, so a freed node in shared memory waits, like
+// memory passed to shmfree, until every reader has moved on before it's
+// used again.
+//
+#define JSW_SLAB_BYTES 65536
+#define JSW_SLAB_FIRST 4
+
+typedef struct jsw_slab {
+  struct jsw_slab *next;   /* Next slab of the list's, of any height */
+  size_t           bytes;  /* Size of the slab, this header included */
+} jsw_slab_t;
+
+typedef struct jsw_waiting {
+  struct jsw_node *node;   /* Node freed in shared memory */
+  size_t           cycle;  /* Write cycle it was freed in */
+} jsw_waiting_t;
+
+typedef struct jsw_pool {
+  jsw_slab_t      *slabs;  /* All of the slabs */
+  struct jsw_node **free;  /* Free nodes of each height, linked by row */
+  char           **fresh;  /* Next never used node of each height */
+  size_t          *left;   /* Never used nodes left in the newest slab */
+  size_t          *grow;   /* Nodes in the next slab of each height */
+  size_t           bytes;  /* Memory the slabs take */
+  jsw_waiting_t   *waiting; /* Shared memory nodes freed too recently */
+  size_t           first;  /* Oldest of them */
+  size_t           nwaiting; /* End of them */
+  size_t           awaiting; /* Room for them */
+} jsw_pool_t;
+
 // dynamic shared elements
 typedef struct jsw_pub {
   jsw_node_t  *head; /* Full height header node */
   size_t       curh; /* Tallest available column */
   size_t       size; /* Number of row at level 0 */
+  size_t       keys; /* Number of nodes at level 0, distinct keys */
 } jsw_pub_t;
 
 // statically defined and private elements
@@ -52,6 +106,15 @@ struct jsw_skip {
   void        *share;
 #endif
   jsw_node_t **fix;  /* Update array */
+  size_t      *rank; /* Rows before each node in the update array */
+  size_t       curpos; /* Rows before the current link */
+  int          finger; /* Update array still describes a place in the list */
+  ctable_Btree *btree; /* B+tree in place of the list, see ctable_btree.h */
+  ctable_BtreeCursor bcur; /* Traversal cursor for the B+tree */
+  ctable_HashIndex *hash; /* Hash index in place of the list, see ctable_hashindex.h */
+  ctable_HashIndexCursor hcur; /* Traversal cursor for the hash index */
+  hash_f       hashf; /* Row hash function for the hash index */
+  jsw_pool_t  *pool; /* Node slabs, owner only, NULL for readers */
 };
 
 /*
@@ -99,31 +162,195 @@ static size_t rlevel ( size_t max )
 }
 
 //
-// new_node - construct an empty new node, does not make a copy of the row
+// pool_new - make an empty node pool for a list of max height
+//
+static jsw_pool_t *pool_new ( size_t max )
+{
+  jsw_pool_t *pool = (jsw_pool_t *)ckalloc ( sizeof *pool );
+  size_t h;
+
+  pool->slabs = NULL;
+  pool->free = (jsw_node_t **)ckalloc ( max * sizeof *pool->free );
+  pool->fresh = (char **)ckalloc ( max * sizeof *pool->fresh );
+  pool->left = (size_t *)ckalloc ( max * sizeof *pool->left );
+  pool->grow = (size_t *)ckalloc ( max * sizeof *pool->grow );
+  for ( h = 0; h < max; h++ ) {
+    pool->free[h] = NULL;
+    pool->fresh[h] = NULL;
+    pool->left[h] = 0;
+    pool->grow[h] = JSW_SLAB_FIRST;
+  }
+  pool->bytes = 0;
+  pool->waiting = NULL;
+  pool->first = 0;
+  pool->nwaiting = 0;
+  pool->awaiting = 0;
+
+  return pool;
+}
+
+//
+// pool_delete - free all of a pool's slabs, and with them every node that
+// came from it
+//
+static void pool_delete ( jsw_pool_t *pool, void *share, int final )
+{
+  jsw_slab_t *slab;
+  jsw_slab_t *save;
+
+  for ( slab = pool->slabs; slab != NULL; slab = save ) {
+    save = slab->next;
+#ifdef WITH_SHARED_TABLES
+    if(share) {
+      if(!final)
+        shmfree((shm_t *)share, (char *)slab);
+    } else
+#endif
+      ckfree ( (char *)slab );
+  }
+
+  if ( pool->waiting )
+    ckfree ( (char *)pool->waiting );
+  ckfree ( (char *)pool->free );
+  ckfree ( (char *)pool->fresh );
+  ckfree ( (char *)pool->left );
+  ckfree ( (char *)pool->grow );
+  ckfree ( (char *)pool );
+}
+
+#ifdef WITH_SHARED_TABLES
+//
+// pool_collect - put the freed shared memory nodes no reader can still be
+// looking at back on their free lists
+//
+static void pool_collect ( jsw_pool_t *pool, shm_t *share )
+{
+  while ( pool->first < pool->nwaiting && shmcollectable ( share, pool->waiting[pool->first].cycle ) ) {
+    jsw_node_t *node = pool->waiting[pool->first++].node;
+
+    node->row = (ctable_BaseRow *)pool->free[node->height];
+    pool->free[node->height] = node;
+  }
+
+  if ( pool->first == pool->nwaiting ) {
+    pool->first = pool->nwaiting = 0;
+  }
+}
+#endif
+
+//
+// pool_alloc - take a node of the given height from the pool, from its
+// free list if there's one there and otherwise from the newest slab for
+// the height, starting a new slab if that's used up
+//
+static jsw_node_t *pool_alloc ( jsw_pool_t *pool, size_t height, void *share )
+{
+  jsw_node_t *node;
+  jsw_slab_t *slab;
+  size_t size = NODE_SIZE(height);
+  size_t bytes;
+
+#ifdef WITH_SHARED_TABLES
+  if ( share && pool->nwaiting > pool->first && pool->free[height] == NULL )
+    pool_collect ( pool, (shm_t *)share );
+#endif
+
+  if ( (node = pool->free[height]) != NULL ) {
+    pool->free[height] = (jsw_node_t *)node->row;
+    return node;
+  }
+
+  if ( pool->left[height] == 0 ) {
+    bytes = sizeof (jsw_slab_t) + pool->grow[height] * size;
+
+#ifdef WITH_SHARED_TABLES
+    if(share) {
+      slab = (jsw_slab_t *)shmalloc ((shm_t*)share, bytes);
+      if(!slab) {
+        Tcl_Panic("Can't allocate shared memory for skiplist");
+      }
+    } else
+#endif
+      slab = (jsw_slab_t *)ckalloc ( bytes );
+
+    slab->next = pool->slabs;
+    slab->bytes = bytes;
+    pool->slabs = slab;
+    pool->bytes += bytes;
+
+    pool->fresh[height] = (char *)(slab + 1);
+    pool->left[height] = pool->grow[height];
+    if ( (pool->grow[height] * 2 + 1) * size <= JSW_SLAB_BYTES )
+      pool->grow[height] *= 2;
+  }
+
+  node = (jsw_node_t *)(void *)pool->fresh[height];
+  pool->fresh[height] += size;
+  pool->left[height]--;
+
+  return node;
+}
+
+//
+// pool_free - give a node back to the pool it came from
+//
+static void pool_free ( jsw_pool_t *pool, jsw_node_t *node, void *share )
+{
+#ifdef WITH_SHARED_TABLES
+  if(share) {
+    if ( pool->nwaiting == pool->awaiting ) {
+      if ( pool->first > 0 ) {
+        memmove ( pool->waiting, pool->waiting + pool->first, (pool->nwaiting - pool->first) * sizeof *pool->waiting );
+        pool->nwaiting -= pool->first;
+        pool->first = 0;
+      } else {
+        pool->awaiting = pool->awaiting ? pool->awaiting * 2 : 64;
+        pool->waiting = (jsw_waiting_t *)ckrealloc ( (char *)pool->waiting, pool->awaiting * sizeof *pool->waiting );
+      }
+    }
+    pool->waiting[pool->nwaiting].node = node;
+    pool->waiting[pool->nwaiting].cycle = ((shm_t *)share)->map->cycle;
+    pool->nwaiting++;
+    return;
+  }
+#endif
+
+  node->row = (ctable_BaseRow *)pool->free[node->height];
+  pool->free[node->height] = node;
+}
+
+//
+// new_node - construct an empty new node, does not make a copy of the row,
+// from the list's pool if it has one
 //
 INLINE
-static jsw_node_t *new_node ( ctable_BaseRow *row, size_t height, void *share )
+static jsw_node_t *new_node ( ctable_BaseRow *row, size_t height, void *share, jsw_pool_t *pool )
 {
   jsw_node_t *node;
   size_t i;
 
+  if ( pool ) {
+    node = pool_alloc ( pool, height, share );
+  } else
 #ifdef WITH_SHARED_TABLES
   if(share) {
-    node  = (jsw_node_t *)shmalloc ((shm_t*)share, sizeof (jsw_node_t) + height * sizeof (jsw_node_t *) );
+    node  = (jsw_node_t *)shmalloc ((shm_t*)share, NODE_SIZE(height) );
     if(!node) {
       //if(DUMPER) shmdump(share);
       Tcl_Panic("Can't allocate shared memory for skiplist");
     }
   } else
 #endif
-    node  = (jsw_node_t *)ckalloc ( sizeof (jsw_node_t) + height * sizeof (jsw_node_t *) );
+    node  = (jsw_node_t *)ckalloc ( NODE_SIZE(height) );
 
   node->row = row;
 
   node->height = height;
 
-  for ( i = 0; i < height; i++ )
+  for ( i = 0; i < height; i++ ) {
     node->next[i] = NULL;
+    SPAN(node)[i] = 0;
+  }
 
   return node;
 }
@@ -132,8 +359,13 @@ static jsw_node_t *new_node ( ctable_BaseRow *row, size_t height, void *share )
 // free_node - free a skip list node but not the row associated with it
 //
 INLINE
-static void free_node ( jsw_node_t *node, void *share )
+static void free_node ( jsw_node_t *node, void *share, jsw_pool_t *pool )
 {
+  if ( pool ) {
+    pool_free ( pool, node, share );
+    return;
+  }
+
 #ifdef WITH_SHARED_TABLES
   if(share)
     shmfree((shm_t *)share, (char *)node);
@@ -143,14 +375,16 @@ static void free_node ( jsw_node_t *node, void *share )
 }
 
 //
-// locate - find an existing row, or the position before where it would be
+// locate_by - find an existing row, or the position before where it would
+// be, by a compare that may be coarser than the list's own, as long as
+// rows in the list's order are in its order too
 //
 INLINE
-static jsw_node_t *locate ( jsw_skip_t *skip, ctable_BaseRow *row )
+static jsw_node_t *locate_by ( jsw_skip_t *skip, ctable_BaseRow *row, cmp_f cmp )
 {
   jsw_node_t *p = skip->publicdata->head;
-  cmp_f       cmp = skip->cmp;
   size_t i;
+  size_t pos = 0;
   jsw_node_t *next;
 
   for ( i = skip->publicdata->curh; i < (size_t)-1; i-- ) {
@@ -159,19 +393,198 @@ static jsw_node_t *locate ( jsw_skip_t *skip, ctable_BaseRow *row )
         break;
       }
 
+      pos += SPAN(p)[i];
       p = next;
     }
 
     skip->fix[i] = p;
+    skip->rank[i] = pos;
   }
 
+  skip->finger = 1;
   return p;
 }
 
+//
+// locate - find an existing row, or the position before where it would be
+//
+INLINE
+static jsw_node_t *locate ( jsw_skip_t *skip, ctable_BaseRow *row )
+{
+  return locate_by ( skip, row, skip->cmp );
+}
+
+//
+// locate_from_finger - find the node holding row's key, or the one after
+// where it would go, filling in the update array like locate. Rather than
+// coming down from the head, start from where the update array was last
+// left and climb only as high as needed to get around the rows between
+// there and row, so rows that arrive in order or nearly so, like a feed's
+// timestamps, are found in a few steps instead of a search of the list.
+//
+// each level's entry in the update array is the last node before the
+// finger at that level, and its next node is past the finger. Going
+// forward, if the next node at one level doesn't sort before row, neither
+// does the next node at any level above it. Going back, once a level's
+// entry sorts before row, so do the entries at all the levels above it.
+//
+INLINE
+static jsw_node_t *locate_from_finger ( jsw_skip_t *skip, ctable_BaseRow *row )
+{
+  jsw_node_t **fix = skip->fix;
+  cmp_f        cmp = skip->cmp;
+  size_t       curh = skip->publicdata->curh;
+  jsw_node_t  *head = skip->publicdata->head;
+  size_t       i = 0;
+  size_t       pos;
+  int          c;
+  jsw_node_t  *p;
+  jsw_node_t  *next;
+
+  if ( !skip->finger || fix[0] == head )
+    return locate ( skip, row )->next[0];
+
+  c = cmp ( row, fix[0]->row );
+
+  if ( c > 0 ) {
+    while ( i < curh && (next = fix[i + 1]->next[i + 1]) != NULL && cmp ( row, next->row ) > 0 )
+      i++;
+  } else if ( c < 0 ) {
+    while ( fix[i] != head && cmp ( row, fix[i]->row ) <= 0 )
+      i++;
+  } else {
+    // another row with the key at the finger, the update array already
+    // holds the nodes before it at the levels it's not on
+    return fix[0];
+  }
+
+  p = fix[i];
+  pos = skip->rank[i];
+
+  for ( ; i < (size_t)-1; i-- ) {
+    while ( (next = p->next[i]) != NULL ) {
+      if ( cmp ( row, next->row ) <= 0 ) {
+        break;
+      }
+
+      pos += SPAN(p)[i];
+      p = next;
+    }
+
+    fix[i] = p;
+    skip->rank[i] = pos;
+  }
+
+  return p->next[0];
+}
+
+//
+// adjust - a row was linked into or taken out of node p, just found by
+// locate, so widen or narrow every link that passes over p
+//
+INLINE
+static void adjust ( jsw_skip_t *skip, jsw_node_t *p, long delta )
+{
+  size_t i;
+
+  for ( i = 0; i <= skip->publicdata->curh; i++ ) {
+    if ( i < p->height )
+      SPAN(p)[i] += delta;
+    else
+      SPAN(skip->fix[i])[i] += delta;
+  }
+
+  skip->publicdata->size += delta;
+}
+
+//
+// link_node - link a new node holding one row in after the node locate
+// stopped at, raising the list's height first if the node is taller
+//
+INLINE
+static jsw_node_t *link_node ( jsw_skip_t *skip, ctable_BaseRow *row, int nodeIdx )
+{
+  size_t h = rlevel ( skip->maxh );
+  size_t curh = skip->publicdata->curh;
+  jsw_node_t *head = skip->publicdata->head;
+  size_t px = skip->rank[0] + SPAN(skip->fix[0])[0];
+  jsw_node_t *it;
+  size_t i;
+
+  /* Raise height if necessary, the new top level is empty */
+  if ( h > curh ) {
+// printf("raising the height from %d to %d, size %d\n", (int)curh, (int)h, (int)skip->publicdata->size);
+    h = ++curh;
+    skip->fix[h] = head;
+    skip->rank[h] = 0;
+    SPAN(head)[h] = skip->publicdata->size;
+    skip->publicdata->curh = curh;
+  }
+
+  it = new_node ( row, h, skip->share, skip->pool );
+
+  if ( nodeIdx >= 0 ) {
+    // Throw away the row we just inserted with new_node! Yes, we mean to do this.
+    ctable_ListInit (&it->row, __FILE__, __LINE__);
+    ctable_ListInsertHead (&it->row, row, nodeIdx);
+  }
+
+  /* Build skip links, and split the spans they cut across */
+  for ( i = curh; i < (size_t)-1; i-- ) {
+    if ( i < h ) {
+      SPAN(it)[i] = skip->rank[i] + SPAN(skip->fix[i])[i] + 1 - px;
+      SPAN(skip->fix[i])[i] = px - skip->rank[i];
+      it->next[i] = skip->fix[i]->next[i];
+      skip->fix[i]->next[i] = it;
+
+      // leave the finger on the new node for the next insert
+      skip->fix[i] = it;
+      skip->rank[i] = px;
+    } else {
+      SPAN(skip->fix[i])[i]++;
+    }
+  }
+
+  skip->publicdata->size++;
+  skip->publicdata->keys++;
+  return it;
+}
+
+//
+// unlink_node - take node p, just found by locate, out of the list without
+// freeing it, along with all of its rows
+//
+INLINE
+static void unlink_node ( jsw_skip_t *skip, jsw_node_t *p )
+{
+  size_t w = SPAN(p)[0];
+  size_t i;
+
+  for ( i = 0; i <= skip->publicdata->curh; i++ ) {
+    if ( i < p->height ) {
+      SPAN(skip->fix[i])[i] += SPAN(p)[i] - w;
+      skip->fix[i]->next[i] = p->next[i];
+    } else {
+      SPAN(skip->fix[i])[i] -= w;
+    }
+  }
+
+  skip->publicdata->size -= w;
+  skip->publicdata->keys--;
+
+  /* Lower height if necessary */
+  while ( skip->publicdata->curh > 0 ) {
+    if ( skip->publicdata->head->next[skip->publicdata->curh - 1] != NULL )
+      break;
+
+    --skip->publicdata->curh;
+  }
+}
+
 //
 // jsw_private - return a private version of a skiplist in shared memory
 //
-jsw_skip_t *jsw_private ( jsw_skip_t *skip, size_t max, cmp_f cmp, void *share, int id )
+jsw_skip_t *jsw_private ( jsw_skip_t *skip, size_t max, cmp_f cmp, hash_f hash, void *share, int id )
 {
   jsw_skip_t *new_skip = skip;
 
@@ -179,15 +592,30 @@ jsw_skip_t *jsw_private ( jsw_skip_t *skip, size_t max, cmp_f cmp, void *share,
     // If this is a new skiplist, initialize skiplist structure
     skip->id = id;
     skip->fix = NULL;
+    skip->rank = NULL;
+    skip->finger = 0;
     skip->curl = NULL;
+    skip->curpos = 0;
   } else if(skip->id != id) {
     // If this isn't my skiplist, allocate new skiplist structure
     new_skip = (jsw_skip_t *)ckalloc(sizeof *skip);
 
     new_skip->curl = skip->curl;
+    new_skip->curpos = 0;
     new_skip->id = id;
     new_skip->fix = NULL;
+    new_skip->rank = NULL;
+    new_skip->finger = 0;
     new_skip->publicdata = skip->publicdata;
+    new_skip->btree = skip->btree;
+    new_skip->bcur.leaf = NULL;
+    new_skip->bcur.row = NULL;
+    new_skip->bcur.valid = 1;
+    new_skip->hash = skip->hash;
+    new_skip->hcur.entry = NULL;
+    new_skip->hcur.row = NULL;
+    new_skip->hcur.valid = 1;
+    new_skip->pool = NULL;
 
     skip = new_skip;
   }
@@ -195,6 +623,7 @@ jsw_skip_t *jsw_private ( jsw_skip_t *skip, size_t max, cmp_f cmp, void *share,
   // initialise dynamic private data if necessary
   if (!skip->fix) {
     skip->fix = (jsw_node_t **)ckalloc ( max * sizeof *skip->fix );
+    skip->rank = (size_t *)ckalloc ( max * sizeof *skip->rank );
   }
 
   // Fill in static private data
@@ -205,6 +634,7 @@ jsw_skip_t *jsw_private ( jsw_skip_t *skip, size_t max, cmp_f cmp, void *share,
   skip->share = share;
 #endif
   skip->cmp = cmp;
+  skip->hashf = hash;
   return skip;
 }
 
@@ -213,18 +643,20 @@ jsw_skip_t *jsw_private ( jsw_skip_t *skip, size_t max, cmp_f cmp, void *share,
 //
 void jsw_free_private_copy(jsw_skip_t *skip)
 {
-    if(skip->fix)
+    if(skip->fix) {
 	ckfree((char *)skip->fix);
+	ckfree((char *)skip->rank);
+    }
     ckfree((char *)skip);
 }
 
 //
 // clone skiplist if needed
 //
-jsw_skip_t *jsw_private_copy(jsw_skip_t *skip, int id, cmp_f cmp)
+jsw_skip_t *jsw_private_copy(jsw_skip_t *skip, int id, cmp_f cmp, hash_f hash)
 {
     if(skip->id != id)
-	return jsw_private(skip, skip->maxh, cmp?cmp:skip->cmp, skip->share, id);
+	return jsw_private(skip, skip->maxh, cmp?cmp:skip->cmp, hash?hash:skip->hashf, skip->share, id);
     return NULL;
 }
 
@@ -244,14 +676,18 @@ void jsw_sinit ( jsw_skip_t *skip, size_t max, cmp_f cmp, void *share)
 #endif
     skip->publicdata = (jsw_pub_t *)ckalloc ( sizeof *skip->publicdata );
 
-  skip->publicdata->head = new_node ( NULL, ++max, share );
+  skip->publicdata->head = new_node ( NULL, ++max, share, NULL );
 
   skip->publicdata->curh = 0;
   skip->publicdata->size = 0;
+  skip->publicdata->keys = 0;
+  skip->btree = NULL;
+  skip->hash = NULL;
+  skip->pool = pool_new ( max );
 
   // We're creating this skiplist, our "id" is zero
   // (now fills in skip->maxh, skip->curl)
-  jsw_private(skip, max, cmp, share, 0);
+  jsw_private(skip, max, cmp, NULL, share, 0);
 
   jsw_seed ( jsw_time_seed() );
 }
@@ -279,6 +715,68 @@ jsw_skip_t *jsw_snew ( size_t max, cmp_f cmp, void *share)
   return skip;
 }
 
+//
+// jsw_snew_btree - allocate a B+tree index behind the skip list interface,
+// max is only kept so the index can be rebuilt the same way
+//
+jsw_skip_t *jsw_snew_btree ( size_t max, cmp_f cmp, void *share)
+{
+  jsw_skip_t *skip;
+
+#ifdef WITH_SHARED_TABLES
+  if(share) {
+    skip = (jsw_skip_t *)shmalloc ( (shm_t *)share, sizeof *skip );
+    if(!skip) {
+      Tcl_Panic("Can't allocate shared memory for btree");
+    }
+  } else
+#endif
+    skip = (jsw_skip_t *)ckalloc ( sizeof *skip );
+
+  skip->publicdata = NULL;
+  skip->btree = ctable_BtreeNew (share);
+  skip->bcur.leaf = NULL;
+  skip->bcur.row = NULL;
+  skip->bcur.valid = 1;
+  skip->hash = NULL;
+  skip->pool = NULL;
+
+  jsw_private(skip, max + 1, cmp, NULL, share, 0);
+
+  return skip;
+}
+
+//
+// jsw_snew_hash - allocate a hash index behind the skip list interface,
+// max is only kept so the index can be rebuilt the same way
+//
+jsw_skip_t *jsw_snew_hash ( size_t max, cmp_f cmp, hash_f hash, void *share)
+{
+  jsw_skip_t *skip;
+
+#ifdef WITH_SHARED_TABLES
+  if(share) {
+    skip = (jsw_skip_t *)shmalloc ( (shm_t *)share, sizeof *skip );
+    if(!skip) {
+      Tcl_Panic("Can't allocate shared memory for hash index");
+    }
+  } else
+#endif
+    skip = (jsw_skip_t *)ckalloc ( sizeof *skip );
+
+  skip->publicdata = NULL;
+  skip->btree = NULL;
+  skip->hash = ctable_HashIndexNew (share);
+  skip->hcur.entry = NULL;
+  skip->hcur.row = NULL;
+  skip->hcur.valid = 1;
+  skip->pool = NULL;
+
+  jsw_private(skip, max + 1, cmp, hash, share, 0);
+
+  return skip;
+}
+
 //
 // jsw_sdelete_skiplist - delete the entire skip list
 //
@@ -286,21 +784,39 @@ jsw_skip_t *jsw_snew ( size_t max, cmp_f cmp, void *share)
 //
 void jsw_sdelete_skiplist ( jsw_skip_t *skip, int final )
 {
-  jsw_node_t *it = skip->publicdata->head->next[0];
+  jsw_node_t *it;
   jsw_node_t *save;
 
-  while ( it != NULL ) {
-    save = it->next[0];
+  if ( skip->btree ) {
+    ctable_BtreeDelete ( skip->btree, skip->share, final );
+    goto free_skip;
+  }
+
+  if ( skip->hash ) {
+    ctable_HashIndexDelete ( skip->hash, skip->share, final );
+    goto free_skip;
+  }
+
+  // the nodes all go with their slabs, without walking the list
+  if ( skip->pool ) {
+    pool_delete ( skip->pool, skip->share, final );
+  } else {
+    it = skip->publicdata->head->next[0];
+    while ( it != NULL ) {
+      save = it->next[0];
 #ifdef WITH_SHARED_TABLES
-    if(!final || !skip->share)
+      if(!final || !skip->share)
 #endif
-      free_node ( it, skip->share );
-    it = save;
+        free_node ( it, skip->share, NULL );
+      it = save;
+    }
   }
 
-  free_node ( skip->publicdata->head, skip->share );
+  free_node ( skip->publicdata->head, skip->share, NULL );
 
+free_skip:
   ckfree ( (char *)skip->fix );
+  ckfree ( (char *)skip->rank );
 
 #ifdef WITH_SHARED_TABLES
   if(skip->share) {
@@ -318,9 +834,24 @@ void jsw_sdelete_skiplist ( jsw_skip_t *skip, int final )
 INLINE
 void *jsw_sfind ( jsw_skip_t *skip, ctable_BaseRow *row )
 {
-  jsw_node_t *p = locate ( skip, row )->next[0];
+  jsw_node_t *p;
+
+  if ( skip->btree ) {
+    ctable_BtreePlace ( skip->btree, skip->cmp, &skip->bcur, row, BTREE_PLACE_GE );
+    if ( skip->bcur.row != NULL && skip->cmp ( row, skip->bcur.row ) == 0 )
+      return skip->bcur.row;
+    return NULL;
+  }
+
+  if ( skip->hash ) {
+    ctable_HashIndexFind ( skip->hash, skip->cmp, skip->hashf, &skip->hcur, row );
+    return skip->hcur.row;
+  }
+
+  p = locate ( skip, row )->next[0];
 
   skip->curl = p;
+  skip->curpos = skip->rank[0] + SPAN(skip->fix[0])[0];
 
   if ( p != NULL && skip->cmp ( row, p->row ) == 0 )
     return p;
@@ -333,16 +864,33 @@ void *jsw_sfind ( jsw_skip_t *skip, ctable_BaseRow *row )
 //     corresponding skip list node pointer that matches the specified
 //     row or exceeds it.
 //
+//     cmp is the list's own compare, or for a composite index one that
+//     only looks at its leading fields
+//
 INLINE
-void *jsw_sfind_equal_or_greater ( jsw_skip_t *skip, ctable_BaseRow *row )
+void *jsw_sfind_equal_or_greater ( jsw_skip_t *skip, ctable_BaseRow *row, cmp_f cmp )
 {
-  jsw_node_t *p = locate ( skip, row )->next[0];
-  cmp_f       cmp = skip->cmp;
+  jsw_node_t *p;
+
+  if ( skip->btree ) {
+    ctable_BtreePlace ( skip->btree, cmp, &skip->bcur, row, BTREE_PLACE_GE );
+    return skip->bcur.row;
+  }
+
+  // a hash index has nothing to be greater than, it can only find the row
+  if ( skip->hash ) {
+    ctable_HashIndexFind ( skip->hash, skip->cmp, skip->hashf, &skip->hcur, row );
+    return skip->hcur.row;
+  }
+
+  p = locate_by ( skip, row, cmp )->next[0];
+  skip->curpos = skip->rank[0] + SPAN(skip->fix[0])[0];
 
 //printf("find_equal_or_greater row %8lx, p %8lx ", (long unsigned int)row, (long unsigned int)p);
 
   while (p !=NULL && cmp (p->row, row) < 0) {
 //printf("p->%8lx ", (long unsigned int)p);
+      skip->curpos += SPAN(p)[0];
       p = p->next[0];
   }
 
@@ -359,12 +907,37 @@ void *jsw_sfind_equal_or_greater ( jsw_skip_t *skip, ctable_BaseRow *row )
 INLINE 
 void *jsw_findlast ( jsw_skip_t *skip)
 {
-  jsw_node_t *p = skip->publicdata->head;
+  jsw_node_t *p;
   size_t i;
   jsw_node_t *next;
 
+  if ( skip->btree ) {
+    ctable_BtreePlace ( skip->btree, skip->cmp, &skip->bcur, NULL, BTREE_PLACE_LAST );
+    return skip->bcur.row;
+  }
+
+  // a hash index has to look at every key for the highest
+  if ( skip->hash ) {
+    ctable_HashIndexCursor last;
+
+    last.entry = NULL;
+    last.row = NULL;
+    for ( ctable_HashIndexFirst ( skip->hash, &skip->hcur ); skip->hcur.row != NULL; ctable_HashIndexNext ( skip->hash, &skip->hcur ) ) {
+      if ( last.row == NULL || skip->cmp ( skip->hcur.row, last.row ) > 0 )
+        last = skip->hcur;
+    }
+    skip->hcur = last;
+    skip->hcur.walking = 0;
+    skip->hcur.valid = 1;
+    return skip->hcur.row;
+  }
+
+  p = skip->publicdata->head;
+  skip->curpos = 0;
+
   for ( i = skip->publicdata->curh; i < (size_t)-1; i-- ) {
     while ( (next = p->next[i]) != NULL ) {
+      skip->curpos += SPAN(p)[i];
       p = next;
     }
   }
@@ -382,34 +955,16 @@ INLINE
 int jsw_sinsert ( jsw_skip_t *skip, ctable_BaseRow *row )
 {
   // void *p = locate ( skip, row )->row;
-  jsw_node_t *p = locate ( skip, row )->next[0];
+  jsw_node_t *p = locate_from_finger ( skip, row );
   cmp_f       cmp = skip->cmp;
 
   // if we got something and it compares the same, it's already there
   if ( p != NULL && cmp ( row, p->row ) == 0 ) {
     return 0;
-  } else {
-    // it's new
-    size_t h = rlevel ( skip->maxh );
-    jsw_node_t *it;
-
-    it = new_node ( row, h, skip->share );
-
-    /* Raise height if necessary */
-    if ( h > skip->publicdata->curh ) {
-// printf("raising the height from %d to %d, size %d\n", (int)skip->publicdata->curh, (int)h, (int)skip->publicdata->size);
-      h = ++skip->publicdata->curh;
-      skip->fix[h] = skip->publicdata->head;
-    }
-
-    /* Build skip links */
-    while ( --h < (size_t)-1 ) {
-      it->next[h] = skip->fix[h]->next[h];
-      skip->fix[h]->next[h] = it;
-    }
   }
 
-  skip->publicdata->size++;
+  // it's new
+  link_node ( skip, row, -1 );
   return 1;
 }
 
@@ -420,8 +975,16 @@ int jsw_sinsert ( jsw_skip_t *skip, ctable_BaseRow *row )
 INLINE
 int jsw_sinsert_linked ( jsw_skip_t *skip, ctable_BaseRow *row , int nodeIdx, int unique)
 {
+  jsw_node_t *p;
+
+  if ( skip->btree )
+    return ctable_BtreeInsert ( skip->btree, skip->cmp, skip->share, row, nodeIdx, unique );
+
+  if ( skip->hash )
+    return ctable_HashIndexInsert ( skip->hash, skip->cmp, skip->hashf, skip->share, row, nodeIdx, unique );
+
   // void *p = locate ( skip, row )->row;
-  jsw_node_t *p = locate ( skip, row )->next[0];
+  p = locate_from_finger ( skip, row );
 
   if ( p != NULL && skip->cmp ( row, p->row ) == 0 ) {
     // we found a matching skip list entry
@@ -433,38 +996,80 @@ int jsw_sinsert_linked ( jsw_skip_t *skip, ctable_BaseRow *row , int nodeIdx, in
 
     // dups are allowed, insert this guy
     ctable_ListInsertHead (&p->row, row, nodeIdx);
+    adjust ( skip, p, 1 );
   } else {
-    // no matching skip list entry
-
-    // insert the new node
-    size_t h = rlevel ( skip->maxh );
-    jsw_node_t *it;
+    // no matching skip list entry, insert the new node
+    link_node ( skip, row, nodeIdx );
+  }
 
-// printf("h %d\n", (int)h);
+  return 1;
+}
 
-    it = new_node ( row, h, skip->share );
+//
+// jsw_sbuild_linked - fill an empty skip list from an array of n rows
+// already sorted by the skip list's compare function, linking rows that
+// compare the same into one node the way jsw_sinsert_linked does.
+//
+// builds every level in a single pass by keeping the last node placed
+// at each level, rather than searching for each row's position.
+//
+void jsw_sbuild_linked ( jsw_skip_t *skip, ctable_BaseRow **rows, size_t n, int nodeIdx )
+{
+  jsw_node_t **last = skip->fix;
+  size_t      *lastPos = skip->rank;
+  jsw_node_t  *it = NULL;
+  size_t       pos;
+  size_t       curh;
+  size_t       i, h;
+
+  if ( skip->btree ) {
+    ctable_BtreeBuild ( skip->btree, skip->cmp, skip->share, rows, n, nodeIdx );
+    return;
+  }
 
-    // Throw away the row we just inserted with new_node! Yes, we mean to do this.
-    ctable_ListInit (&it->row, __FILE__, __LINE__);
+  if ( skip->hash ) {
+    ctable_HashIndexBuild ( skip->hash, skip->cmp, skip->hashf, skip->share, rows, n, nodeIdx );
+    return;
+  }
 
-    ctable_ListInsertHead (&it->row, row, nodeIdx);
+  curh = skip->publicdata->curh;
+  pos = skip->publicdata->size;
+  for ( h = 0; h < skip->maxh; h++ ) {
+    last[h] = skip->publicdata->head;
+    lastPos[h] = 0;
+  }
 
-    /* Raise height if necessary */
-    if ( h > skip->publicdata->curh ) {
-// printf("raising the height from %d to %d, size %d\n", (int)skip->publicdata->curh, (int)h, (int)skip->publicdata->size);
-      h = ++skip->publicdata->curh;
-      skip->fix[h] = skip->publicdata->head;
+  for ( i = 0; i < n; i++, pos++ ) {
+    if ( it != NULL && skip->cmp ( rows[i], it->row ) == 0 ) {
+      ctable_ListInsertHead (&it->row, rows[i], nodeIdx);
+      continue;
     }
 
-    /* Build skip links */
+    h = rlevel ( skip->maxh );
+    it = new_node ( rows[i], h, skip->share, skip->pool );
+
+    ctable_ListInit (&it->row, __FILE__, __LINE__);
+    ctable_ListInsertHead (&it->row, rows[i], nodeIdx);
+    skip->publicdata->keys++;
+
+    if ( h > curh )
+      curh = h;
+
     while ( --h < (size_t)-1 ) {
-      it->next[h] = skip->fix[h]->next[h];
-      skip->fix[h]->next[h] = it;
+      SPAN(last[h])[h] = pos - lastPos[h];
+      last[h]->next[h] = it;
+      last[h] = it;
+      lastPos[h] = pos;
     }
   }
 
-  skip->publicdata->size++;
-  return 1;
+  // the last node at each level spans to the end of the list
+  for ( h = 0; h < skip->maxh; h++ )
+    SPAN(last[h])[h] = pos - lastPos[h];
+
+  skip->publicdata->curh = curh;
+  skip->publicdata->size += n;
+  skip->finger = 0;
 }
 
 //
@@ -480,33 +1085,56 @@ int jsw_serase ( jsw_skip_t *skip, ctable_BaseRow *row )
 
   if ( p == NULL || skip->cmp ( row, p->row ) != 0 )
     return 0;
-  else {
-    size_t i;
 
-    // fix skip list pointers that point directly to me by traversing
-    // the fix list of stuff from the locate
-    for ( i = 0; i < skip->publicdata->curh; i++ ) {
-      if ( skip->fix[i]->next[i] != p )
-        break;
+  // fix skip list pointers that point directly to me from the fix list
+  // of stuff from the locate, then free the node
+  unlink_node ( skip, p );
+  free_node ( p, skip->share, skip->pool );
 
-      skip->fix[i]->next[i] = p->next[i];
-    }
+  /* Erasure invalidates traversal markers */
+  jsw_sreset ( skip );
 
-    // free the node
-    free_node ( p, skip->share );
-    skip->publicdata->size--;
+  return 1;
+}
 
-    /* Lower height if necessary */
-    while ( skip->publicdata->curh > 0 ) {
-      if ( skip->publicdata->head->next[skip->publicdata->curh - 1] != NULL )
-        break;
+//
+// jsw_serase_linked - take a row out of the list of rows linked to its
+// key, and the key out of the skip list if that was the last row
+//
+// the key is located even when other rows share it, to keep the spans
+// over its node right
+//
+// return 0 if the row's key wasn't in the skip list
+//
+int jsw_serase_linked ( jsw_skip_t *skip, ctable_BaseRow *row, int nodeIdx )
+{
+  jsw_node_t *p;
 
-      --skip->publicdata->curh;
-    }
+  if ( skip->btree )
+    return ctable_BtreeErase ( skip->btree, skip->cmp, skip->share, row, nodeIdx );
+
+  if ( skip->hash )
+    return ctable_HashIndexErase ( skip->hash, skip->share, row, nodeIdx );
+
+  p = locate ( skip, row )->next[0];
+
+  if ( p == NULL || skip->cmp ( row, p->row ) != 0 ) {
+    ctable_ListRemove ( row, nodeIdx );
+    return 0;
   }
 
-  /* Erasure invalidates traversal markers */
-  jsw_sreset ( skip );
+  if ( row->_ll_nodes[nodeIdx].next == NULL && row->_ll_nodes[nodeIdx].prev == &p->row ) {
+    // it's the last one, unlink the node while the row is still in
+    // it for anyone walking the list, then take the row out
+    unlink_node ( skip, p );
+    ctable_ListRemove ( row, nodeIdx );
+    free_node ( p, skip->share, skip->pool );
+    jsw_sreset ( skip );
+  } else {
+    // the key stays, but the row no longer counts
+    ctable_ListRemove ( row, nodeIdx );
+    adjust ( skip, p, -1 );
+  }
 
   return 1;
 }
@@ -543,12 +1171,52 @@ void
 jsw_dump (const char *s, jsw_skip_t *skip, int indexNumber) {
     jsw_node_t *p = skip->curl;
 
+    if (skip->btree) {
+	ctable_BaseRow *walkRow;
+
+	printf("%8lx '%s' slot %d of leaf %8lx\n    list ", (long unsigned int)skip->bcur.row, s, skip->bcur.pos, (long unsigned int)skip->bcur.leaf);
+	CTABLE_LIST_FOREACH (skip->bcur.row, walkRow, indexNumber) {
+	    printf("%8lx ", (long unsigned int)walkRow);
+	    if ( skip->cmp ( skip->bcur.row, walkRow ) != 0 ) {
+		Tcl_Panic ("index hosed - value in dup list doesn't match others, row == 0x%08lx, walkRow == 0x%08lx", (long)skip->bcur.row, (long)walkRow);
+	    }
+	}
+	printf("\n");
+	return;
+    }
+
+    if (skip->hash) {
+	ctable_BaseRow *walkRow;
+
+	printf("%8lx '%s' bucket %ld\n    list ", (long unsigned int)skip->hcur.row, s, (long)skip->hcur.bucket);
+	CTABLE_LIST_FOREACH (skip->hcur.row, walkRow, indexNumber) {
+	    printf("%8lx ", (long unsigned int)walkRow);
+	    if ( skip->cmp ( skip->hcur.row, walkRow ) != 0 ) {
+		Tcl_Panic ("index hosed - value in dup list doesn't match others, row == 0x%08lx, walkRow == 0x%08lx", (long)skip->hcur.row, (long)walkRow);
+	    }
+	}
+	printf("\n");
+	return;
+    }
+
     jsw_dump_node (s, skip, p, indexNumber);
 }
 
 void
 jsw_dump_head (jsw_skip_t *skip) {
-    jsw_node_t *p = skip->publicdata->head;
+    jsw_node_t *p;
+
+    if (skip->btree) {
+	printf("%8lx 'HEAD' btree height %d size %ld\n", (long unsigned int)skip->btree->root, skip->btree->height, (long)skip->btree->size);
+	return;
+    }
+
+    if (skip->hash) {
+	printf("%8lx 'HEAD' hash buckets %ld values %ld size %ld\n", (long unsigned int)skip->hash->buckets, (long)skip->hash->nBuckets, (long)skip->hash->nEntries, (long)skip->hash->size);
+	return;
+    }
+
+    p = skip->publicdata->head;
 
     jsw_dump_node ("HEAD", skip, p, -1);
 }
@@ -558,16 +1226,49 @@ jsw_dump_head (jsw_skip_t *skip) {
 //
 size_t jsw_ssize ( jsw_skip_t *skip )
 {
+  if ( skip->btree )
+    return skip->btree->size;
+  if ( skip->hash )
+    return skip->hash->size;
   return skip->publicdata->size;
 }
 
+//
+// jsw_sdistinct - return the number of distinct keys in the index
+//
+size_t jsw_sdistinct ( jsw_skip_t *skip )
+{
+  if ( skip->btree )
+    return skip->btree->values;
+  if ( skip->hash )
+    return skip->hash->nEntries;
+  return skip->publicdata->keys;
+}
+
+//
+// jsw_sdepth - return the max height the skip list was created with
+//
+size_t jsw_sdepth ( jsw_skip_t *skip )
+{
+  return skip->maxh - 1;
+}
+
 //
 // jsw_reset - invalidate traversal markers by resetting the current link
 //             for traversal to the first element in the list
 //
 void jsw_sreset ( jsw_skip_t *skip )
 {
+  if ( skip->btree ) {
+    ctable_BtreePlace ( skip->btree, skip->cmp, &skip->bcur, NULL, BTREE_PLACE_FIRST );
+    return;
+  }
+  if ( skip->hash ) {
+    ctable_HashIndexFirst ( skip->hash, &skip->hcur );
+    return;
+  }
   skip->curl = skip->publicdata->head->next[0];
+  skip->curpos = 0;
 }
 
 //
@@ -577,6 +1278,7 @@ void jsw_sreset ( jsw_skip_t *skip )
 void jsw_sreset_head ( jsw_skip_t *skip )
 {
   skip->curl = skip->publicdata->head;
+  skip->curpos = 0;
 }
 
 //
@@ -585,6 +1287,10 @@ void jsw_sreset_head ( jsw_skip_t *skip )
 INLINE
 ctable_BaseRow *jsw_srow ( jsw_skip_t *skip )
 {
+  if ( skip->btree )
+    return skip->bcur.row;
+  if ( skip->hash )
+    return skip->hcur.row;
   return skip->curl == NULL ? NULL : skip->curl->row;
 }
 
@@ -595,9 +1301,128 @@ ctable_BaseRow *jsw_srow ( jsw_skip_t *skip )
 INLINE int
 jsw_snext ( jsw_skip_t *skip )
 {
-  jsw_node_t *curl = skip->curl;
-  jsw_node_t *next = curl->next[0];
+  jsw_node_t *curl;
+  jsw_node_t *next;
+
+  if ( skip->btree )
+    return ctable_BtreeNext ( skip->btree, skip->cmp, &skip->bcur, skip->id != 0 );
+  if ( skip->hash )
+    return ctable_HashIndexNext ( skip->hash, &skip->hcur );
+
+  curl = skip->curl;
+  next = curl->next[0];
+  skip->curpos += SPAN(curl)[0];
   return ( skip->curl = next ) != NULL;
 }
 
+//
+// jsw_svalid - for a reader walking the index while the master changes it,
+//              has the master moved things since the current row was read
+//
+INLINE int
+jsw_svalid ( jsw_skip_t *skip )
+{
+  if ( skip->btree )
+    return ctable_BtreeValid ( &skip->bcur );
+  if ( skip->hash )
+    return skip->hcur.valid;
+  return 1;
+}
+
+//
+// jsw_scounted - can rows be counted and found by position in the index
+//
+int jsw_scounted ( jsw_skip_t *skip )
+{
+  return skip->btree == NULL && skip->hash == NULL;
+}
+
+//
+// jsw_sordered - are the rows walked in order of the list's compare
+//
+int jsw_sordered ( jsw_skip_t *skip )
+{
+  return skip->hash == NULL;
+}
+
+//
+// jsw_srank - return the number of rows before the current link, or the
+//             number of rows in the list if it has run off the end
+//
+size_t jsw_srank ( jsw_skip_t *skip )
+{
+  return skip->curpos;
+}
+
+//
+// jsw_sposition - return the number of rows that sort before row, or if
+//                 inclusive is set the number that sort before or with it,
+//                 by cmp as for jsw_sfind_equal_or_greater
+//
+size_t jsw_sposition ( jsw_skip_t *skip, ctable_BaseRow *row, int inclusive, cmp_f cmp )
+{
+  jsw_node_t *p = skip->publicdata->head;
+  size_t      pos = 0;
+  size_t      i;
+  jsw_node_t *next;
+
+  for ( i = skip->publicdata->curh; i < (size_t)-1; i-- ) {
+    while ( (next = p->next[i]) != NULL ) {
+      int c = cmp ( row, next->row );
+
+      if ( c < 0 || (c == 0 && !inclusive) )
+        break;
+
+      pos += SPAN(p)[i];
+      p = next;
+    }
+  }
+
+  return pos + SPAN(p)[0];
+}
+
+//
+// jsw_sestimate - jsw_sposition for any ordered index. A skip list counts
+//                 the rows exactly, a B+tree guesses from where row falls
+//                 in the nodes on the way down to it. A hash index has no
+//                 order, so it's anyone's guess
+//
+size_t jsw_sestimate ( jsw_skip_t *skip, ctable_BaseRow *row, int inclusive, cmp_f cmp )
+{
+  if ( skip->btree )
+    return ctable_BtreeEstimate ( skip->btree, cmp, row, inclusive );
+  if ( skip->hash )
+    return skip->hash->size / 2;
+  return jsw_sposition ( skip, row, inclusive, cmp );
+}
+
+//
+// jsw_sseek - move the current link to the node holding row n, counting
+//             from zero, and return how far into the node's rows it is
+//
+size_t jsw_sseek ( jsw_skip_t *skip, size_t n )
+{
+  jsw_node_t *p = skip->publicdata->head;
+  size_t      pos = 0;
+  size_t      i;
+  jsw_node_t *next;
+
+  for ( i = skip->publicdata->curh; i < (size_t)-1; i-- ) {
+    while ( (next = p->next[i]) != NULL && pos + SPAN(p)[i] <= n ) {
+      pos += SPAN(p)[i];
+      p = next;
+    }
+  }
+
+  // p is the last node starting at or before row n, the head only
+  // if the list is empty
+  if ( p == skip->publicdata->head ) {
+    p = p->next[0];
+  }
+
+  skip->curl = p;
+  skip->curpos = pos;
+  return n - pos;
+}
+
 // vim: set ts=8 sw=4 sts=4 noet :
@@ -35,6 +35,9 @@ typedef struct jsw_skip jsw_skip_t;
 /* Application specific key comparison function */
 typedef int   (*cmp_f) ( const ctable_BaseRow *row1, const ctable_BaseRow *row2 );
 
+/* Hash of a row's key, rows that compare the same must hash the same */
+typedef unsigned int (*hash_f) ( const ctable_BaseRow *row );
+
 /*
   Create a new skip list with a max height of max
 
@@ -42,10 +45,26 @@ typedef int   (*cmp_f) ( const ctable_BaseRow *row1, const ctable_BaseRow *row2
 */
 jsw_skip_t *jsw_snew ( size_t max, cmp_f cmp, void *share );
 
+/*
+  Create a new B+tree index with the same interface as a skip list,
+  see ctable_btree.h
+
+  Returns: An empty index
+*/
+jsw_skip_t *jsw_snew_btree ( size_t max, cmp_f cmp, void *share );
+
+/*
+  Create a new hash index with the same interface as a skip list, it
+  only finds keys and walks them in no order, see ctable_hashindex.h
+
+  Returns: An empty index
+*/
+jsw_skip_t *jsw_snew_hash ( size_t max, cmp_f cmp, hash_f hash, void *share );
+
 /*
   Create a private copy of a skiplist, and free it
 */
-jsw_skip_t *jsw_private_copy(jsw_skip_t *skip, int id, cmp_f cmp);
+jsw_skip_t *jsw_private_copy(jsw_skip_t *skip, int id, cmp_f cmp, hash_f hash);
 void jsw_free_private_copy(jsw_skip_t *skip);
 
 /* Release all memory used by the skip list */
@@ -72,6 +91,12 @@ int         jsw_sinsert ( jsw_skip_t *skip, ctable_BaseRow *row );
 */
 int jsw_sinsert_linked ( jsw_skip_t *skip, ctable_BaseRow *row, int nodeIdx, int unique );
 
+/*
+  Fill an empty skip list from n rows sorted by its compare function,
+  linking rows with the same key into one node
+*/
+void jsw_sbuild_linked ( jsw_skip_t *skip, ctable_BaseRow **rows, size_t n, int nodeIdx );
+
 /*
   Remove a row with the selected key
 
@@ -79,9 +104,23 @@ int jsw_sinsert_linked ( jsw_skip_t *skip, ctable_BaseRow *row, int nodeIdx, int
 */
 int         jsw_serase ( jsw_skip_t *skip, ctable_BaseRow *row );
 
+/*
+  Remove a row from the rows linked to its key, and the key itself
+  if it was the last one
+
+  Returns: non-zero for success, zero if the key wasn't there
+*/
+int         jsw_serase_linked ( jsw_skip_t *skip, ctable_BaseRow *row, int nodeIdx );
+
 /* Current number of rows at height 0 */
 size_t      jsw_ssize ( jsw_skip_t *skip );
 
+/* Number of distinct keys in the skip list */
+size_t      jsw_sdistinct ( jsw_skip_t *skip );
+
+/* Max height the skip list was created with */
+size_t      jsw_sdepth ( jsw_skip_t *skip );
+
 /* Reset the traversal markers to the beginning */
 void        jsw_sreset ( jsw_skip_t *skip );
 
@@ -99,6 +138,44 @@ ctable_BaseRow       *jsw_srow ( jsw_skip_t *skip );
 */
 int         jsw_snext ( jsw_skip_t *skip );
 
+/*
+  Check that a shared memory reader's place in the list is still good
+
+  Returns 0 if the master changed things under it
+*/
+int         jsw_svalid ( jsw_skip_t *skip );
+
+/*
+  Counting by position. Skip lists keep the number of rows each link
+  passes over, so these take O(log n). B+tree and hash indexes don't.
+
+  Returns non-zero if the index can count
+*/
+int         jsw_scounted ( jsw_skip_t *skip );
+
+/*
+  Are the keys walked in order. A hash index only finds them.
+
+  Returns non-zero if traversal is in key order
+*/
+int         jsw_sordered ( jsw_skip_t *skip );
+
+/* Number of rows before the current link, the size at end-of-list */
+size_t      jsw_srank ( jsw_skip_t *skip );
+
+/* Number of rows before row's key, or up to and including it, by cmp */
+size_t      jsw_sposition ( jsw_skip_t *skip, ctable_BaseRow *row, int inclusive, cmp_f cmp );
+
+/* The same estimated for any index, exact for a skip list */
+size_t      jsw_sestimate ( jsw_skip_t *skip, ctable_BaseRow *row, int inclusive, cmp_f cmp );
+
+/*
+  Move the current link to the key holding row n, from 0
+
+  Returns how many of the key's rows come before row n
+*/
+size_t      jsw_sseek ( jsw_skip_t *skip, size_t n );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,235 @@
+#
+# make sure searches on fields with bitmap indexes, alone and several at
+# once, find the rows they should through inserts, updates, nulls, deletes
+# and bulk loads, and that booleans can be indexed
+#
+# $Id$
+#
+
+source test_common.tcl
+
+source search-test-proc.tcl
+
+package require ctable
+
+CExtension bitmapindex 1.0 {
+
+CTable bitmap_indexed {
+    varstring status indexed 1 indextype bitmap
+    boolean active indexed 1 indextype bitmap
+    boolean late indexed 1 indextype bitmap
+    fixedstring region 2 indexed 1 indextype bitmap default NA
+    int level indexed 1 indextype bitmap
+    boolean flag indexed 1
+    int value
+}
+
+}
+
+package require Bitmapindex
+
+if {![catch {CTable bad_bitmap {key id indexed 1 indextype bitmap}} err]} {
+    error "a bitmap index on the key should have been rejected"
+}
+if {![string match "*can't have a bitmap index" $err]} {
+    error "unexpected error for a bitmap index on the key: $err"
+}
+if {![catch {CTable bad_bitmap {int a
+    int b
+    compositeindex ab {a b} indextype bitmap}} err]} {
+    error "a composite bitmap index should have been rejected"
+}
+if {![string match "*can't be a bitmap index*" $err]} {
+    error "unexpected error for a composite bitmap index: $err"
+}
+
+proc row {i} {
+    return [list status [lindex {landed scheduled departed enroute cancelled} [expr {$i % 5}]] active [expr {$i % 3 == 0}] late [expr {$i % 10 == 7}] region [lindex {NA EU AS SA} [expr {$i % 4}]] level [expr {$i % 8}] flag [expr {$i % 2}] value [expr {$i % 1000}]]
+}
+
+set indexes {status active late region level flag}
+
+# the bitmaps answer every comparison, so the offset is skipped without
+# looking at the rows and has to land where walking them would
+proc check_offsets {what compare n} {
+    set keys [search_keys c -compare $compare]
+    if {[llength $keys] != $n} {
+	error "$what: search -compare [list $compare] found [llength $keys] rows, expected $n"
+    }
+    set half [expr {$n / 2}]
+    if {[search_keys c -compare $compare -offset $half -limit 15] != [lrange $keys $half [expr {$half + 14}]]} {
+	error "$what: search -compare [list $compare] -offset $half -limit 15 found '[search_keys c -compare $compare -offset $half -limit 15]'"
+    }
+    if {[count c $compare -offset [expr {$n - 10}]] != 10 || [count c $compare -offset $n -limit 3] != 0} {
+	error "$what: search -compare [list $compare] -offset [expr {$n - 10}] counted [count c $compare -offset [expr {$n - 10}]] rows"
+    }
+}
+
+bitmap_indexed create c
+create_indexes c $indexes
+
+# enough rows to spill the first block of row numbers into a second, and
+# every combination comes round every 3000 rows. a third are active, the
+# late rows are departed, level 6 is always AS and level 1 always flagged
+for {set i 0} {$i < 72000} {incr i} {
+    c set $i {*}[row $i]
+}
+
+# every row is in every index, whatever its values
+check_index_counts c "after load" $indexes
+check_counts c "after load" {
+    {{true active}} 24000
+    {{false active} {= status landed}} 9600
+    {{true active} {true late}} 2400
+    {{= status enroute} {in region {EU NA}}} 7200
+    {{in status {departed scheduled}} {false late} {range level 2 5}} 9000
+    {{< level 3} {true active}} 9000
+    {{>= level 6} {> level 3} {<= level 7} {!= region AS}} 9000
+    {{= status nosuchstatus} {true active}} 0
+    {{true active} {> value 500}} 11976
+    {{null status} {true active}} 0
+    {{!= status departed} {true late}} 0
+    {{match status *ed} {true late} {= region SA}} 3600
+    {{= status landed}} 14400
+    {{true flag}} 36000
+    {{true flag} {false active} {= level 1}} 6000
+}
+check_offsets "after load" {{true active} {true late}} 2400
+
+# comparisons on two bitmap indexed fields go through both bitmaps
+if {![uses_index c active {{true active} {= region EU}}] || ![uses_index c region {{true active} {= region EU}}]} {
+    error "true active and region EU didn't use both bitmap indexes"
+}
+if {![uses_index c late {{true late}}]} {
+    error "true late didn't use its bitmap index"
+}
+
+# late rows have values ending in 7, 24 rows of each
+if {[search_values c value -compare {{true active} {true late}} -sort value -offset 23 -limit 2] != {7 17}} {
+    error "after load: active and late sorted by value got [search_values c value -compare {{true active} {true late}} -sort value -offset 23 -limit 2]"
+}
+
+# rows move between the bitmaps of the values they have
+for {set i 4} {$i < 72000} {incr i 5} {
+    c set $i status landed
+}
+for {set i 1} {$i < 72000} {incr i 3} {
+    c set $i active 1
+}
+c search -compare {{= level 7}} -key k -code {lappend sevens $k}
+foreach k $sevens {
+    c incr $k level 1
+}
+check_index_counts c "after update" $indexes
+check_counts c "after update" {
+    {{= status landed}} 28800
+    {{= status cancelled}} 0
+    {{true active}} 48000
+    {{true active} {true late}} 4800
+    {{= level 8}} 9000
+    {{>= level 6} {> level 3} {<= level 7} {!= region AS}} 0
+}
+if {[lsort [c index list status]] != {departed enroute landed scheduled}} {
+    error "after update: index list status [c index list status]"
+}
+
+# null rows are in the index but match no value
+for {set i 0} {$i < 72000} {incr i 1000} {
+    c null $i status
+    c null [expr {$i + 1}] active
+}
+check_index_counts c "after setting nulls" $indexes
+check_counts c "after setting nulls" {
+    {{null status}} 72
+    {{= status landed}} 28728
+    {{null status} {true active}} 48
+    {{null active}} 72
+    {{true active}} 47952
+}
+for {set i 0} {$i < 72000} {incr i 1000} {
+    c set $i status landed
+    c set [expr {$i + 1}] active [expr {($i + 1) % 3 != 2}]
+}
+check_counts c "after unsetting nulls" {
+    {{null status}} 0
+    {{true active}} 48000
+}
+
+# deleted rows give back their numbers for new rows to use
+for {set i 0} {$i < 72000} {incr i 2} {
+    c delete $i
+}
+check_index_counts c "after delete" $indexes
+check_counts c "after delete" {
+    {{true active}} 24000
+    {{true late}} 7200
+    {{= status landed}} 14400
+    {{false flag}} 0
+}
+for {set i 100000} {$i < 112000} {incr i} {
+    c set $i {*}[row $i]
+}
+check_index_counts c "after reusing row numbers" $indexes
+check_counts c "after reusing row numbers" {
+    {{true late}} 8400
+    {{true flag}} 42000
+    {{= status cancelled}} 2400
+}
+check_offsets "after reusing row numbers" {{true late} {true flag}} 8400
+
+c search -compare {{true active} {= region EU}} -delete 1
+if {[c count] != 35000} {
+    error "after search -delete: [c count] rows"
+}
+check_index_counts c "after search -delete" $indexes
+check_counts c "after search -delete" {
+    {{true active} {= region EU}} 0
+    {{true late}} 5800
+}
+
+c search -compare {{true late} {= status departed}} -update {late 0}
+check_counts c "after search -update" {
+    {{true late}} 0
+    {{false late}} 35000
+}
+
+# a bulk load builds each index in one pass
+set fp [open tmp_bitmap.tsv w]
+for {set i 0} {$i < 24000} {incr i} {
+    array set r [row $i]
+    puts $fp "$i\t$r(status)\t$r(active)\t$r(late)\t$r(region)\t$r(level)\t$r(flag)\t$r(value)"
+}
+close $fp
+c reset
+create_indexes c $indexes
+set fp [open tmp_bitmap.tsv r]
+c read_tabsep $fp -bulk
+close $fp
+file delete tmp_bitmap.tsv
+
+check_index_counts c "after bulk load" $indexes
+check_counts c "after bulk load" {
+    {{true active}} 8000
+    {{true active} {true late}} 800
+    {{true flag} {false active} {= level 1}} 2000
+    {{= status enroute} {in region {EU NA}}} 2400
+}
+check_offsets "after bulk load" {{true active} {true late}} 800
+
+for {set i 0} {$i < 24000} {incr i 7} {
+    c set $i active 1
+}
+if {[count c {{true active}}] != 10286} {
+    error "after updating a bulk load: [count c {{true active}}] rows active"
+}
+
+c index drop active
+c index create active
+check_index_counts c "after recreating an index" $indexes
+if {[count c {{true active}}] != 10286 || ![uses_index c active {{true active} {= region EU}}]} {
+    error "after recreating an index: [count c {{true active}}] rows active"
+}
+
+c destroy
+
+puts "bitmap index tests passed"
@@ -0,0 +1,195 @@
+#
+# make sure fields indexed with a B+tree find, count and order their rows,
+# through inserts, updates, deletes and bulk loads
+#
+# $Id$
+#
+
+source test_common.tcl
+
+source search-test-proc.tcl
+
+package require ctable
+
+CExtension btreeindex 1.0 {
+
+CTable btree_indexed {
+    varstring name indexed 1 indextype btree
+    int value indexed 1 indextype btree
+    double score indexed 1 indextype btree
+}
+
+CTable btree_unique {
+    varstring name indexed 1 unique 1 indextype btree
+}
+
+}
+
+package require Btreeindex
+
+if {![catch {CTable bad_indextype {int value indexed 1 indextype bogus}} err]} {
+    error "indextype bogus should have been rejected"
+}
+if {![string match "unknown indextype*" $err]} {
+    error "unexpected error for a bad indextype: $err"
+}
+
+btree_indexed create b
+b index create name
+b index create value
+b index create score
+
+# 20 rows of each value, enough for the tree to be several levels deep
+for {set i 0} {$i < 20000} {incr i} {
+    b set $i name [format n%05d [expr {$i * 7 % 20000}]] value [expr {$i % 1000}] score [expr {$i / 4.0}]
+}
+
+if {[b index count value] != 20000 || [b index span value] != {0 999}} {
+    error "after load: value index count [b index count value] span [b index span value]"
+}
+if {[b index span name] != {n00000 n19999}} {
+    error "after load: name index span [b index span name]"
+}
+foreach {compare count} {
+    {{= value 5}} 20
+    {{< value 10}} 200
+    {{<= value 10}} 220
+    {{> value 990}} 180
+    {{>= value 990}} 200
+    {{range value 100 120}} 400
+    {{in value {1 5 999 4000}}} 60
+    {{= value -1}} 0
+    {{= name n00007}} 1
+    {{> name n19990}} 9
+    {{match name n0001*}} 10
+    {{in name {n00021 nosuchname}}} 1
+    {{< score 2}} 8
+    {{range value 10 900} {< score 100}} 390
+} {
+    if {[b search -compare $compare -countOnly 1] != $count} {
+	error "after load: search -compare $compare found [b search -compare $compare -countOnly 1] rows, expected $count"
+    }
+}
+if {[b search -compare {{= name n00007}} -key k -code {set found $k}] != 1 || $found != 1} {
+    error "after load: name n00007 should be row 1"
+}
+
+# walking the tree in order stands in for a sort
+if {[search_values b name -sort name -limit 3] != {n00000 n00001 n00002}} {
+    error "after load: search -sort name -limit 3 got [search_values b name -sort name -limit 3]"
+}
+if {[search_values b value -sort -value -limit 3] != {999 999 999}} {
+    error "after load: search -sort -value -limit 3 got [search_values b value -sort -value -limit 3]"
+}
+set want [concat [lrepeat 10 2] [lrepeat 15 3]]
+if {[search_values b value -sort value -offset 50 -limit 25] != $want} {
+    error "after load: search -sort value -offset 50 -limit 25 got [search_values b value -sort value -offset 50 -limit 25]"
+}
+set scores {}
+for {set i 19960} {$i < 20000} {incr i} {
+    lappend scores [expr {$i / 4.0}]
+}
+if {[search_values b score -compare {{>= score 4990}} -sort score] != $scores} {
+    error "after load: search >= score -sort score got [search_values b score -compare {{>= score 4990}} -sort score]"
+}
+
+# move the rows of value 5 to value 6, between leaves
+b search -compare {{= value 5}} -key k -code {lappend fives $k}
+foreach k $fives {
+    b set $k value 6
+}
+if {[b search -compare {{= value 5}} -countOnly 1] != 0 || [b search -compare {{= value 6}} -countOnly 1] != 40} {
+    error "after update: value 5 has [b search -compare {{= value 5}} -countOnly 1] rows, 6 has [b search -compare {{= value 6}} -countOnly 1]"
+}
+foreach k $fives {
+    b incr $k value 1000
+}
+if {[b search -compare {{= value 1006}} -countOnly 1] != 20 || [b index span value] != {0 1006}} {
+    error "after incr: value 1006 has [b search -compare {{= value 1006}} -countOnly 1] rows, span [b index span value]"
+}
+
+# deleting the even rows leaves the odd values
+for {set i 0} {$i < 20000} {incr i 2} {
+    b delete $i
+}
+if {[b index count value] != 10000 || [b index span value] != {1 1006}} {
+    error "after delete: value index count [b index count value] span [b index span value]"
+}
+if {[b search -compare {{< value 10}} -countOnly 1] != 80 || [b search -compare {{= value 2}} -countOnly 1] != 0} {
+    error "after delete: value < 10 has [b search -compare {{< value 10}} -countOnly 1] rows"
+}
+if {[search_values b value -sort value -limit 3] != {1 1 1}} {
+    error "after delete: search -sort value -limit 3 got [search_values b value -sort value -limit 3]"
+}
+
+# take the tree down to a few rows and back up again
+for {set i 1} {$i < 19990} {incr i 2} {
+    b delete $i
+}
+if {[b count] != 5 || [search_values b value -sort value] != {991 993 995 997 999}} {
+    error "after emptying: [b count] rows with values [search_values b value -sort value]"
+}
+for {set i 0} {$i < 5000} {incr i} {
+    b set $i name [format m%05d $i] value [expr {$i % 50}] score [expr {$i / 4.0}]
+}
+if {[b search -compare {{= value 7}} -countOnly 1] != 100 || [b index span value] != {0 999}} {
+    error "after reload: value 7 has [b search -compare {{= value 7}} -countOnly 1] rows, span [b index span value]"
+}
+
+b search -compare {{< value 25}} -delete 1
+if {[b count] != 2505 || [b search -compare {{< value 25}} -countOnly 1] != 0 || [b index count value] != 2505} {
+    error "after search -delete: [b count] rows, value index count [b index count value]"
+}
+
+# a bulk load builds the index from sorted rows in one pass
+set fp [open tmp_btree.tsv w]
+for {set i 0} {$i < 20000} {incr i} {
+    puts $fp "$i\tn[expr {19999 - $i}]\t[expr {$i % 1000}]\t[expr {$i / 4.0}]"
+}
+close $fp
+b reset
+b index create name
+b index create value
+b index create score
+set fp [open tmp_btree.tsv r]
+b read_tabsep $fp -bulk
+close $fp
+file delete tmp_btree.tsv
+
+if {[b index count value] != 20000 || [b index span value] != {0 999}} {
+    error "after bulk load: value index count [b index count value] span [b index span value]"
+}
+if {[b search -compare {{range value 100 120}} -countOnly 1] != 400} {
+    error "after bulk load: range value 100 120 found [b search -compare {{range value 100 120}} -countOnly 1] rows"
+}
+if {[search_values b value -sort value -offset 50 -limit 25] != $want} {
+    error "after bulk load: search -sort value -offset 50 -limit 25 got [search_values b value -sort value -offset 50 -limit 25]"
+}
+for {set i 0} {$i < 20000} {incr i 5} {
+    b set $i value [expr {$i % 1000 + 1000}]
+}
+if {[b search -compare {{>= value 1000}} -countOnly 1] != 4000 || [b search -compare {{= value 5}} -countOnly 1] != 0} {
+    error "after updating a bulk load: value >= 1000 has [b search -compare {{>= value 1000}} -countOnly 1] rows"
+}
+
+b index drop value
+b index create value
+if {[b index count value] != 20000 || [b index span value] != {1 1995}} {
+    error "after recreating an index: value index count [b index count value] span [b index span value]"
+}
+if {[search_values b value -sort -value -limit 2] != {1995 1995}} {
+    error "after recreating an index: search -sort -value -limit 2 got [search_values b value -sort -value -limit 2]"
+}
+
+b destroy
+
+# a unique field checks through the B+tree too
+btree_unique create u
+u index create name
+u set 1 name one
+if {![catch {u set 2 name one} err]} {
+    error "unique btree index allowed a duplicate"
+}
+u destroy
+
+puts "btree index tests passed"
@@ -0,0 +1,264 @@
+#
+# make sure searches through composite indexes find the rows they should,
+# in order, through inserts, updates, nulls, deletes and bulk loads
+#
+# $Id$
+#
+
+source test_common.tcl
+
+source search-test-proc.tcl
+
+package require ctable
+
+CExtension compositeindex 1.0 {
+
+CTable composite {
+    varstring name
+    int a
+    int b indexed 1
+    double c
+    fixedstring code 2 default zz
+    compositeindex ab {a b}
+    compositeindex nab {name a b}
+    compositeindex bc {b c} indextype btree
+    compositeindex codea {code a}
+}
+
+}
+
+package require Compositeindex
+
+if {![catch {CTable bad_composite {varstring name
+    compositeindex bad {name nosuchfield}}} err]} {
+    error "a composite index of a field that doesn't exist should have been rejected"
+}
+if {![string match "*refers to field \"nosuchfield\"*" $err]} {
+    error "unexpected error for a composite index of a missing field: $err"
+}
+if {![catch {CTable bad_composite {varstring name
+    boolean flag
+    compositeindex nf {name flag}}} err]} {
+    error "a composite index of a boolean should have been rejected"
+}
+if {![string match "*can't include boolean*" $err]} {
+    error "unexpected error for a composite index of a boolean: $err"
+}
+if {![catch {CTable bad_composite {varstring name
+    compositeindex nn {name name}}} err]} {
+    error "a composite index naming a field twice should have been rejected"
+}
+if {![string match "*more than once" $err]} {
+    error "unexpected error for a composite index naming a field twice: $err"
+}
+if {![catch {CTable bad_composite {varstring name
+    compositeindex nh {name} indextype hash}} err]} {
+    error "a composite hash index should have been rejected"
+}
+if {![string match "*can't be a hash index*" $err]} {
+    error "unexpected error for a composite hash index: $err"
+}
+
+proc row {i} {
+    return [list name [lindex {aa ab ba bb} [expr {$i % 4}]] a [expr {$i % 20}] b [expr {$i % 50}] c [expr {$i % 100 / 10.0}] code [lindex {ab ac bc} [expr {$i % 3}]]]
+}
+
+set indexes {b ab nab bc codea}
+
+composite create c
+create_indexes c $indexes
+
+if {[c index indexed] != $indexes} {
+    error "index indexed returned '[c index indexed]'"
+}
+
+# every combination of the fields' values comes round every 300 rows,
+# a is 3 when i % 20 is 3, and then b is 3, 13, 23, 33 or 43 and name bb
+for {set i 0} {$i < 3000} {incr i} {
+    c set $i {*}[row $i]
+}
+
+check_index_counts c "after load" $indexes
+check_counts c "after load" {
+    {{= a 3}} 150
+    {{= a 3} {= b 23}} 30
+    {{= a 3} {range b 10 30}} 60
+    {{= a 3} {>= b 25}} 60
+    {{= a 3} {> b 25}} 60
+    {{= a 3} {<= b 25}} 90
+    {{= a 3} {< b 25} {> c 1}} 60
+    {{> b 25} {= a 3}} 60
+    {{= name bb} {= a 3}} 150
+    {{= name ab} {= a 3}} 0
+    {{= name bb} {= a 3} {range b 5 45}} 120
+    {{= name bb} {< a 10}} 300
+    {{= name bb} {null a}} 0
+    {{= b 23} {range c 2.5 7.5}} 30
+    {{= code ab} {range a 5 15}} 500
+    {{= code zz}} 0
+    {{= a -1} {= b 0}} 0
+    {{>= a 15}} 750
+}
+
+# walking the index in order stands in for the sort
+if {[search_values c b -compare {{= a 3}} -sort {a b} -offset 25 -limit 10] != {3 3 3 3 3 13 13 13 13 13}} {
+    error "after load: a = 3 sorted by a b got [search_values c b -compare {{= a 3}} -sort {a b} -offset 25 -limit 10]"
+}
+if {[search_values c b -compare {{= name bb} {= a 3}} -sort -b -limit 3] != {43 43 43}} {
+    error "after load: name bb a 3 sorted down by b got [search_values c b -compare {{= name bb} {= a 3}} -sort -b -limit 3]"
+}
+if {[search_values c c -compare {{= b 23} {range c 2 8}} -sort c -limit 1] != {2.3}} {
+    error "after load: b 23 sorted by c got [search_values c c -compare {{= b 23} {range c 2 8}} -sort c -limit 1]"
+}
+
+# an index that answers every comparison counts and skips the offset
+# without walking the rows
+if {[count c {{= a 3} {range b 10 30}} -offset 55] != 5 || [count c {{= a 3} {range b 10 30}} -offset 60 -limit 3] != 0} {
+    error "after load: a 3 b 10 to 30 -offset 55 found [count c {{= a 3} {range b 10 30}} -offset 55] rows"
+}
+set keys {}
+c search -compare {{= a 3} {range b 10 30}} -key k -code {lappend keys $k}
+set got {}
+c search -compare {{= a 3} {range b 10 30}} -offset 20 -limit 15 -key k -code {lappend got $k}
+if {$got != [lrange $keys 20 34] || [lsort -unique [lmap k $got {c get $k b}]] != {13 23}} {
+    error "after load: a 3 b 10 to 30 -offset 20 -limit 15 found '$got'"
+}
+
+# move rows around every composite the fields are part of
+c search -compare {{= a 3} {= b 23}} -key k -code {lappend twentythrees $k}
+foreach k $twentythrees {
+    c set $k b 24
+}
+c search -compare {{= a 3} {= b 13}} -key k -code {lappend thirteens $k}
+foreach k $thirteens {
+    c set $k name aa
+}
+c search -compare {{= a 3} {= b 43}} -key k -code {lappend fortythrees $k}
+foreach k $fortythrees {
+    c incr $k b 100
+}
+check_counts c "after update" {
+    {{= a 3} {= b 23}} 0
+    {{= a 3} {= b 24}} 30
+    {{= name bb} {= a 3}} 120
+    {{= name aa} {= a 3}} 30
+    {{= a 3} {> b 100}} 30
+    {{= a 3} {>= b 25}} 60
+    {{= b 143} {range c 4 5}} 30
+}
+if {[search_values c b -compare {{= a 3}} -sort {a -b} -limit 2] != {143 143}} {
+    error "after update: a 3 sorted down by b got [search_values c b -compare {{= a 3}} -sort {a -b} -limit 2]"
+}
+
+# nulls sort first, and leave the rows in the indexes
+c search -compare {{= a 3} {= b 33}} -key k -code {lappend thirtythrees $k}
+foreach k $thirtythrees {
+    c null $k a
+}
+foreach k $thirteens {
+    c null $k name b
+}
+check_counts c "after setting nulls" {
+    {{= a 3}} 120
+    {{= name bb} {null a}} 30
+    {{null a} {= b 33}} 30
+    {{= name aa} {= a 3}} 0
+    {{null name} {= a 3} {null b}} 30
+}
+check_index_counts c "after setting nulls" {ab nab bc}
+foreach k $thirtythrees {
+    c set $k a 3
+}
+# the rows of b 13 keep the name aa they were given
+foreach k $thirteens {
+    c set $k name aa b 13
+}
+check_counts c "after unsetting nulls" {
+    {{= a 3}} 150
+    {{= name bb} {null a}} 0
+    {{= name aa} {= a 3} {= b 13}} 30
+}
+
+# deleting the even rows leaves the odd values of a
+for {set i 0} {$i < 3000} {incr i 2} {
+    c delete $i
+}
+check_counts c "after delete" {
+    {{= a 3}} 150
+    {{= a 4}} 0
+    {{= code ab} {range a 5 15}} 250
+    {{= name bb} {< a 10}} 270
+}
+
+c search -compare {{= a 3}} -delete 1
+if {[c count] != 1350 || [c index count ab] != 1350 || [c index count nab] != 1350} {
+    error "after search -delete: [c count] rows, ab index count [c index count ab]"
+}
+check_counts c "after search -delete" {
+    {{= a 3}} 0
+    {{= name bb} {< a 10}} 150
+}
+
+# new rows only setting some of the fields, the rest come from defaults
+for {set i 3000} {$i < 3100} {incr i} {
+    c set $i a [expr {$i % 20}]
+}
+check_counts c "after partial rows" {
+    {{= code zz}} 100
+    {{= code zz} {range a 5 15}} 50
+    {{null name} {= a 7}} 5
+}
+check_index_counts c "after partial rows" $indexes
+
+# a bulk load builds composite indexes in one pass like any other
+set fp [open tmp_composite.tsv w]
+for {set i 0} {$i < 3000} {incr i} {
+    array set r [row $i]
+    puts $fp "$i\t$r(name)\t$r(a)\t$r(b)\t$r(c)\t$r(code)"
+}
+close $fp
+c reset
+create_indexes c $indexes
+set fp [open tmp_composite.tsv r]
+c read_tabsep $fp -bulk
+close $fp
+file delete tmp_composite.tsv
+
+check_counts c "after bulk load" {
+    {{= a 3} {range b 10 30}} 60
+    {{= name bb} {= a 3} {range b 5 45}} 120
+    {{= b 23} {range c 2.5 7.5}} 30
+    {{= code ab} {range a 5 15}} 500
+}
+if {[search_values c b -compare {{= a 3}} -sort {a b} -offset 25 -limit 10] != {3 3 3 3 3 13 13 13 13 13}} {
+    error "after bulk load: a = 3 sorted by a b got [search_values c b -compare {{= a 3}} -sort {a b} -offset 25 -limit 10]"
+}
+
+for {set i 0} {$i < 3000} {incr i 7} {
+    c set $i b 99
+}
+check_counts c "after updating a bulk load" {
+    {{= a 3} {= b 99}} 21
+    {{= b 99} {range c 0 10}} 429
+}
+
+c index drop ab
+c index drop nab
+c index create ab
+c index create nab
+check_counts c "after recreating indexes" {
+    {{= a 3} {= b 99}} 21
+    {{= name bb} {= a 3} {range b 5 45}} 103
+}
+
+# the composite's values show as lists
+if {[c index span ab] != {{0 0} {19 99}}} {
+    error "index span of a composite index returned '[c index span ab]'"
+}
+if {[llength [c index list codea]] != 60} {
+    error "index list of a composite index returned [llength [c index list codea]] values, expected 60"
+}
+
+c destroy
+
+puts "composite index tests passed"
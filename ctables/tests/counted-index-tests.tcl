@@ -0,0 +1,220 @@
+#
+# make sure searches that count rows or skip an offset through the index,
+# without walking it, land on the right rows
+#
+# $Id$
+#
+
+source test_common.tcl
+
+source search-test-proc.tcl
+
+package require ctable
+
+CExtension countedindex 1.0 {
+
+CTable counted {
+    varstring name indexed 1
+    int value indexed 1
+}
+
+}
+
+package require Countedindex
+
+proc name {i} {
+    return [format %c%c [expr {97 + $i % 26}] [expr {97 + $i / 26 % 26}]]
+}
+
+counted create c
+c index create name
+c index create value
+
+# 50 rows of each value, so offsets land inside a value's rows
+for {set i 0} {$i < 10000} {incr i} {
+    c set $i name [name $i] value [expr {$i % 200}]
+}
+
+if {[c index count value] != 10000 || [c index count name] != 10000} {
+    error "after load: index counts [c index count value] and [c index count name]"
+}
+foreach {compare n} {
+    {{= value 7}} 50
+    {{= value -1}} 0
+    {{< value 10}} 500
+    {{<= value 10}} 550
+    {{> value 190}} 450
+    {{>= value 190}} 500
+    {{range value 50 60}} 500
+    {{range value 60 50}} 0
+    {{< name b}} 385
+    {{> name m}} 5380
+} {
+    if {[count c $compare] != $n} {
+	error "after load: search -compare $compare -countOnly 1 got [count c $compare], expected $n"
+    }
+}
+if {[count c {{< value 10}} -offset 480 -limit 30] != 20 || [search_values c value -compare {{< value 10}} -offset 480 -limit 30] != [lrepeat 20 9]} {
+    error "after load: value < 10 -offset 480 -limit 30 got [search_values c value -compare {{< value 10}} -offset 480 -limit 30]"
+}
+if {[count c {{= value 7}} -offset 49] != 1 || [count c {{= value 7}} -offset 50] != 0 || [count c {{range value 50 60}} -offset 505 -limit 3] != 0} {
+    error "after load: offsets at or past the end of the rows found some"
+}
+if {[search_values c value -compare {{>= value 190}} -offset 0 -limit 5] != [lrepeat 5 190]} {
+    error "after load: value >= 190 -limit 5 got [search_values c value -compare {{>= value 190}} -offset 0 -limit 5]"
+}
+if {[search_values c name -compare {{> name m}} -offset 5379 -limit 3] != {zz}} {
+    error "after load: last name past m got [search_values c name -compare {{> name m}} -offset 5379 -limit 3]"
+}
+
+# the offset lands on the row walking the index would have got to
+set keys {}
+c search -compare {{range value 50 60}} -key k -code {lappend keys $k}
+set got {}
+c search -compare {{range value 50 60}} -offset 123 -limit 7 -key k -code {lappend got $k}
+if {$got != [lrange $keys 123 129]} {
+    error "after load: range value 50 60 -offset 123 -limit 7 got '$got', expected '[lrange $keys 123 129]'"
+}
+
+# move values 0 to 9 past the rest
+c search -compare {{< value 10}} -key k -code {lappend low $k}
+foreach k $low {
+    c incr $k value 1000
+}
+if {[count c {{< value 10}}] != 0 || [count c {{>= value 1000}}] != 500 || [count c {{>= value 1000}} -offset 470] != 30} {
+    error "after update: value >= 1000 has [count c {{>= value 1000}}] rows"
+}
+if {[search_values c value -compare {{>= value 1000}} -offset 499] != {1009}} {
+    error "after update: last value >= 1000 is [search_values c value -compare {{>= value 1000}} -offset 499]"
+}
+
+# deleting the even rows leaves the odd values
+for {set i 0} {$i < 10000} {incr i 2} {
+    c delete $i
+}
+if {[c index count value] != 5000 || [count c {{>= value 1000}}] != 250 || [count c {{range value 50 60}}] != 250} {
+    error "after delete: value index count [c index count value], >= 1000 has [count c {{>= value 1000}}] rows"
+}
+if {[search_values c value -compare {{range value 50 60}} -offset 200 -limit 2] != {59 59}} {
+    error "after delete: range value 50 60 -offset 200 got [search_values c value -compare {{range value 50 60}} -offset 200 -limit 2]"
+}
+
+# down to a handful of rows, then mostly distinct values
+for {set i 1} {$i < 9990} {incr i 2} {
+    c delete $i
+}
+if {[c index count value] != 5 || [count c {{> value 190}}] != 5 || [search_values c value -compare {{> value 190}} -sort value -offset 4 -limit 1] != {199}} {
+    error "after emptying: values [search_values c value -sort value]"
+}
+for {set i 0} {$i < 5000} {incr i} {
+    c set $i name [name $i] value [expr {$i % 199}]
+}
+if {[count c {{= value 7}}] != 26 || [count c {{< value 20}}] != 520 || [count c {{< value 20}} -offset 519] != 1} {
+    error "after reload: value 7 has [count c {{= value 7}}] rows, < 20 has [count c {{< value 20}}]"
+}
+
+c search -compare {{< value 20}} -delete 1
+if {[c index count value] != 4485 || [c index count name] != 4485 || [count c {{< value 20}}] != 0} {
+    error "after search -delete: index counts [c index count value] and [c index count name]"
+}
+
+# a bulk load builds the counts as it builds the index
+set fp [open tmp_counted.tsv w]
+for {set i 0} {$i < 10000} {incr i} {
+    puts $fp "$i\t[name $i]\t[expr {$i % 200}]"
+}
+close $fp
+c reset
+c index create name
+c index create value
+set fp [open tmp_counted.tsv r]
+c read_tabsep $fp -bulk
+close $fp
+file delete tmp_counted.tsv
+
+if {[c index count value] != 10000 || [count c {{range value 50 60}}] != 500 || [count c {{> name m}}] != 5380} {
+    error "after bulk load: value index count [c index count value], range 50 60 has [count c {{range value 50 60}}] rows"
+}
+if {[search_values c value -compare {{< value 10}} -offset 480 -limit 30] != [lrepeat 20 9]} {
+    error "after bulk load: value < 10 -offset 480 -limit 30 got [search_values c value -compare {{< value 10}} -offset 480 -limit 30]"
+}
+for {set i 0} {$i < 10000} {incr i 200} {
+    c set $i value 1000
+}
+if {[count c {{= value 0}}] != 0 || [count c {{= value 1000}}] != 50 || [count c {{> value 198}} -offset 50] != 50} {
+    error "after updating a bulk load: value 1000 has [count c {{= value 1000}}] rows"
+}
+
+# rows arriving in order, or nearly, are placed starting from the last
+# insert rather than the head of the list
+c reset
+c index create name
+c index create value
+for {set i 0} {$i < 5000} {incr i} {
+    c set $i name [name $i] value [expr {$i / 25}]
+}
+if {[count c {{= value 7}}] != 25 || [count c {{< value 100}} -offset 2499] != 1 || [search_values c value -compare {{>= value 100}} -offset 2475] != [lrepeat 25 199]} {
+    error "after ordered load: value 7 has [count c {{= value 7}}] rows"
+}
+
+# 25 rows each of values 150 to 159 are already there
+set n 250
+for {set i 5000} {$i < 10000} {incr i} {
+    set value [expr {($i + $i * 37 % 100) / 50}]
+    c set $i name [name $i] value $value
+    if {$value >= 150 && $value < 160} {
+	incr n
+    }
+}
+if {[count c {{range value 150 160}}] != $n || [search_values c value -sort value] != [lsort -integer [search_values c value]]} {
+    error "after nearly ordered load: range value 150 160 has [count c {{range value 150 160}}] rows, expected $n"
+}
+
+for {set i 10000} {$i < 12000} {incr i} {
+    c set $i name [name $i] value [expr {200 - $i / 10 % 200}]
+}
+if {[c index count value] != 12000 || [count c {{= value 1}}] != 35 || [count c {{< value 0}}] != 0} {
+    error "after reverse ordered load: value 1 has [count c {{= value 1}}] rows"
+}
+if {[search_values c value -sort value -limit 35] != [concat [lrepeat 25 0] [lrepeat 10 1]]} {
+    error "after reverse ordered load: lowest values [search_values c value -sort value -limit 35]"
+}
+
+# nodes freed by deletes are used again for new values, with their links
+# and counts set up from scratch, and dropping the index or resetting the
+# table gives back all of them at once
+c reset
+c index create value
+for {set round 0} {$round < 4} {incr round} {
+    for {set i 0} {$i < 8000} {incr i} {
+	c set $i value [expr {$round * 10000 + $i}]
+    }
+    for {set i 0} {$i < 8000} {incr i} {
+	if {$i % 8 != 0} {
+	    c delete $i
+	}
+    }
+    if {[c index count value] != 1000 || [count c [list [list >= value [expr {$round * 10000}]]]] != 1000} {
+	error "after churn round $round: value index count [c index count value]"
+    }
+    if {[search_values c value -sort value -offset 999 -limit 1] != [expr {$round * 10000 + 7992}]} {
+	error "after churn round $round: last value [search_values c value -sort value -offset 999 -limit 1]"
+    }
+}
+c index drop value
+c index create value
+if {[c index count value] != 1000 || [search_values c value -sort value -limit 2] != {30000 30008}} {
+    error "after recreating a churned index: values [search_values c value -sort value -limit 2]"
+}
+c reset
+c index create value
+for {set i 0} {$i < 100} {incr i} {
+    c set $i value [expr {99 - $i}]
+}
+if {[c index count value] != 100 || [count c {{< value 50}} -offset 49] != 1 || [search_values c value -sort value -limit 3] != {0 1 2}} {
+    error "after reset: value index count [c index count value]"
+}
+
+c destroy
+
+puts "counted index tests passed"
@@ -0,0 +1,255 @@
+#
+# make sure fields with a hash index find the rows they should for "=" and
+# "in", through inserts, updates, nulls, deletes and bulk loads, and that
+# other comparisons on them still work without the index
+#
+# $Id$
+#
+
+source test_common.tcl
+
+source search-test-proc.tcl
+
+package require ctable
+
+CExtension hashindex 1.0 {
+
+CTable hash_indexed {
+    varstring name indexed 1 indextype hash
+    int value indexed 1 indextype hash
+    double score indexed 1 indextype hash
+    fixedstring code 3 indexed 1 indextype hash default aaa
+    inet ip indexed 1 indextype hash
+}
+
+CTable hash_unique {
+    varstring name indexed 1 unique 1 indextype hash
+}
+
+}
+
+package require Hashindex
+
+if {![catch {CTable bad_hash_key {key id indexed 1 indextype hash}} err]} {
+    error "a hash index on the key should have been rejected"
+}
+if {![string match "*can't have a hash index" $err]} {
+    error "unexpected error for a hash index on the key: $err"
+}
+
+proc row {i} {
+    return [list name [format n%04d [expr {$i % 3000}]] value [expr {$i % 1000}] score [expr {$i % 41 / 4.0 - 5}] code [lindex {aaa abb acc add} [expr {$i % 4}]] ip 10.0.[expr {$i % 4}].[expr {$i % 200}]]
+}
+
+set indexes {name value score code ip}
+
+hash_indexed create h
+create_indexes h $indexes
+
+# enough rows for the hash tables to grow several times, 2 of each name,
+# 6 of each value, and the score is 0 when i % 41 is 20
+for {set i 0} {$i < 6000} {incr i} {
+    h set $i {*}[row $i]
+}
+
+check_index_counts h "after load" $indexes
+check_counts h "after load" {
+    {{= name n0007}} 2
+    {{= value 7}} 6
+    {{= score 0}} 146
+    {{= score -0.0}} 146
+    {{= code acc}} 1500
+    {{= ip 10.0.1.5}} 30
+    {{= name nosuchname}} 0
+    {{= value -1}} 0
+    {{in name {n0007 n0008 zzz}}} 4
+    {{in value {1 2 3 -1}}} 18
+    {{in score {0 2.5 -5 99}}} 439
+    {{in code {aaa abb zzz}}} 3000
+    {{= name n0007} {= value 7}} 2
+    {{in value {1 2 3}} {= code abb}} 6
+    {{> value 990}} 54
+    {{range value 100 200} {= code aaa}} 150
+    {{< name n0010}} 20
+    {{>= score 4.5}} 438
+    {{null value}} 0
+}
+
+# the index lists every value once, and its span is still the lowest and
+# highest value even though it keeps them in no order
+if {[llength [h index list value]] != 1000 || [lsort [h index list code]] != {aaa abb acc add}} {
+    error "after load: index list value has [llength [h index list value]] values, code [h index list code]"
+}
+if {[h index span value] != {0 999} || [h index span score] != {-5.0 5.0}} {
+    error "after load: index span value [h index span value], score [h index span score]"
+}
+
+# "=" and "in" go through the index, other comparisons can't
+set before [h index searches value]
+count h {{= value 7}}
+count h {{in value {1 2}}}
+if {[h index searches value] != $before + 2} {
+    error "= and in on value used its hash index [expr {[h index searches value] - $before}] times, expected 2"
+}
+count h {{range value 100 200}}
+count h {{> value 990}}
+if {[h index searches value] != $before + 2} {
+    error "range and > on value shouldn't have used its hash index"
+}
+
+if {[search_values h value -compare {{in value {1 2 3}}} -sort value -offset 5 -limit 3] != {1 2 2}} {
+    error "after load: in value sorted -offset 5 -limit 3 got [search_values h value -compare {{in value {1 2 3}}} -sort value -offset 5 -limit 3]"
+}
+if {[search_values h name -compare {{= value 7}} -sort -name] != {n2007 n2007 n1007 n1007 n0007 n0007}} {
+    error "after load: value 7 sorted down by name got [search_values h name -compare {{= value 7}} -sort -name]"
+}
+
+# move rows from one value to another
+h search -compare {{= value 7}} -key k -code {lappend sevens $k}
+foreach k $sevens {
+    h set $k value 8
+}
+h search -compare {{= name n0007}} -key k -code {lappend named $k}
+foreach k $named {
+    h set $k name moved code zzz
+}
+check_counts h "after update" {
+    {{= value 7}} 0
+    {{= value 8}} 12
+    {{in value {7 8 9}}} 18
+    {{= name n0007}} 0
+    {{= name moved}} 2
+    {{= code zzz}} 2
+    {{= code add}} 1498
+}
+if {[llength [h index list value]] != 999 || [lsort [h index list code]] != {aaa abb acc add zzz}} {
+    error "after update: index list value has [llength [h index list value]] values, code [h index list code]"
+}
+
+# null rows stay in the index without matching any value
+h search -compare {{= value 8}} -key k -code {lappend eights $k}
+foreach k $eights {
+    h null $k value
+}
+foreach k $named {
+    h null $k name score
+}
+check_counts h "after setting nulls" {
+    {{= value 8}} 0
+    {{null value}} 12
+    {{in value {8 9}}} 6
+    {{= name moved}} 0
+    {{null score}} 2
+}
+if {[h index count value] != 6000 || [h index count score] != 6000} {
+    error "after setting nulls: value index count [h index count value], score [h index count score]"
+}
+foreach k $eights {
+    h set $k value 8
+}
+check_counts h "after unsetting nulls" {
+    {{= value 8}} 12
+    {{null value}} 0
+}
+
+# deleting the even rows leaves the odd values, and the codes of odd rows,
+# the rows moved from 7 to 8 included
+for {set i 0} {$i < 6000} {incr i 2} {
+    h delete $i
+}
+check_counts h "after delete" {
+    {{= value 8}} 6
+    {{= value 7}} 0
+    {{= value 9}} 6
+    {{= code abb}} 1500
+    {{= code aaa}} 0
+    {{in code {aaa acc add}}} 1498
+}
+if {[llength [h index list value]] != 500 || [lsort [h index list code]] != {abb add zzz}} {
+    error "after delete: index list value has [llength [h index list value]] values, code [h index list code]"
+}
+
+h search -compare {{in code {abb}}} -delete 1
+if {[h count] != 1500 || [h index count code] != 1500 || [lsort [h index list code]] != {add zzz}} {
+    error "after search -delete: [h count] rows, code index count [h index count code]"
+}
+
+# a bulk load builds each index in one pass
+set fp [open tmp_hash.tsv w]
+for {set i 0} {$i < 6000} {incr i} {
+    array set r [row $i]
+    puts $fp "$i\t$r(name)\t$r(value)\t$r(score)\t$r(code)\t$r(ip)"
+}
+close $fp
+h reset
+create_indexes h $indexes
+set fp [open tmp_hash.tsv r]
+h read_tabsep $fp -bulk
+close $fp
+file delete tmp_hash.tsv
+
+check_counts h "after bulk load" {
+    {{= name n0007}} 2
+    {{in value {1 2 3 -1}}} 18
+    {{= score 0}} 146
+    {{= ip 10.0.1.5}} 30
+}
+if {[llength [h index list value]] != 1000 || [llength [h index list name]] != 3000} {
+    error "after bulk load: index list value has [llength [h index list value]] values, name [llength [h index list name]]"
+}
+
+for {set i 0} {$i < 6000} {incr i 7} {
+    h set $i name seven
+}
+check_counts h "after updating a bulk load" {
+    {{= name seven}} 858
+    {{= name n0007}} 1
+}
+
+h index drop value
+h index create value
+check_counts h "after recreating an index" {
+    {{in value {1 2 3 -1}}} 18
+    {{= value 999}} 6
+}
+
+# down to nothing and back, the entries for the values all go
+for {set i 0} {$i < 6000} {incr i} {
+    h delete $i
+}
+if {[h index count value] != 0 || [h index list value] != {} || [h index span value] != {}} {
+    error "after emptying: value index count [h index count value], list [h index list value]"
+}
+for {set i 0} {$i < 100} {incr i} {
+    h set $i {*}[row $i]
+}
+check_counts h "after reload" {
+    {{= value 7}} 1
+    {{in name {n0007 n0099 n0100}}} 2
+}
+if {[llength [h index list value]] != 100} {
+    error "after reload: index list value has [llength [h index list value]] values"
+}
+
+# 0.0 and -0.0 are the same value
+h reset
+h index create score
+h set 1 score 0.0
+h set 2 score -0.0
+h set 3 score 1.5
+if {[count h {{= score 0}}] != 2 || [count h {{= score -0.0}}] != 2 || [llength [h index list score]] != 2} {
+    error "0.0 and -0.0: = score 0 found [count h {{= score 0}}] rows, index list score [h index list score]"
+}
+
+h destroy
+
+# a unique field checks through the hash index too
+hash_unique create u
+u index create name
+u set 1 name one
+if {![catch {u set 2 name one} err]} {
+    error "unique hash index allowed a duplicate"
+}
+u destroy
+
+puts "hash index tests passed"
@@ -0,0 +1,193 @@
+#
+# make sure the index advisor counts the comparisons of searches that had
+# to look at every row, advises the ones that would have been worth an
+# index and creates those indexes when asked to
+#
+# $Id$
+#
+
+source test_common.tcl
+
+package require ctable
+
+CExtension indexadvisor 1.0 {
+
+CTable advised {
+    varstring status indexed 1
+    int value indexed 1
+    fixedstring code 3 indexed 1 indextype hash
+    varstring name indexed 1 indextype trigram
+    int other
+}
+
+}
+
+package require Indexadvisor
+
+advised create t
+
+for {set i 0} {$i < 1000} {incr i} {
+    t set $i status [expr {$i % 100 == 0 ? "rare" : "common"}] value [expr {$i % 10}] code [format c%02d [expr {$i % 50}]] name "row $i" other [expr {$i % 500}]
+}
+
+if {"[t index advise]" != ""} {
+    error "advice before starting: got '[t index advise]'"
+}
+if {"[t index advise counts]" != ""} {
+    error "counts before starting: got '[t index advise counts]'"
+}
+
+t index advise start 3 0.1
+
+# not advised until enough searches have made the comparison
+t search -compare {{= status rare}} -countOnly 1
+t search -compare {{= status rare}} -countOnly 1
+if {"[t index advise]" != ""} {
+    error "advice after two searches: got '[t index advise]'"
+}
+t search -compare {{= status rare}} -countOnly 1
+if {"[t index advise]" != "{status = 3 3000 30}"} {
+    error "advice after three searches: got '[t index advise]'"
+}
+
+# comparisons that accept too many rows are counted but not advised
+for {set i 0} {$i < 3} {incr i} {
+    t search -compare {{< value 5}} -countOnly 1
+}
+if {"[t index advise counts]" != "{status = 3 3000 30} {value < 3 3000 1500}"} {
+    error "counts of an unselective comparison: got '[t index advise counts]'"
+}
+if {"[t index advise]" != "{status = 3 3000 30}"} {
+    error "advice with an unselective comparison: got '[t index advise]'"
+}
+
+# each comparison of a search counts the rows it accepts on its own
+t index advise reset
+if {"[t index advise counts]" != ""} {
+    error "counts after reset: got '[t index advise counts]'"
+}
+for {set i 0} {$i < 3} {incr i} {
+    t search -compare {{= status rare} {< value 5}} -countOnly 1
+}
+if {"[t index advise counts]" != "{status = 3 3000 30} {value < 3 3000 1500}"} {
+    error "counts of two comparisons: got '[t index advise counts]'"
+}
+
+# only comparisons the field's type of index could be walked for count
+t index advise reset
+foreach compare {
+    {{!= status rare}} {{notnull status}} {{< code c10}} {{= code c10}}
+    {{match name *}} {{match name {*w 12*}}} {{match_case status *ar*}}
+    {{= other 7}}
+} {
+    t search -compare $compare -countOnly 1
+}
+if {"[t index advise counts]" != "{code = 1 1000 20} {name match 1 1000 11} {other = 1 1000 2}"} {
+    error "counts of comparisons by index type: got '[t index advise counts]'"
+}
+
+# a search that stops early counts the rows it looked at
+t index advise reset
+t search -compare {{= other 7}} -limit 1 -countOnly 1
+lassign [lindex [t index advise counts] 0] field term scans examined matched
+if {$examined >= 1000 || $matched != 1} {
+    error "search with a limit looked at $examined rows and matched $matched"
+}
+
+# searches that walk an index aren't counted
+t index advise reset
+t index create value
+t search -compare {{= value 3}} -countOnly 1
+t search -compare {{= status rare} {= value 3}} -countOnly 1
+if {"[t index advise counts]" != ""} {
+    error "counts of an indexed field: got '[t index advise counts]'"
+}
+t index drop value
+
+# with create, the indexes advised are made once it's idle, but not for
+# fields that weren't defined as indexable
+t index advise start 2 0.05 1
+t index advise reset
+foreach compare {{{= status rare}} {{= other 7}} {{match name {*w 12*}}}} {
+    t search -compare $compare -countOnly 1
+    t search -compare $compare -countOnly 1
+}
+if {"[t index indexed]" != ""} {
+    error "indexes before idle: got '[t index indexed]'"
+}
+update
+if {"[lsort [t index indexed]]" != "name status"} {
+    error "indexes after idle: got '[lsort [t index indexed]]'"
+}
+if {"[t index advise]" != "{other = 2 2000 4}"} {
+    error "advice after creating indexes: got '[t index advise]'"
+}
+if {[t search -compare {{= status rare}} -countOnly 1] != 10} {
+    error "rows found with the new index: got [t search -compare {{= status rare}} -countOnly 1]"
+}
+if {[t index count status] != 1000} {
+    error "index count of the new index: got [t index count status]"
+}
+
+# the settings can change without losing the counts
+t index advise start 3 0.05 0
+if {"[t index advise]" != ""} {
+    error "advice with more searches needed: got '[t index advise]'"
+}
+if {"[t index advise counts]" != "{other = 2 2000 4}"} {
+    error "counts kept after changing settings: got '[t index advise counts]'"
+}
+
+t index advise stop
+if {"[t index advise]" != ""} {
+    error "advice after stopping: got '[t index advise]'"
+}
+t search -compare {{= other 7}} -countOnly 1
+if {"[t index advise counts]" != ""} {
+    error "counts after stopping: got '[t index advise counts]'"
+}
+
+if {![catch {t index advise start 3 2} err]} {
+    error "a maxFraction over 1 should have been rejected"
+}
+if {$err != "maxFraction must be between 0 and 1"} {
+    error "unexpected error for a maxFraction over 1: $err"
+}
+if {![catch {t index advise start x} err]} {
+    error "a minScans that isn't a number should have been rejected"
+}
+if {![string match "expected integer*" $err]} {
+    error "unexpected error for a minScans that isn't a number: $err"
+}
+if {![catch {t index advise start 3 0.1 maybe} err]} {
+    error "a create that isn't a boolean should have been rejected"
+}
+if {![string match "expected boolean*" $err]} {
+    error "unexpected error for a create that isn't a boolean: $err"
+}
+if {![catch {t index advise bogus} err]} {
+    error "index advise bogus should have failed"
+}
+if {![string match "bad option \"bogus\"*" $err]} {
+    error "unexpected error from index advise bogus: $err"
+}
+if {![catch {t index advise stop now} err]} {
+    error "index advise stop now should have failed"
+}
+if {![string match "wrong # args*" $err]} {
+    error "unexpected error from index advise stop now: $err"
+}
+
+# a table destroyed with an index waiting to be created mustn't be touched
+advised create d
+for {set i 0} {$i < 100} {incr i} {
+    d set $i status [expr {$i % 50 == 0 ? "rare" : "common"}]
+}
+d index advise start 1 0.1 1
+d search -compare {{= status rare}} -countOnly 1
+d destroy
+update
+
+t destroy
+
+puts "index advisor tests passed"
@@ -0,0 +1,332 @@
+#
+# make sure tables keyed with a non-default hash function or key index
+# layout behave the same as ones using the defaults
+#
+# $Id$
+#
+
+source test_common.tcl
+
+package require ctable
+
+CExtension keyhash 1.0 {
+
+CTable wyhash_keyed {
+    key id hash wyhash
+    varstring name
+    int value indexed 1
+}
+
+CTable open_keyed {
+    key id keyindex open
+    varstring name
+    int value indexed 1
+}
+
+CTable open_wyhash_keyed {
+    key id hash wyhash keyindex open
+    varstring name
+    int value indexed 1
+}
+
+CTable incremental_keyed {
+    key id keyindex incremental
+    varstring name
+    int value indexed 1
+}
+
+CTable inline_keyed {
+    key id inline 16
+    varstring name
+    int value indexed 1
+}
+
+CTable open_inline_keyed {
+    key id keyindex open inline 40
+    varstring name
+    int value indexed 1
+}
+
+CTable int_keyed {
+    key id keytype int
+    int value
+}
+
+CTable wide_keyed {
+    key id keytype wide keyindex open
+    int value
+}
+
+}
+
+package require Keyhash
+
+proc rowkey {i} {
+    # long common prefixes are the case the seeded hash is meant for
+    return [format "UAL1234-1700000000-schedule-%06d" $i]
+}
+
+proc check_table {t nRows} {
+    for {set i 0} {$i < $nRows} {incr i} {
+	$t set [rowkey $i] name "row $i" value $i
+    }
+
+    if {[$t count] != $nRows} {
+	error "$t: expected $nRows rows, got [$t count]"
+    }
+
+    if {[llength [$t names]] != $nRows} {
+	error "$t: expected $nRows names, got [llength [$t names]]"
+    }
+
+    for {set i 0} {$i < $nRows} {incr i 997} {
+	set key [rowkey $i]
+	if {![$t exists $key]} {
+	    error "$t: key '$key' not found"
+	}
+	if {"[$t get $key value]" != "$i"} {
+	    error "$t: key '$key' should have value $i, got '[$t get $key value]'"
+	}
+    }
+
+    if {[$t exists "UAL1234-1700000000-schedule-"]} {
+	error "$t: prefix of a key should not be found"
+    }
+
+    set key [rowkey 42]
+    $t search -compare [list [list in id [list $key]]] -key k -code {
+	set found $k
+    }
+    if {![info exists found] || $found != $key} {
+	error "$t: hash search for '$key' failed"
+    }
+
+    # delete every other row, then put half of them back
+    for {set i 0} {$i < $nRows} {incr i 2} {
+	$t delete [rowkey $i]
+    }
+    if {[$t count] != $nRows / 2} {
+	error "$t: expected [expr {$nRows / 2}] rows after deletes, got [$t count]"
+    }
+    for {set i 0} {$i < $nRows} {incr i 4} {
+	$t set [rowkey $i] name "back $i" value $i
+    }
+    for {set i 0} {$i < $nRows} {incr i} {
+	set shouldExist [expr {$i % 2 == 1 || $i % 4 == 0}]
+	if {[$t exists [rowkey $i]] != $shouldExist} {
+	    error "$t: key '[rowkey $i]' exists should be $shouldExist"
+	}
+    }
+    set n 0
+    $t foreach k {
+	incr n
+    }
+    if {$n != [$t count]} {
+	error "$t: foreach visited $n rows, table has [$t count]"
+    }
+
+    # renaming a row moves it in the key table
+    $t set [rowkey 1] id renamed
+    if {[$t exists [rowkey 1]] || ![$t exists renamed]} {
+	error "$t: renaming key '[rowkey 1]' failed"
+    }
+
+    # short keys take a different path through the hash
+    $t reset
+    foreach key {a ab abc abcd abcdefgh abcdefghijklmnop abcdefghijklmnopq} {
+	$t set $key value [string length $key]
+    }
+    foreach key {a ab abc abcd abcdefgh abcdefghijklmnop abcdefghijklmnopq} {
+	if {"[$t get $key value]" != "[string length $key]"} {
+	    error "$t: short key '$key' lookup failed"
+	}
+    }
+    if {[$t count] != 7} {
+	error "$t: expected 7 rows after reset, got [$t count]"
+    }
+}
+
+foreach table {wyhash_keyed open_keyed open_wyhash_keyed incremental_keyed inline_keyed open_inline_keyed} {
+    $table create t
+    check_table t 20000
+    t destroy
+}
+
+# growing past 12288 rows moves an incremental table from 4096 to 65536
+# buckets, migrating a few buckets on every access
+incremental_keyed create t
+for {set i 0} {$i < 12300} {incr i} {
+    t set [rowkey $i] value $i
+}
+if {![string match "*incremental rehash in progress*" [t statistics]]} {
+    error "incremental_keyed: statistics should report a rehash in progress"
+}
+for {set i 0} {$i < 12300} {incr i} {
+    if {"[t get [rowkey $i] value]" != "$i"} {
+	error "incremental_keyed: key '[rowkey $i]' lookup failed during rehash"
+    }
+}
+if {[string match "*incremental rehash in progress*" [t statistics]]} {
+    error "incremental_keyed: rehash should have finished"
+}
+if {![string match "12300 entries in table, 65536 buckets*" [t statistics]]} {
+    error "incremental_keyed: unexpected statistics [t statistics]"
+}
+t destroy
+
+# read_tabsep -expected sizes the key table for the rows up front
+set fp [open tmp_key_hash.tsv w]
+for {set i 0} {$i < 12300} {incr i} {
+    puts $fp "[rowkey $i]\trow $i\t$i"
+}
+close $fp
+foreach {table stats} {
+    wyhash_keyed "12300 entries in table, 65536 buckets*"
+    incremental_keyed "12300 entries in table, 65536 buckets*"
+    open_keyed "12300 entries in table, 16384 slots*"
+} {
+    $table create t
+    t index create value
+    set fp [open tmp_key_hash.tsv r]
+    t read_tabsep $fp -expected 12300 -bulk
+    close $fp
+    if {![string match $stats [t statistics]] || [string match "*rehash in progress*" [t statistics]]} {
+	error "$table: unexpected statistics after presized load [t statistics]"
+    }
+    if {[t index count value] != 12300 || "[t get [rowkey 4321] value]" != "4321"} {
+	error "$table: presized load lost rows"
+    }
+    t destroy
+}
+
+# statistics -dict gives the same numbers as a list, plus counters
+foreach {table histogram} {
+    wyhash_keyed chain_histogram
+    incremental_keyed chain_histogram
+    open_keyed probe_histogram
+} {
+    $table create t
+    for {set i 0} {$i < 12300} {incr i} {
+	t set [rowkey $i] value $i
+    }
+    for {set i 0} {$i < 12300} {incr i} {
+	t exists [rowkey $i]
+    }
+    set stats [t statistics -dict]
+    if {[dict get $stats entries] != 12300 || [dict get $stats rebuilds] < 1} {
+	error "$table: unexpected statistics -dict $stats"
+    }
+    set total 0
+    foreach n [dict get $stats $histogram] {
+	incr total $n
+    }
+    if {$histogram == "probe_histogram"} {
+	set want 12300
+    } else {
+	set want [expr {[dict get $stats buckets] + [dict get $stats rehash_remaining]}]
+    }
+    if {$total != $want} {
+	error "$table: $histogram adds up to $total, expected $want"
+    }
+    if {[dict get $stats lookups] < 24600 || [dict get $stats sampled_lookups] < 24600 / 64 || [dict get $stats average_probes] < 1} {
+	error "$table: lookups weren't sampled: $stats"
+    }
+    t destroy
+}
+wyhash_keyed create t
+if {![catch {t statistics -bogus}]} {
+    error "statistics should reject unknown options"
+}
+t destroy
+
+# integer keys are compared and sorted by value, and are kept in the row,
+# the longest of them, the most negative, included
+foreach {table big min} {
+    int_keyed 2147483647 -2147483648
+    wide_keyed 9223372036854775807 -9223372036854775808
+} {
+    $table create t
+    foreach key [list 0 7 10 -3 -20 100 $big -$big $min] {
+	t set $key value 1
+    }
+    if {[t count] != 9} {
+	error "$table: expected 9 rows, got [t count]"
+    }
+    if {![t exists $big] || ![t exists -$big] || ![t exists $min] || [t exists 8]} {
+	error "$table: integer key lookup failed"
+    }
+    if {[t get $min id value] != [list $min 1]} {
+	error "$table: row $min read back as [t get $min id value]"
+    }
+
+    set keys {}
+    t search -sort id -key k -code {
+	lappend keys $k
+    }
+    if {$keys != [list $min -$big -20 -3 0 7 10 100 $big]} {
+	error "$table: keys sorted as $keys"
+    }
+
+    set keys {}
+    t search -compare {{range id -5 50}} -sort id -key k -code {
+	lappend keys $k
+    }
+    if {$keys != {-3 0 7 10}} {
+	error "$table: range search found $keys"
+    }
+
+    # only the canonical form of a number is a key
+    foreach bad [list abc 007 +7 -0 " 7" 1.5 "" 1$big] {
+	if {![catch {t set $bad value 1} err]} {
+	    error "$table: key '$bad' should have been rejected"
+	}
+	if {![string match "expected integer key*" $err]} {
+	    error "$table: unexpected error for key '$bad': $err"
+	}
+	if {[t exists $bad]} {
+	    error "$table: key '$bad' should not exist"
+	}
+    }
+
+    t set 7 id 8
+    if {[t exists 7] || ![t exists 8]} {
+	error "$table: renaming key 7 to 8 failed"
+    }
+    t delete $min
+    t set 8 id $min
+    t set $min id 8
+    if {[t exists $min] || [t get 8 id] != 8} {
+	error "$table: renaming key 8 through $min failed"
+    }
+    if {![catch {t set 8 id 08}]} {
+	error "$table: renaming key to 08 should have failed"
+    }
+
+    for {set i 0} {$i < 20000} {incr i} {
+	t set [expr {$i * 100003}] value $i
+    }
+    for {set i 0} {$i < 20000} {incr i 97} {
+	if {"[t get [expr {$i * 100003}] value]" != "$i"} {
+	    error "$table: lookup of [expr {$i * 100003}] failed"
+	}
+    }
+    t destroy
+}
+
+# an unknown hash function is caught when the table is defined
+if {![catch {
+    CExtension keyhashbad 1.0 {
+	CTable badhash {
+	    key id hash nosuchhash
+	    int value
+	}
+    }
+}]} {
+    error "defining a key with an unknown hash should have failed"
+}
+
+if {![string match "unknown hash*" $::errorInfo]} {
+    error "unexpected error for unknown hash: $::errorInfo"
+}
+
+puts "key hash tests passed"
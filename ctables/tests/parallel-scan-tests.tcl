@@ -0,0 +1,120 @@
+#
+# make sure a search that compares every row with several threads finds
+# the same rows, in the same order, as one that compares them with one
+#
+# $Id$
+#
+
+source test_common.tcl
+
+source search-test-proc.tcl
+
+package require ctable
+
+CExtension parallelscan 1.0 {
+
+CTable scanned {
+    int a
+    int n
+    double d
+    varstring s
+    fixedstring f 3
+    inet ip
+}
+
+}
+
+package require Parallelscan
+
+scanned create t
+
+# enough rows to be worth threads, in several runs and a last one that's short
+for {set i 0} {$i < 70000} {incr i} {
+    t set k$i a [expr {$i % 1000}] n $i d [expr {sin($i)}] s str[expr {$i % 77}]x f [format %03d [expr {$i % 500}]] ip 10.[expr {$i % 256}].0.1
+}
+
+proc search {threads args} {
+    set keys {}
+    set n [t search {*}$args -threads $threads -key k -code {lappend keys $k}]
+    return [list $n $keys]
+}
+
+# counts
+expect "count of a < 10" [t search -compare {{< a 10}} -countOnly 1 -threads 4] 700
+expect "count of s matching *7x" [t search -compare {{match s *7x}} -countOnly 1 -threads 4] [expr {909 * 7}]
+set want 0
+for {set i 123} {$i < 70000} {incr i 500} {
+    if {$i % 256 == 3} {
+	incr want
+    }
+}
+expect "count of f = 123 and ip 10.3.0.1" [t search -compare {{= f 123} {= ip 10.3.0.1}} -countOnly 1 -threads 4] $want
+expect "count of nothing" [t search -compare {{= a -1}} -countOnly 1 -threads 4] 0
+expect "count of everything" [t search -countOnly 1 -threads 4] 70000
+
+# sorted, with an offset and a limit
+expect "a = 7 sorted down by n" [search 4 -compare {{= a 7}} -sort -n -offset 2 -limit 3] {3 {k67007 k66007 k65007}}
+expect "range a sorted by n" [search 4 -compare {{range a 100 110}} -sort n -limit 4] {4 {k100 k101 k102 k103}}
+expect "in a sorted by a then n" [search 4 -compare {{in a {999 2 1}}} -sort {-a n} -offset 69 -limit 3] {3 {k69999 k2 k1002}}
+expect "sorted past the end" [search 4 -compare {{= a 7}} -sort n -offset 70] {0 {}}
+
+# what one thread finds, in the order it finds it
+foreach {compare opts} {
+    {{!= a 5} {< d -0.9}} {}
+    {{notmatch s str1*}} {-glob k1*}
+    {{= a 7}} {-offset 65}
+    {{> d 0.5}} {-sort d -offset 1000 -limit 20}
+} {
+    expect "search -compare $compare $opts" [search 4 -compare $compare {*}$opts] [search 1 -compare $compare {*}$opts]
+}
+
+# the rows that are written out are in the same order
+set fp [open tmp_parallel1.tsv w]
+t search -compare {{> d 0}} -write_tabsep $fp -threads 1
+close $fp
+set fp [open tmp_parallel4.tsv w]
+t search -compare {{> d 0}} -write_tabsep $fp -threads 4
+close $fp
+set fp [open tmp_parallel1.tsv]
+set want [read $fp]
+close $fp
+set fp [open tmp_parallel4.tsv]
+set got [read $fp]
+close $fp
+file delete tmp_parallel1.tsv tmp_parallel4.tsv
+expect "written rows" $got $want
+
+# break and error still work from the main thread
+set got {}
+set n [t search -compare {{< a 500}} -sort d -threads 4 -key k -code {
+    lappend got $k
+    if {[llength $got] == 3} break
+}]
+expect "break out of a parallel scan" [list $n $got] [list 3 [lrange [lindex [search 1 -compare {{< a 500}} -sort d] 1] 0 2]]
+
+if {![catch {t search -compare {{< a 500}} -sort d -threads 4 -key k -code {error oops}} result]} {
+    error "error from -code in a parallel scan wasn't passed on"
+}
+expect "error from -code in a parallel scan" $result oops
+
+# -delete takes the rows found by all the threads
+set want [t search -compare {{< a 20}} -countOnly 1]
+t search -compare {{< a 20}} -sort a -threads 4 -delete 1 -key k -code {}
+expect "rows left after -delete" [t count] [expr {70000 - $want}]
+expect "deleted rows" [t search -compare {{< a 20}} -countOnly 1 -threads 4] 0
+
+foreach {cmd err} {
+    {t search -threads -1 -countOnly 1} {threads must be zero or more}
+    {t search -threads x -countOnly 1} {expected integer but got "x"*}
+} {
+    if {![catch $cmd result]} {
+	error "$cmd should have failed"
+    }
+    if {![string match $err $result]} {
+	error "unexpected error from $cmd: $result"
+    }
+}
+
+t destroy
+
+puts "parallel scan tests passed"
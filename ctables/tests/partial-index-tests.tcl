@@ -0,0 +1,317 @@
+#
+# make sure partial indexes only have the rows matching their where, that
+# rows move in and out of them as they change, and that searches use them
+# only when they can't miss a row
+#
+# $Id$
+#
+
+source test_common.tcl
+
+source search-test-proc.tcl
+
+package require ctable
+
+CExtension partialindex 1.0 {
+
+CTable flights {
+    varstring status
+    int eta
+    int alt
+    boolean active
+    fixedstring origin 4 default KXXX
+    compositeindex active_eta {eta} where {{!= status landed}}
+    compositeindex climbing {alt eta} where {{in status {departed enroute}} {< alt 30000}} indextype btree
+    compositeindex live_origin {origin eta} where {{true active}}
+}
+
+}
+
+package require Partialindex
+
+if {![catch {CTable bad_partial {varstring s
+    int e
+    compositeindex p {e} where {{!= nosuchfield x}}}} err]} {
+    error "a where on a field that doesn't exist should have been rejected"
+}
+if {![string match "*refers to field \"nosuchfield\"*" $err]} {
+    error "unexpected error for a where on a missing field: $err"
+}
+if {![catch {CTable bad_partial {varstring s
+    int e
+    compositeindex p {e} where {{~ s x}}}} err]} {
+    error "a where with an unknown term should have been rejected"
+}
+if {![string match "unknown term*" $err]} {
+    error "unexpected error for a where with an unknown term: $err"
+}
+if {![catch {CTable bad_partial {varstring s
+    int e
+    compositeindex p {e} where {s}}} err]} {
+    error "a where with just a field should have been rejected"
+}
+if {![string match "*must be a term, a field and any values" $err]} {
+    error "unexpected error for a where with just a field: $err"
+}
+if {![catch {CTable bad_partial {varstring s
+    int e
+    compositeindex p {e} where {}}} err]} {
+    error "an empty where should have been rejected"
+}
+if {![string match "empty where*" $err]} {
+    error "unexpected error for an empty where: $err"
+}
+if {![catch {CTable bad_partial {varstring s
+    tclobj t
+    int e
+    compositeindex p {e} where {{notnull t}}}} err]} {
+    error "a where on a tclobj should have been rejected"
+}
+if {![string match "*can't refer to tclobj*" $err]} {
+    error "unexpected error for a where on a tclobj: $err"
+}
+if {![catch {CTable bad_partial {varstring s
+    int e
+    compositeindex p {e} where {{!= s x}} bogus 1}} err]} {
+    error "a partial index with an unknown option should have been rejected"
+}
+if {![string match "unknown option*" $err]} {
+    error "unexpected error for a partial index with an unknown option: $err"
+}
+
+proc row {i} {
+    return [list status [lindex {landed scheduled departed enroute} [expr {$i % 4}]] eta [expr {$i % 1000}] alt [expr {$i % 40 * 1000}] active [expr {$i % 5 == 0}] origin [lindex {KSFO KJFK KORD} [expr {$i % 3}]]]
+}
+
+set indexes {active_eta climbing live_origin}
+
+flights create c
+create_indexes c $indexes
+
+# every combination comes round every 600 rows. a quarter of the rows have
+# each status, i % 40 picks the altitude, so 14 in 40 are climbing, and
+# every fifth row is active
+for {set i 0} {$i < 3000} {incr i} {
+    c set $i {*}[row $i]
+}
+
+# the rows in each index are the ones matching its where
+check_index_counts c "after load" $indexes {2250 1050 600}
+check_counts c "after load" {
+    {{!= status landed}} 2250
+    {{!= status landed} {< eta 100}} 225
+    {{!= status landed} {range eta 200 400}} 450
+    {{= status enroute} {>= eta 900}} 75
+    {{in status {scheduled departed}} {> eta 500}} 750
+    {{= status landed} {< eta 100}} 75
+    {{< eta 100}} 300
+    {{= status departed} {< alt 10000}} 150
+    {{in status {departed enroute}} {<= alt 29000}} 1050
+    {{in status {departed enroute}} {< alt 35000}} 1275
+    {{true active} {= origin KSFO}} 200
+    {{true active}} 600
+    {{false active} {= origin KSFO}} 800
+    {{= origin KXXX}} 0
+}
+
+# a search that can only match rows in the index walks it, one that could
+# match rows left out doesn't
+foreach compare {
+    {{= status enroute} {>= eta 900}}
+    {{!= status landed} {< eta 100}}
+} {
+    if {![uses_index c active_eta $compare]} {
+	error "search -compare [list $compare] didn't use the active_eta index"
+    }
+}
+foreach compare {
+    {{< eta 100}}
+    {{!= status scheduled}}
+    {{in status {scheduled landed}}}
+} {
+    if {[uses_index c active_eta $compare]} {
+	error "search -compare [list $compare] used the active_eta index"
+    }
+}
+if {![uses_index c climbing {{in status {departed enroute}} {<= alt 29000}}]} {
+    error "alt up to 29000 didn't use the climbing index"
+}
+if {[uses_index c climbing {{in status {departed enroute}} {< alt 35000}}]} {
+    error "alt below 35000 used the climbing index"
+}
+if {![uses_index c live_origin {{true active} {= origin KSFO}}]} {
+    error "active from KSFO didn't use the live_origin index"
+}
+
+# the landed rows of eta 0 aren't in the index to be found
+if {[search_values c eta -compare {{!= status landed}} -sort eta -limit 4] != {1 1 1 2}} {
+    error "after load: not landed sorted by eta got [search_values c eta -compare {{!= status landed}} -sort eta -limit 4]"
+}
+if {[search_values c alt -compare {{in status {departed enroute}} {<= alt 29000}} -sort -alt -limit 1] != {27000}} {
+    error "after load: highest climbing alt [search_values c alt -compare {{in status {departed enroute}} {<= alt 29000}} -sort -alt -limit 1]"
+}
+
+# rows move in and out as the fields in the where change: scheduled rows
+# landing leave active_eta, enroute rows dropping below 30000 join climbing
+# and departed rows going above it leave, and rows made active join
+# live_origin
+c search -compare {{= status scheduled} {< eta 100}} -key k -code {lappend landing $k}
+foreach k $landing {
+    c set $k status landed
+}
+c search -compare {{= alt 35000}} -key k -code {lappend descending $k}
+foreach k $descending {
+    c incr $k alt -30000
+}
+check_index_counts c "after descending" $indexes {2175 1125 600}
+c search -compare {{= alt 2000}} -key k -code {lappend ascending $k}
+foreach k $ascending {
+    c set $k alt 35000
+}
+for {set i 6} {$i < 3000} {incr i 15} {
+    c set $i active 1
+}
+check_index_counts c "after update" $indexes {2175 1050 800}
+check_counts c "after update" {
+    {{!= status landed} {< eta 100}} 150
+    {{= status departed} {< alt 10000}} 75
+    {{in status {departed enroute}} {<= alt 29000}} 1050
+    {{in status {departed enroute}} {< alt 35000}} 1275
+    {{true active} {= origin KSFO}} 400
+}
+if {[search_values c eta -compare {{!= status landed}} -sort eta -limit 4] != {2 2 2 3}} {
+    error "after update: not landed sorted by eta got [search_values c eta -compare {{!= status landed}} -sort eta -limit 4]"
+}
+if {[search_values c alt -compare {{in status {departed enroute}} {<= alt 29000}} -sort alt -limit 1] != {3000}} {
+    error "after update: lowest climbing alt [search_values c alt -compare {{in status {departed enroute}} {<= alt 29000}} -sort alt -limit 1]"
+}
+
+# a null alt is never below 30000 and a null active never true, but a
+# null eta leaves the row in the index
+c search -compare {{= alt 3000}} -key k -code {lappend nullalt $k}
+foreach k $nullalt {
+    c null $k alt
+}
+for {set i 0} {$i < 3000} {incr i 15} {
+    c null $i active
+}
+foreach i {999 1999 2999} {
+    c null $i eta
+}
+check_index_counts c "after setting nulls" $indexes {2175 975 600}
+check_counts c "after setting nulls" {
+    {{null alt}} 75
+    {{null active}} 200
+    {{!= status landed} {null eta}} 3
+}
+foreach k $nullalt {
+    c set $k alt 3000
+}
+for {set i 0} {$i < 3000} {incr i 15} {
+    c set $i active 1
+}
+foreach i {999 1999 2999} {
+    c set $i eta 999
+}
+check_index_counts c "after unsetting nulls" $indexes {2175 1050 800}
+
+# deleting the even rows leaves the scheduled and enroute ones
+for {set i 0} {$i < 3000} {incr i 2} {
+    c delete $i
+}
+check_index_counts c "after delete" $indexes {1425 600 400}
+check_counts c "after delete" {
+    {{!= status landed}} 1425
+    {{= status landed}} 75
+    {{true active}} 400
+}
+
+c search -compare {{= status scheduled}} -update {status landed}
+check_index_counts c "after search -update" $indexes {750 600 400}
+check_counts c "after search -update" {
+    {{= status landed}} 750
+    {{= status scheduled}} 0
+}
+
+c search -compare {{= status enroute} {< eta 300}} -delete 1
+if {[c count] != 1275} {
+    error "after search -delete: [c count] rows"
+}
+check_index_counts c "after search -delete" $indexes {525 417 340}
+
+# new rows only setting some of the fields, the rest come from defaults
+for {set i 3000} {$i < 3100} {incr i} {
+    c set $i status departed alt 1000
+}
+for {set i 3100} {$i < 3110} {incr i} {
+    c set $i status landed active 1
+}
+check_index_counts c "after partial rows" $indexes {625 517 350}
+check_counts c "after partial rows" {
+    {{= origin KXXX}} 110
+    {{true active} {= origin KXXX}} 10
+    {{!= status landed} {null eta}} 100
+}
+
+# a bulk load builds each index from just the rows in it
+set fp [open tmp_partial.tsv w]
+for {set i 0} {$i < 3000} {incr i} {
+    array set r [row $i]
+    puts $fp "$i\t$r(status)\t$r(eta)\t$r(alt)\t$r(active)\t$r(origin)"
+}
+close $fp
+c reset
+create_indexes c $indexes
+set fp [open tmp_partial.tsv r]
+c read_tabsep $fp -bulk
+close $fp
+file delete tmp_partial.tsv
+
+check_index_counts c "after bulk load" $indexes {2250 1050 600}
+check_counts c "after bulk load" {
+    {{!= status landed} {< eta 100}} 225
+    {{true active} {= origin KSFO}} 200
+}
+if {[search_values c eta -compare {{!= status landed}} -sort eta -limit 4] != {1 1 1 2}} {
+    error "after bulk load: not landed sorted by eta got [search_values c eta -compare {{!= status landed}} -sort eta -limit 4]"
+}
+
+for {set i 0} {$i < 3000} {incr i 7} {
+    c set $i status landed
+}
+if {[c index count active_eta] != 1929 || [count c {{= status landed}}] != 1071} {
+    error "after updating a bulk load: active_eta index count [c index count active_eta]"
+}
+
+c index drop active_eta
+c index create active_eta
+if {[c index count active_eta] != 1929 || [count c {{!= status landed}}] != 1929} {
+    error "after recreating an index: active_eta index count [c index count active_eta]"
+}
+
+c destroy
+
+# a where that can't be parsed stops the index being made
+CExtension partialbad 1.0 {
+
+CTable partial_bad {
+    int n
+    int m
+    compositeindex bad_m {m} where {{> n notanumber}}
+}
+
+}
+
+package require Partialbad
+
+partial_bad create p
+p set 1 n 1 m 1
+if {![catch {p index create bad_m} err]} {
+    error "index with a bad where was created"
+}
+if {![string match "*while parsing where of index \"bad_m\"" $err]} {
+    error "unexpected error for a bad where: $err"
+}
+p destroy
+
+puts "partial index tests passed"
@@ -0,0 +1,284 @@
+#
+# make sure the row estimates the search planner works from are what the
+# indexes say they should be, that they keep up as rows come and go, that
+# a walk covering most of the table loses to looking at every row, and
+# that the cheapest walk is picked and finds the right rows
+#
+# $Id$
+#
+
+source test_common.tcl
+
+source search-test-proc.tcl
+
+package require ctable
+
+CExtension plannerstats 1.0 {
+
+CTable planned {
+    int a indexed 1
+    int b indexed 1 indextype btree
+    int c indexed 1 indextype hash
+    varstring s indexed 1
+    int d
+    compositeindex cd {c d}
+}
+
+}
+
+package require Plannerstats
+
+proc row {i} {
+    return [list a $i b [expr {$i % 1000}] c [expr {$i % 100}] s x[expr {$i % 50}] d [expr {$i % 7}]]
+}
+
+set indexes {a b c s cd}
+
+# the indexes the search walked
+proc walked {compare} {
+    foreach index $::indexes {
+	set before($index) [t index searches $index]
+    }
+    count t $compare
+    set walked {}
+    foreach index $::indexes {
+	if {[t index searches $index] != $before($index)} {
+	    lappend walked $index
+	}
+    }
+    return $walked
+}
+
+planned create t
+for {set i 0} {$i < 10000} {incr i} {
+    t set $i {*}[row $i]
+}
+create_indexes t $indexes
+
+# a skip list counts the rows in a range exactly, and knows its distinct
+# values for "in"
+set got [t index estimate {
+    {< a 100} {<= a 100} {range a 10 20} {= a 5} {= a -1} {>= a 9990}
+    {> a 9990} {in a {1 2 3}} {= s x7} {in s {x1 x2 x3}} {< s x2}
+}]
+if {$got != {100 101 10 1 0 10 9 3 200 600 2400}} {
+    error "skip list estimates: got '$got'"
+}
+
+# a hash index only knows its distinct values, anything else is guessed
+set got [t index estimate {{= c 7} {in c {1 2}} {< c 5}}]
+if {$got != {100 200 3300}} {
+    error "hash index estimates: got '$got'"
+}
+
+# no index is all guesswork
+set got [t index estimate {{= d 1} {< d 3} {in d {1 2}} {notnull d}}]
+if {$got != {1000 3300 2000 9000}} {
+    error "unindexed estimates: got '$got'"
+}
+
+# a B+tree guesses ranges from the shape of the tree, "=" from its
+# distinct values
+if {[t index estimate {{= b 5}}] != 10} {
+    error "B+tree equality estimate: got [t index estimate {{= b 5}}]"
+}
+lassign [t index estimate {{< b 500} {>= b 250} {range b 100 900} {> b 999} {<= b 999}}] lt ge range gt le
+if {abs($lt - 5000) > 300 || abs($ge - 7500) > 300 || abs($range - 8000) > 300} {
+    error "B+tree range estimates: got $lt, $ge and $range, expected about 5000, 7500 and 8000"
+}
+if {abs($gt) > 300 || abs($le - 10000) > 300} {
+    error "B+tree estimates at the ends: got $gt and $le, expected about 0 and 10000"
+}
+
+# the distinct values keep up with deletes and updates
+for {set i 0} {$i < 10000} {incr i} {
+    if {$i % 100 == 0 || $i % 1000 < 100 || $i % 50 == 1} {
+	t delete $i
+    }
+}
+set got [t index estimate {{= c 7} {in c {1 2}} {= b 500} {in s {x2 x3}} {= s x1}}]
+if {$got != {90 180 10 356 0}} {
+    error "estimates after deletes: got '$got'"
+}
+
+for {set i 0} {$i < 10000} {incr i 2} {
+    if {[t exists $i]} {
+	t set $i s y
+    }
+}
+set got [t index estimate {{= s y} {in s {y}} {= s x3}}]
+if {$got != {4410 349 180}} {
+    error "estimates after updates: got '$got'"
+}
+
+# c 7 below 1000 lost row 7, c 4 above 100 lost x004 of each thousand
+if {[count t {{= c 7} {< a 1000}}] != 9 || [walked {{= c 7} {< a 1000}}] != {c}} {
+    error "after updates: c 7 below 1000 found [count t {{= c 7} {< a 1000}}] rows walking [walked {{= c 7} {< a 1000}}]"
+}
+if {[count t {{= s y} {= c 4} {> a 100}}] != 90 || [walked {{= s y} {= c 4} {> a 100}}] != {c}} {
+    error "after updates: s y c 4 found [count t {{= s y} {= c 4} {> a 100}}] rows walking [walked {{= s y} {= c 4} {> a 100}}]"
+}
+
+# a bulk load builds the indexes in one pass, the counts have to be right
+set fp [open tmp_planner.tsv w]
+for {set i 0} {$i < 10000} {incr i} {
+    array set r [row $i]
+    puts $fp "$i\t$r(a)\t$r(b)\t$r(c)\t$r(s)\t$r(d)"
+}
+close $fp
+t reset
+create_indexes t $indexes
+set fp [open tmp_planner.tsv r]
+t read_tabsep $fp -bulk
+close $fp
+file delete tmp_planner.tsv
+
+set got [t index estimate {{in a {1 2 3}} {= b 5} {in c {1 2}} {in s {x1 x2 x3}}}]
+if {$got != {3 10 200 600}} {
+    error "estimates after a bulk load: got '$got'"
+}
+
+# the walk with the fewest rows wins, whichever comparison comes first
+if {[count t {{range a 0 9000} {< b 10}}] != 90 || [walked {{range a 0 9000} {< b 10}}] != {b}} {
+    error "a 0 to 9000 b below 10 found [count t {{range a 0 9000} {< b 10}}] rows walking [walked {{range a 0 9000} {< b 10}}]"
+}
+if {[count t {{< a 100} {range b 0 900}}] != 100 || [walked {{< a 100} {range b 0 900}}] != {a}} {
+    error "a below 100 b 0 to 900 found [count t {{< a 100} {range b 0 900}}] rows walking [walked {{< a 100} {range b 0 900}}]"
+}
+if {[count t {{> a -1} {= c 7}}] != 100 || [walked {{> a -1} {= c 7}}] != {c}} {
+    error "a above -1 c 7 found [count t {{> a -1} {= c 7}}] rows walking [walked {{> a -1} {= c 7}}]"
+}
+if {[count t {{in a {5 6 7 500 9999}} {> b 0}}] != 5 || [walked {{in a {5 6 7 500 9999}} {> b 0}}] != {a}} {
+    error "a in a list b above 0 found [count t {{in a {5 6 7 500 9999}} {> b 0}}] rows walking [walked {{in a {5 6 7 500 9999}} {> b 0}}]"
+}
+if {[count t {{range a 100 200} {= s x3}}] != 2 || [walked {{range a 100 200} {= s x3}}] != {a}} {
+    error "a 100 to 200 s x3 found [count t {{range a 100 200} {= s x3}}] rows walking [walked {{range a 100 200} {= s x3}}]"
+}
+
+# c 5 is every hundredth row, of which d 3 is every seventh, and the
+# composite on both finds them
+if {[count t {{= c 5} {= d 3}}] != 14 || [walked {{= c 5} {= d 3}}] != {cd}} {
+    error "c 5 d 3 found [count t {{= c 5} {= d 3}}] rows walking [walked {{= c 5} {= d 3}}]"
+}
+if {[count t {{= c 5} {< d 3} {> a 5000}}] != 22 || [walked {{= c 5} {< d 3} {> a 5000}}] != {cd}} {
+    error "c 5 d below 3 a above 5000 found [count t {{= c 5} {< d 3} {> a 5000}}] rows walking [walked {{= c 5} {< d 3} {> a 5000}}]"
+}
+
+# walking in the order of the sort, or sorting what another walk found
+if {[search_keys t -compare {{range a 0 9000} {< b 10}} -sort a -limit 3] != {0 1 2}} {
+    error "a 0 to 9000 b below 10 sorted by a got [search_keys t -compare {{range a 0 9000} {< b 10}} -sort a -limit 3]"
+}
+if {[search_keys t -compare {{range a 0 9000} {< b 10}} -sort {b a} -offset 10 -limit 3] != {1001 2001 3001}} {
+    error "a 0 to 9000 b below 10 sorted by b a got [search_keys t -compare {{range a 0 9000} {< b 10}} -sort {b a} -offset 10 -limit 3]"
+}
+if {[search_keys t -compare {{= c 5} {= d 3}} -sort -a -limit 2] != {9705 9005}} {
+    error "c 5 d 3 sorted down by a got [search_keys t -compare {{= c 5} {= d 3}} -sort -a -limit 2]"
+}
+if {[search_keys t -compare {{< a 100} {range b 0 900}} -sort {s -a} -limit 3] != {50 0 51}} {
+    error "a below 100 sorted by s and down by a got [search_keys t -compare {{< a 100} {range b 0 900}} -sort {s -a} -limit 3]"
+}
+if {[search_keys t -compare {{> a -1} {= c 7}} -sort {c a} -offset 3 -limit 2] != {307 407}} {
+    error "c 7 sorted by c a got [search_keys t -compare {{> a -1} {= c 7}} -sort {c a} -offset 3 -limit 2]"
+}
+if {[count t {{range a 0 9000} {< b 10}} -offset 85 -limit 10] != 5} {
+    error "a 0 to 9000 b below 10 -offset 85 -limit 10 counted [count t {{range a 0 9000} {< b 10}} -offset 85 -limit 10] rows"
+}
+
+# a search whose index would walk nearly every row looks at the rows
+# directly instead, which the index advisor can see for the unindexed
+# comparison that comes with it
+t index advise start 1 1
+if {[count t {{> a 10} {= d 3}}] != 1427 || [t index advise counts] != {{d = 1 10000 1429}}} {
+    error "walk of nearly every row: index advise counts '[t index advise counts]'"
+}
+t index advise reset
+count t {{< a 10} {= d 3}}
+count t {{= c 10} {= d 3}}
+t search -compare {{> a 10} {= d 3}} -sort a -limit 5 -key k -code {}
+if {[t index advise counts] != {}} {
+    error "selective walks: index advise counts '[t index advise counts]'"
+}
+t index advise stop
+
+if {![catch {t index estimate} err]} {
+    error "index estimate without comparisons should have failed"
+}
+if {![string match "wrong # args*" $err]} {
+    error "unexpected error from index estimate without comparisons: $err"
+}
+if {![catch {t index estimate {{= nosuch 1}}} err]} {
+    error "index estimate of a missing field should have failed"
+}
+if {![string match "bad field \"nosuch\"*" $err]} {
+    error "unexpected error from index estimate of a missing field: $err"
+}
+if {![catch {t index estimate {{within a 10.0.0.0/8}}} err]} {
+    error "index estimate of within on an int should have failed"
+}
+if {![string match "*must be an inet or mac type*" $err]} {
+    error "unexpected error from index estimate of within on an int: $err"
+}
+
+t destroy
+
+# two long "in" lists on indexed fields cost more to check on each row one
+# index finds than gathering the rows both indexes find and keeping those
+# in both, and so do they with a comparison neither index can help with
+planned create v
+for {set i 0} {$i < 20000} {incr i} {
+    v set $i a [expr {$i % 400}] b [expr {$i / 50}] d [expr {$i % 7}]
+}
+v index create a
+v index create b
+
+set as {}
+set bs {}
+for {set i 0} {$i < 100} {incr i} {
+    lappend as [expr {$i * 2}]
+    lappend bs $i
+}
+set want {}
+for {set i 0} {$i < 20000} {incr i} {
+    if {$i % 400 < 200 && $i % 2 == 0 && $i / 50 < 100} {
+	lappend want $i
+    }
+}
+
+v search -compare [list [list in a $as] [list in b $bs]] -key k -code {
+    lappend found $k
+}
+if {[v index searches a] != 1 || [v index searches b] != 1} {
+    error "intersection used a [v index searches a] times and b [v index searches b] times, expected once each"
+}
+if {[lsort -integer $found] != $want} {
+    error "intersection found [llength $found] rows, expected [llength $want]"
+}
+
+set n [v search -compare [list [list in b $bs] [list in a $as] {= d 3}] -countOnly 1]
+if {$n != 186} {
+    error "intersection with an unindexed comparison counted $n rows, expected 186"
+}
+if {[v index searches a] != 2 || [v index searches b] != 2} {
+    error "intersection with an unindexed comparison didn't use both indexes"
+}
+
+v search -compare [list [list in a $as] [list in b $bs]] -sort {-b -a} -offset 10 -limit 3 -key k -code {
+    lappend sorted $k
+}
+if {$sorted != [lrange [lsort -integer -decreasing $want] 10 12]} {
+    error "sorted intersection found $sorted"
+}
+
+# with "=" on one of them, one index is walked and the other comparison is
+# checked on the rows it finds
+set n [v search -compare [list {= a 10} [list in b $bs]] -countOnly 1]
+if {$n != 13} {
+    error "walk of one index counted $n rows, expected 13"
+}
+if {[v index searches a] != 4 || [v index searches b] != 3} {
+    error "walk of one index used a [v index searches a] times and b [v index searches b] times"
+}
+
+v destroy
+
+puts "planner tests passed"
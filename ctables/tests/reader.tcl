@@ -112,6 +112,51 @@ foreach id [array names idwant] {
     }
 }
 
+puts "Looking up 10000 keys"
+
+set failed 0
+for {set i 0} {$i < 10000} {incr i} {
+    set k [lindex $names [expr {int(rand() * $num)}]]
+    if {![r exists $k] || [llength [r get $k]] == 0} {
+	incr failed
+    }
+    if {[r search -compare [list [list = _key $k]] -countOnly 1] != 1} {
+	incr failed
+    }
+    if {[r search -compare [list [list in _key [list $k nosuchkey]]] -countOnly 1] != 1} {
+	incr failed
+    }
+}
+if {[r exists nosuchkey]} {
+    incr failed
+}
+
+puts "done, $failed lookups failed"
+
+puts "Looking up keys across a reset"
+
+# the master only adds rows after the reset, so a key the reader still
+# finds that the master doesn't have came from the table before it
+m reset
+set stale 0
+foreach k $names {
+    if {[r exists $k] && ![m exists $k]} {
+	incr stale
+    }
+}
+
+foreach k $names {
+    m set $k $orig($k)
+}
+set missing 0
+foreach k $names {
+    if {![r exists $k] || [r search -compare [list [list = _key $k]] -countOnly 1] != 1} {
+	incr missing
+    }
+}
+
+puts "done, $stale stale and $missing missing after the reset"
+
 puts "shutting down"
 
 m shutdown
@@ -0,0 +1,188 @@
+#
+# make sure the comparisons made by each field's own predicate, rather
+# than by search_compare, find the rows they should, null fields included
+#
+# $Id$
+#
+
+source test_common.tcl
+
+source search-test-proc.tcl
+
+package require ctable
+
+CExtension searchpredicate 1.0 {
+
+CTable compared {
+    int a
+    short h
+    double d
+    float x
+    varstring s
+    fixedstring f 3
+    int n notnull 1
+    boolean b
+}
+
+}
+
+package require Searchpredicate
+
+compared create t
+
+# every few rows leave a field null, they all sort after anything that isn't
+set fields {a h d x s f n b}
+for {set i 0} {$i < 500} {incr i} {
+    set values [list \
+	a [expr {$i % 40 - 20}] h [expr {$i % 13}] d [expr {($i % 17) / 4.0}] \
+	x [expr {($i % 9) / 2.0}] s str[expr {$i % 23}] f [format %03d [expr {$i % 31}]] \
+	n [expr {$i % 11}] b [expr {$i % 3 == 1}]]
+    foreach field {a h d x s f b} skip {3 5 7 4 6 9 8} {
+	if {$i % $skip == 0} {
+	    dict unset values $field
+	}
+    }
+    t set k$i {*}$values
+    set rows(k$i) $values
+}
+
+proc cmp {type a b} {
+    if {$a eq "" && $b eq ""} {
+	return 0
+    }
+    if {$a eq ""} {
+	return 1
+    }
+    if {$b eq ""} {
+	return -1
+    }
+    if {$type eq "string"} {
+	return [string compare $a $b]
+    }
+    return [expr {$a < $b ? -1 : $a > $b ? 1 : 0}]
+}
+
+proc matches {compare} {
+    global rows
+    set keys {}
+    foreach k [array names rows] {
+	set found 1
+	foreach term $compare {
+	    lassign $term op field value value2
+	    set type [expr {$field in {s f _key} ? "string" : "number"}]
+	    if {$field eq "_key"} {
+		set v $k
+	    } elseif {[dict exists $rows($k) $field]} {
+		set v [dict get $rows($k) $field]
+	    } else {
+		set v ""
+	    }
+	    set c [cmp $type $v $value]
+	    switch $op {
+		<  { set ok [expr {$c < 0}] }
+		<= { set ok [expr {$c <= 0}] }
+		=  { set ok [expr {$c == 0}] }
+		!= { set ok [expr {$c != 0}] }
+		>= { set ok [expr {$c >= 0}] }
+		>  { set ok [expr {$c > 0}] }
+		range { set ok [expr {$c >= 0 && [cmp $type $v $value2] < 0}] }
+		null { set ok [expr {$v eq ""}] }
+		notnull { set ok [expr {$v ne ""}] }
+		match { set ok [expr {$v ne "" && [string match $value $v]}] }
+		true { set ok [expr {$v ne "" && $v != 0}] }
+		false { set ok [expr {$v ne "" && $v == 0}] }
+		in {
+		    set ok 0
+		    foreach one $value {
+			if {[cmp $type $v $one] == 0} {
+			    set ok 1
+			}
+		    }
+		}
+	    }
+	    if {!$ok} {
+		set found 0
+		break
+	    }
+	}
+	if {$found} {
+	    lappend keys $k
+	}
+    }
+    return [lsort $keys]
+}
+
+foreach {field values} {
+    a {-20 -1 0 7 19 25}
+    h {0 6 12}
+    d {0 1.25 2.5 4}
+    x {0 1.5 4}
+    s {str0 str15 str9 zzz}
+    f {000 015 030}
+    n {0 5 10}
+    _key {k0 k250 k49 z}
+} {
+    foreach value $values {
+	foreach op {< <= = != >= >} {
+	    set compare [list [list $op $field $value]]
+	    set got {}
+	    t search -compare $compare -key k -code {lappend got $k}
+	    expect "search -compare $compare" [lsort $got] [matches $compare]
+	}
+	foreach value2 $values {
+	    set compare [list [list range $field $value $value2]]
+	    expect "search -compare $compare" [t search -compare $compare -countOnly 1] [llength [matches $compare]]
+	}
+    }
+}
+
+# null, notnull, true, false and in, which the switch in search_compare
+# makes too, true and false only on numbers and booleans
+foreach field {a h d x s f n b} {
+    set ops {null notnull}
+    if {$field in {a h d x n b}} {
+	lappend ops true false
+    }
+    foreach op $ops {
+	set compare [list [list $op $field]]
+	set got {}
+	t search -compare $compare -key k -code {lappend got $k}
+	expect "search -compare $compare" [lsort $got] [matches $compare]
+    }
+}
+foreach {field list} {
+    a {-20 7 7 19 25}
+    h {}
+    d {1.25 4 0}
+    x {1.5}
+    s {str1 str15 nope}
+    f {000 030}
+    n {0 10 3}
+    b {1}
+    _key {k0 k250 z}
+} {
+    set compare [list [list in $field $list]]
+    set got {}
+    t search -compare $compare -key k -code {lappend got $k}
+    expect "search -compare $compare" [lsort $got] [matches $compare]
+}
+
+# several at once, and alongside comparisons only search_compare makes
+foreach compare {
+    {{< a 0} {>= d 1} {!= s str3}}
+    {{range h 2 9} {> x 1} {<= f 020}}
+    {{= n 4} {< _key k3}}
+    {{> a 0} {null d}}
+    {{notnull s} {<= h 3}}
+    {{< n 3} {match s str1*}}
+    {{in a {1 2 3 -5}} {true b} {notnull s}}
+    {{false b} {in s {str2 str4}} {range d 0 3}}
+} {
+    set got {}
+    t search -compare $compare -key k -code {lappend got $k}
+    expect "search -compare $compare" [lsort $got] [matches $compare]
+}
+
+t destroy
+
+puts "search predicate tests passed"
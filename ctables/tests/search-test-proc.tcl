@@ -0,0 +1,64 @@
+# Procs shared by the tests of searches and indexes, each taking the table
+# to search first
+
+# the values of a field in the rows a search finds, in the order found
+proc search_values {table field args} {
+    set values {}
+    $table search {*}$args -get v -fields [list $field] -code {lappend values [lindex $v 0]}
+    return $values
+}
+
+# the keys of the rows a search finds, in the order found
+proc search_keys {table args} {
+    set keys {}
+    $table search {*}$args -key k -code {lappend keys $k}
+    return $keys
+}
+
+# how many rows a search -compare finds
+proc count {table compare args} {
+    return [$table search -compare $compare {*}$args -countOnly 1]
+}
+
+# check the rows a list of search -compare and count pairs find
+proc check_counts {table what counts} {
+    foreach {compare n} $counts {
+	if {[count $table $compare] != $n} {
+	    error "$what: search -compare [list $compare] found [count $table $compare] rows, expected $n"
+	}
+    }
+}
+
+# check the counts of the indexes, given in want or else every row
+proc check_index_counts {table what indexes {want {}}} {
+    set got {}
+    foreach index $indexes {
+	lappend got [$table index count $index]
+    }
+    if {$want == {}} {
+	set want [lrepeat [llength $indexes] [$table count]]
+    }
+    if {$got != $want} {
+	error "$what: index counts of $indexes are $got, expected $want"
+    }
+}
+
+proc create_indexes {table indexes} {
+    foreach index $indexes {
+	$table index create $index
+    }
+}
+
+# did the search -compare walk the index, by its "index searches"
+proc uses_index {table index compare} {
+    set before [$table index searches $index]
+    count $table $compare
+    return [expr {[$table index searches $index] != $before}]
+}
+
+# check a result is the one wanted
+proc expect {what got want} {
+    if {"$got" != "$want"} {
+	error "$what: got '$got', expected '$want'"
+    }
+}
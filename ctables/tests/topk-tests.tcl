@@ -0,0 +1,98 @@
+#
+# make sure a sort with a small limit, which only keeps the rows it will
+# return rather than every match, gets the same rows in the same order as
+# sorting everything
+#
+# $Id$
+#
+
+source test_common.tcl
+
+source search-test-proc.tcl
+
+package require ctable
+
+CExtension topk 1.0 {
+
+CTable ranked {
+    int a indexed 1
+    int b
+    varstring s
+    double d
+}
+
+}
+
+package require Topk
+
+ranked create t
+
+# a is unique, b and s have lots of duplicates, d is in no order at all
+proc load {} {
+    t reset
+    for {set i 0} {$i < 5000} {incr i} {
+	t set k$i a [expr {($i * 7919) % 5000}] b [expr {$i % 37}] s x[expr {$i % 11}] d [expr {sin($i)}]
+    }
+}
+load
+
+# every row, sorted in Tcl, ties broken by a since lsort is stable
+proc sorted {sort compare} {
+    set rows {}
+    t search -compare $compare -array row -key k -code {
+	lappend rows [list $k $row(a) $row(b) $row(s) $row(d)]
+    }
+    set rows [lsort -integer -index 1 $rows]
+    foreach field [lreverse $sort] {
+	set order -increasing
+	if {[string index $field 0] == "-"} {
+	    set order -decreasing
+	    set field [string range $field 1 end]
+	}
+	set column [lsearch {k a b s d} $field]
+	set type [dict get {a -integer b -integer s -ascii d -real} $field]
+	set rows [lsort $type $order -index $column $rows]
+    }
+    set keys {}
+    foreach item $rows {
+	lappend keys [lindex $item 0]
+    }
+    return $keys
+}
+
+foreach sort {a -a {b a} {-b a} {s -a} {s b -a} d -d} {
+    foreach compare {{} {{< b 20}} {{= s x3}} {{> a 4990}}} {
+	set all [sorted $sort $compare]
+	foreach {offset limit} {0 1 0 10 5 10 0 100 990 20 4998 10 0 2000} {
+	    set want [lrange $all $offset [expr {$offset + $limit - 1}]]
+	    set got {}
+	    set n [t search -compare $compare -sort $sort -offset $offset -limit $limit -key k -code {lappend got $k}]
+	    expect "search -compare $compare -sort $sort -offset $offset -limit $limit" $got $want
+	    expect "count from search -compare $compare -sort $sort -offset $offset -limit $limit" $n [llength $want]
+	}
+    }
+}
+
+# a break partway through still counts the rows up to it
+set got {}
+set n [t search -sort -a -limit 10 -key k -code {
+    lappend got $k
+    if {[llength $got] == 4} break
+}]
+expect "search broken out of" [list $n $got] [list 4 [lrange [sorted -a {}] 0 3]]
+
+# and -delete deletes them
+set gone [lrange [sorted {s a} {}] 10 19]
+set got {}
+t search -sort {s a} -offset 10 -limit 10 -key k -code {lappend got $k} -delete 1
+expect "rows handed to -code with -delete" $got $gone
+expect "rows left after -delete" [t count] 4990
+foreach k $gone {
+    if {[t exists $k]} {
+	error "search -delete didn't delete $k"
+    }
+}
+
+t destroy
+
+puts "top rows tests passed"
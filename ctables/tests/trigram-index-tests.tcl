@@ -0,0 +1,245 @@
+#
+# make sure match searches on a field with a trigram index find the rows
+# they should, for patterns the index can narrow and patterns it can't,
+# through updates, nulls, deletes and bulk loads
+#
+# $Id$
+#
+
+source test_common.tcl
+
+source search-test-proc.tcl
+
+package require ctable
+
+CExtension trigramindex 1.0 {
+
+CTable trigram_indexed {
+    varstring name indexed 1 indextype trigram
+    varstring note indexed 1 indextype trigram notnull 1
+    int value
+}
+
+}
+
+package require Trigramindex
+
+if {![catch {CTable bad_trigram {fixedstring code 4 indexed 1 indextype trigram}} err]} {
+    error "a trigram index on a fixedstring should have been rejected"
+}
+if {![string match "*only varstrings can have a trigram index" $err]} {
+    error "unexpected error for a trigram index on a fixedstring: $err"
+}
+if {![catch {CTable bad_trigram {key id indexed 1 indextype trigram}} err]} {
+    error "a trigram index on the key should have been rejected"
+}
+if {![string match "*only varstrings can have a trigram index" $err]} {
+    error "unexpected error for a trigram index on the key: $err"
+}
+if {![catch {CTable bad_trigram {varstring a
+    varstring b
+    compositeindex ab {a b} indextype trigram}} err]} {
+    error "a composite trigram index should have been rejected"
+}
+if {![string match "*can't be a trigram index*" $err]} {
+    error "unexpected error for a composite trigram index: $err"
+}
+
+proc row {i} {
+    return [list name "[lindex {Houston dallas BOSTON Kirkwood Austin} [expr {$i % 5}]] [lindex {Straße München a*b ab xy İhlen Ihlenfeld} [expr {$i % 7}]]" note [lindex {{to houston} {to Dallas} {via boston} {kirk road}} [expr {$i % 4}]] value [expr {$i % 10}]]
+}
+
+set indexes {name note}
+
+trigram_indexed create c
+create_indexes c $indexes
+
+# each name is a city and a word, every pairing comes round every 35 rows,
+# so there are 700 rows of each city and 500 of each word
+for {set i 0} {$i < 3500} {incr i} {
+    c set $i {*}[row $i]
+}
+
+check_index_counts c "after load" $indexes
+check_counts c "after load" {
+    {{match name *ousto*}} 700
+    {{match_case name *ousto*}} 700
+    {{match name *HOUSTON*}} 700
+    {{match_case name *HOUSTON*}} 0
+    {{match name *boston*}} 700
+    {{match_case name *boston*}} 0
+    {{match_case name *BOSTON*}} 700
+    {{match name *dallas*straße*}} 100
+    {{match name *hou?ton*}} 700
+    {{match name *h[oO]uston*}} 700
+    {{match_case name *Kirk*}} 700
+    {{match name *kirk*}} 700
+    {{match name *irk?*}} 700
+    {{match name *ße*}} 500
+    {{match name *ihlen*}} 500
+    {{match name *hlen*}} 1000
+    {{match_case name *Ihlen*}} 500
+    {{match name *straße*}} 500
+    {{match name *münchen*}} 500
+    {{match_case name *München*}} 500
+    {{match name *a\\*b*}} 500
+    {{match name *a?b*}} 500
+    {{match name *ab*}} 500
+    {{match name Hou*}} 700
+    {{match_case name hou*}} 0
+    {{match name *xy}} 500
+    {{match name "*n a\\*b*"}} 300
+    {{match name *nosuchthing*}} 0
+    {{match name *}} 3500
+    {{notmatch name *ousto*}} 2800
+    {{notmatch_case name *Dallas*}} 3500
+    {{match name *ousto*} {< value 5}} 350
+    {{match name *dallas*} {match note *boston*}} 175
+    {{match note *houston*}} 875
+    {{match_case note *Dallas*}} 875
+}
+
+# patterns with three plain characters in a row are narrowed by the index.
+# when case doesn't matter bytes outside ASCII are left out, and so are "i"
+# and "k" in globs since Tcl folds other characters onto them, which can
+# leave nothing to narrow by
+foreach compare {
+    {{match name *ousto*}}
+    {{match_case name *Kirk*}}
+    {{match name *kirk*}}
+    {{match name *münchen*}}
+    {{match name *a\\*b*}}
+} {
+    if {![uses_index c name $compare]} {
+	error "search -compare [list $compare] didn't use the trigram index"
+    }
+}
+foreach compare {
+    {{match name *ab*}}
+    {{match name *h?u*}}
+    {{match name *irk?*}}
+    {{match name *ße*}}
+} {
+    if {[uses_index c name $compare]} {
+	error "search -compare [list $compare] used the trigram index"
+    }
+}
+
+if {[search_values c value -compare {{match name *ousto*}} -sort value -offset 348 -limit 4] != {0 0 5 5}} {
+    error "after load: *ousto* sorted by value got [search_values c value -compare {{match name *ousto*}} -sort value -offset 348 -limit 4]"
+}
+
+# the trigrams of the old value go, those of the new one come
+for {set i 0} {$i < 1000} {incr i 5} {
+    c set $i name "Austin xy"
+}
+for {set i 3} {$i < 400} {incr i 4} {
+    c set $i note "to houston"
+}
+check_index_counts c "after update" $indexes
+check_counts c "after update" {
+    {{match name *ousto*}} 500
+    {{match name *austin*}} 900
+    {{match name *xy}} 672
+    {{match note *houston*}} 975
+    {{match note *kirk*}} 775
+}
+
+for {set i 1} {$i < 500} {incr i 5} {
+    c null $i name
+}
+check_index_counts c "after setting nulls" $indexes
+check_counts c "after setting nulls" {
+    {{null name}} 100
+    {{match name *dallas*}} 600
+    {{match name *}} 3400
+}
+
+# changing what nulls look like mustn't leave them in the index
+trigram_indexed null_value Houston
+for {set i 1} {$i < 500} {incr i 5} {
+    c set $i name "Austin Dallas"
+}
+trigram_indexed null_value ""
+check_counts c "after unsetting nulls" {
+    {{null name}} 0
+    {{match name *ousto*}} 500
+    {{match name *dallas*}} 700
+    {{match name *austin*}} 1000
+}
+
+# deleting the even rows leaves the odd ones, whose numbers go to new rows
+for {set i 0} {$i < 3500} {incr i 2} {
+    c delete $i
+}
+check_index_counts c "after delete" $indexes
+check_counts c "after delete" {
+    {{match name *ousto*}} 250
+    {{match name *dallas*}} 350
+    {{match name *austin*}} 500
+    {{match note *kirk*}} 775
+}
+for {set i 100000} {$i < 101750} {incr i} {
+    c set $i {*}[row $i]
+}
+check_index_counts c "after reusing row numbers" $indexes
+check_counts c "after reusing row numbers" {
+    {{match name *ousto*}} 600
+    {{match name *dallas*}} 700
+    {{match name *austin*}} 850
+}
+
+c search -compare {{match name *dallas*}} -delete 1
+if {[c count] != 2800} {
+    error "after search -delete: [c count] rows"
+}
+check_index_counts c "after search -delete" $indexes
+check_counts c "after search -delete" {
+    {{match name *dallas*}} 0
+    {{match name *austin*}} 800
+    {{match note *kirk*}} 970
+    {{match note *boston*}} 349
+}
+
+c search -compare {{match note *kirk*}} -update {note Boston}
+check_counts c "after search -update" {
+    {{match note *kirk*}} 0
+    {{match note *boston*}} 1319
+    {{match_case note *Boston*}} 970
+}
+
+# a bulk load builds each index in one pass
+set fp [open tmp_trigram.tsv w]
+for {set i 0} {$i < 3500} {incr i} {
+    array set r [row $i]
+    puts $fp "$i\t$r(name)\t$r(note)\t$r(value)"
+}
+close $fp
+c reset
+create_indexes c $indexes
+set fp [open tmp_trigram.tsv r]
+c read_tabsep $fp -bulk
+close $fp
+file delete tmp_trigram.tsv
+
+check_index_counts c "after bulk load" $indexes
+check_counts c "after bulk load" {
+    {{match name *ousto*}} 700
+    {{match name *dallas*straße*}} 100
+    {{match_case name *München*}} 500
+    {{match name *dallas*} {match note *boston*}} 175
+}
+
+c index drop name
+c index create name
+check_counts c "after recreating an index" {
+    {{match name *ousto*}} 700
+    {{match name *a\\*b*}} 500
+}
+if {![uses_index c name {{match name *ousto*}}]} {
+    error "after recreating an index: *ousto* didn't use the trigram index"
+}
+
+c destroy
+
+puts "trigram index tests passed"
@@ -215,5 +215,102 @@ if {$count != 2} {
     error "polling: got count=$count expected 2"
 }
 
+puts "bulk load"
+proc index_results {} {
+    set result {}
+    foreach field {rank name value} {
+	lappend result [t index count $field]
+	set span [lsort -dictionary [list [t get coke $field] [t get ge $field]]]
+	foreach compare [list [list < $field [t get ibm $field]] [concat range $field $span]] {
+	    set keys {}
+	    t search -compare [list $compare] -key k -code {lappend keys $k}
+	    lappend result [lsort $keys]
+	}
+    }
+    return $result
+}
+
+proc index_top_brands {} {
+    t reset
+    t index create rank
+    t index create name
+    t index create value
+}
+
+index_top_brands
+suck_in_top_brands
+set expected [index_results]
+
+index_top_brands
+suck_in_top_brands -bulk -expected 1000
+if {[t count] != 100} {
+    error "bulk load: expected count of 100 but got [t count]"
+}
+if {[t index indexed] != {rank name value}} {
+    error "bulk load: got indexes [list [t index indexed]] expected {rank name value}"
+}
+if {[index_results] != $expected} {
+    error "bulk load: got [list [index_results]] expected [list $expected]"
+}
+
+# the rebuilt indexes should keep up with changes as usual
+t set coke rank 500
+if {[t search -compare {{= rank 500}} -key k -code {}] != 1 || [t index count rank] != 100} {
+    error "bulk load: index not updated after set"
+}
+
+puts "bulk load with a duplicate in a unique index"
+
+CExtension bulkunique 1.0 {
+
+CTable bulk_unique {
+    int id indexed 1 unique 1
+    varstring name indexed 1
+}
+
+}
+
+package require Bulkunique
+
+bulk_unique create u
+u index create id
+u index create name
+u set a id 1 name first
+
+set fp [open tmp_bulk_unique.tsv w]
+puts $fp "b\t2\tsecond"
+puts $fp "c\t1\tthird"
+puts $fp "d\t4\tfourth"
+close $fp
+
+set fp [open tmp_bulk_unique.tsv]
+if {![catch {u read_tabsep $fp -bulk} result]} {
+    error "bulk load with a duplicate id should have failed"
+}
+close $fp
+file delete tmp_bulk_unique.tsv
+if {![string match {unique check failed for field "id", value "1" while reading line 2*} $result]} {
+    error "bulk load with a duplicate id: unexpected error '$result'"
+}
+
+# the unique index was never dropped, and still refuses duplicates
+if {[u index indexed] != {id name}} {
+    error "bulk load with a duplicate id: got indexes [list [u index indexed]] expected {id name}"
+}
+if {[u search -compare {{= id 1}} -key k -code {set found $k}] != 1 || $found != "a"} {
+    error "bulk load with a duplicate id: id 1 isn't just row a any more"
+}
+if {[u exists c] || [u count] != 2 || [u index count name] != 2} {
+    error "bulk load with a duplicate id: the duplicate row was left in the table"
+}
+if {![catch {u set e id 2}]} {
+    error "bulk load with a duplicate id: unique index no longer enforced"
+}
+if {[u exists d]} {
+    error "bulk load with a duplicate id: rows after the duplicate were loaded"
+}
+
+u destroy
+
 puts "finished"
 
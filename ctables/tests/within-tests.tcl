@@ -0,0 +1,161 @@
+#
+# make sure "within" finds the rows whose inet or mac address is inside a
+# prefix, through the index or not, and that bad prefixes are caught
+#
+# $Id$
+#
+
+source test_common.tcl
+
+source search-test-proc.tcl
+
+package require ctable
+
+CExtension withinprefix 1.0 {
+
+CTable within_prefix {
+    inet ip indexed 1
+    mac mac indexed 1
+    inet gateway
+    int value
+}
+
+}
+
+package require Withinprefix
+
+within_prefix create c
+c index create ip
+c index create mac
+
+# every combination comes round every 4200 rows. the first byte of ip
+# goes 10 10 172 173 206, the second is i % 4, the third steps every 20
+# rows, and the last is i % 7 * 30. the mac's company is i % 3, its fourth
+# byte 128 for odd rows plus i % 5, and its last byte i % 256
+proc row {i} {
+    set ip [lindex {10 10 172 173 206} [expr {$i % 5}]].[expr {$i % 4}].[expr {$i / 20 % 10}].[expr {$i % 7 * 30}]
+    set mac [lindex {00:40:96 00:40:97 fe:ed:da} [expr {$i % 3}]]:[format %02x:00:%02x [expr {$i % 2 * 128 + $i % 5}] [expr {$i % 256}]]
+    set gateway [expr {$i % 2 == 0 ? "10.0.0.[expr {$i % 10}]" : "192.168.0.1"}]
+    return [list ip $ip mac $mac gateway $gateway value [expr {$i % 10}]]
+}
+
+for {set i 0} {$i < 4200} {incr i} {
+    c set $i {*}[row $i]
+}
+
+# 10.1.2.x is rows 41 and 45 of every 200, their last byte steps 4 places
+# round the 7 possible every 200 rows
+check_counts c "after load" {
+    {{within ip 10.0.0.0/8}} 1680
+    {{within ip 10.1.0.0/16}} 420
+    {{within ip 10.1.2.0/24}} 42
+    {{within ip 10.1.2.128/25}} 12
+    {{within ip 10.1.2.30/32}} 6
+    {{within ip 172.2.0.0/15}} 420
+    {{within ip 173.0.0.0/7}} 1680
+    {{within ip 0.0.0.0/0}} 4200
+    {{within ip 255.0.0.0/8}} 0
+    {{within ip 206.3.255.255/12}} 840
+    {{within ip 11.0.0.0/8}} 0
+    {{within mac 00:40:96:00:00:00/24}} 1400
+    {{within mac 00:40:96:80:00:00/25}} 700
+    {{within mac 00:40:00:00:00:00/16}} 2800
+    {{within mac fe:ed:da:84:00:00/30}} 140
+    {{within mac fe:ed:da:84:00:00/29}} 700
+    {{within mac 00:40:97:81:00:00/40}} 140
+    {{within mac 00:00:00:00:00:00/0}} 4200
+    {{within mac 01:00:00:00:00:00/8}} 0
+    {{within gateway 10.0.0.0/8}} 2100
+    {{within ip 10.0.0.0/8} {< value 5}} 840
+    {{within ip 10.0.0.0/8} {within gateway 10.0.0.0/8}} 840
+    {{within mac 00:40:96:00:00:00/24} {within ip 10.1.0.0/16}} 140
+}
+
+# a prefix is a range of the index
+if {![uses_index c ip {{within ip 10.1.0.0/16}}]} {
+    error "within ip 10.1.0.0/16 didn't walk the ip index"
+}
+
+if {[search_values c ip -compare {{within ip 10.1.2.0/24}} -sort ip -offset 5 -limit 2] != {10.1.2.0 10.1.2.30}} {
+    error "after load: 10.1.2.0/24 sorted by ip got [search_values c ip -compare {{within ip 10.1.2.0/24}} -sort ip -offset 5 -limit 2]"
+}
+if {[search_values c mac -compare {{within mac 00:40:96:80:00:00/25}} -sort mac -limit 1] != {0:40:96:80:0:1}} {
+    error "after load: 00:40:96:80:00:00/25 sorted by mac got [search_values c mac -compare {{within mac 00:40:96:80:00:00/25}} -sort mac -limit 1]"
+}
+
+# nulls are never within a prefix, and rows leave the prefixes they were in
+for {set i 0} {$i < 420} {incr i 5} {
+    c null $i ip
+}
+for {set i 0} {$i < 300} {incr i 3} {
+    c set $i mac fe:ed:da:00:00:00
+}
+for {set i 6} {$i < 700} {incr i 7} {
+    c delete $i
+}
+# row 1280 had fe:ed:da:00:00:00 to start with
+check_counts c "after updates" {
+    {{within ip 10.0.0.0/8}} 1568
+    {{null ip}} 72
+    {{within ip 0.0.0.0/0}} 4028
+    {{within mac 00:40:96:00:00:00/24}} 1280
+    {{within mac fe:ed:da:00:00:00/24}} 1453
+    {{within mac fe:ed:da:00:00:00/48}} 87
+}
+
+# bits past the prefix length are ignored, and no length is the whole address
+c set edge ip 10.1.2.3 mac 00:40:96:01:02:03 value 99
+check_counts c "edges" {
+    {{within ip 10.1.2.3/8} {= value 99}} 1
+    {{within ip 10.1.2.3} {= value 99}} 1
+    {{within ip 10.1.2.4} {= value 99}} 0
+    {{within mac 00:40:96:01:02:03} {= value 99}} 1
+    {{within mac 00:40:96:01:02:03/47} {= value 99}} 1
+}
+
+if {![catch {c search -compare {{within ip 10.0.0.0/33}}} err]} {
+    error "a prefix of 33 bits should have failed"
+}
+if {![string match "expected IP address prefix like*" $err]} {
+    error "unexpected error for a prefix of 33 bits: $err"
+}
+if {![catch {c search -compare {{within ip 10.0.0.0/}}} err]} {
+    error "a prefix without a length should have failed"
+}
+if {![string match "expected IP address prefix like*" $err]} {
+    error "unexpected error for a prefix without a length: $err"
+}
+if {![catch {c search -compare {{within ip 10.0.0.0/8x}}} err]} {
+    error "a prefix length that isn't a number should have failed"
+}
+if {![string match "expected IP address prefix like*" $err]} {
+    error "unexpected error for a prefix length that isn't a number: $err"
+}
+if {![catch {c search -compare {{within ip 10.0.0.300/8}}} err]} {
+    error "a prefix with a bad address should have failed"
+}
+if {![string match "expected IP address prefix like*" $err]} {
+    error "unexpected error for a prefix with a bad address: $err"
+}
+if {![catch {c search -compare {{within mac 00:40:96:00:00:00/49}}} err]} {
+    error "a mac prefix of 49 bits should have failed"
+}
+if {![string match "expected MAC address prefix like*" $err]} {
+    error "unexpected error for a mac prefix of 49 bits: $err"
+}
+if {![catch {c search -compare {{within value 10.0.0.0/8}}} err]} {
+    error "within on an int should have failed"
+}
+if {![string match "*must be an inet or mac type*" $err]} {
+    error "unexpected error for within on an int: $err"
+}
+if {![catch {c search -compare {{within ip}}} err]} {
+    error "within without a prefix should have failed"
+}
+if {![string match "*require 3 arguments*" $err]} {
+    error "unexpected error for within without a prefix: $err"
+}
+
+c destroy
+
+puts "within tests passed"
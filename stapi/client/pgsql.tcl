@@ -824,6 +824,10 @@ namespace eval ::stapi {
 	    lappend where "$col < [pg_quote $v2]"
 	  }
 
+	  within {
+	    lappend where "$col <<= [pg_quote $v1]"
+	  }
+
 	  in {
 	    foreach v $v1 {
 	      lappend q [pg_quote $v]
@@ -88,6 +88,16 @@ namespace eval ::stapi {
 	dict incr catchOptions -level 1
 	return -options $catchOptions $catchResult
       }
+      get - exists - array_get - array_get_with_nulls {
+	# key lookups go through shared memory too, unless the reader
+	# can't use the master's key index
+	set status [catch {uplevel 1 [namespace which reader] $args} catchResult catchOptions]
+	if {$status == 1 && $attached && [lrange [dict get $catchOptions -errorcode] 0 1] eq {speedtables read_only}} {
+	  catch {uplevel 1 [namespace which master] $args} catchResult catchOptions
+	}
+	dict incr catchOptions -level 1
+	return -options $catchOptions $catchResult
+      }
       destroy {
 	if {$attached} {
 	  master destroy